@@ -0,0 +1,91 @@
+#include "alloc_hook.h"
+#include <cstddef>
+
+#if LLAMA_ANDROID_ALLOC_HOOK && defined(__linux__) && !defined(__ANDROID__) && defined(__GLIBC__)
+#define ALLOC_HOOK_ACTIVE 1
+#else
+#define ALLOC_HOOK_ACTIVE 0
+#endif
+
+#if ALLOC_HOOK_ACTIVE
+
+#include <cerrno>
+#include <cstdlib>
+#include <malloc.h>
+
+// glibc's own entry points, so the hooks need no dlsym() (which allocates)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+// Initial-exec TLS is reserved at thread start, so reading it never allocates
+static thread_local uint64_t g_allocations __attribute__((tls_model("initial-exec"))) = 0;
+
+// Definitions match glibc's noexcept declarations; default visibility so
+// the C++ runtime's operator new resolves to these
+#define ALLOC_HOOK_EXPORT extern "C" __attribute__((visibility("default")))
+
+ALLOC_HOOK_EXPORT void* malloc(size_t size) noexcept {
+    g_allocations++;
+    return __libc_malloc(size);
+}
+
+ALLOC_HOOK_EXPORT void* calloc(size_t count, size_t size) noexcept {
+    g_allocations++;
+    return __libc_calloc(count, size);
+}
+
+ALLOC_HOOK_EXPORT void* realloc(void* ptr, size_t size) noexcept {
+    g_allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+ALLOC_HOOK_EXPORT void* memalign(size_t alignment, size_t size) noexcept {
+    g_allocations++;
+    return __libc_memalign(alignment, size);
+}
+
+ALLOC_HOOK_EXPORT void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    g_allocations++;
+    return __libc_memalign(alignment, size);
+}
+
+ALLOC_HOOK_EXPORT int posix_memalign(void** out, size_t alignment, size_t size) noexcept {
+    // As libc: a power of two that is a multiple of sizeof(void*)
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void*) != 0) {
+        return EINVAL;
+    }
+    g_allocations++;
+    void* ptr = __libc_memalign(alignment, size);
+    if (ptr == nullptr) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+ALLOC_HOOK_EXPORT void free(void* ptr) noexcept {
+    __libc_free(ptr);
+}
+
+#endif
+
+namespace llamaandroid {
+
+bool allocationHookEnabled() {
+    return ALLOC_HOOK_ACTIVE != 0;
+}
+
+uint64_t threadAllocationCount() {
+#if ALLOC_HOOK_ACTIVE
+    return g_allocations;
+#else
+    return 0;
+#endif
+}
+
+} // namespace llamaandroid
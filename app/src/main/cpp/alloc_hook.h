@@ -0,0 +1,23 @@
+#ifndef ALLOC_HOOK_H
+#define ALLOC_HOOK_H
+
+#include <cstdint>
+
+namespace llamaandroid {
+
+/**
+ * Whether heap allocations are being counted. True only in Linux host
+ * builds configured with -DLLAMA_ANDROID_ALLOC_HOOK=ON, which interpose
+ * malloc and friends; used to check that the decode loop stays off the heap.
+ */
+bool allocationHookEnabled();
+
+/**
+ * Heap allocations made by the calling thread so far (always 0 when the
+ * hook is not enabled)
+ */
+uint64_t threadAllocationCount();
+
+} // namespace llamaandroid
+
+#endif // ALLOC_HOOK_H
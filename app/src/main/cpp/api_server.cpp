@@ -0,0 +1,831 @@
+#include "api_server.h"
+#include "json_util.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#define LOG_TAG "ApiServer"
+#include "llama_log.h"
+
+namespace llamaandroid {
+
+static const size_t MAX_HEADER_BYTES = 64 * 1024;
+static const size_t MAX_BODY_BYTES = 8 * 1024 * 1024;
+static const int READ_TIMEOUT_MS = 30000;
+
+// Poll interval while waiting for tokens, used to notice disconnected clients
+static const int CLIENT_CHECK_MS = 500;
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::map<std::string, std::string> headers;  // Lower-case names
+    std::string body;
+};
+
+// ============================================================================
+// HTTP helpers
+// ============================================================================
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool clientGone(int fd) {
+    pollfd pfd = {fd, POLLRDHUP, 0};
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR)) != 0;
+}
+
+static bool readSome(int fd, std::string& buffer) {
+    pollfd pfd = {fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, READ_TIMEOUT_MS);
+    if (ready <= 0) {
+        return false;
+    }
+    char chunk[16384];
+    ssize_t n;
+    do {
+        n = recv(fd, chunk, sizeof(chunk), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+    buffer.append(chunk, static_cast<size_t>(n));
+    return true;
+}
+
+static std::string toLower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return text;
+}
+
+static std::string trim(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t");
+    size_t end = text.find_last_not_of(" \t\r");
+    return start == std::string::npos ? std::string() : text.substr(start, end - start + 1);
+}
+
+/**
+ * Read one request; returns the HTTP status to reply with on failure, 0 on success
+ */
+static int readRequest(int fd, HttpRequest& request) {
+    std::string buffer;
+    size_t headerEnd;
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+        if (buffer.size() > MAX_HEADER_BYTES) {
+            return 431;
+        }
+        if (!readSome(fd, buffer)) {
+            return -1;
+        }
+    }
+    
+    std::string head = buffer.substr(0, headerEnd);
+    size_t lineEnd = head.find("\r\n");
+    std::string requestLine = head.substr(0, lineEnd);
+    
+    size_t sp1 = requestLine.find(' ');
+    size_t sp2 = requestLine.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos) {
+        return 400;
+    }
+    request.method = requestLine.substr(0, sp1);
+    request.path = requestLine.substr(sp1 + 1, sp2 - sp1 - 1);
+    size_t query = request.path.find('?');
+    if (query != std::string::npos) {
+        request.path.resize(query);
+    }
+    
+    size_t pos = lineEnd == std::string::npos ? head.size() : lineEnd + 2;
+    while (pos < head.size()) {
+        size_t next = head.find("\r\n", pos);
+        if (next == std::string::npos) {
+            next = head.size();
+        }
+        std::string line = head.substr(pos, next - pos);
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            request.headers[toLower(trim(line.substr(0, colon)))] = trim(line.substr(colon + 1));
+        }
+        pos = next + 2;
+    }
+    
+    size_t contentLength = 0;
+    auto it = request.headers.find("content-length");
+    if (it != request.headers.end()) {
+        contentLength = static_cast<size_t>(strtoull(it->second.c_str(), nullptr, 10));
+    } else if (request.headers.count("transfer-encoding") != 0) {
+        return 411;
+    }
+    if (contentLength > MAX_BODY_BYTES) {
+        return 413;
+    }
+    
+    request.body = buffer.substr(headerEnd + 4);
+    while (request.body.size() < contentLength) {
+        if (!readSome(fd, request.body)) {
+            return -1;
+        }
+    }
+    request.body.resize(contentLength);
+    return 0;
+}
+
+static const char* statusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+static bool sendResponse(int fd, int status, const std::string& body,
+                         const char* contentType = "application/json") {
+    char head[256];
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+             status, statusText(status), contentType, body.size());
+    return sendAll(fd, head + body);
+}
+
+static std::string errorJson(const std::string& message, const char* type) {
+    return "{\"error\":{\"message\":" + jsonQuote(message) + ",\"type\":" + jsonQuote(type) + "}}";
+}
+
+static void sendError(int fd, int status, const std::string& message) {
+    const char* type = status >= 500 ? "server_error" : "invalid_request_error";
+    sendResponse(fd, status, errorJson(message, type));
+}
+
+static bool sendEvent(int fd, const std::string& data) {
+    return sendAll(fd, "data: " + data + "\n\n");
+}
+
+// ============================================================================
+// Request helpers
+// ============================================================================
+
+/**
+ * Holds back text that could be the start of a stop sequence, and cuts the
+ * output where one completes
+ */
+class StopFilter {
+public:
+    explicit StopFilter(std::vector<std::string> stops) : stops_(std::move(stops)) {}
+    
+    std::string feed(const std::string& piece, bool& stopped) {
+        held_ += piece;
+        
+        size_t cut = std::string::npos;
+        for (const std::string& stop : stops_) {
+            size_t pos = held_.find(stop);
+            if (pos < cut) {
+                cut = pos;
+            }
+        }
+        if (cut != std::string::npos) {
+            std::string out = held_.substr(0, cut);
+            held_.clear();
+            stopped = true;
+            return out;
+        }
+        
+        size_t hold = 0;
+        for (const std::string& stop : stops_) {
+            for (size_t k = std::min(stop.size() - 1, held_.size()); k > hold; k--) {
+                if (held_.compare(held_.size() - k, k, stop, 0, k) == 0) {
+                    hold = k;
+                    break;
+                }
+            }
+        }
+        std::string out = held_.substr(0, held_.size() - hold);
+        held_.erase(0, held_.size() - hold);
+        return out;
+    }
+    
+    std::string flush() {
+        std::string out;
+        out.swap(held_);
+        return out;
+    }
+
+private:
+    std::vector<std::string> stops_;
+    std::string held_;
+};
+
+static LlamaConfig requestConfig(const JsonValue& body, const LlamaConfig& defaults) {
+    LlamaConfig config = defaults;
+    if (body["max_tokens"].isNumber()) {
+        config.maxTokens = static_cast<int>(body["max_tokens"].asNumber());
+    }
+    if (body["max_completion_tokens"].isNumber()) {
+        config.maxTokens = static_cast<int>(body["max_completion_tokens"].asNumber());
+    }
+    if (body["temperature"].isNumber()) {
+        config.temperature = static_cast<float>(body["temperature"].asNumber());
+    }
+    if (body["top_p"].isNumber()) {
+        config.topP = static_cast<float>(body["top_p"].asNumber());
+    }
+    if (body["top_k"].isNumber()) {
+        config.topK = static_cast<int>(body["top_k"].asNumber());
+    }
+    if (body["repeat_penalty"].isNumber()) {
+        config.repeatPenalty = static_cast<float>(body["repeat_penalty"].asNumber());
+    }
+    if (body["frequency_penalty"].isNumber()) {
+        config.frequencyPenalty = static_cast<float>(body["frequency_penalty"].asNumber());
+    }
+    if (body["presence_penalty"].isNumber()) {
+        config.presencePenalty = static_cast<float>(body["presence_penalty"].asNumber());
+    }
+    if (body["penalty_window"].isNumber()) {
+        config.penaltyWindow = static_cast<int>(body["penalty_window"].asNumber());
+    }
+    if (body["dry_multiplier"].isNumber()) {
+        config.dryMultiplier = static_cast<float>(body["dry_multiplier"].asNumber());
+    }
+    if (body["seed"].isNumber()) {
+        config.seed = static_cast<int>(body["seed"].asNumber());
+    }
+    return config;
+}
+
+/**
+ * Scheduling class from the non-standard "priority" field
+ * ("foreground", "normal" or "background")
+ */
+static bool requestPriority(const JsonValue& body, RequestPriority& out) {
+    out = RequestPriority::Normal;
+    if (!body.has("priority") || body["priority"].isNull()) {
+        return true;
+    }
+    const std::string name = body["priority"].isString() ? body["priority"].asString() : std::string();
+    if (name == "foreground") {
+        out = RequestPriority::Foreground;
+    } else if (name == "background") {
+        out = RequestPriority::Background;
+    } else if (name != "normal") {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read a field that may be a string or an array of strings
+ */
+static bool stringList(const JsonValue& value, std::vector<std::string>& out) {
+    if (value.isString()) {
+        out.push_back(value.asString());
+        return true;
+    }
+    if (!value.isArray()) {
+        return false;
+    }
+    for (size_t i = 0; i < value.size(); i++) {
+        if (!value[i].isString()) {
+            return false;
+        }
+        out.push_back(value[i].asString());
+    }
+    return true;
+}
+
+/**
+ * Message content is either a string or an array of typed parts
+ */
+static std::string messageContent(const JsonValue& content) {
+    if (content.isString()) {
+        return content.asString();
+    }
+    std::string text;
+    for (size_t i = 0; i < content.size(); i++) {
+        if (content[i]["type"].asString() == "text") {
+            text += content[i]["text"].asString();
+        }
+    }
+    return text;
+}
+
+static const char* openAiFinishReason(const std::string& reason) {
+    return reason == "length" ? "length" : "stop";
+}
+
+// ============================================================================
+// ApiServer
+// ============================================================================
+
+ApiServer::ApiServer(LlamaContextWrapper& wrapper, const ApiServerConfig& config,
+                     std::shared_ptr<SequenceScheduler> scheduler)
+    : wrapper_(wrapper),
+      config_(config),
+      scheduler_(std::move(scheduler)),
+      ownsScheduler_(scheduler_ == nullptr) {
+    if (ownsScheduler_) {
+        scheduler_ = std::make_shared<SequenceScheduler>(
+            wrapper, static_cast<size_t>(std::max(1, config.maxQueuedRequests)));
+    }
+}
+
+ApiServer::~ApiServer() {
+    stop();
+}
+
+bool ApiServer::start() {
+    if (running_) {
+        return true;
+    }
+    
+    if (!scheduler_->start()) {
+        setError(scheduler_->getLastError());
+        return false;
+    }
+    
+    if (!bindSocket()) {
+        if (ownsScheduler_) {
+            scheduler_->stop();
+        }
+        return false;
+    }
+    
+    running_ = true;
+    acceptThread_ = std::thread(&ApiServer::acceptLoop, this);
+    
+    if (config_.socketPath.empty()) {
+        LOGI("API server listening on 127.0.0.1:%d", boundPort_);
+    } else {
+        LOGI("API server listening on %s", config_.socketPath.c_str());
+    }
+    return true;
+}
+
+void ApiServer::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    
+    // Wakes the blocked accept()
+    shutdown(listenFd_, SHUT_RDWR);
+    if (acceptThread_.joinable()) {
+        acceptThread_.join();
+    }
+    close(listenFd_);
+    listenFd_ = -1;
+    
+    if (!config_.socketPath.empty() && config_.socketPath[0] != '@') {
+        unlink(config_.socketPath.c_str());
+    }
+    
+    // In-flight requests finish as cancelled, which ends their handlers. A
+    // shared scheduler keeps running; the handlers see their connection
+    // shut down below and cancel their own requests.
+    if (ownsScheduler_) {
+        scheduler_->stop();
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        for (auto& connection : connections_) {
+            shutdown(connection->fd, SHUT_RDWR);
+        }
+    }
+    reapConnections(true);
+    
+    LOGI("API server stopped");
+}
+
+bool ApiServer::isRunning() const {
+    return running_;
+}
+
+SchedulerStats ApiServer::getStats() const {
+    return scheduler_->getStats();
+}
+
+std::string ApiServer::getLastError() const {
+    std::lock_guard<std::mutex> lock(errorMutex_);
+    return lastError_;
+}
+
+void ApiServer::setError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(errorMutex_);
+    lastError_ = error;
+    LOGE("Error: %s", error.c_str());
+}
+
+bool ApiServer::bindSocket() {
+    const std::string& path = config_.socketPath;
+    
+    if (!path.empty()) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        
+        const bool abstract = path[0] == '@';
+        if (path.size() >= sizeof(addr.sun_path)) {
+            setError("Socket path too long: " + path);
+            return false;
+        }
+        memcpy(addr.sun_path, path.data(), path.size());
+        socklen_t len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+        if (abstract) {
+            addr.sun_path[0] = '\0';
+            len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size());
+        } else {
+            unlink(path.c_str());  // Stale socket from a previous run
+        }
+        
+        listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd_ < 0 || bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), len) != 0) {
+            setError("Failed to bind " + path + ": " + strerror(errno));
+            if (listenFd_ >= 0) {
+                close(listenFd_);
+                listenFd_ = -1;
+            }
+            return false;
+        }
+        boundPort_ = 0;
+    } else {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(config_.port));
+        
+        listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (listenFd_ >= 0) {
+            setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (listenFd_ < 0 || bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            setError("Failed to bind 127.0.0.1:" + std::to_string(config_.port) + ": " + strerror(errno));
+            if (listenFd_ >= 0) {
+                close(listenFd_);
+                listenFd_ = -1;
+            }
+            return false;
+        }
+        
+        socklen_t len = sizeof(addr);
+        getsockname(listenFd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        boundPort_ = ntohs(addr.sin_port);
+    }
+    
+    if (listen(listenFd_, 64) != 0) {
+        setError(std::string("listen failed: ") + strerror(errno));
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    return true;
+}
+
+void ApiServer::acceptLoop() {
+    while (running_) {
+        int fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (!running_) {
+                break;
+            }
+            if (errno != EINTR && errno != ECONNABORTED) {
+                LOGW("accept failed: %s", strerror(errno));
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            continue;
+        }
+        
+        reapConnections(false);
+        
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        if (static_cast<int>(connections_.size()) >= config_.maxConnections) {
+            sendError(fd, 503, "Too many connections");
+            close(fd);
+            continue;
+        }
+        
+        connections_.emplace_back(new Connection());
+        Connection* connection = connections_.back().get();
+        connection->fd = fd;
+        connection->thread = std::thread(&ApiServer::handleConnection, this, connection);
+    }
+}
+
+void ApiServer::reapConnections(bool all) {
+    std::list<std::unique_ptr<Connection>> finished;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        for (auto it = connections_.begin(); it != connections_.end();) {
+            if (all || (*it)->done) {
+                finished.push_back(std::move(*it));
+                it = connections_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    // Handlers leave their socket open so it is never shut down after reuse
+    for (auto& connection : finished) {
+        connection->thread.join();
+        close(connection->fd);
+    }
+}
+
+void ApiServer::handleConnection(Connection* connection) {
+    const int fd = connection->fd;
+    
+    HttpRequest request;
+    int status = readRequest(fd, request);
+    if (status > 0) {
+        sendError(fd, status, "Malformed request");
+    } else if (status == 0) {
+        LOGD("%s %s", request.method.c_str(), request.path.c_str());
+        
+        const std::string& path = request.path;
+        const bool post = request.method == "POST";
+        const bool get = request.method == "GET";
+        
+        if (path == "/v1/chat/completions" || path == "/v1/completions" || path == "/v1/embeddings") {
+            if (!post) {
+                sendError(fd, 405, "Use POST for " + path);
+            } else if (path == "/v1/embeddings") {
+                handleEmbeddings(fd, request);
+            } else {
+                handleCompletion(fd, request, path == "/v1/chat/completions");
+            }
+        } else if (path == "/v1/models" && get) {
+            handleModels(fd);
+        } else if (path == "/health" && get) {
+            sendResponse(fd, 200, "{\"status\":\"ok\"}");
+        } else {
+            sendError(fd, 404, "Unknown endpoint: " + path);
+        }
+    }
+    
+    shutdown(fd, SHUT_WR);
+    connection->done = true;
+}
+
+std::string ApiServer::nextId(const char* prefix) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s%llx%llx", prefix,
+             static_cast<unsigned long long>(time(nullptr)),
+             static_cast<unsigned long long>(nextId_++));
+    return buf;
+}
+
+void ApiServer::handleModels(int fd) {
+    std::string body = "{\"object\":\"list\",\"data\":[{\"id\":" + jsonQuote(config_.modelName) +
+                       ",\"object\":\"model\",\"created\":0,\"owned_by\":\"local\"}]}";
+    sendResponse(fd, 200, body);
+}
+
+void ApiServer::handleCompletion(int fd, const HttpRequest& request, bool chat) {
+    JsonValue body;
+    std::string parseError;
+    if (!JsonValue::parse(request.body, body, parseError) || !body.isObject()) {
+        sendError(fd, 400, "Invalid JSON body: " + parseError);
+        return;
+    }
+    
+    std::string prompt;
+    if (chat) {
+        const JsonValue& messages = body["messages"];
+        if (!messages.isArray() || messages.size() == 0) {
+            sendError(fd, 400, "'messages' must be a non-empty array");
+            return;
+        }
+        std::vector<ChatMessage> conversation;
+        for (size_t i = 0; i < messages.size(); i++) {
+            conversation.push_back({messages[i]["role"].asString(), messageContent(messages[i]["content"])});
+        }
+        if (!wrapper_.applyChatTemplate(conversation, prompt)) {
+            sendError(fd, 500, wrapper_.getLastError());
+            return;
+        }
+    } else {
+        std::vector<std::string> prompts;
+        if (!stringList(body["prompt"], prompts) || prompts.size() != 1) {
+            sendError(fd, 400, "'prompt' must be a string");
+            return;
+        }
+        prompt = prompts[0];
+    }
+    
+    LlamaConfig config = requestConfig(body, config_.defaults);
+    if (config.maxTokens < 1) {
+        sendError(fd, 400, "'max_tokens' must be at least 1");
+        return;
+    }
+    
+    std::vector<std::string> stops;
+    if (body.has("stop") && !body["stop"].isNull() && !stringList(body["stop"], stops)) {
+        sendError(fd, 400, "'stop' must be a string or an array of strings");
+        return;
+    }
+    stops.erase(std::remove(stops.begin(), stops.end(), std::string()), stops.end());
+    
+    RequestPriority priority;
+    if (!requestPriority(body, priority)) {
+        sendError(fd, 400, "'priority' must be \"foreground\", \"normal\" or \"background\"");
+        return;
+    }
+    
+    const bool stream = body["stream"].asBool();
+    
+    std::shared_ptr<ScheduledRequest> handle = scheduler_->submitCompletion(prompt, &config, priority);
+    if (handle == nullptr) {
+        sendError(fd, running_ ? 429 : 503, scheduler_->getLastError());
+        return;
+    }
+    
+    const std::string id = nextId(chat ? "chatcmpl-" : "cmpl-");
+    const std::string created = std::to_string(static_cast<long long>(time(nullptr)));
+    const std::string header = "{\"id\":" + jsonQuote(id) + ",\"object\":" +
+        jsonQuote(chat ? (stream ? "chat.completion.chunk" : "chat.completion") : "text_completion") +
+        ",\"created\":" + created + ",\"model\":" + jsonQuote(config_.modelName) + ",\"choices\":[";
+    
+    // One streamed choice carrying text (or a delta) and an optional finish reason
+    auto chunk = [&](const std::string& text, const char* finishReason) {
+        std::string choice = "{\"index\":0,";
+        if (chat) {
+            choice += text.empty() && finishReason != nullptr ? "\"delta\":{}" : "\"delta\":{\"content\":" + jsonQuote(text) + "}";
+        } else {
+            choice += "\"text\":" + jsonQuote(text) + ",\"logprobs\":null";
+        }
+        choice += ",\"finish_reason\":";
+        choice += finishReason != nullptr ? jsonQuote(finishReason) : "null";
+        return header + choice + "}]}";
+    };
+    
+    StopFilter filter(stops);
+    bool stopped = false;
+    bool clientOk = true;
+    std::string text;
+    
+    if (stream) {
+        clientOk = sendAll(fd, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                               "Cache-Control: no-cache\r\nConnection: close\r\n\r\n");
+        if (clientOk && chat) {
+            clientOk = sendEvent(fd, header + "{\"index\":0,\"delta\":{\"role\":\"assistant\",\"content\":\"\"},"
+                                              "\"finish_reason\":null}]}");
+        }
+    }
+    
+    std::string piece;
+    while (clientOk && !stopped) {
+        int r = handle->next(piece, CLIENT_CHECK_MS);
+        if (r < 0) {
+            break;
+        }
+        if (r == 0) {
+            clientOk = !clientGone(fd);
+            continue;
+        }
+        
+        std::string out = filter.feed(piece, stopped);
+        if (stream) {
+            if (!out.empty()) {
+                clientOk = sendEvent(fd, chunk(out, nullptr));
+            }
+        } else {
+            text += out;
+        }
+    }
+    
+    if (!clientOk) {
+        LOGI("Client disconnected, cancelling %s", id.c_str());
+        handle->cancel();
+        return;
+    }
+    
+    if (stopped) {
+        handle->cancel();
+    } else {
+        std::string tail = filter.flush();
+        if (stream && !tail.empty()) {
+            sendEvent(fd, chunk(tail, nullptr));
+        }
+        text += tail;
+        
+        if (!handle->succeeded()) {
+            if (stream) {
+                sendEvent(fd, errorJson(handle->error(), "server_error"));
+                sendEvent(fd, "[DONE]");
+            } else {
+                sendError(fd, 500, handle->error());
+            }
+            return;
+        }
+    }
+    
+    const char* finishReason = stopped ? "stop" : openAiFinishReason(handle->finishReason());
+    
+    if (stream) {
+        sendEvent(fd, chunk(std::string(), finishReason));
+        sendEvent(fd, "[DONE]");
+        return;
+    }
+    
+    const int promptTokens = handle->promptTokens();
+    const int completionTokens = handle->completionTokens();
+    
+    std::string choice = "{\"index\":0,";
+    if (chat) {
+        choice += "\"message\":{\"role\":\"assistant\",\"content\":" + jsonQuote(text) + "}";
+    } else {
+        choice += "\"text\":" + jsonQuote(text) + ",\"logprobs\":null";
+    }
+    choice += ",\"finish_reason\":" + jsonQuote(finishReason) + "}";
+    
+    std::string response = header + choice + "],\"usage\":{\"prompt_tokens\":" + std::to_string(promptTokens) +
+        ",\"completion_tokens\":" + std::to_string(completionTokens) +
+        ",\"total_tokens\":" + std::to_string(promptTokens + completionTokens) + "}}";
+    sendResponse(fd, 200, response);
+}
+
+void ApiServer::handleEmbeddings(int fd, const HttpRequest& request) {
+    JsonValue body;
+    std::string parseError;
+    if (!JsonValue::parse(request.body, body, parseError) || !body.isObject()) {
+        sendError(fd, 400, "Invalid JSON body: " + parseError);
+        return;
+    }
+    
+    std::vector<std::string> inputs;
+    if (!stringList(body["input"], inputs) || inputs.empty()) {
+        sendError(fd, 400, "'input' must be a string or a non-empty array of strings");
+        return;
+    }
+    
+    std::shared_ptr<ScheduledRequest> handle = scheduler_->submitEmbedding(inputs);
+    if (handle == nullptr) {
+        sendError(fd, running_ ? 429 : 503, scheduler_->getLastError());
+        return;
+    }
+    handle->wait();
+    
+    if (!handle->succeeded()) {
+        sendError(fd, 500, handle->error().empty() ? "Embedding request cancelled" : handle->error());
+        return;
+    }
+    
+    std::vector<std::vector<float>> vectors = handle->embeddings();
+    std::string response = "{\"object\":\"list\",\"data\":[";
+    char num[32];
+    for (size_t i = 0; i < vectors.size(); i++) {
+        if (i > 0) {
+            response += ',';
+        }
+        response += "{\"object\":\"embedding\",\"index\":" + std::to_string(i) + ",\"embedding\":[";
+        for (size_t k = 0; k < vectors[i].size(); k++) {
+            float v = std::isfinite(vectors[i][k]) ? vectors[i][k] : 0.0f;
+            snprintf(num, sizeof(num), k == 0 ? "%.7g" : ",%.7g", v);
+            response += num;
+        }
+        response += "]}";
+    }
+    
+    const int promptTokens = handle->promptTokens();
+    response += "],\"model\":" + jsonQuote(config_.modelName) +
+        ",\"usage\":{\"prompt_tokens\":" + std::to_string(promptTokens) +
+        ",\"total_tokens\":" + std::to_string(promptTokens) + "}}";
+    sendResponse(fd, 200, response);
+}
+
+} // namespace llamaandroid
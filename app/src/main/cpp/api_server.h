@@ -0,0 +1,134 @@
+#ifndef API_SERVER_H
+#define API_SERVER_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#include "llama_context_wrapper.h"
+#include "sequence_scheduler.h"
+
+namespace llamaandroid {
+
+struct HttpRequest;
+
+/**
+ * Configuration for the local API server
+ */
+struct ApiServerConfig {
+    // Unix domain socket path. A leading '@' selects the Linux abstract
+    // namespace (no file, visible to other apps on the device). Empty
+    // selects loopback TCP instead.
+    std::string socketPath;
+    
+    // Loopback TCP port when socketPath is empty (0 = any free port)
+    int port = 8080;
+    
+    // Model id reported by /v1/models and in responses
+    std::string modelName = "local";
+    
+    // Concurrent client connections; further connections wait in the backlog
+    int maxConnections = 16;
+    
+    // Requests waiting for a free sequence before 429 is returned
+    int maxQueuedRequests = 64;
+    
+    // Sampling defaults for requests that do not set them
+    LlamaConfig defaults;
+};
+
+/**
+ * Embeddable OpenAI-compatible HTTP server for one resident model.
+ *
+ * Serves GET /v1/models, POST /v1/completions, POST /v1/chat/completions
+ * (both with "stream": true as server-sent events) and POST /v1/embeddings
+ * on a Unix domain socket or 127.0.0.1. Requests from all connections are
+ * queued on a SequenceScheduler, which decodes up to
+ * LlamaConfig::parallelSequences of them in the same batch.
+ *
+ * Completion requests may carry a non-standard "priority" field
+ * ("foreground", "normal" or "background") that selects their scheduling
+ * class.
+ *
+ * Responses are sent with "Connection: close"; clients open one connection
+ * per request.
+ */
+class ApiServer {
+public:
+    /**
+     * @param wrapper Wrapper with a loaded in-process model; must outlive the server
+     * @param config Listening address and request defaults
+     * @param scheduler Scheduler shared with other clients of the model, or
+     *        nullptr to let the server run its own
+     */
+    ApiServer(LlamaContextWrapper& wrapper, const ApiServerConfig& config,
+              std::shared_ptr<SequenceScheduler> scheduler = nullptr);
+    ~ApiServer();
+    
+    ApiServer(const ApiServer&) = delete;
+    ApiServer& operator=(const ApiServer&) = delete;
+    
+    /**
+     * Bind the socket and start serving
+     * @return true if successful; on failure see getLastError()
+     */
+    bool start();
+    
+    /**
+     * Stop accepting, cancel in-flight requests and close all connections
+     */
+    void stop();
+    
+    bool isRunning() const;
+    
+    /**
+     * Bound TCP port (useful with port 0), or 0 for a Unix socket
+     */
+    int getPort() const { return boundPort_; }
+    
+    SchedulerStats getStats() const;
+    std::string getLastError() const;
+
+private:
+    struct Connection {
+        int fd = -1;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+    
+    LlamaContextWrapper& wrapper_;
+    ApiServerConfig config_;
+    std::shared_ptr<SequenceScheduler> scheduler_;
+    bool ownsScheduler_;
+    
+    int listenFd_ = -1;
+    int boundPort_ = 0;
+    std::thread acceptThread_;
+    std::atomic<bool> running_{false};
+    std::atomic<uint64_t> nextId_{1};
+    
+    std::list<std::unique_ptr<Connection>> connections_;
+    std::mutex connectionsMutex_;
+    
+    std::string lastError_;
+    mutable std::mutex errorMutex_;
+    
+    void setError(const std::string& error);
+    bool bindSocket();
+    void acceptLoop();
+    void reapConnections(bool all);
+    void handleConnection(Connection* connection);
+    
+    void handleCompletion(int fd, const HttpRequest& request, bool chat);
+    void handleEmbeddings(int fd, const HttpRequest& request);
+    void handleModels(int fd);
+    
+    std::string nextId(const char* prefix);
+};
+
+} // namespace llamaandroid
+
+#endif // API_SERVER_H
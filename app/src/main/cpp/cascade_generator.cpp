@@ -0,0 +1,271 @@
+#include "cascade_generator.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#define LOG_TAG "LlamaCascade"
+#include "llama_log.h"
+
+namespace llamaandroid {
+
+#if LLAMA_AVAILABLE
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+#endif
+
+CascadeGenerator::CascadeGenerator(LlamaContextWrapper& small, LlamaContextWrapper& large,
+                                   const CascadeConfig& config)
+    : small_(small), large_(large), config_(config) {
+}
+
+bool CascadeGenerator::generateStream(const std::string& prompt, TokenCallback callback, const LlamaConfig* config) {
+    stats_ = CascadeStats();
+    lastError_.clear();
+    
+    if (&small_ == &large_) {
+        lastError_ = "Cascade needs two different models";
+        LOGE("%s", lastError_.c_str());
+        return false;
+    }
+    
+    // Wait out a paced generation sleeping on either model without holding
+    // the other model's lock
+    std::unique_lock<std::mutex> smallLock(small_.mutex_, std::defer_lock);
+    std::unique_lock<std::mutex> largeLock(large_.mutex_, std::defer_lock);
+    for (;;) {
+        std::lock(smallLock, largeLock);
+        LlamaContextWrapper* pacing = small_.pacingSleep_ ? &small_ : large_.pacingSleep_ ? &large_ : nullptr;
+        if (pacing == nullptr) {
+            break;
+        }
+        largeLock.unlock();
+        smallLock.unlock();
+        pacing->lockIdle();
+    }
+    small_.clearError();
+    large_.clearError();
+    
+    if (!small_.isModelLoaded() || !large_.isModelLoaded()) {
+        lastError_ = "Model not loaded";
+        LOGE("%s", lastError_.c_str());
+        return false;
+    }
+    if (small_.scheduler_ != nullptr || large_.scheduler_ != nullptr) {
+        lastError_ = "Context is serving scheduled requests";
+        LOGE("%s", lastError_.c_str());
+        return false;
+    }
+    if (std::atomic_load(&small_.remote_) != nullptr || std::atomic_load(&large_.remote_) != nullptr) {
+        // Drafting and verification share logits, which a helper process does not expose
+        lastError_ = "Cascade needs both models in this process";
+        LOGE("%s", lastError_.c_str());
+        return false;
+    }
+    
+    const LlamaConfig& smallCfg = config ? *config : small_.currentConfig_;
+    const LlamaConfig& largeCfg = config ? *config : large_.currentConfig_;
+    
+    small_.isGenerating_ = true;
+    large_.isGenerating_ = true;
+    small_.shouldCancel_ = false;
+    large_.shouldCancel_ = false;
+    
+#if LLAMA_AVAILABLE
+    if (config != nullptr) {
+        small_.setupSampler(*config);
+        large_.setupSampler(*config);
+    }
+    
+    auto finish = [this](bool ok) {
+        small_.isGenerating_ = false;
+        large_.isGenerating_ = false;
+        return ok;
+    };
+    
+    // Small model phase
+    auto smallStart = std::chrono::steady_clock::now();
+    
+    std::vector<llama_token> promptTokens = small_.tokenize(prompt, true);
+    const int smallCtx = static_cast<int>(llama_n_ctx(small_.context_));
+    if (promptTokens.empty() || (int)promptTokens.size() > smallCtx - 4) {
+        lastError_ = promptTokens.empty() ? "Failed to tokenize prompt" : "Prompt too long for context size";
+        LOGE("%s", lastError_.c_str());
+        return finish(false);
+    }
+    
+    small_.resetKvCache();
+    llama_sampler_reset(small_.sampler_);
+    
+    if (!small_.prefill(promptTokens, 0, 0)) {
+        lastError_ = "Failed to process prompt";
+        LOGE("%s", lastError_.c_str());
+        return finish(false);
+    }
+    
+    const llama_vocab* smallVocab = llama_model_get_vocab(small_.model_);
+    const int nVocab = llama_vocab_n_tokens(smallVocab);
+    
+    std::string accepted;
+    int nCur = static_cast<int>(promptTokens.size());
+    int lowRun = 0;
+    bool finished = false;
+    
+    while (stats_.smallTokens < smallCfg.maxTokens && nCur < smallCtx && !small_.shouldCancel_) {
+        // Read the raw distribution before sampling mutates the candidates
+        const float* logits = llama_get_logits_ith(small_.context_, -1);
+        llama_token token = llama_sampler_sample(small_.sampler_, small_.context_, -1);
+        
+        if (!isConfident(logits, nVocab, token, lowRun)) {
+            stats_.escalated = true;
+            LOGI("Escalating after %d small-model tokens", stats_.smallTokens);
+            break;
+        }
+        
+        if (llama_vocab_is_eog(smallVocab, token)) {
+            finished = true;
+            break;
+        }
+        
+        std::string piece = small_.detokenize({token});
+        accepted += piece;
+        callback(piece);
+        stats_.smallTokens++;
+        
+        llama_batch batch = llama_batch_get_one(&token, 1);
+        if (llama_decode(small_.context_, batch) != 0) {
+            lastError_ = "Failed to decode token";
+            LOGE("%s", lastError_.c_str());
+            return finish(false);
+        }
+        nCur++;
+    }
+    
+    stats_.smallMs = elapsedMs(smallStart);
+    
+    if (!stats_.escalated || finished || small_.shouldCancel_ || large_.shouldCancel_) {
+        LOGI("Cascade complete on small model: %d tokens", stats_.smallTokens);
+        return finish(true);
+    }
+    
+    // Large model phase: prefill prompt plus the accepted prefix and continue
+    auto largeStart = std::chrono::steady_clock::now();
+    
+    std::vector<llama_token> largeTokens = large_.tokenize(prompt + accepted, true);
+    const int largeCtx = static_cast<int>(llama_n_ctx(large_.context_));
+    if (largeTokens.empty() || (int)largeTokens.size() > largeCtx - 4) {
+        lastError_ = largeTokens.empty() ? "Failed to tokenize prompt" : "Prompt too long for context size";
+        LOGE("%s", lastError_.c_str());
+        return finish(false);
+    }
+    stats_.largePrefillTokens = static_cast<int>(largeTokens.size());
+    
+    large_.resetKvCache();
+    llama_sampler_reset(large_.sampler_);
+    
+    if (!large_.prefill(largeTokens, 0, 0)) {
+        lastError_ = "Failed to process prompt on large model";
+        LOGE("%s", lastError_.c_str());
+        return finish(false);
+    }
+    
+    const llama_vocab* largeVocab = llama_model_get_vocab(large_.model_);
+    nCur = static_cast<int>(largeTokens.size());
+    const int remaining = largeCfg.maxTokens - stats_.smallTokens;
+    
+    while (stats_.largeTokens < remaining && nCur < largeCtx &&
+           !small_.shouldCancel_ && !large_.shouldCancel_) {
+        llama_token token = llama_sampler_sample(large_.sampler_, large_.context_, -1);
+        if (llama_vocab_is_eog(largeVocab, token)) {
+            break;
+        }
+        
+        callback(large_.detokenize({token}));
+        stats_.largeTokens++;
+        
+        llama_batch batch = llama_batch_get_one(&token, 1);
+        if (llama_decode(large_.context_, batch) != 0) {
+            lastError_ = "Failed to decode token";
+            LOGE("%s", lastError_.c_str());
+            return finish(false);
+        }
+        nCur++;
+    }
+    
+    stats_.largeMs = elapsedMs(largeStart);
+    
+    LOGI("Cascade complete: %d small + %d large tokens (prefill %d)",
+         stats_.smallTokens, stats_.largeTokens, stats_.largePrefillTokens);
+    return finish(true);
+    
+#else
+    // Stub implementation: the small model always answers
+    (void)largeCfg;
+    LOGW("Using stub cascade");
+    
+    std::string stubResponse = "Cascade stub response. Your prompt was: " + prompt.substr(0, 50) + "...";
+    for (size_t i = 0; i < stubResponse.size() && stats_.smallTokens < smallCfg.maxTokens && !small_.shouldCancel_; i += 8) {
+        callback(stubResponse.substr(i, 8));
+        stats_.smallTokens++;
+    }
+    
+    small_.isGenerating_ = false;
+    large_.isGenerating_ = false;
+    return true;
+#endif
+}
+
+void CascadeGenerator::cancelGeneration() {
+    small_.cancelGeneration();
+    large_.cancelGeneration();
+}
+
+CascadeStats CascadeGenerator::getLastStats() const {
+    return stats_;
+}
+
+std::string CascadeGenerator::getLastError() const {
+    return lastError_;
+}
+
+#if LLAMA_AVAILABLE
+
+bool CascadeGenerator::isConfident(const float* logits, int nVocab, llama_token token, int& lowRun) const {
+    if (logits == nullptr || token < 0 || token >= nVocab) {
+        return true;
+    }
+    
+    // log-sum-exp over the raw logits, before temperature and truncation
+    float maxLogit = logits[0];
+    for (int i = 1; i < nVocab; i++) {
+        maxLogit = std::max(maxLogit, logits[i]);
+    }
+    
+    double sumExp = 0.0;
+    double sumExpLogit = 0.0;
+    for (int i = 0; i < nVocab; i++) {
+        double e = std::exp(static_cast<double>(logits[i] - maxLogit));
+        sumExp += e;
+        sumExpLogit += e * (logits[i] - maxLogit);
+    }
+    const double logZ = std::log(sumExp);
+    
+    bool low;
+    if (config_.metric == CascadeMetric::Entropy) {
+        // H = log Z - E[logit], both relative to maxLogit
+        const double entropy = logZ - sumExpLogit / sumExp;
+        low = entropy > config_.threshold;
+    } else {
+        const double logProb = (logits[token] - maxLogit) - logZ;
+        low = logProb < config_.threshold;
+    }
+    
+    lowRun = low ? lowRun + 1 : 0;
+    return lowRun < std::max(1, config_.patience);
+}
+
+#endif // LLAMA_AVAILABLE
+
+} // namespace llamaandroid
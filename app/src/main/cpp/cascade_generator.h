@@ -0,0 +1,88 @@
+#ifndef CASCADE_GENERATOR_H
+#define CASCADE_GENERATOR_H
+
+#include <string>
+
+#include "llama_context_wrapper.h"
+
+namespace llamaandroid {
+
+/**
+ * Confidence signal used to decide when to escalate
+ */
+enum class CascadeMetric {
+    LogProb = 0,   // Log-probability of the sampled token falls below the threshold
+    Entropy = 1    // Entropy of the next-token distribution rises above the threshold
+};
+
+/**
+ * Escalation policy for cascade generation
+ */
+struct CascadeConfig {
+    CascadeMetric metric = CascadeMetric::LogProb;
+    
+    // Log-probability (nats) for LogProb, entropy (nats) for Entropy
+    float threshold = -2.5f;
+    
+    // Consecutive low-confidence tokens required before escalating
+    int patience = 1;
+};
+
+/**
+ * Outcome of a cascade generation
+ */
+struct CascadeStats {
+    bool escalated = false;
+    int smallTokens = 0;         // Tokens accepted from the small model
+    int largeTokens = 0;         // Tokens generated by the large model
+    int largePrefillTokens = 0;  // Prompt plus accepted prefix re-evaluated by the large model
+    double smallMs = 0.0;
+    double largeMs = 0.0;
+};
+
+/**
+ * Small/large model cascade.
+ *
+ * The small model generates first while the per-token confidence is
+ * monitored. When confidence stays below the threshold for `patience`
+ * tokens, the low-confidence token is discarded and the large model takes
+ * over mid-stream: it prefills the prompt plus the text accepted so far and
+ * finishes the response. The models may use different vocabularies since the
+ * hand-over happens in text space.
+ */
+class CascadeGenerator {
+public:
+    CascadeGenerator(LlamaContextWrapper& small, LlamaContextWrapper& large, const CascadeConfig& config);
+    
+    /**
+     * Generate a streaming response through the cascade
+     * @param prompt Input text prompt
+     * @param callback Function to call for each generated token
+     * @param config Sampling configuration applied to both models (optional)
+     * @return true if successful; on failure see getLastError()
+     */
+    bool generateStream(const std::string& prompt, TokenCallback callback, const LlamaConfig* config = nullptr);
+    
+    /**
+     * Cancel ongoing generation on whichever model is active
+     */
+    void cancelGeneration();
+    
+    CascadeStats getLastStats() const;
+    std::string getLastError() const;
+    
+private:
+    LlamaContextWrapper& small_;
+    LlamaContextWrapper& large_;
+    CascadeConfig config_;
+    CascadeStats stats_;
+    std::string lastError_;
+    
+#if LLAMA_AVAILABLE
+    bool isConfident(const float* logits, int nVocab, llama_token token, int& lowRun) const;
+#endif
+};
+
+} // namespace llamaandroid
+
+#endif // CASCADE_GENERATOR_H
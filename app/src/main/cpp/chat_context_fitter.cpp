@@ -0,0 +1,413 @@
+#include "chat_context_fitter.h"
+#include <algorithm>
+
+#define LOG_TAG "ChatContextFitter"
+#include "llama_log.h"
+
+namespace llamaandroid {
+
+// Cached message tokenisations kept beyond the ones the last fit used
+static const size_t MAX_CACHED_MESSAGES = 1024;
+
+// MiddleOut never cuts a message below this many tokens
+static const size_t MIDDLE_OUT_MIN_TOKENS = 32;
+
+#if LLAMA_AVAILABLE
+// Render the first count messages; false if the template cannot be applied
+static bool renderChat(const char* tmpl, const std::vector<llama_chat_message>& chat, size_t count,
+                       bool addAssistant, std::vector<char>& buf, std::string& out) {
+    int32_t n = llama_chat_apply_template(tmpl, chat.data(), count, addAssistant,
+                                          buf.data(), static_cast<int32_t>(buf.size()));
+    if (n > static_cast<int32_t>(buf.size())) {
+        buf.resize(n);
+        n = llama_chat_apply_template(tmpl, chat.data(), count, addAssistant,
+                                      buf.data(), static_cast<int32_t>(buf.size()));
+    }
+    if (n < 0) {
+        return false;
+    }
+    out.assign(buf.data(), n);
+    return true;
+}
+#endif
+
+ChatContextFitter::ChatContextFitter(LlamaContextWrapper& wrapper)
+    : wrapper_(wrapper) {
+}
+
+std::string ChatContextFitter::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+bool ChatContextFitter::fit(const std::vector<ChatMessage>& messages, const ContextFitOptions& options,
+                            const LlamaConfig* config, std::vector<int32_t>& tokens, ContextFitResult* result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> wrapperLock(wrapper_.mutex_);
+    lastError_.clear();
+    tokens.clear();
+    
+    ContextFitResult local;
+    bool success = fitLocked(messages, options, config, tokens, local);
+    if (success && result != nullptr) {
+        *result = std::move(local);
+    }
+    return success;
+}
+
+const std::vector<int32_t>* ChatContextFitter::cachedTokenize(const std::string& text, bool& fromCache) {
+    // Called with mutex_ and wrapper_.mutex_ held
+    auto it = cache_.find(text);
+    if (it != cache_.end()) {
+        it->second.lastUse = fitCount_;
+        fromCache = true;
+        return &it->second.tokens;
+    }
+    fromCache = false;
+
+#if LLAMA_AVAILABLE
+    std::vector<llama_token> tokens = wrapper_.tokenize(text, false);
+    if (tokens.empty() && !text.empty()) {
+        return nullptr;
+    }
+    CachedTokens& entry = cache_[text];
+    entry.tokens.assign(tokens.begin(), tokens.end());
+    entry.lastUse = fitCount_;
+    return &entry.tokens;
+#else
+    return nullptr;
+#endif
+}
+
+void ChatContextFitter::evict() {
+    if (cache_.size() <= MAX_CACHED_MESSAGES) {
+        return;
+    }
+    // Messages of other conversations, or ones that scrolled out of this one
+    for (auto it = cache_.begin(); it != cache_.end();) {
+        if (it->second.lastUse != fitCount_) {
+            it = cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool ChatContextFitter::fitLocked(const std::vector<ChatMessage>& messages, const ContextFitOptions& options,
+                                  const LlamaConfig* config, std::vector<int32_t>& tokens, ContextFitResult& result) {
+    // Called with mutex_ and wrapper_.mutex_ held
+#if LLAMA_AVAILABLE
+    if (std::atomic_load(&wrapper_.remote_) != nullptr) {
+        lastError_ = "Context fitting needs the model in this process";
+        return false;
+    }
+    if (wrapper_.model_ == nullptr || wrapper_.context_ == nullptr) {
+        lastError_ = "Model not loaded";
+        return false;
+    }
+    if (messages.empty()) {
+        lastError_ = "Conversation is empty";
+        return false;
+    }
+    
+    const char* tmpl = llama_model_chat_template(wrapper_.model_, nullptr);
+    if (tmpl == nullptr) {
+        lastError_ = "Model has no chat template";
+        return false;
+    }
+    
+    // Token ids are only valid for the model they were produced with
+    if (modelGeneration_ != wrapper_.modelGeneration_) {
+        cache_.clear();
+        modelGeneration_ = wrapper_.modelGeneration_;
+    }
+    fitCount_++;
+    
+    const size_t n = messages.size();
+    std::vector<llama_chat_message> chat;
+    size_t totalLength = 0;
+    chat.reserve(n);
+    for (const ChatMessage& message : messages) {
+        chat.push_back({message.role.c_str(), message.content.c_str()});
+        totalLength += message.role.size() + message.content.size();
+    }
+    
+    // Text each message adds to the rendered conversation
+    std::vector<char> buf(totalLength * 2 + 256);
+    std::vector<std::string> pieces(n);
+    std::string previous;
+    std::string rendered;
+    bool splittable = true;
+    for (size_t i = 0; i < n && splittable; i++) {
+        if (!renderChat(tmpl, chat, i + 1, false, buf, rendered)) {
+            lastError_ = "Chat template is not supported";
+            return false;
+        }
+        splittable = rendered.compare(0, previous.size(), previous) == 0;
+        if (splittable) {
+            pieces[i] = rendered.substr(previous.size());
+            previous.swap(rendered);
+        }
+    }
+    
+    std::string full;
+    if (!renderChat(tmpl, chat, n, true, buf, full)) {
+        lastError_ = "Chat template is not supported";
+        return false;
+    }
+    splittable = splittable && full.compare(0, previous.size(), previous) == 0;
+    
+    if (!splittable) {
+        LOGW("Chat template has no per-message boundaries, tokenising without fitting");
+        std::vector<llama_token> all = wrapper_.tokenize(full, true);
+        if (all.empty()) {
+            lastError_ = "Failed to tokenize prompt";
+            return false;
+        }
+        tokens.assign(all.begin(), all.end());
+        result.promptTokens = tokens.size();
+        result.tokenizedMessages = n;
+        for (size_t i = 0; i < n; i++) {
+            result.keptMessages.push_back(static_cast<int>(i));
+        }
+        return true;
+    }
+    
+    std::vector<const std::vector<int32_t>*> messageTokens(n);
+    for (size_t i = 0; i < n; i++) {
+        bool fromCache = false;
+        messageTokens[i] = cachedTokenize(pieces[i], fromCache);
+        if (messageTokens[i] == nullptr) {
+            lastError_ = "Failed to tokenize message " + std::to_string(i);
+            return false;
+        }
+        if (fromCache) {
+            result.cachedMessages++;
+        } else {
+            result.tokenizedMessages++;
+        }
+    }
+    bool fromCache = false;
+    const std::vector<int32_t>* assistantPrefix = cachedTokenize(full.substr(previous.size()), fromCache);
+    if (assistantPrefix == nullptr) {
+        lastError_ = "Failed to tokenize the assistant prefix";
+        return false;
+    }
+    
+    const llama_vocab* vocab = llama_model_get_vocab(wrapper_.model_);
+    const bool addBos = llama_vocab_get_add_bos(vocab);
+    
+    // Turns: a user message and the messages that answer it, after the
+    // leading system messages
+    size_t firstTurn = 0;
+    while (firstTurn < n && messages[firstTurn].role == "system") {
+        firstTurn++;
+    }
+    std::vector<size_t> turnStarts;
+    std::vector<size_t> turnOf(n, 0);
+    for (size_t i = firstTurn; i < n; i++) {
+        if (i == firstTurn || messages[i].role == "user") {
+            turnStarts.push_back(i);
+        }
+        turnOf[i] = turnStarts.size() - 1;
+    }
+    turnStarts.push_back(n);
+    const size_t turnCount = turnStarts.size() - 1;
+    
+    std::vector<bool> keptTurn(turnCount, true);
+    std::vector<size_t> cut(n, 0);
+    size_t total = (addBos ? 1 : 0) + assistantPrefix->size();
+    for (size_t i = 0; i < n; i++) {
+        total += messageTokens[i]->size();
+    }
+    
+    auto turnTokens = [&](size_t turn) {
+        size_t count = 0;
+        for (size_t i = turnStarts[turn]; i < turnStarts[turn + 1]; i++) {
+            count += messageTokens[i]->size();
+        }
+        return count;
+    };
+    auto dropTurn = [&](size_t turn) {
+        keptTurn[turn] = false;
+        total -= turnTokens(turn);
+    };
+    auto messageKept = [&](size_t i) {
+        return i < firstTurn || keptTurn[turnOf[i]];
+    };
+    
+    const LlamaConfig& cfg = config != nullptr ? *config : wrapper_.currentConfig_;
+    const size_t n_ctx = llama_n_ctx(wrapper_.context_);
+    size_t reserve = static_cast<size_t>(std::max(options.reserveTokens >= 0 ? options.reserveTokens : cfg.maxTokens, 0));
+    reserve = std::max<size_t>(std::min(reserve, n_ctx / 2), 4);
+    const size_t budget = n_ctx - reserve;
+    
+    // The last turn holds the message being answered and is never dropped
+    switch (options.policy) {
+        case ContextFitPolicy::None:
+            break;
+        
+        case ContextFitPolicy::SystemAndLastTurns: {
+            const size_t keep = static_cast<size_t>(std::max(options.keepLastTurns, 1));
+            for (size_t t = 0; t + keep < turnCount; t++) {
+                dropTurn(t);
+            }
+            for (size_t t = 0; t + 1 < turnCount && total > budget; t++) {
+                if (keptTurn[t]) {
+                    dropTurn(t);
+                }
+            }
+            break;
+        }
+        
+        case ContextFitPolicy::DropOldest:
+            for (size_t t = 0; t + 1 < turnCount && total > budget; t++) {
+                dropTurn(t);
+            }
+            break;
+        
+        case ContextFitPolicy::MiddleOut: {
+            std::vector<size_t> kept;
+            for (size_t t = 0; t < turnCount; t++) {
+                kept.push_back(t);
+            }
+            while (total > budget && kept.size() > 1) {
+                size_t middle = kept.size() / 2;
+                if (middle == kept.size() - 1) {
+                    middle--;
+                }
+                dropTurn(kept[middle]);
+                kept.erase(kept.begin() + middle);
+            }
+            
+            // Then cut the middle of the longest messages that are left,
+            // keeping the role markers at either end
+            while (total > budget) {
+                size_t longest = n;
+                size_t longestLength = MIDDLE_OUT_MIN_TOKENS;
+                for (size_t i = 0; i < n; i++) {
+                    if (!messageKept(i)) {
+                        continue;
+                    }
+                    size_t length = messageTokens[i]->size() - cut[i];
+                    if (length > longestLength) {
+                        longest = i;
+                        longestLength = length;
+                    }
+                }
+                if (longest == n) {
+                    break;
+                }
+                size_t amount = std::min(total - budget, longestLength - MIDDLE_OUT_MIN_TOKENS);
+                cut[longest] += amount;
+                result.truncatedTokens += amount;
+                total -= amount;
+            }
+            break;
+        }
+    }
+    
+    if (options.policy != ContextFitPolicy::None && total > budget) {
+        lastError_ = "Prompt too long for context size";
+        LOGE("Conversation needs %zu tokens after fitting, %zu available", total, budget);
+        return false;
+    }
+    
+    tokens.reserve(total);
+    if (addBos) {
+        tokens.push_back(llama_vocab_bos(vocab));
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!messageKept(i)) {
+            continue;
+        }
+        const std::vector<int32_t>& piece = *messageTokens[i];
+        const size_t keep = piece.size() - cut[i];
+        const size_t head = keep / 2;
+        tokens.insert(tokens.end(), piece.begin(), piece.begin() + head);
+        tokens.insert(tokens.end(), piece.end() - (keep - head), piece.end());
+        result.keptMessages.push_back(static_cast<int>(i));
+    }
+    tokens.insert(tokens.end(), assistantPrefix->begin(), assistantPrefix->end());
+    result.promptTokens = tokens.size();
+    
+    evict();
+    
+    LOGD("Fitted %zu of %zu messages into %zu tokens (%zu cut, %zu tokenised)",
+         result.keptMessages.size(), n, tokens.size(), result.truncatedTokens, result.tokenizedMessages);
+    return true;
+#else
+    (void)messages;
+    (void)options;
+    (void)config;
+    (void)tokens;
+    (void)result;
+    lastError_ = "Tokenisation requires llama.cpp";
+    return false;
+#endif
+}
+
+bool ChatContextFitter::generateStream(const std::vector<ChatMessage>& messages, const ContextFitOptions& options,
+                                       TokenCallback callback, const LlamaConfig* config) {
+    bool byText = std::atomic_load(&wrapper_.remote_) != nullptr;
+#if !LLAMA_AVAILABLE
+    byText = true;
+#endif
+
+    if (byText) {
+        // No local vocabulary: send the rendered conversation unfitted
+        std::string text;
+        if (!wrapper_.applyChatTemplate(messages, text)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            lastError_ = wrapper_.getLastError();
+            return false;
+        }
+        wrapper_.generateStream(text, callback, config);
+    } else {
+        std::vector<int32_t> tokens;
+        if (!fit(messages, options, config, tokens)) {
+            return false;
+        }
+        wrapper_.generateStreamTokens(tokens, callback, config);
+    }
+    
+    std::string error = wrapper_.getLastError();
+    if (!error.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = error;
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<ScheduledRequest> ChatContextFitter::submit(SequenceScheduler& scheduler,
+                                                            const std::vector<ChatMessage>& messages,
+                                                            const ContextFitOptions& options,
+                                                            const LlamaConfig* config, RequestPriority priority) {
+    std::shared_ptr<ScheduledRequest> request;
+#if LLAMA_AVAILABLE
+    std::vector<int32_t> tokens;
+    if (!fit(messages, options, config, tokens)) {
+        return nullptr;
+    }
+    request = scheduler.submitCompletion(tokens, config, priority);
+#else
+    // No local vocabulary: queue the rendered conversation unfitted
+    (void)options;
+    std::string text;
+    if (!wrapper_.applyChatTemplate(messages, text)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = wrapper_.getLastError();
+        return nullptr;
+    }
+    request = scheduler.submitCompletion(text, config, priority);
+#endif
+
+    if (request == nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = scheduler.getLastError();
+    }
+    return request;
+}
+
+} // namespace llamaandroid
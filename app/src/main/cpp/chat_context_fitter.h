@@ -0,0 +1,132 @@
+#ifndef CHAT_CONTEXT_FITTER_H
+#define CHAT_CONTEXT_FITTER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+#include "llama_context_wrapper.h"
+#include "sequence_scheduler.h"
+
+namespace llamaandroid {
+
+/**
+ * How a conversation that does not fit the context is shortened. A turn
+ * is a user message together with the messages that answer it; the
+ * leading system messages and the last turn are always kept.
+ */
+enum class ContextFitPolicy {
+    None,                // Keep everything; generation fails if it does not fit
+    DropOldest,          // Drop the oldest turns
+    MiddleOut,           // Drop turns from the middle, then cut the middle of the longest messages
+    SystemAndLastTurns,  // Keep at most keepLastTurns turns, then drop the oldest
+};
+
+/**
+ * Options for ChatContextFitter
+ */
+struct ContextFitOptions {
+    ContextFitPolicy policy = ContextFitPolicy::DropOldest;
+    int keepLastTurns = 8;    // SystemAndLastTurns: most recent turns kept
+    int reserveTokens = -1;   // Context left for the response; -1 uses maxTokens (at most half the context)
+};
+
+/**
+ * Outcome of a fit
+ */
+struct ContextFitResult {
+    size_t promptTokens = 0;
+    size_t truncatedTokens = 0;      // Tokens cut from inside messages (MiddleOut)
+    size_t cachedMessages = 0;       // Messages whose tokens came from the cache
+    size_t tokenizedMessages = 0;    // Messages tokenised by this fit
+    std::vector<int> keptMessages;   // Indices of the messages in the prompt, ascending
+};
+
+/**
+ * Fits a chat conversation into the context window in token space.
+ *
+ * Every message is rendered with the model's chat template as the text the
+ * template adds for it (the conversation rendered up to and including the
+ * message, minus the conversation rendered before it) and tokenised on
+ * its own. Those token arrays are cached by text, so a growing
+ * conversation only tokenises its new messages. The policy then removes
+ * whole turns, or for MiddleOut also tokens from the middle of a message -
+ * the template's role markers at both ends stay intact - until the prompt
+ * and the reserved response fit n_ctx. The prompt is assembled from the
+ * cached arrays; nothing is tokenised twice.
+ *
+ * Templates whose earlier output changes as messages are added (no
+ * per-message boundary) fall back to tokenising the whole conversation
+ * without fitting. Out of process, or without llama.cpp, the rendered
+ * text is generated from unfitted.
+ */
+class ChatContextFitter {
+public:
+    /**
+     * @param wrapper Wrapper whose model's template and vocabulary are used; must outlive the fitter
+     */
+    explicit ChatContextFitter(LlamaContextWrapper& wrapper);
+    
+    /**
+     * Produce the prompt tokens for a conversation, shortened to fit
+     * @param messages Conversation, ending with the message to answer
+     * @param options Fit policy
+     * @param config Configuration the response is generated with (optional)
+     * @param tokens Receives the token ids, starting with BOS if the model adds one
+     * @param result Receives what was kept (optional)
+     * @return true if successful; on failure see getLastError()
+     */
+    bool fit(const std::vector<ChatMessage>& messages, const ContextFitOptions& options,
+             const LlamaConfig* config, std::vector<int32_t>& tokens, ContextFitResult* result = nullptr);
+    
+    /**
+     * Fit and generate a streaming response
+     * @param messages Conversation, ending with the message to answer
+     * @param options Fit policy
+     * @param callback Function to call for each generated token
+     * @param config Sampling configuration (optional)
+     * @return true if successful; on failure see getLastError()
+     */
+    bool generateStream(const std::vector<ChatMessage>& messages, const ContextFitOptions& options,
+                        TokenCallback callback, const LlamaConfig* config = nullptr);
+    
+    /**
+     * Fit and queue the conversation on a scheduler running on the same wrapper
+     * @param scheduler Scheduler that owns the wrapper's context
+     * @param messages Conversation, ending with the message to answer
+     * @param options Fit policy
+     * @param config Sampling configuration and token limit (nullptr uses the wrapper's)
+     * @param priority Scheduling class
+     * @return Request handle, or nullptr on failure (see getLastError())
+     */
+    std::shared_ptr<ScheduledRequest> submit(SequenceScheduler& scheduler, const std::vector<ChatMessage>& messages,
+                                             const ContextFitOptions& options, const LlamaConfig* config,
+                                             RequestPriority priority);
+    
+    std::string getLastError() const;
+
+private:
+    struct CachedTokens {
+        std::vector<int32_t> tokens;
+        uint64_t lastUse = 0;   // Fit that last used the entry
+    };
+    
+    LlamaContextWrapper& wrapper_;
+    std::unordered_map<std::string, CachedTokens> cache_;  // By rendered message text
+    uint64_t modelGeneration_ = 0;
+    uint64_t fitCount_ = 0;
+    
+    std::string lastError_;
+    mutable std::mutex mutex_;
+    
+    bool fitLocked(const std::vector<ChatMessage>& messages, const ContextFitOptions& options,
+                   const LlamaConfig* config, std::vector<int32_t>& tokens, ContextFitResult& result);
+    const std::vector<int32_t>* cachedTokenize(const std::string& text, bool& fromCache);
+    void evict();
+};
+
+} // namespace llamaandroid
+
+#endif // CHAT_CONTEXT_FITTER_H
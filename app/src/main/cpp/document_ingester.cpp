@@ -0,0 +1,501 @@
+#define LOG_TAG "DocumentIngester"
+#include "document_ingester.h"
+#include "llama_log.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sys/stat.h>
+
+namespace llamaandroid {
+
+// File bytes read per fread
+static const size_t READ_BLOCK_BYTES = 256 * 1024;
+
+// Text held back waiting for a safe tokenisation boundary before it is
+// tokenised anyway
+static const size_t MAX_CARRY_BYTES = 4 * 1024 * 1024;
+
+// Shortest allowed chunk
+static const int MIN_CHUNK_TOKENS = 16;
+
+// Most frequent manifest save while documents complete
+static const double SAVE_INTERVAL_MS = 1000.0;
+
+struct DocumentIngester::Chunk {
+    std::vector<int32_t> tokens;  // Embedding input with the overlap, without BOS
+    uint32_t slot = 0;
+    size_t document = 0;          // Index into pending_
+};
+
+struct DocumentIngester::PendingDocument {
+    std::string path;
+    IndexedDocument document;
+    size_t outstanding = 0;   // Chunks still to be embedded
+    bool complete = false;    // Every chunk has been read
+    bool failed = false;      // Read error; the indexed entry is left as it was
+};
+
+// splitmix64 finaliser: per-token value of the rolling hash
+static uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// FNV-1a over the token ids
+static uint64_t hashTokens(const std::vector<int32_t>& tokens) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int32_t token : tokens) {
+        uint32_t value = static_cast<uint32_t>(token);
+        for (int i = 0; i < 4; i++) {
+            hash ^= (value >> (i * 8)) & 0xFF;
+            hash *= 0x100000001B3ULL;
+        }
+    }
+    return hash;
+}
+
+// End of the last newline that is followed by a non-space character, or
+// npos; tokenisation never merges across it
+static size_t lastSafeBoundary(const std::string& text) {
+    for (size_t i = text.size(); i > 1; i--) {
+        if (text[i - 2] == '\n' && text[i - 1] != ' ' && text[i - 1] != '\n' &&
+            text[i - 1] != '\t' && text[i - 1] != '\r') {
+            return i - 1;
+        }
+    }
+    return std::string::npos;
+}
+
+#if !LLAMA_AVAILABLE
+static void normalize(std::vector<float>& vector) {
+    double norm = 0.0;
+    for (float v : vector) {
+        norm += double(v) * v;
+    }
+    norm = norm > 0.0 ? std::sqrt(norm) : 1.0;
+    for (float& v : vector) {
+        v = static_cast<float>(v / norm);
+    }
+}
+#endif
+
+static double elapsedMs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+DocumentIngester::DocumentIngester(LlamaContextWrapper& wrapper)
+    : wrapper_(wrapper) {
+}
+
+// Out of line: Chunk and PendingDocument are only complete here
+DocumentIngester::~DocumentIngester() = default;
+
+bool DocumentIngester::prepare(std::string& modelKey) {
+    std::lock_guard<std::mutex> lock(wrapper_.mutex_);
+    if (wrapper_.scheduler_ != nullptr) {
+        // Embedding decodes would take cells from the scheduler's sequences
+        lastError_ = "Context is serving scheduled requests";
+        return false;
+    }
+#if LLAMA_AVAILABLE
+    if (std::atomic_load(&wrapper_.remote_) != nullptr) {
+        lastError_ = "Ingestion needs the model in this process";
+        return false;
+    }
+    if (wrapper_.model_ == nullptr || wrapper_.context_ == nullptr) {
+        lastError_ = "Model not loaded";
+        return false;
+    }
+    
+    dim_ = llama_model_n_embd(wrapper_.model_);
+    batchTokens_ = static_cast<int>(llama_n_batch(wrapper_.context_));
+    batchSequences_ = wrapper_.embeddingSequenceCount();
+    
+    const llama_vocab* vocab = llama_model_get_vocab(wrapper_.model_);
+    addBos_ = llama_vocab_get_add_bos(vocab);
+    bos_ = llama_vocab_bos(vocab);
+    
+    // Vectors from another model, or pooled differently, are not comparable
+    char desc[128];
+    llama_model_desc(wrapper_.model_, desc, sizeof(desc));
+    modelKey = std::string(desc) + " params=" + std::to_string(llama_model_n_params(wrapper_.model_)) +
+               " pooling=" + std::to_string(static_cast<int>(llama_pooling_type(wrapper_.context_)));
+#else
+    // Stub: byte tokens and pseudo-embeddings, as in SequenceScheduler
+    dim_ = 16;
+    batchTokens_ = 2048;
+    batchSequences_ = 4;
+    modelKey = "stub";
+#endif
+    return true;
+}
+
+bool DocumentIngester::tokenizeText(const std::string& text, std::vector<int32_t>& tokens,
+                                    std::vector<uint32_t>& pieceBytes) {
+    tokens.clear();
+    pieceBytes.clear();
+    if (text.empty()) {
+        return true;
+    }
+#if LLAMA_AVAILABLE
+    std::lock_guard<std::mutex> lock(wrapper_.mutex_);
+    if (wrapper_.model_ == nullptr) {
+        lastError_ = "Model not loaded";
+        return false;
+    }
+    std::vector<llama_token> ids = wrapper_.tokenize(text, false);
+    if (ids.empty()) {
+        lastError_ = "Failed to tokenize document";
+        return false;
+    }
+    
+    const llama_vocab* vocab = llama_model_get_vocab(wrapper_.model_);
+    char piece[256];
+    tokens.assign(ids.begin(), ids.end());
+    pieceBytes.reserve(ids.size());
+    for (llama_token id : ids) {
+        int32_t n = llama_token_to_piece(vocab, id, piece, sizeof(piece), 0, true);
+        pieceBytes.push_back(static_cast<uint32_t>(n < 0 ? -n : n));
+    }
+#else
+    tokens.reserve(text.size());
+    for (unsigned char c : text) {
+        tokens.push_back(c);
+    }
+    pieceBytes.assign(text.size(), 1);
+#endif
+    return true;
+}
+
+bool DocumentIngester::ingest(const std::string& indexDir, const std::vector<std::string>& paths,
+                              const IngestOptions& options, const IngestProgressCallback& onProgress,
+                              IngestStats& stats) {
+    const auto start = std::chrono::steady_clock::now();
+    lastError_.clear();
+    stats = IngestStats();
+    stats_ = &stats;
+    batch_.clear();
+    batchTokenCount_ = 0;
+    pending_.clear();
+    lastSave_ = start;
+    
+    std::string modelKey;
+    if (!prepare(modelKey) || !index_.open(indexDir, dim_, modelKey, lastError_)) {
+        return false;
+    }
+    
+    const int inputTokens = options.chunkTokens + options.overlapTokens + (addBos_ ? 1 : 0);
+    if (options.chunkTokens < MIN_CHUNK_TOKENS || options.overlapTokens < 0 ||
+        options.overlapTokens > options.chunkTokens / 2) {
+        lastError_ = "Chunks need at least " + std::to_string(MIN_CHUNK_TOKENS) +
+                     " tokens and an overlap of at most half a chunk";
+        return false;
+    }
+    if (inputTokens > batchTokens_) {
+        lastError_ = "Chunks of " + std::to_string(inputTokens) + " tokens exceed the batch size (" +
+                     std::to_string(batchTokens_) + ")";
+        return false;
+    }
+    
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!ingestFile(paths[i], options)) {
+            return false;
+        }
+        stats.files++;
+        if (onProgress && !onProgress(i + 1, paths.size())) {
+            lastError_ = "Ingestion cancelled";
+            return false;
+        }
+    }
+    
+    if (!flushBatch() || !finishDocuments()) {
+        return false;
+    }
+    if (options.prune) {
+        stats.removedFiles = index_.retainDocuments(paths);
+    }
+    if (!index_.save(lastError_)) {
+        return false;
+    }
+    
+    stats.elapsedMs = elapsedMs(start);
+    LOGI("Ingested %zu files (%zu unchanged, %zu failed): %zu chunks, %zu embedded in %zu decodes, %.0f ms",
+         stats.files, stats.unchangedFiles, stats.failedFiles, stats.chunks, stats.embeddedChunks,
+         stats.decodes, stats.elapsedMs);
+    return true;
+}
+
+bool DocumentIngester::ingestFile(const std::string& path, const IngestOptions& options) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        LOGW("Cannot read %s: %s", path.c_str(), std::strerror(errno));
+        stats_->failedFiles++;
+        return true;
+    }
+    
+    IndexedDocument state;
+    state.size = static_cast<unsigned long long>(st.st_size);
+    state.mtimeSec = st.st_mtim.tv_sec;
+    state.mtimeNsec = st.st_mtim.tv_nsec;
+    
+    std::multimap<uint64_t, uint32_t> oldSlots;
+    const IndexedDocument* indexed = index_.find(path);
+    if (indexed != nullptr) {
+        if (indexed->size == state.size && indexed->mtimeSec == state.mtimeSec &&
+            indexed->mtimeNsec == state.mtimeNsec) {
+            stats_->unchangedFiles++;
+            return true;
+        }
+        for (const IndexedChunk& chunk : indexed->chunks) {
+            oldSlots.emplace(chunk.hash, chunk.slot);
+        }
+    }
+    
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        LOGW("Cannot open %s: %s", path.c_str(), std::strerror(errno));
+        stats_->failedFiles++;
+        return true;
+    }
+    
+    const size_t documentIndex = pending_.size();
+    pending_.push_back({path, state, 0, false, false});
+    
+    // Content-defined boundaries: after minTokens, cut where the rolling
+    // hash (over the last 64 tokens) has its low bits clear
+    const size_t maxTokens = static_cast<size_t>(options.chunkTokens);
+    const size_t minTokens = maxTokens / 2;
+    uint64_t mask = 1;
+    while (mask < maxTokens / 4) {
+        mask <<= 1;
+    }
+    mask -= 1;
+    
+    std::vector<int32_t> window;    // Overlap from the previous chunk, then the chunk
+    std::vector<uint64_t> offsets;  // Byte offset of each token in window
+    size_t overlapCount = 0;
+    uint64_t rolling = 0;
+    uint64_t byteOffset = 0;
+    bool ok = true;
+    
+    auto emit = [&]() {
+        IndexedChunk chunk;
+        chunk.hash = hashTokens(window);
+        chunk.offset = offsets.front();
+        chunk.length = byteOffset - chunk.offset;
+        stats_->chunks++;
+        
+        auto reused = oldSlots.find(chunk.hash);
+        if (reused != oldSlots.end()) {
+            chunk.slot = reused->second;
+            oldSlots.erase(reused);
+            stats_->reusedChunks++;
+        } else {
+            chunk.slot = index_.allocateSlot();
+            Chunk pendingChunk;
+            pendingChunk.tokens = window;
+            pendingChunk.slot = chunk.slot;
+            pendingChunk.document = documentIndex;
+            pending_[documentIndex].outstanding++;
+            ok = queueChunk(std::move(pendingChunk));
+        }
+        pending_[documentIndex].document.chunks.push_back(chunk);
+        
+        const size_t keep = std::min(window.size(), static_cast<size_t>(options.overlapTokens));
+        window.erase(window.begin(), window.end() - keep);
+        offsets.erase(offsets.begin(), offsets.end() - keep);
+        overlapCount = keep;
+    };
+    
+    std::string carry;
+    std::vector<char> block(READ_BLOCK_BYTES);
+    std::vector<int32_t> tokens;
+    std::vector<uint32_t> pieceBytes;
+    bool eof = false;
+    
+    while (ok && !eof) {
+        size_t n = std::fread(block.data(), 1, block.size(), file);
+        carry.append(block.data(), n);
+        eof = n < block.size();
+        if (eof && std::ferror(file)) {
+            LOGW("Read error in %s", path.c_str());
+            pending_[documentIndex].failed = true;
+            stats_->failedFiles++;
+            break;
+        }
+        
+        size_t cut = eof ? carry.size() : lastSafeBoundary(carry);
+        if (cut == std::string::npos || cut == 0) {
+            if (carry.size() < MAX_CARRY_BYTES) {
+                continue;
+            }
+            cut = carry.size();
+        }
+        
+        const uint64_t segmentStart = byteOffset;
+        const uint64_t segmentEnd = segmentStart + cut;
+        if (!tokenizeText(carry.substr(0, cut), tokens, pieceBytes)) {
+            ok = false;
+            break;
+        }
+        carry.erase(0, cut);
+        stats_->tokens += tokens.size();
+        
+        for (size_t i = 0; i < tokens.size() && ok; i++) {
+            window.push_back(tokens[i]);
+            offsets.push_back(byteOffset);
+            // Pieces of tokenisers that do not round-trip may not add up
+            byteOffset = std::min<uint64_t>(byteOffset + pieceBytes[i], segmentEnd);
+            rolling = (rolling << 1) + mix64(static_cast<uint32_t>(tokens[i]));
+            
+            const size_t length = window.size() - overlapCount;
+            if (length >= maxTokens || (length >= minTokens && (rolling & mask) == 0)) {
+                emit();
+            }
+        }
+        byteOffset = segmentEnd;
+    }
+    std::fclose(file);
+    
+    if (ok && window.size() > overlapCount && !pending_[documentIndex].failed) {
+        emit();
+    }
+    if (!ok) {
+        return false;
+    }
+    
+    pending_[documentIndex].complete = true;
+    return finishDocuments();
+}
+
+bool DocumentIngester::queueChunk(Chunk chunk) {
+    const size_t inputTokens = chunk.tokens.size() + (addBos_ ? 1 : 0);
+    if (static_cast<int>(batch_.size()) >= batchSequences_ ||
+        batchTokenCount_ + inputTokens > static_cast<size_t>(batchTokens_)) {
+        if (!flushBatch()) {
+            return false;
+        }
+    }
+    batchTokenCount_ += inputTokens;
+    batch_.push_back(std::move(chunk));
+    return true;
+}
+
+bool DocumentIngester::flushBatch() {
+    if (batch_.empty()) {
+        return true;
+    }
+    
+    std::vector<std::vector<float>> vectors;
+    if (!embedBatch(vectors)) {
+        return false;
+    }
+    stats_->decodes++;
+    stats_->embeddedChunks += batch_.size();
+    
+    for (size_t i = 0; i < batch_.size(); i++) {
+        if (!index_.writeVector(batch_[i].slot, vectors[i].data(), lastError_)) {
+            return false;
+        }
+        pending_[batch_[i].document].outstanding--;
+    }
+    batch_.clear();
+    batchTokenCount_ = 0;
+    return finishDocuments();
+}
+
+bool DocumentIngester::finishDocuments() {
+    bool finished = false;
+    for (PendingDocument& pending : pending_) {
+        if (!pending.complete || pending.outstanding > 0 || pending.path.empty()) {
+            continue;
+        }
+        if (!pending.failed) {
+            index_.putDocument(pending.path, std::move(pending.document));
+            finished = true;
+        }
+        pending.path.clear();
+    }
+    
+    // Saved at the end of ingest() in any case
+    if (finished && elapsedMs(lastSave_) >= SAVE_INTERVAL_MS) {
+        lastSave_ = std::chrono::steady_clock::now();
+        return index_.save(lastError_);
+    }
+    return true;
+}
+
+bool DocumentIngester::embedBatch(std::vector<std::vector<float>>& vectors) {
+#if LLAMA_AVAILABLE
+    std::unique_lock<std::mutex> lock = wrapper_.lockIdle();
+    if (wrapper_.context_ == nullptr) {
+        lastError_ = "Model not loaded";
+        return false;
+    }
+    if (wrapper_.scheduler_ != nullptr) {
+        // Started since prepare()
+        lastError_ = "Context is serving scheduled requests";
+        return false;
+    }
+    
+    // One sequence per chunk, beside the wrapper's cached prompt where the
+    // context has room for it
+    std::vector<const std::vector<llama_token>*> inputs;
+    inputs.reserve(batch_.size());
+    for (const Chunk& chunk : batch_) {
+        inputs.push_back(&chunk.tokens);
+    }
+    return wrapper_.embedSequences(inputs, addBos_, EmbeddingPooling::Default, vectors, lastError_);
+#else
+    // Deterministic pseudo-embedding derived from the tokens
+    vectors.assign(batch_.size(), std::vector<float>(dim_, 0.0f));
+    for (size_t s = 0; s < batch_.size(); s++) {
+        const std::vector<int32_t>& tokens = batch_[s].tokens;
+        for (size_t i = 0; i < tokens.size(); i++) {
+            vectors[s][i % dim_] += static_cast<float>(tokens[i] & 0xFF) / 255.0f;
+        }
+    }
+    for (std::vector<float>& vector : vectors) {
+        normalize(vector);
+    }
+    return true;
+#endif
+}
+
+bool DocumentIngester::search(const std::string& indexDir, const std::string& query, size_t limit,
+                              std::vector<IndexHit>& hits) {
+    lastError_.clear();
+    hits.clear();
+    
+    std::string modelKey;
+    if (!prepare(modelKey) || !index_.open(indexDir, dim_, modelKey, lastError_)) {
+        return false;
+    }
+    
+    Chunk chunk;
+    std::vector<uint32_t> pieceBytes;
+    if (!tokenizeText(query, chunk.tokens, pieceBytes)) {
+        return false;
+    }
+    if (chunk.tokens.empty()) {
+        lastError_ = "Query is empty";
+        return false;
+    }
+    const size_t maxTokens = static_cast<size_t>(batchTokens_ - (addBos_ ? 1 : 0));
+    if (chunk.tokens.size() > maxTokens) {
+        chunk.tokens.resize(maxTokens);
+    }
+    
+    batch_.assign(1, std::move(chunk));
+    std::vector<std::vector<float>> vectors;
+    bool ok = embedBatch(vectors);
+    batch_.clear();
+    return ok && index_.search(vectors[0].data(), limit, hits, lastError_);
+}
+
+} // namespace llamaandroid
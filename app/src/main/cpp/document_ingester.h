@@ -0,0 +1,138 @@
+#ifndef DOCUMENT_INGESTER_H
+#define DOCUMENT_INGESTER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+#include "llama_context_wrapper.h"
+#include "embedding_index.h"
+
+namespace llamaandroid {
+
+/**
+ * Options for DocumentIngester::ingest()
+ */
+struct IngestOptions {
+    int chunkTokens = 256;     // Longest chunk; chunks average about three quarters of this
+    int overlapTokens = 32;    // Tokens of the previous chunk embedded with each chunk
+    bool prune = false;        // Remove indexed documents that are not in the list
+};
+
+/**
+ * Counters of an ingestion
+ */
+struct IngestStats {
+    size_t files = 0;
+    size_t unchangedFiles = 0;   // Skipped: same size and modification time as indexed
+    size_t failedFiles = 0;      // Could not be read
+    size_t removedFiles = 0;     // Pruned from the index
+    size_t chunks = 0;           // Chunks of the files that were read
+    size_t embeddedChunks = 0;   // Chunks whose content changed and were embedded
+    size_t reusedChunks = 0;     // Chunks whose vector was kept
+    size_t tokens = 0;           // Tokens read
+    size_t decodes = 0;          // Embedding decode calls
+    double elapsedMs = 0;
+};
+
+/**
+ * Progress of an ingestion; return false to cancel
+ */
+using IngestProgressCallback = std::function<bool(size_t filesDone, size_t filesTotal)>;
+
+/**
+ * Streams documents into an EmbeddingIndex with the wrapper's model.
+ *
+ * Each file is read in blocks and tokenised up to the last point where
+ * tokenisation cannot merge across (a newline before a non-space), so the
+ * tokens match a tokenisation of the whole file without holding it in
+ * memory. Chunk boundaries are content-defined: a boundary falls where a
+ * rolling hash of the preceding tokens matches a mask, between half and
+ * the whole of chunkTokens. An edit therefore only changes the chunks
+ * around it; the boundaries after it fall at the same tokens again. Every
+ * chunk is embedded together with the last overlapTokens of the previous
+ * one, and the hash of those tokens decides whether its vector is reused.
+ *
+ * Chunks that need embedding are packed into batches of up to n_batch
+ * tokens, one sequence per chunk (n_seq_max - 1 of them, or one with a
+ * single sequence; see LlamaConfig::parallelSequences), across documents,
+ * and embedded on the wrapper's generation context (see
+ * LlamaContextWrapper::embed()). The vectors - pooled by the context or
+ * averaged over the tokens, then L2-normalised - are written straight to
+ * their index slots, and the manifest is saved once each document is
+ * complete.
+ *
+ * With a single sequence the embedding decodes clear the context's prompt
+ * cache, so the next generation evaluates its prompt again. Ingestion and
+ * search fail while a SequenceScheduler runs on the wrapper, whose
+ * sequences the decodes would overwrite.
+ */
+class DocumentIngester {
+public:
+    /**
+     * @param wrapper Wrapper with the embedding model loaded; must outlive the ingester
+     */
+    explicit DocumentIngester(LlamaContextWrapper& wrapper);
+    ~DocumentIngester();
+    
+    DocumentIngester(const DocumentIngester&) = delete;
+    DocumentIngester& operator=(const DocumentIngester&) = delete;
+    
+    /**
+     * Add or update documents in an index
+     * @param indexDir Index directory (see EmbeddingIndex)
+     * @param paths Document files (UTF-8 text)
+     * @param options Chunking options
+     * @param onProgress Called after each file (optional)
+     * @param stats Receives the counters
+     * @return true if successful; on failure see getLastError()
+     */
+    bool ingest(const std::string& indexDir, const std::vector<std::string>& paths, const IngestOptions& options,
+                const IngestProgressCallback& onProgress, IngestStats& stats);
+    
+    /**
+     * Find the chunks most similar to a query
+     * @param indexDir Index directory
+     * @param query Query text, embedded like a chunk
+     * @param limit Maximum number of hits
+     * @param hits Receives the hits, most similar first
+     * @return true if successful; on failure see getLastError()
+     */
+    bool search(const std::string& indexDir, const std::string& query, size_t limit, std::vector<IndexHit>& hits);
+    
+    std::string getLastError() const { return lastError_; }
+
+private:
+    struct Chunk;
+    struct PendingDocument;
+    
+    LlamaContextWrapper& wrapper_;
+    EmbeddingIndex index_;
+    std::string lastError_;
+    
+    int dim_ = 0;
+    int batchTokens_ = 0;     // Tokens per embedding decode
+    int batchSequences_ = 1;  // Chunks per embedding decode
+    bool addBos_ = false;
+    int32_t bos_ = 0;
+    
+    std::vector<Chunk> batch_;               // Chunks waiting for the next decode
+    size_t batchTokenCount_ = 0;
+    std::vector<PendingDocument> pending_;   // Documents with chunks not yet embedded
+    IngestStats* stats_ = nullptr;
+    std::chrono::steady_clock::time_point lastSave_;
+
+    bool prepare(std::string& modelKey);
+    bool ingestFile(const std::string& path, const IngestOptions& options);
+    bool tokenizeText(const std::string& text, std::vector<int32_t>& tokens, std::vector<uint32_t>& pieceBytes);
+    bool queueChunk(Chunk chunk);
+    bool flushBatch();
+    bool embedBatch(std::vector<std::vector<float>>& vectors);
+    bool finishDocuments();
+};
+
+} // namespace llamaandroid
+
+#endif // DOCUMENT_INGESTER_H
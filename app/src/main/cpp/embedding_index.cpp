@@ -0,0 +1,361 @@
+#define LOG_TAG "EmbeddingIndex"
+#include "embedding_index.h"
+#include "llama_log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <queue>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace llamaandroid {
+
+static const char* VECTOR_FILE = "vectors.f32";
+static const char* MANIFEST_FILE = "manifest.txt";
+static const char* MANIFEST_MAGIC = "llama-embedding-index 1";
+
+// Vector file header: magic, version, dim, reserved
+static const uint32_t VECTOR_MAGIC = 0x5645454C;  // "LEEV"
+static const uint32_t VECTOR_VERSION = 1;
+static const size_t VECTOR_HEADER_BYTES = 16;
+
+// Slots read per pread while searching
+static const size_t SEARCH_BLOCK_SLOTS = 256;
+
+static bool writeFully(int fd, const void* data, size_t size, off_t offset) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+
+static bool readFully(int fd, void* data, size_t size, off_t offset) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+
+EmbeddingIndex::~EmbeddingIndex() {
+    close();
+}
+
+void EmbeddingIndex::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool EmbeddingIndex::open(const std::string& dir, int dim, const std::string& modelKey, std::string& error) {
+    close();
+    dir_ = dir;
+    dim_ = dim;
+    modelKey_ = modelKey;
+    documents_.clear();
+    freeSlots_.clear();
+    releasedSlots_.clear();
+    slotCount_ = 0;
+    
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        error = "Cannot create index directory " + dir + ": " + std::strerror(errno);
+        return false;
+    }
+    
+    const std::string vectorPath = dir + "/" + VECTOR_FILE;
+    fd_ = ::open(vectorPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+        error = "Cannot open " + vectorPath + ": " + std::strerror(errno);
+        return false;
+    }
+    
+    uint32_t header[4] = {};
+    struct stat st;
+    const size_t slotBytes = static_cast<size_t>(dim_) * sizeof(float);
+    bool valid = readManifest() &&
+                 readFully(fd_, header, sizeof(header), 0) &&
+                 header[0] == VECTOR_MAGIC && header[1] == VECTOR_VERSION &&
+                 header[2] == static_cast<uint32_t>(dim_) &&
+                 fstat(fd_, &st) == 0 &&
+                 static_cast<uint64_t>(st.st_size) >= VECTOR_HEADER_BYTES + uint64_t(slotCount_) * slotBytes;
+    
+    if (!valid) {
+        if (!documents_.empty()) {
+            LOGW("Index %s was built differently or is damaged, starting it empty", dir.c_str());
+        }
+        documents_.clear();
+        slotCount_ = 0;
+        header[0] = VECTOR_MAGIC;
+        header[1] = VECTOR_VERSION;
+        header[2] = static_cast<uint32_t>(dim_);
+        header[3] = 0;
+        if (ftruncate(fd_, 0) != 0 || !writeFully(fd_, header, sizeof(header), 0)) {
+            error = "Cannot initialise " + vectorPath + ": " + std::strerror(errno);
+            close();
+            return false;
+        }
+        return save(error);
+    }
+    
+    std::vector<bool> used(slotCount_, false);
+    for (const auto& entry : documents_) {
+        for (const IndexedChunk& chunk : entry.second.chunks) {
+            used[chunk.slot] = true;
+        }
+    }
+    for (uint32_t slot = slotCount_; slot > 0; slot--) {
+        if (!used[slot - 1]) {
+            freeSlots_.push_back(slot - 1);
+        }
+    }
+    
+    LOGI("Index %s: %zu documents, %zu chunks, %zu free slots",
+         dir.c_str(), documents_.size(), getChunkCount(), freeSlots_.size());
+    return true;
+}
+
+bool EmbeddingIndex::readManifest() {
+    std::ifstream in(dir_ + "/" + MANIFEST_FILE);
+    std::string line;
+    if (!std::getline(in, line) || line != MANIFEST_MAGIC) {
+        return false;
+    }
+    
+    int dim = 0;
+    unsigned long slots = 0;
+    if (!std::getline(in, line) || std::sscanf(line.c_str(), "dim %d", &dim) != 1 || dim != dim_) {
+        return false;
+    }
+    if (!std::getline(in, line) || line.compare(0, 6, "model ") != 0 || line.substr(6) != modelKey_) {
+        return false;
+    }
+    if (!std::getline(in, line) || std::sscanf(line.c_str(), "slots %lu", &slots) != 1) {
+        return false;
+    }
+    slotCount_ = static_cast<uint32_t>(slots);
+    
+    IndexedDocument* document = nullptr;
+    while (std::getline(in, line)) {
+        IndexedDocument parsed;
+        IndexedChunk chunk;
+        unsigned long long hash = 0;
+        unsigned long long offset = 0;
+        unsigned long long length = 0;
+        unsigned int slot = 0;
+        int pathStart = 0;
+        
+        if (std::sscanf(line.c_str(), "D %llu %lld %ld %n", &parsed.size, &parsed.mtimeSec,
+                        &parsed.mtimeNsec, &pathStart) == 3 && pathStart > 0) {
+            document = &documents_[line.substr(pathStart)];
+            *document = parsed;
+        } else if (std::sscanf(line.c_str(), "C %llx %u %llu %llu", &hash, &slot, &offset, &length) == 4 &&
+                   document != nullptr && slot < slotCount_) {
+            chunk.hash = hash;
+            chunk.slot = slot;
+            chunk.offset = offset;
+            chunk.length = length;
+            document->chunks.push_back(chunk);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+const IndexedDocument* EmbeddingIndex::find(const std::string& path) const {
+    auto it = documents_.find(path);
+    return it != documents_.end() ? &it->second : nullptr;
+}
+
+size_t EmbeddingIndex::getChunkCount() const {
+    size_t count = 0;
+    for (const auto& entry : documents_) {
+        count += entry.second.chunks.size();
+    }
+    return count;
+}
+
+uint32_t EmbeddingIndex::allocateSlot() {
+    if (!freeSlots_.empty()) {
+        uint32_t slot = freeSlots_.back();
+        freeSlots_.pop_back();
+        return slot;
+    }
+    return slotCount_++;
+}
+
+bool EmbeddingIndex::writeVector(uint32_t slot, const float* vector, std::string& error) {
+    const size_t slotBytes = static_cast<size_t>(dim_) * sizeof(float);
+    if (fd_ < 0 || !writeFully(fd_, vector, slotBytes, VECTOR_HEADER_BYTES + off_t(slot) * slotBytes)) {
+        error = std::string("Cannot write index vector: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void EmbeddingIndex::releaseSlots(const IndexedDocument& document, const IndexedDocument* replacement) {
+    std::set<uint32_t> kept;
+    if (replacement != nullptr) {
+        for (const IndexedChunk& chunk : replacement->chunks) {
+            kept.insert(chunk.slot);
+        }
+    }
+    for (const IndexedChunk& chunk : document.chunks) {
+        if (kept.count(chunk.slot) == 0) {
+            releasedSlots_.push_back(chunk.slot);
+        }
+    }
+}
+
+void EmbeddingIndex::putDocument(const std::string& path, IndexedDocument document) {
+    auto it = documents_.find(path);
+    if (it != documents_.end()) {
+        releaseSlots(it->second, &document);
+        it->second = std::move(document);
+    } else {
+        documents_.emplace(path, std::move(document));
+    }
+}
+
+size_t EmbeddingIndex::retainDocuments(const std::vector<std::string>& paths) {
+    std::set<std::string> keep(paths.begin(), paths.end());
+    size_t removed = 0;
+    for (auto it = documents_.begin(); it != documents_.end();) {
+        if (keep.count(it->first) == 0) {
+            releaseSlots(it->second, nullptr);
+            it = documents_.erase(it);
+            removed++;
+        } else {
+            ++it;
+        }
+    }
+    return removed;
+}
+
+bool EmbeddingIndex::save(std::string& error) {
+    // Vectors first, so the manifest never references unwritten slots
+    if (fd_ < 0 || fdatasync(fd_) != 0) {
+        error = std::string("Cannot sync index vectors: ") + std::strerror(errno);
+        return false;
+    }
+    
+    const std::string path = dir_ + "/" + MANIFEST_FILE;
+    const std::string temporary = path + ".tmp" + std::to_string(getpid());
+    FILE* file = std::fopen(temporary.c_str(), "w");
+    if (file == nullptr) {
+        error = "Cannot write " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    
+    std::fprintf(file, "%s\ndim %d\nmodel %s\nslots %lu\n", MANIFEST_MAGIC, dim_, modelKey_.c_str(),
+                 static_cast<unsigned long>(slotCount_));
+    for (const auto& entry : documents_) {
+        const IndexedDocument& document = entry.second;
+        std::fprintf(file, "D %llu %lld %ld %s\n", document.size, document.mtimeSec, document.mtimeNsec,
+                     entry.first.c_str());
+        for (const IndexedChunk& chunk : document.chunks) {
+            std::fprintf(file, "C %016" PRIx64 " %u %" PRIu64 " %" PRIu64 "\n",
+                         chunk.hash, chunk.slot, chunk.offset, chunk.length);
+        }
+    }
+    
+    bool written = std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    std::fclose(file);
+    if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        error = "Cannot write " + path + ": " + std::strerror(errno);
+        std::remove(temporary.c_str());
+        return false;
+    }
+    
+    freeSlots_.insert(freeSlots_.end(), releasedSlots_.begin(), releasedSlots_.end());
+    releasedSlots_.clear();
+    return true;
+}
+
+bool EmbeddingIndex::search(const float* query, size_t limit, std::vector<IndexHit>& hits,
+                            std::string& error) const {
+    hits.clear();
+    if (limit == 0 || slotCount_ == 0) {
+        return true;
+    }
+    
+    // Owner of every referenced slot
+    struct Owner {
+        const std::string* path = nullptr;
+        const IndexedChunk* chunk = nullptr;
+    };
+    std::vector<Owner> owners(slotCount_);
+    for (const auto& entry : documents_) {
+        for (const IndexedChunk& chunk : entry.second.chunks) {
+            owners[chunk.slot] = {&entry.first, &chunk};
+        }
+    }
+    
+    // Min-heap of the best scores seen
+    using Scored = std::pair<float, uint32_t>;
+    std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>> best;
+    
+    const size_t slotBytes = static_cast<size_t>(dim_) * sizeof(float);
+    std::vector<float> block(SEARCH_BLOCK_SLOTS * dim_);
+    for (uint32_t first = 0; first < slotCount_; first += SEARCH_BLOCK_SLOTS) {
+        const uint32_t count = std::min<uint32_t>(SEARCH_BLOCK_SLOTS, slotCount_ - first);
+        if (!readFully(fd_, block.data(), count * slotBytes, VECTOR_HEADER_BYTES + off_t(first) * slotBytes)) {
+            error = std::string("Cannot read index vectors: ") + std::strerror(errno);
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            if (owners[first + i].chunk == nullptr) {
+                continue;
+            }
+            const float* vector = block.data() + size_t(i) * dim_;
+            float score = 0;
+            for (int k = 0; k < dim_; k++) {
+                score += vector[k] * query[k];
+            }
+            if (best.size() < limit) {
+                best.push({score, first + i});
+            } else if (score > best.top().first) {
+                best.pop();
+                best.push({score, first + i});
+            }
+        }
+    }
+    
+    hits.resize(best.size());
+    for (size_t i = hits.size(); i > 0; i--) {
+        const Owner& owner = owners[best.top().second];
+        hits[i - 1].path = *owner.path;
+        hits[i - 1].offset = owner.chunk->offset;
+        hits[i - 1].length = owner.chunk->length;
+        hits[i - 1].score = best.top().first;
+        best.pop();
+    }
+    return true;
+}
+
+} // namespace llamaandroid
@@ -0,0 +1,138 @@
+#ifndef EMBEDDING_INDEX_H
+#define EMBEDDING_INDEX_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+namespace llamaandroid {
+
+/**
+ * One embedded chunk of a document
+ */
+struct IndexedChunk {
+    uint64_t hash = 0;     // Hash of the tokens the vector was computed from
+    uint32_t slot = 0;     // Vector slot in the vector file
+    uint64_t offset = 0;   // Byte range of the chunk text in the document
+    uint64_t length = 0;
+};
+
+/**
+ * A document and the file state its chunks were computed from
+ */
+struct IndexedDocument {
+    unsigned long long size = 0;
+    long long mtimeSec = 0;
+    long mtimeNsec = 0;
+    std::vector<IndexedChunk> chunks;
+};
+
+/**
+ * One search result
+ */
+struct IndexHit {
+    std::string path;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    float score = 0;       // Cosine similarity with the query
+};
+
+/**
+ * On-disk vector index of document chunks.
+ *
+ * A directory with two files: vectors.f32, a header followed by fixed-size
+ * slots of dim L2-normalised floats, and manifest.txt, which lists every
+ * document with its size, modification time and chunks (hash, slot, byte
+ * range). Vectors are written straight into their slot with pwrite; the
+ * manifest is replaced through a rename by save().
+ *
+ * A slot referenced by the saved manifest is never overwritten: slots that
+ * a document stops using become free only after the next save, so a crash
+ * at any point leaves the last saved manifest consistent with the vectors.
+ *
+ * The manifest records the model that produced the vectors; opening the
+ * index with a different model or width starts it empty.
+ */
+class EmbeddingIndex {
+public:
+    EmbeddingIndex() = default;
+    ~EmbeddingIndex();
+    
+    EmbeddingIndex(const EmbeddingIndex&) = delete;
+    EmbeddingIndex& operator=(const EmbeddingIndex&) = delete;
+    
+    /**
+     * Open or create an index
+     * @param dir Index directory, created if missing
+     * @param dim Vector width
+     * @param modelKey Identity of the embedding model
+     * @return true if successful, false with error set
+     */
+    bool open(const std::string& dir, int dim, const std::string& modelKey, std::string& error);
+    
+    /**
+     * Indexed state of a document, or nullptr if it is not indexed
+     */
+    const IndexedDocument* find(const std::string& path) const;
+    
+    /**
+     * Reserve a slot that no saved document uses
+     */
+    uint32_t allocateSlot();
+    
+    /**
+     * Write the vector of a slot (dim floats)
+     */
+    bool writeVector(uint32_t slot, const float* vector, std::string& error);
+    
+    /**
+     * Replace a document's entry; its old slots that the new chunks do not
+     * use are released at the next save()
+     */
+    void putDocument(const std::string& path, IndexedDocument document);
+    
+    /**
+     * Remove documents not in the given set
+     * @return Number of documents removed
+     */
+    size_t retainDocuments(const std::vector<std::string>& paths);
+    
+    /**
+     * Write the manifest
+     * @return true if successful, false with error set
+     */
+    bool save(std::string& error);
+    
+    /**
+     * Chunks most similar to a query
+     * @param query L2-normalised vector of dim floats
+     * @param limit Maximum number of hits
+     * @param hits Receives the hits, most similar first
+     * @return true if successful, false with error set
+     */
+    bool search(const float* query, size_t limit, std::vector<IndexHit>& hits, std::string& error) const;
+    
+    int getDim() const { return dim_; }
+    size_t getDocumentCount() const { return documents_.size(); }
+    size_t getChunkCount() const;
+
+private:
+    std::string dir_;
+    std::string modelKey_;
+    int dim_ = 0;
+    int fd_ = -1;
+    
+    std::map<std::string, IndexedDocument> documents_;
+    uint32_t slotCount_ = 0;               // Slots in the vector file
+    std::vector<uint32_t> freeSlots_;      // Not referenced by the saved manifest
+    std::vector<uint32_t> releasedSlots_;  // Dropped since the last save; free after it
+    
+    void releaseSlots(const IndexedDocument& document, const IndexedDocument* replacement);
+    bool readManifest();
+    void close();
+};
+
+} // namespace llamaandroid
+
+#endif // EMBEDDING_INDEX_H
@@ -0,0 +1,106 @@
+#define LOG_TAG "GenerationPacer"
+#include "generation_pacer.h"
+#include "llama_log.h"
+#include <algorithm>
+#include <time.h>
+
+namespace llamaandroid {
+
+int64_t processCpuTimeUs() {
+    timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+#if LLAMA_AVAILABLE
+
+GenerationPacer::GenerationPacer(llama_context* context, const LlamaConfig& config, SleepFunction sleepUntil)
+    : context_(context),
+      sleepUntil_(sleepUntil),
+      rate_(config.pacedTokensPerSecond > 0.0f ? config.pacedTokensPerSecond : 0.0),
+      lead_(std::max(1, config.pacedLeadTokens)),
+      savedThreads_(llama_n_threads(context)),
+      savedThreadsBatch_(llama_n_threads_batch(context)),
+      start_(Clock::now()),
+      cpuStartUs_(processCpuTimeUs()) {
+    if (rate_ <= 0.0) {
+        return;
+    }
+    
+    const int threads = config.pacedThreads > 0 ? std::min(config.pacedThreads, savedThreads_)
+                                                 : std::max(1, savedThreads_ / 2);
+    llama_set_n_threads(context_, threads, savedThreadsBatch_);
+    
+    // A pool of our own can be paused while waiting for the reader; the
+    // default one is created per graph and cannot. Builds using OpenMP
+    // ignore attached pools, and their workers idle per OMP_WAIT_POLICY.
+    ggml_threadpool_params params = ggml_threadpool_params_default(threads);
+    threadpool_ = ggml_threadpool_new(&params);
+    if (threadpool_ != nullptr) {
+        llama_attach_threadpool(context_, threadpool_, nullptr);
+    }
+    
+    LOGD("Pacing to %.1f tokens/s on %d threads, %d tokens ahead", rate_, threads, lead_);
+}
+
+GenerationPacer::~GenerationPacer() {
+    if (rate_ <= 0.0) {
+        return;
+    }
+    if (threadpool_ != nullptr) {
+        llama_detach_threadpool(context_);
+        ggml_threadpool_free(threadpool_);
+    }
+    llama_set_n_threads(context_, savedThreads_, savedThreadsBatch_);
+}
+
+void GenerationPacer::tokenEmitted() {
+    emitted_++;
+    if (rate_ <= 0.0) {
+        return;
+    }
+    
+    // The reader starts on the first token and takes one every 1/rate s
+    const Clock::time_point now = Clock::now();
+    if (emitted_ == 1) {
+        firstToken_ = now;
+    }
+    const double elapsed = std::chrono::duration<double>(now - firstToken_).count();
+    const int read = static_cast<int>(elapsed * rate_) + 1;
+    if (emitted_ - read < lead_) {
+        return;
+    }
+    
+    // Buffer full: sleep until half of it has been read
+    const int resumeAt = emitted_ - std::max(1, lead_ / 2);
+    const auto wake = firstToken_ + std::chrono::duration_cast<Clock::duration>(
+                                        std::chrono::duration<double>((resumeAt - 1) / rate_));
+    if (wake <= now) {
+        return;
+    }
+    
+    if (threadpool_ != nullptr) {
+        ggml_threadpool_pause(threadpool_);
+    }
+    sleepUntil_(wake);
+    if (threadpool_ != nullptr) {
+        ggml_threadpool_resume(threadpool_);
+    }
+    sleptUs_ += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - now).count();
+}
+
+GenerationStats GenerationPacer::finish() const {
+    GenerationStats stats;
+    stats.tokens = emitted_;
+    stats.paced = rate_ > 0.0;
+    stats.wallMs = std::chrono::duration<double, std::milli>(Clock::now() - start_).count();
+    stats.cpuMs = (processCpuTimeUs() - cpuStartUs_) / 1000.0;
+    stats.sleptMs = sleptUs_ / 1000.0;
+    return stats;
+}
+
+#endif
+
+} // namespace llamaandroid
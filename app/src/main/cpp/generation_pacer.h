@@ -0,0 +1,84 @@
+#ifndef GENERATION_PACER_H
+#define GENERATION_PACER_H
+
+#include "llama_context_wrapper.h"
+#include <chrono>
+
+#if LLAMA_AVAILABLE
+#include "ggml-cpu.h"
+#endif
+
+namespace llamaandroid {
+
+/**
+ * Process CPU time in microseconds (all threads, including llama.cpp's
+ * compute threads)
+ */
+int64_t processCpuTimeUs();
+
+#if LLAMA_AVAILABLE
+/**
+ * Paces the decode phase of one generation to a target output rate and
+ * measures what it costs.
+ *
+ * With LlamaConfig::pacedTokensPerSecond set, tokens are decoded at full
+ * speed on pacedThreads threads until pacedLeadTokens are buffered ahead
+ * of a reader consuming them at the target rate; decoding then sleeps
+ * until half of that lead is used up, with the decode thread pool paused
+ * so its workers do not spin. The device thus runs in short bursts
+ * instead of racing through the reply and staying hot.
+ *
+ * Construct after the prompt has been evaluated, so prefill keeps every
+ * batch thread. The context's thread settings are restored on destruction.
+ */
+class GenerationPacer {
+public:
+    using Clock = std::chrono::steady_clock;
+    
+    /**
+     * Waits until the given time; lets the caller release its locks for
+     * the duration of the sleep
+     */
+    using SleepFunction = FunctionRef<void(Clock::time_point wake)>;
+    
+    /**
+     * @param context Context being decoded
+     * @param config Pacing settings of the generation
+     * @param sleepUntil Called to wait for the reader to catch up
+     */
+    GenerationPacer(llama_context* context, const LlamaConfig& config, SleepFunction sleepUntil);
+    ~GenerationPacer();
+    
+    GenerationPacer(const GenerationPacer&) = delete;
+    GenerationPacer& operator=(const GenerationPacer&) = delete;
+    
+    /**
+     * Call after each token handed to the caller; may sleep
+     */
+    void tokenEmitted();
+    
+    /**
+     * Wall and CPU time since construction
+     */
+    GenerationStats finish() const;
+
+private:
+    llama_context* context_;
+    SleepFunction sleepUntil_;
+    double rate_;        // Tokens per second (0 = unpaced)
+    int lead_;           // Tokens allowed ahead of the reader
+    int savedThreads_;
+    int savedThreadsBatch_;
+    ggml_threadpool* threadpool_ = nullptr;
+    
+    Clock::time_point start_;
+    int64_t cpuStartUs_;
+    Clock::time_point firstToken_;
+    int emitted_ = 0;
+    int64_t sleptUs_ = 0;
+};
+#endif
+
+} // namespace llamaandroid
+
+#endif // GENERATION_PACER_H
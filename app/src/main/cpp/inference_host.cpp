@@ -0,0 +1,415 @@
+#include "inference_host.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define LOG_TAG "LlamaHost"
+#include "llama_log.h"
+
+namespace llamaandroid {
+
+// Fixed descriptor numbers in the helper process
+static const int HOST_CONTROL_FD = 3;
+static const int HOST_RING_FD = 4;
+
+// Token ring capacity; large enough that the helper never waits on a
+// consumer that is merely slow to wake up
+static const size_t RING_CAPACITY = 1u << 20;
+
+// Poll interval used to notice a dead helper while waiting for tokens
+static const int LIVENESS_POLL_MS = 200;
+
+static_assert(std::is_trivially_copyable<LlamaConfig>::value,
+              "LlamaConfig is sent to the helper process as raw bytes");
+
+static std::string encodeConfig(const LlamaConfig& config) {
+    return std::string(reinterpret_cast<const char*>(&config), sizeof(config));
+}
+
+static bool decodeConfig(const std::string& payload, size_t offset, LlamaConfig& config) {
+    if (payload.size() < offset + sizeof(config)) {
+        return false;
+    }
+    memcpy(&config, payload.data() + offset, sizeof(config));
+    return true;
+}
+
+InferenceHostClient::~InferenceHostClient() {
+    stop();
+}
+
+std::string InferenceHostClient::defaultExecutablePath() {
+    const char* env = getenv("LLAMA_ANDROID_HOST");
+    if (env != nullptr && env[0] != '\0') {
+        return env;
+    }
+    
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&runInferenceHost), &info) != 0 && info.dli_fname != nullptr) {
+        std::string self = info.dli_fname;
+        size_t slash = self.rfind('/');
+        if (slash != std::string::npos) {
+            return self.substr(0, slash + 1) + "libllama-host.so";
+        }
+    }
+    return "libllama-host.so";
+}
+
+bool InferenceHostClient::start(const std::string& executablePath) {
+    std::string path = executablePath.empty() ? defaultExecutablePath() : executablePath;
+    
+    if (!ring_.create(RING_CAPACITY)) {
+        lastError_ = "Failed to create token ring";
+        return false;
+    }
+    
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        lastError_ = std::string("socketpair failed: ") + strerror(errno);
+        return false;
+    }
+    
+    LOGI("Starting inference host: %s", path.c_str());
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        lastError_ = std::string("fork failed: ") + strerror(errno);
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return false;
+    }
+    
+    if (pid == 0) {
+        // Child: only async-signal-safe calls until exec. Move both
+        // descriptors out of the way first, since either may already sit on
+        // one of the target numbers
+        int controlFd = fcntl(fds[1], F_DUPFD, 10);
+        int ringFd = fcntl(ring_.fd(), F_DUPFD, 10);
+        dup2(controlFd, HOST_CONTROL_FD);
+        dup2(ringFd, HOST_RING_FD);
+        const char* argv[] = { path.c_str(), "--control-fd", "3", "--ring-fd", "4", nullptr };
+        execv(path.c_str(), const_cast<char* const*>(argv));
+        _exit(127);
+    }
+    
+    ::close(fds[1]);
+    controlFd_ = fds[0];
+    pid_ = pid;
+    return true;
+}
+
+void InferenceHostClient::stop() {
+    if (pid_ < 0) {
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(sendMutex_);
+        sendFrame(controlFd_, static_cast<uint32_t>(HostCommand::Shutdown), nullptr, 0);
+    }
+    
+    // Give the helper a moment to free the model, then make sure it is gone
+    for (int i = 0; i < 50; i++) {
+        if (waitpid(pid_, nullptr, WNOHANG) == pid_) {
+            pid_ = -1;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (pid_ > 0) {
+        LOGW("Inference host did not exit, killing it");
+        kill(pid_, SIGKILL);
+        waitpid(pid_, nullptr, 0);
+        pid_ = -1;
+    }
+    
+    ring_.close();
+    ::close(controlFd_);
+    controlFd_ = -1;
+    modelLoaded_ = false;
+}
+
+bool InferenceHostClient::isAlive() {
+    if (pid_ < 0) {
+        return false;
+    }
+    
+    int status = 0;
+    pid_t rc = waitpid(pid_, &status, WNOHANG);
+    if (rc == pid_) {
+        pid_ = -1;
+        if (WIFSIGNALED(status)) {
+            markDead("Inference host crashed with signal " + std::to_string(WTERMSIG(status)));
+        } else {
+            markDead("Inference host exited with status " + std::to_string(WEXITSTATUS(status)));
+        }
+        return false;
+    }
+    return true;
+}
+
+void InferenceHostClient::markDead(const std::string& reason) {
+    lastError_ = reason;
+    modelLoaded_ = false;
+    LOGE("%s", reason.c_str());
+}
+
+void InferenceHostClient::failHost() {
+    // A helper that corrupts the ring cannot be trusted with further requests
+    stop();
+    markDead("Inference host sent a malformed token record");
+}
+
+bool InferenceHostClient::sendCommand(HostCommand command, const std::string& payload) {
+    std::lock_guard<std::mutex> lock(sendMutex_);
+    if (controlFd_ < 0 || !sendFrame(controlFd_, static_cast<uint32_t>(command), payload)) {
+        isAlive();
+        if (lastError_.empty()) {
+            lastError_ = "Inference host is not running";
+        }
+        return false;
+    }
+    return true;
+}
+
+bool InferenceHostClient::awaitReply() {
+    uint32_t command = 0;
+    std::string payload;
+    if (!recvFrame(controlFd_, command, payload)) {
+        if (isAlive()) {
+            lastError_ = "Lost connection to inference host";
+        }
+        return false;
+    }
+    if (command != static_cast<uint32_t>(HostCommand::Ok)) {
+        lastError_ = payload.empty() ? "Inference host request failed" : payload;
+        return false;
+    }
+    return true;
+}
+
+bool InferenceHostClient::loadModel(const std::string& modelPath, const LlamaConfig& config) {
+    std::lock_guard<std::mutex> lock(requestMutex_);
+    lastError_.clear();
+    
+    LlamaConfig hostConfig = config;
+    hostConfig.outOfProcess = false;
+    
+    if (!sendCommand(HostCommand::Load, encodeConfig(hostConfig) + modelPath) || !awaitReply()) {
+        return false;
+    }
+    
+    modelLoaded_ = true;
+    return true;
+}
+
+bool InferenceHostClient::unloadModel() {
+    std::lock_guard<std::mutex> lock(requestMutex_);
+    modelLoaded_ = false;
+    return sendCommand(HostCommand::Unload, std::string()) && awaitReply();
+}
+
+bool InferenceHostClient::generateStream(const std::string& prompt, const TokenCallback& callback,
+                                         const LlamaConfig* config) {
+    std::lock_guard<std::mutex> lock(requestMutex_);
+    lastError_.clear();
+    
+    if (!modelLoaded_) {
+        lastError_ = "Model not loaded";
+        return false;
+    }
+    
+    ring_.reset();
+    
+    std::string payload;
+    payload.push_back(config != nullptr ? 1 : 0);
+    payload += encodeConfig(config != nullptr ? *config : LlamaConfig());
+    payload += prompt;
+    if (!sendCommand(HostCommand::Generate, payload)) {
+        return false;
+    }
+    
+    RingRecordType type;
+    std::string record;
+    for (;;) {
+        int rc = ring_.read(type, record, LIVENESS_POLL_MS);
+        if (rc == 0) {
+            if (!isAlive()) {
+                return false;
+            }
+            continue;
+        }
+        if (rc < 0) {
+            if (ring_.failed()) {
+                failHost();
+            } else {
+                lastError_ = "Token channel closed";
+            }
+            return false;
+        }
+        
+        if (type == RingRecordType::Token) {
+            callback(record);
+        } else if (type == RingRecordType::Done) {
+            lastError_ = record;
+            return record.empty();
+        }
+    }
+}
+
+void InferenceHostClient::cancelGeneration() {
+    sendCommand(HostCommand::Cancel, std::string());
+}
+
+int64_t InferenceHostClient::benchmarkChannel(uint32_t count, uint32_t recordSize) {
+    std::lock_guard<std::mutex> lock(requestMutex_);
+    
+    ring_.reset();
+    
+    uint32_t args[2] = { count, recordSize };
+    auto start = std::chrono::steady_clock::now();
+    if (!sendCommand(HostCommand::Bench, std::string(reinterpret_cast<const char*>(args), sizeof(args)))) {
+        return -1;
+    }
+    
+    RingRecordType type;
+    std::string record;
+    uint32_t received = 0;
+    while (received < count) {
+        int rc = ring_.read(type, record, LIVENESS_POLL_MS);
+        if (rc < 0 || (rc == 0 && !isAlive())) {
+            if (ring_.failed()) {
+                failHost();
+            }
+            return -1;
+        }
+        if (rc == 1 && type == RingRecordType::Bench) {
+            received++;
+        }
+    }
+    
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// ============================================================================
+// Helper process side
+// ============================================================================
+
+int runInferenceHost(int controlFd, int ringFd) {
+    ShmTokenRing ring;
+    if (!ring.attach(ringFd)) {
+        LOGE("Inference host failed to attach token ring");
+        return 1;
+    }
+    
+    LlamaContextWrapper wrapper;
+    std::thread worker;
+    
+    LOGI("Inference host ready (pid %d)", static_cast<int>(getpid()));
+    
+    uint32_t command = 0;
+    std::string payload;
+    while (recvFrame(controlFd, command, payload)) {
+        switch (static_cast<HostCommand>(command)) {
+            case HostCommand::Load: {
+                if (worker.joinable()) {
+                    worker.join();
+                }
+                LlamaConfig config;
+                if (!decodeConfig(payload, 0, config)) {
+                    sendFrame(controlFd, static_cast<uint32_t>(HostCommand::Error), "Malformed load request");
+                    break;
+                }
+                std::string path = payload.substr(sizeof(config));
+                if (wrapper.loadModel(path, config)) {
+                    sendFrame(controlFd, static_cast<uint32_t>(HostCommand::Ok), nullptr, 0);
+                } else {
+                    sendFrame(controlFd, static_cast<uint32_t>(HostCommand::Error), wrapper.getLastError());
+                }
+                break;
+            }
+            
+            case HostCommand::Unload:
+                if (worker.joinable()) {
+                    wrapper.cancelGeneration();
+                    worker.join();
+                }
+                wrapper.unloadModel();
+                sendFrame(controlFd, static_cast<uint32_t>(HostCommand::Ok), nullptr, 0);
+                break;
+            
+            case HostCommand::Generate: {
+                if (worker.joinable()) {
+                    worker.join();
+                }
+                LlamaConfig config;
+                if (payload.empty() || !decodeConfig(payload, 1, config)) {
+                    const char* error = "Malformed generate request";
+                    ring.write(RingRecordType::Done, error, strlen(error));
+                    break;
+                }
+                bool hasConfig = payload[0] != 0;
+                std::string prompt = payload.substr(1 + sizeof(config));
+                
+                // Generate on a worker so Cancel keeps being read here
+                worker = std::thread([&wrapper, &ring, hasConfig, config, prompt]() {
+                    wrapper.generateStream(prompt, [&ring](const std::string& token) {
+                        ring.write(RingRecordType::Token, token.data(), token.size());
+                    }, hasConfig ? &config : nullptr);
+                    std::string error = wrapper.getLastError();
+                    ring.write(RingRecordType::Done, error.data(), error.size());
+                });
+                break;
+            }
+            
+            case HostCommand::Cancel:
+                wrapper.cancelGeneration();
+                break;
+            
+            case HostCommand::Bench: {
+                uint32_t args[2] = { 0, 0 };
+                if (payload.size() >= sizeof(args)) {
+                    memcpy(args, payload.data(), sizeof(args));
+                }
+                std::string record(args[1], 'x');
+                for (uint32_t i = 0; i < args[0]; i++) {
+                    ring.write(RingRecordType::Bench, record.data(), record.size());
+                }
+                break;
+            }
+            
+            case HostCommand::Shutdown:
+                wrapper.cancelGeneration();
+                if (worker.joinable()) {
+                    worker.join();
+                }
+                wrapper.unloadModel();
+                LOGI("Inference host shutting down");
+                return 0;
+            
+            default:
+                LOGW("Unknown host command: %u", command);
+                break;
+        }
+    }
+    
+    // Parent went away
+    wrapper.cancelGeneration();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    LOGI("Control channel closed, inference host exiting");
+    return 0;
+}
+
+} // namespace llamaandroid
@@ -0,0 +1,106 @@
+#ifndef INFERENCE_HOST_H
+#define INFERENCE_HOST_H
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <sys/types.h>
+
+#include "llama_context_wrapper.h"
+#include "ipc_channel.h"
+
+namespace llamaandroid {
+
+/**
+ * Commands sent over the control socket
+ */
+enum class HostCommand : uint32_t {
+    Load = 1,       // Payload: LlamaConfig + model path; reply Ok/Error
+    Unload = 2,     // Reply Ok
+    Generate = 3,   // Payload: flag + LlamaConfig + prompt; tokens and Done go to the ring
+    Cancel = 4,     // No reply
+    Shutdown = 5,   // No reply, host exits
+    Bench = 6,      // Payload: count + record size; host floods the ring with Bench records
+    Ok = 100,
+    Error = 101     // Payload: error message
+};
+
+/**
+ * Parent-side handle to a helper process running LlamaContextWrapper.
+ *
+ * The helper is started with fork/exec and owns the model: the weights are
+ * mmapped there, so a native crash or OOM kill takes down only the helper.
+ * Requests go over a stream socket; tokens stream back through a
+ * ShmTokenRing. If the helper dies, calls fail with an error instead of
+ * bringing down the calling process.
+ */
+class InferenceHostClient {
+public:
+    InferenceHostClient() = default;
+    ~InferenceHostClient();
+    
+    // Prevent copying
+    InferenceHostClient(const InferenceHostClient&) = delete;
+    InferenceHostClient& operator=(const InferenceHostClient&) = delete;
+    
+    /**
+     * Start the helper process
+     * @param executablePath Path to the llama-host executable (empty = default)
+     */
+    bool start(const std::string& executablePath);
+    
+    /**
+     * Stop the helper process, killing it if it does not exit promptly
+     */
+    void stop();
+    
+    bool isAlive();
+    
+    bool loadModel(const std::string& modelPath, const LlamaConfig& config);
+    bool unloadModel();
+    bool generateStream(const std::string& prompt, const TokenCallback& callback, const LlamaConfig* config);
+    void cancelGeneration();
+    
+    /**
+     * Measure the token channel: the helper writes `count` records of
+     * `recordSize` bytes and this side reads them all
+     * @return Elapsed nanoseconds, or -1 on failure
+     */
+    int64_t benchmarkChannel(uint32_t count, uint32_t recordSize);
+    
+    std::string getLastError() const { return lastError_; }
+    
+    /**
+     * Default helper location: next to this library as libllama-host.so
+     * (so it is packaged and extracted like a shared library), overridable
+     * with the LLAMA_ANDROID_HOST environment variable
+     */
+    static std::string defaultExecutablePath();
+    
+private:
+    pid_t pid_ = -1;
+    int controlFd_ = -1;
+    ShmTokenRing ring_;
+    bool modelLoaded_ = false;
+    std::string lastError_;
+    std::mutex requestMutex_;   // One request at a time on the control channel
+    std::mutex sendMutex_;      // Cancel may be sent while a request is active
+    
+    bool sendCommand(HostCommand command, const std::string& payload);
+    bool awaitReply();
+    void markDead(const std::string& reason);
+    void failHost();
+};
+
+/**
+ * Serve requests inside the helper process until Shutdown or until the
+ * parent goes away
+ * @param controlFd Control socket inherited from the parent
+ * @param ringFd Token ring memfd inherited from the parent
+ * @return Process exit code
+ */
+int runInferenceHost(int controlFd, int ringFd);
+
+} // namespace llamaandroid
+
+#endif // INFERENCE_HOST_H
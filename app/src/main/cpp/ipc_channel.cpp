@@ -0,0 +1,316 @@
+#include "ipc_channel.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOG_TAG "LlamaIpc"
+#include "llama_log.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+namespace llamaandroid {
+
+// Record prefix: payload length and type
+static const size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+// Frames larger than this are treated as a corrupt stream
+static const uint32_t MAX_FRAME_SIZE = 64u * 1024u * 1024u;
+
+static int futexWait(std::atomic<uint32_t>* addr, uint32_t expected, int timeoutMs) {
+    // Shared (non-private) futex: the word lives in memory mapped by both processes
+    struct timespec ts;
+    struct timespec* tsp = nullptr;
+    if (timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = static_cast<long>(timeoutMs % 1000) * 1000000L;
+        tsp = &ts;
+    }
+    return static_cast<int>(syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr),
+                                    FUTEX_WAIT, expected, tsp, nullptr, 0));
+}
+
+static void futexWake(std::atomic<uint32_t>* addr) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+ShmTokenRing::~ShmTokenRing() {
+    if (header_ != nullptr) {
+        munmap(header_, mappedSize_);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+bool ShmTokenRing::create(size_t capacity) {
+    size_t cap = 4096;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    
+    // memfd_create through syscall: the libc wrapper needs API 30 on Android
+    int fd = static_cast<int>(syscall(SYS_memfd_create, "llama-token-ring", MFD_CLOEXEC));
+    if (fd < 0) {
+        LOGE("memfd_create failed: %s", strerror(errno));
+        return false;
+    }
+    
+    size_t size = sizeof(Header) + cap;
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        LOGE("ftruncate failed: %s", strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    
+    if (!map(fd, size)) {
+        ::close(fd);
+        return false;
+    }
+    
+    // The fresh memfd is zero-filled, which is a valid empty header
+    header_->capacity = static_cast<uint32_t>(cap);
+    fd_ = fd;
+    return true;
+}
+
+bool ShmTokenRing::attach(int fd) {
+    Header probe;
+    if (pread(fd, &probe.capacity, sizeof(probe.capacity), offsetof(Header, capacity)) !=
+        static_cast<ssize_t>(sizeof(probe.capacity))) {
+        LOGE("Failed to read ring header: %s", strerror(errno));
+        return false;
+    }
+    
+    if (probe.capacity == 0 || (probe.capacity & (probe.capacity - 1)) != 0) {
+        LOGE("Invalid token ring capacity %u", probe.capacity);
+        return false;
+    }
+    
+    if (!map(fd, sizeof(Header) + probe.capacity)) {
+        return false;
+    }
+    fd_ = fd;
+    return true;
+}
+
+bool ShmTokenRing::map(int fd, size_t size) {
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        LOGE("mmap of token ring failed: %s", strerror(errno));
+        return false;
+    }
+    
+    header_ = static_cast<Header*>(addr);
+    data_ = static_cast<uint8_t*>(addr) + sizeof(Header);
+    mappedSize_ = size;
+    capacity_ = size - sizeof(Header);
+    return true;
+}
+
+void ShmTokenRing::copyIn(uint64_t pos, const void* src, size_t size) {
+    const size_t cap = capacity_;
+    const size_t offset = static_cast<size_t>(pos & (cap - 1));
+    const size_t first = std::min(size, cap - offset);
+    memcpy(data_ + offset, src, first);
+    if (first < size) {
+        memcpy(data_, static_cast<const uint8_t*>(src) + first, size - first);
+    }
+}
+
+void ShmTokenRing::copyOut(uint64_t pos, void* dst, size_t size) const {
+    const size_t cap = capacity_;
+    const size_t offset = static_cast<size_t>(pos & (cap - 1));
+    const size_t first = std::min(size, cap - offset);
+    memcpy(dst, data_ + offset, first);
+    if (first < size) {
+        memcpy(static_cast<uint8_t*>(dst) + first, data_, size - first);
+    }
+}
+
+bool ShmTokenRing::write(RingRecordType type, const void* data, size_t size) {
+    const size_t recordSize = RECORD_HEADER_SIZE + size;
+    if (header_ == nullptr || recordSize > capacity_) {
+        return false;
+    }
+    
+    const uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    
+    // Wait for space
+    for (;;) {
+        if (header_->closed.load(std::memory_order_acquire)) {
+            return false;
+        }
+        uint32_t seq = header_->spaceSeq.load(std::memory_order_acquire);
+        uint64_t head = header_->head.load(std::memory_order_acquire);
+        if (tail + recordSize - head <= capacity_) {
+            break;
+        }
+        header_->writerWaiting.store(1, std::memory_order_seq_cst);
+        // Re-check after announcing, then sleep until a read bumps spaceSeq
+        head = header_->head.load(std::memory_order_seq_cst);
+        if (tail + recordSize - head > capacity_) {
+            futexWait(&header_->spaceSeq, seq, 100);
+        }
+        header_->writerWaiting.store(0, std::memory_order_relaxed);
+    }
+    
+    uint32_t prefix[2] = { static_cast<uint32_t>(size), static_cast<uint32_t>(type) };
+    copyIn(tail, prefix, sizeof(prefix));
+    if (size > 0) {
+        copyIn(tail + RECORD_HEADER_SIZE, data, size);
+    }
+    
+    header_->tail.store(tail + recordSize, std::memory_order_release);
+    header_->dataSeq.fetch_add(1, std::memory_order_seq_cst);
+    if (header_->readerWaiting.load(std::memory_order_seq_cst)) {
+        futexWake(&header_->dataSeq);
+    }
+    return true;
+}
+
+int ShmTokenRing::read(RingRecordType& type, std::string& payload, int timeoutMs) {
+    if (header_ == nullptr || failed_) {
+        return -1;
+    }
+    
+    const uint64_t head = header_->head.load(std::memory_order_relaxed);
+    
+    for (;;) {
+        uint32_t seq = header_->dataSeq.load(std::memory_order_acquire);
+        if (header_->tail.load(std::memory_order_acquire) != head) {
+            break;
+        }
+        if (header_->closed.load(std::memory_order_acquire)) {
+            return -1;
+        }
+        if (timeoutMs == 0) {
+            return 0;
+        }
+        header_->readerWaiting.store(1, std::memory_order_seq_cst);
+        int rc = 0;
+        if (header_->tail.load(std::memory_order_seq_cst) == head) {
+            rc = futexWait(&header_->dataSeq, seq, timeoutMs);
+        }
+        header_->readerWaiting.store(0, std::memory_order_relaxed);
+        if (rc != 0 && errno == ETIMEDOUT &&
+            header_->tail.load(std::memory_order_acquire) == head) {
+            return 0;
+        }
+    }
+    
+    // The peer may have crashed mid-write or scribbled over the ring; never
+    // trust a length beyond what it has published
+    const uint64_t available = header_->tail.load(std::memory_order_acquire) - head;
+    uint32_t prefix[2] = { 0, 0 };
+    if (available >= RECORD_HEADER_SIZE && available <= capacity_) {
+        copyOut(head, prefix, sizeof(prefix));
+    }
+    if (available < RECORD_HEADER_SIZE || available > capacity_ || prefix[0] > available - RECORD_HEADER_SIZE) {
+        LOGE("Malformed token ring record (length %u, %llu bytes available)", prefix[0],
+             static_cast<unsigned long long>(available));
+        failed_ = true;
+        close();
+        return -1;
+    }
+    type = static_cast<RingRecordType>(prefix[1]);
+    payload.resize(prefix[0]);
+    if (prefix[0] > 0) {
+        copyOut(head + RECORD_HEADER_SIZE, &payload[0], prefix[0]);
+    }
+    
+    header_->head.store(head + RECORD_HEADER_SIZE + prefix[0], std::memory_order_release);
+    header_->spaceSeq.fetch_add(1, std::memory_order_seq_cst);
+    if (header_->writerWaiting.load(std::memory_order_seq_cst)) {
+        futexWake(&header_->spaceSeq);
+    }
+    return 1;
+}
+
+void ShmTokenRing::reset() {
+    if (header_ == nullptr) {
+        return;
+    }
+    header_->head.store(header_->tail.load(std::memory_order_acquire), std::memory_order_release);
+    header_->spaceSeq.fetch_add(1, std::memory_order_seq_cst);
+    futexWake(&header_->spaceSeq);
+}
+
+void ShmTokenRing::close() {
+    if (header_ == nullptr) {
+        return;
+    }
+    header_->closed.store(1, std::memory_order_seq_cst);
+    header_->dataSeq.fetch_add(1, std::memory_order_seq_cst);
+    header_->spaceSeq.fetch_add(1, std::memory_order_seq_cst);
+    futexWake(&header_->dataSeq);
+    futexWake(&header_->spaceSeq);
+}
+
+static bool writeAll(int fd, const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t size) {
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool sendFrame(int fd, uint32_t command, const void* data, size_t size) {
+    uint32_t prefix[2] = { command, static_cast<uint32_t>(size) };
+    return writeAll(fd, prefix, sizeof(prefix)) && (size == 0 || writeAll(fd, data, size));
+}
+
+bool sendFrame(int fd, uint32_t command, const std::string& payload) {
+    return sendFrame(fd, command, payload.data(), payload.size());
+}
+
+bool recvFrame(int fd, uint32_t& command, std::string& payload) {
+    uint32_t prefix[2];
+    if (!readAll(fd, prefix, sizeof(prefix))) {
+        return false;
+    }
+    if (prefix[1] > MAX_FRAME_SIZE) {
+        LOGE("Control frame too large: %u bytes", prefix[1]);
+        return false;
+    }
+    
+    command = prefix[0];
+    payload.resize(prefix[1]);
+    return prefix[1] == 0 || readAll(fd, &payload[0], prefix[1]);
+}
+
+} // namespace llamaandroid
@@ -0,0 +1,117 @@
+#ifndef IPC_CHANNEL_H
+#define IPC_CHANNEL_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace llamaandroid {
+
+/**
+ * Record types carried by the token ring
+ */
+enum class RingRecordType : uint32_t {
+    Token = 1,   // Payload: UTF-8 token text
+    Done = 2,    // Payload: error message (empty on success)
+    Bench = 3    // Payload: opaque benchmark bytes
+};
+
+/**
+ * Single-producer/single-consumer ring buffer in shared memory.
+ *
+ * The buffer lives in a memfd so it can be shared with a child process by
+ * passing the descriptor across fork/exec. Records are length-prefixed and
+ * may wrap around the end of the buffer. Both sides block on futexes in the
+ * shared header, so an idle channel costs no CPU and a record costs one
+ * memcpy plus, only when the peer is sleeping, one wake-up syscall.
+ */
+class ShmTokenRing {
+public:
+    ShmTokenRing() = default;
+    ~ShmTokenRing();
+    
+    // Prevent copying
+    ShmTokenRing(const ShmTokenRing&) = delete;
+    ShmTokenRing& operator=(const ShmTokenRing&) = delete;
+    
+    /**
+     * Create a new ring backed by a fresh memfd
+     * @param capacity Data capacity in bytes, rounded up to a power of two
+     */
+    bool create(size_t capacity);
+    
+    /**
+     * Map an existing ring from a descriptor received from the creator
+     */
+    bool attach(int fd);
+    
+    /**
+     * Descriptor of the backing memfd, to be passed to the peer process
+     */
+    int fd() const { return fd_; }
+    
+    /**
+     * Append a record, blocking while the ring is full
+     * @return false if the ring was closed or the record can never fit
+     */
+    bool write(RingRecordType type, const void* data, size_t size);
+    
+    /**
+     * Read the next record, blocking up to timeoutMs (-1 = forever). A
+     * record whose length does not fit what the peer has written marks
+     * the ring failed and closes it.
+     * @return 1 if a record was read, 0 on timeout, -1 if closed and drained or failed
+     */
+    int read(RingRecordType& type, std::string& payload, int timeoutMs);
+    
+    /**
+     * Whether read() found a malformed record; the peer is then not to be trusted
+     */
+    bool failed() const { return failed_; }
+    
+    /**
+     * Drop any unread records (consumer side, between requests)
+     */
+    void reset();
+    
+    /**
+     * Mark the ring closed and wake both sides
+     */
+    void close();
+    
+private:
+    struct Header {
+        std::atomic<uint64_t> head;        // Bytes consumed
+        std::atomic<uint64_t> tail;        // Bytes produced
+        std::atomic<uint32_t> dataSeq;     // Futex: bumped after each write
+        std::atomic<uint32_t> spaceSeq;    // Futex: bumped after each read
+        std::atomic<uint32_t> readerWaiting;
+        std::atomic<uint32_t> writerWaiting;
+        std::atomic<uint32_t> closed;
+        uint32_t capacity;
+    };
+    
+    int fd_ = -1;
+    Header* header_ = nullptr;
+    uint8_t* data_ = nullptr;
+    size_t mappedSize_ = 0;
+    size_t capacity_ = 0;  // From the mapping; the shared header is writable by the peer
+    bool failed_ = false;
+    
+    bool map(int fd, size_t size);
+    void copyIn(uint64_t pos, const void* src, size_t size);
+    void copyOut(uint64_t pos, void* dst, size_t size) const;
+};
+
+/**
+ * Length-prefixed frames over a stream socket, used for the control channel
+ */
+bool sendFrame(int fd, uint32_t command, const void* data, size_t size);
+bool sendFrame(int fd, uint32_t command, const std::string& payload);
+bool recvFrame(int fd, uint32_t& command, std::string& payload);
+
+} // namespace llamaandroid
+
+#endif // IPC_CHANNEL_H
@@ -0,0 +1,322 @@
+#include "json_util.h"
+#include <cstdio>
+#include <cstdlib>
+
+namespace llamaandroid {
+
+// Nesting limit, so a hostile body cannot exhaust the stack
+static const int MAX_DEPTH = 64;
+
+static const JsonValue& nullValue() {
+    static const JsonValue value;
+    return value;
+}
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : text_(text) {}
+    
+    bool parseDocument(JsonValue& out, std::string& error) {
+        skipWhitespace();
+        if (!parseValue(out, 0)) {
+            error = error_ + " at offset " + std::to_string(pos_);
+            return false;
+        }
+        skipWhitespace();
+        if (pos_ != text_.size()) {
+            error = "Trailing characters at offset " + std::to_string(pos_);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    const std::string& text_;
+    size_t pos_ = 0;
+    std::string error_;
+    
+    bool fail(const char* message) {
+        error_ = message;
+        return false;
+    }
+    
+    void skipWhitespace() {
+        while (pos_ < text_.size() &&
+               (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r')) {
+            pos_++;
+        }
+    }
+    
+    bool consume(const char* literal) {
+        size_t n = 0;
+        while (literal[n] != '\0') {
+            n++;
+        }
+        if (text_.compare(pos_, n, literal) != 0) {
+            return false;
+        }
+        pos_ += n;
+        return true;
+    }
+    
+    bool parseValue(JsonValue& out, int depth) {
+        if (depth > MAX_DEPTH) {
+            return fail("Nesting too deep");
+        }
+        if (pos_ >= text_.size()) {
+            return fail("Unexpected end of input");
+        }
+        
+        char c = text_[pos_];
+        if (c == '{') {
+            return parseObject(out, depth);
+        }
+        if (c == '[') {
+            return parseArray(out, depth);
+        }
+        if (c == '"') {
+            out.type_ = JsonValue::Type::String;
+            return parseString(out.string_);
+        }
+        if (consume("true")) {
+            out.type_ = JsonValue::Type::Bool;
+            out.bool_ = true;
+            return true;
+        }
+        if (consume("false")) {
+            out.type_ = JsonValue::Type::Bool;
+            out.bool_ = false;
+            return true;
+        }
+        if (consume("null")) {
+            out.type_ = JsonValue::Type::Null;
+            return true;
+        }
+        return parseNumber(out);
+    }
+    
+    bool parseNumber(JsonValue& out) {
+        const char* start = text_.c_str() + pos_;
+        char* end = nullptr;
+        double value = strtod(start, &end);
+        if (end == start) {
+            return fail("Invalid value");
+        }
+        pos_ += static_cast<size_t>(end - start);
+        out.type_ = JsonValue::Type::Number;
+        out.number_ = value;
+        return true;
+    }
+    
+    static void appendUtf8(std::string& out, uint32_t cp) {
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+    
+    bool parseHex4(uint32_t& value) {
+        if (pos_ + 4 > text_.size()) {
+            return fail("Truncated unicode escape");
+        }
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            char h = text_[pos_++];
+            value <<= 4;
+            if (h >= '0' && h <= '9') {
+                value |= static_cast<uint32_t>(h - '0');
+            } else if (h >= 'a' && h <= 'f') {
+                value |= static_cast<uint32_t>(h - 'a' + 10);
+            } else if (h >= 'A' && h <= 'F') {
+                value |= static_cast<uint32_t>(h - 'A' + 10);
+            } else {
+                return fail("Invalid unicode escape");
+            }
+        }
+        return true;
+    }
+    
+    bool parseString(std::string& out) {
+        pos_++; // opening quote
+        while (pos_ < text_.size()) {
+            char c = text_[pos_++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (pos_ >= text_.size()) {
+                break;
+            }
+            char e = text_[pos_++];
+            switch (e) {
+                case '"': out.push_back('"'); break;
+                case '\\': out.push_back('\\'); break;
+                case '/': out.push_back('/'); break;
+                case 'b': out.push_back('\b'); break;
+                case 'f': out.push_back('\f'); break;
+                case 'n': out.push_back('\n'); break;
+                case 'r': out.push_back('\r'); break;
+                case 't': out.push_back('\t'); break;
+                case 'u': {
+                    uint32_t cp;
+                    if (!parseHex4(cp)) {
+                        return false;
+                    }
+                    // Surrogate pair
+                    if (cp >= 0xD800 && cp <= 0xDBFF && text_.compare(pos_, 2, "\\u") == 0) {
+                        pos_ += 2;
+                        uint32_t low;
+                        if (!parseHex4(low)) {
+                            return false;
+                        }
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(out, cp);
+                    break;
+                }
+                default:
+                    return fail("Invalid escape");
+            }
+        }
+        return fail("Unterminated string");
+    }
+    
+    bool parseArray(JsonValue& out, int depth) {
+        out.type_ = JsonValue::Type::Array;
+        pos_++; // [
+        skipWhitespace();
+        if (pos_ < text_.size() && text_[pos_] == ']') {
+            pos_++;
+            return true;
+        }
+        for (;;) {
+            out.array_.emplace_back();
+            skipWhitespace();
+            if (!parseValue(out.array_.back(), depth + 1)) {
+                return false;
+            }
+            skipWhitespace();
+            if (pos_ < text_.size() && text_[pos_] == ',') {
+                pos_++;
+                continue;
+            }
+            if (pos_ < text_.size() && text_[pos_] == ']') {
+                pos_++;
+                return true;
+            }
+            return fail("Expected ',' or ']'");
+        }
+    }
+    
+    bool parseObject(JsonValue& out, int depth) {
+        out.type_ = JsonValue::Type::Object;
+        pos_++; // {
+        skipWhitespace();
+        if (pos_ < text_.size() && text_[pos_] == '}') {
+            pos_++;
+            return true;
+        }
+        for (;;) {
+            skipWhitespace();
+            if (pos_ >= text_.size() || text_[pos_] != '"') {
+                return fail("Expected object key");
+            }
+            std::string key;
+            if (!parseString(key)) {
+                return false;
+            }
+            skipWhitespace();
+            if (pos_ >= text_.size() || text_[pos_] != ':') {
+                return fail("Expected ':'");
+            }
+            pos_++;
+            skipWhitespace();
+            if (!parseValue(out.object_[key], depth + 1)) {
+                return false;
+            }
+            skipWhitespace();
+            if (pos_ < text_.size() && text_[pos_] == ',') {
+                pos_++;
+                continue;
+            }
+            if (pos_ < text_.size() && text_[pos_] == '}') {
+                pos_++;
+                return true;
+            }
+            return fail("Expected ',' or '}'");
+        }
+    }
+};
+
+bool JsonValue::parse(const std::string& text, JsonValue& out, std::string& error) {
+    out = JsonValue();
+    JsonParser parser(text);
+    return parser.parseDocument(out, error);
+}
+
+const std::string& JsonValue::asString() const {
+    static const std::string empty;
+    return type_ == Type::String ? string_ : empty;
+}
+
+const JsonValue& JsonValue::operator[](size_t index) const {
+    if (type_ != Type::Array || index >= array_.size()) {
+        return nullValue();
+    }
+    return array_[index];
+}
+
+const JsonValue& JsonValue::operator[](const std::string& key) const {
+    if (type_ != Type::Object) {
+        return nullValue();
+    }
+    auto it = object_.find(key);
+    return it != object_.end() ? it->second : nullValue();
+}
+
+bool JsonValue::has(const std::string& key) const {
+    return type_ == Type::Object && object_.count(key) != 0;
+}
+
+std::string jsonQuote(const std::string& text) {
+    std::string out;
+    out.reserve(text.size() + 2);
+    out.push_back('"');
+    for (unsigned char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out.push_back(static_cast<char>(c));
+                }
+        }
+    }
+    out.push_back('"');
+    return out;
+}
+
+} // namespace llamaandroid
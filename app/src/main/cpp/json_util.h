@@ -0,0 +1,66 @@
+#ifndef JSON_UTIL_H
+#define JSON_UTIL_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+namespace llamaandroid {
+
+/**
+ * Minimal JSON value for the local server's request bodies.
+ * Parses objects, arrays, strings (with \u escapes), numbers, booleans and
+ * null. Lookups on missing keys or wrong types return a shared null value,
+ * so optional fields can be read without checks.
+ */
+class JsonValue {
+public:
+    enum class Type { Null, Bool, Number, String, Array, Object };
+    
+    JsonValue() = default;
+    
+    /**
+     * Parse a JSON document
+     * @param text Input text
+     * @param out Parsed value
+     * @param error Set to a description of the first syntax error
+     * @return true if the whole input is a single valid JSON value
+     */
+    static bool parse(const std::string& text, JsonValue& out, std::string& error);
+    
+    Type type() const { return type_; }
+    bool isNull() const { return type_ == Type::Null; }
+    bool isString() const { return type_ == Type::String; }
+    bool isNumber() const { return type_ == Type::Number; }
+    bool isArray() const { return type_ == Type::Array; }
+    bool isObject() const { return type_ == Type::Object; }
+    
+    bool asBool(bool fallback = false) const { return type_ == Type::Bool ? bool_ : fallback; }
+    double asNumber(double fallback = 0.0) const { return type_ == Type::Number ? number_ : fallback; }
+    const std::string& asString() const;
+    
+    size_t size() const { return type_ == Type::Array ? array_.size() : 0; }
+    const JsonValue& operator[](size_t index) const;
+    const JsonValue& operator[](const std::string& key) const;
+    bool has(const std::string& key) const;
+
+private:
+    Type type_ = Type::Null;
+    bool bool_ = false;
+    double number_ = 0.0;
+    std::string string_;
+    std::vector<JsonValue> array_;
+    std::map<std::string, JsonValue> object_;
+    
+    friend class JsonParser;
+};
+
+/**
+ * Escape a string for inclusion in JSON output, including the quotes
+ */
+std::string jsonQuote(const std::string& text);
+
+} // namespace llamaandroid
+
+#endif // JSON_UTIL_H
@@ -0,0 +1,22 @@
+#ifndef LIBRARY_VERSION_H
+#define LIBRARY_VERSION_H
+
+#include <string>
+
+// Shared by the inference engine and the JNI shim, which reports it
+// without loading the engine
+#define LLAMA_ANDROID_VERSION "0.1.0"
+
+namespace llamaandroid {
+
+inline std::string libraryVersion() {
+#if LLAMA_AVAILABLE
+    return std::string(LLAMA_ANDROID_VERSION) + " (llama.cpp)";
+#else
+    return std::string(LLAMA_ANDROID_VERSION) + " (stub)";
+#endif
+}
+
+} // namespace llamaandroid
+
+#endif // LIBRARY_VERSION_H
@@ -1,26 +1,279 @@
 #include "llama_context_wrapper.h"
-#include <android/log.h>
+#include "inference_host.h"
+#include "penalty_sampler.h"
+#include "alloc_hook.h"
+#include "generation_pacer.h"
+#include "library_version.h"
+#include "sequence_scheduler.h"
 #include <sstream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <ctime>
 #include <random>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#if LLAMA_AVAILABLE
+#include "gguf.h"
+#endif
 
 #define LOG_TAG "LlamaAndroid"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#include "llama_log.h"
 
 namespace llamaandroid {
 
-// Library version
-static const char* LIBRARY_VERSION = "0.1.0";
+#if LLAMA_AVAILABLE
+static std::string canonicalPath(const std::string& path) {
+    char* resolved = realpath(path.c_str(), nullptr);
+    if (resolved == nullptr) {
+        return path;
+    }
+    std::string result(resolved);
+    free(resolved);
+    return result;
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Share of the reported load progress taken by reading shards ahead;
+// llama.cpp's own load of the then-cached data takes the rest
+static const float PREFAULT_PROGRESS_SHARE = 0.5f;
+
+// Read size of the shard prefault threads
+static const size_t PREFAULT_READ_BYTES = 4 * 1024 * 1024;
+
+// How often prefault progress is reported
+static const int PREFAULT_PROGRESS_INTERVAL_MS = 100;
+
+/**
+ * A lone "<prefix>-00001-of-00004.gguf" stands for all of its shards, named
+ * as llama_split_path does; anything else is taken as given
+ */
+static std::vector<std::string> expandShardPaths(const std::vector<std::string>& paths) {
+    if (paths.size() != 1) {
+        return paths;
+    }
+    
+    const std::string& first = paths[0];
+    const size_t suffixLength = std::strlen("-00001-of-00004.gguf");
+    int splitNo = 0;
+    int splitCount = 0;
+    if (first.size() <= suffixLength ||
+        std::sscanf(first.c_str() + first.size() - suffixLength, "-%5d-of-%5d", &splitNo, &splitCount) != 2 ||
+        splitNo != 1 || splitCount < 2) {
+        return paths;
+    }
+    
+    char prefix[PATH_MAX];
+    if (llama_split_prefix(prefix, sizeof(prefix), first.c_str(), 0, splitCount) <= 0) {
+        return paths;
+    }
+    
+    std::vector<std::string> shards;
+    char path[PATH_MAX];
+    for (int i = 0; i < splitCount; i++) {
+        llama_split_path(path, sizeof(path), prefix, i, splitCount);
+        shards.push_back(path);
+    }
+    return shards;
+}
+
+// MemAvailable from /proc/meminfo: free memory plus reclaimable cache
+static uint64_t availableMemoryBytes() {
+    FILE* file = std::fopen("/proc/meminfo", "r");
+    if (file == nullptr) {
+        return 0;
+    }
+    
+    char line[128];
+    unsigned long long kb = 0;
+    while (std::fgets(line, sizeof(line), file) != nullptr) {
+        if (std::sscanf(line, "MemAvailable: %llu kB", &kb) == 1) {
+            break;
+        }
+    }
+    std::fclose(file);
+    return kb * 1024;
+}
+
+/**
+ * Read shards into the page cache, one thread per shard, reporting the
+ * bytes read over all of them from the calling thread
+ * @return false if a shard cannot be read (error says which)
+ */
+static bool prefaultShards(const std::vector<std::string>& paths, const LoadProgressCallback& onProgress,
+                           std::string& error) {
+    uint64_t totalBytes = 0;
+    for (const std::string& path : paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            error = "Cannot open model shard " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        totalBytes += static_cast<uint64_t>(st.st_size);
+    }
+    
+    uint64_t available = availableMemoryBytes();
+    if (totalBytes > available) {
+        LOGI("Not prefaulting %zu shards: %llu MB exceeds %llu MB available", paths.size(),
+             static_cast<unsigned long long>(totalBytes >> 20), static_cast<unsigned long long>(available >> 20));
+        return true;
+    }
+    
+    std::atomic<uint64_t> bytesRead{0};
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    size_t finished = 0;
+    std::vector<std::string> errors(paths.size());
+    
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < paths.size(); i++) {
+        workers.emplace_back([&, i]() {
+            int fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                errors[i] = "Cannot open model shard " + paths[i] + ": " + std::strerror(errno);
+            } else {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                std::vector<char> buffer(PREFAULT_READ_BYTES);
+                ssize_t n;
+                while ((n = read(fd, buffer.data(), buffer.size())) != 0) {
+                    if (n < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        errors[i] = "Cannot read model shard " + paths[i] + ": " + std::strerror(errno);
+                        break;
+                    }
+                    bytesRead.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+                }
+                close(fd);
+            }
+            
+            std::lock_guard<std::mutex> lock(doneMutex);
+            finished++;
+            doneCondition.notify_one();
+        });
+    }
+    
+    {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        while (finished < paths.size()) {
+            doneCondition.wait_for(lock, std::chrono::milliseconds(PREFAULT_PROGRESS_INTERVAL_MS));
+            if (onProgress && totalBytes > 0) {
+                float fraction = static_cast<float>(bytesRead.load()) / static_cast<float>(totalBytes);
+                onProgress(PREFAULT_PROGRESS_SHARE * std::min(fraction, 1.0f));
+            }
+        }
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    
+    for (const std::string& shardError : errors) {
+        if (!shardError.empty()) {
+            error = shardError;
+            return false;
+        }
+    }
+    return true;
+}
+
+// llama.cpp load progress, mapped into what is left after prefaulting
+struct LoadProgressRange {
+    const LoadProgressCallback* callback;
+    float start;
+};
+
+static bool reportLoadProgress(float progress, void* user) {
+    const LoadProgressRange* range = static_cast<const LoadProgressRange*>(user);
+    (*range->callback)(range->start + (1.0f - range->start) * progress);
+    return true;
+}
+
+/**
+ * Add scale times the directions of a control vector file - F32 tensors
+ * named "direction.<layer>" - into data, n_embd floats per layer from
+ * layer 1. Layer 0 (the token embeddings) is never steered and skipped.
+ */
+static bool addControlVector(llama_model* model, const ControlVectorSpec& spec, std::vector<float>& data,
+                             std::string& error) {
+    const int32_t nEmbd = llama_model_n_embd(model);
+    const int32_t nLayer = llama_model_n_layer(model);
+    
+    ggml_context* tensors = nullptr;
+    gguf_init_params params = {};
+    params.no_alloc = false;
+    params.ctx = &tensors;
+    gguf_context* gguf = gguf_init_from_file(spec.path.c_str(), params);
+    if (gguf == nullptr) {
+        error = "Failed to read control vector " + spec.path;
+        return false;
+    }
+    
+    // Vectors trained on another architecture load fine but steer nonsense
+    const int64_t hintKey = gguf_find_key(gguf, "controlvector.model_hint");
+    char arch[64] = {0};
+    if (hintKey >= 0 && llama_model_meta_val_str(model, "general.architecture", arch, sizeof(arch)) >= 0 &&
+        strcmp(gguf_get_val_str(gguf, hintKey), arch) != 0) {
+        LOGW("Control vector %s was made for %s, model is %s", spec.path.c_str(),
+             gguf_get_val_str(gguf, hintKey), arch);
+    }
+    
+    int layers = 0;
+    const int64_t count = gguf_get_n_tensors(gguf);
+    for (int64_t i = 0; i < count && error.empty(); i++) {
+        const char* name = gguf_get_tensor_name(gguf, i);
+        int layer = -1;
+        if (sscanf(name, "direction.%d", &layer) != 1) {
+            continue;
+        }
+        const ggml_tensor* tensor = ggml_get_tensor(tensors, name);
+        if (tensor == nullptr || tensor->type != GGML_TYPE_F32 || ggml_nelements(tensor) != nEmbd) {
+            error = "Control vector " + spec.path + " does not match the model's embedding size";
+        } else if (layer > nLayer) {
+            error = "Control vector " + spec.path + " has more layers than the model";
+        } else if (layer > 0) {
+            const float* direction = static_cast<const float*>(tensor->data);
+            float* out = data.data() + static_cast<size_t>(layer - 1) * nEmbd;
+            for (int32_t j = 0; j < nEmbd; j++) {
+                out[j] += spec.scale * direction[j];
+            }
+            layers++;
+        }
+    }
+    gguf_free(gguf);
+    ggml_free(tensors);
+    
+    if (error.empty() && layers == 0) {
+        error = "No layer directions in control vector " + spec.path;
+    }
+    return error.empty();
+}
+#endif
+
+// Shortest text tokenised in parallel segments (characters)
+static const size_t PARALLEL_TOKENIZE_MIN_CHARS = 8192;
 
 LlamaContextWrapper::LlamaContextWrapper() {
     LOGI("LlamaContextWrapper created");
 #if LLAMA_AVAILABLE
-    // Initialize llama backend
+    // Initialize llama backend, logging through our sink rather than stderr
+    routeLlamaLogs();
+    const auto start = std::chrono::steady_clock::now();
     llama_backend_init();
-    LOGI("llama.cpp backend initialized");
+    loadTimings_.backendInitMs = millisecondsSince(start);
+    LOGI("llama.cpp backend initialized in %.1f ms", loadTimings_.backendInitMs);
 #else
     LOGW("llama.cpp not available - using stub implementation");
 #endif
@@ -36,10 +289,33 @@ LlamaContextWrapper::~LlamaContextWrapper() {
 }
 
 bool LlamaContextWrapper::loadModel(const std::string& modelPath, const LlamaConfig& config) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    return loadModelShards(std::vector<std::string>{modelPath}, config);
+}
+
+bool LlamaContextWrapper::loadModelShards(const std::vector<std::string>& shardPaths, const LlamaConfig& config,
+                                          const LoadProgressCallback& onProgress) {
+    std::unique_lock<std::mutex> lock = lockIdle();
     clearError();
     
-    LOGI("Loading model from: %s", modelPath.c_str());
+    if (!checkNotScheduled()) {
+        return false;
+    }
+    
+    if (shardPaths.empty()) {
+        setError("No model path given");
+        return false;
+    }
+    
+    LOGI("Loading model from: %s%s", shardPaths[0].c_str(), shardPaths.size() > 1 ? " and further shards" : "");
+    
+    if (config.outOfProcess) {
+        // The host finds the other shards from the first one's name
+        return loadModelRemote(shardPaths[0], config);
+    }
+    
+    if (std::atomic_load(&remote_) != nullptr) {
+        unloadModel();
+    }
     
 #if LLAMA_AVAILABLE
     // Unload existing model if any
@@ -48,55 +324,45 @@ bool LlamaContextWrapper::loadModel(const std::string& modelPath, const LlamaCon
         unloadModel();
     }
     
-    // Set up model parameters
-    llama_model_params modelParams = llama_model_default_params();
-    modelParams.n_gpu_layers = config.gpuLayers;
-    modelParams.use_mmap = config.useMmap;
-    modelParams.use_mlock = config.useMlock;
-    
-    LOGI("Model params: gpu_layers=%d, use_mmap=%d, use_mlock=%d",
-         config.gpuLayers, config.useMmap, config.useMlock);
+    // Peaks are measured from here, so they include the load itself
+    resetPeakRss();
+    LlamaBufferCapture capture;
     
-    // Load the model using new API
-    model_ = llama_model_load_from_file(modelPath.c_str(), modelParams);
-    if (model_ == nullptr) {
-        setError("Failed to load model from: " + modelPath);
+    LoadTimings timings;
+    timings.backendInitMs = loadTimings_.backendInitMs;
+    std::string error;
+    if (!createModelAndContext(shardPaths, config, onProgress, model_, context_, timings, error)) {
+        setError(error);
         LOGE("%s", lastError_.c_str());
         return false;
     }
-    
-    LOGI("Model loaded successfully");
-    
-    // Set up context parameters
-    llama_context_params ctxParams = llama_context_default_params();
-    ctxParams.n_ctx = config.contextSize;
-    ctxParams.n_batch = config.batchSize;
-    ctxParams.n_threads = config.threads;
-    ctxParams.n_threads_batch = config.threadsBatch;
-    
-    LOGI("Context params: n_ctx=%d, n_batch=%d, n_threads=%d",
-         ctxParams.n_ctx, ctxParams.n_batch, ctxParams.n_threads);
-    
-    // Create context using new API
-    context_ = llama_init_from_model(model_, ctxParams);
-    if (context_ == nullptr) {
-        setError("Failed to create llama context");
-        LOGE("%s", lastError_.c_str());
-        llama_model_free(model_);
-        model_ = nullptr;
-        return false;
+    loadTimings_ = timings;
+    bufferSizes_ = capture.sizes();
+    modelPaths_.clear();
+    for (const std::string& path : expandShardPaths(shardPaths)) {
+        modelPaths_.push_back(canonicalPath(path));
     }
+    allocatorPeakBytes_ = 0;
     
     LOGI("Context created successfully");
     
+    allocateDecodeBuffers();
+    
     // Set up sampler with config seed
     setupSampler(config);
     
     currentConfig_ = config;
+    modelGeneration_++;
+    parallelTokenize_ = true;
+    tokenizeValidateRemaining_ = tokenizeValidateCount_;
+    splitRule_ = splitRuleOf(model_);
     LOGI("Model loading complete");
+    logMemoryStats("after load");
     return true;
     
 #else
+    (void)onProgress;
+    
     // Stub implementation for testing without llama.cpp
     LOGW("Using stub implementation - model not actually loaded");
     currentConfig_ = config;
@@ -104,12 +370,154 @@ bool LlamaContextWrapper::loadModel(const std::string& modelPath, const LlamaCon
 #endif
 }
 
+bool LlamaContextWrapper::swapModel(const std::string& modelPath, const LlamaConfig& config) {
+    std::lock_guard<std::mutex> swapLock(swapMutex_);
+    isSwapping_ = true;
+    
+    LOGI("Swapping model to: %s", modelPath.c_str());
+    
+    if (config.outOfProcess || std::atomic_load(&remote_) != nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        setError("Model swap is not supported out of process");
+        isSwapping_ = false;
+        return false;
+    }
+    
+#if LLAMA_AVAILABLE
+    // Load and warm the new model without holding mutex_, so the current
+    // model keeps serving requests for the whole load time
+    resetPeakRss();
+    LlamaBufferCapture capture;
+    
+    llama_model* newModel = nullptr;
+    llama_context* newContext = nullptr;
+    LoadTimings timings;
+    std::string error;
+    if (!createModelAndContext(std::vector<std::string>{modelPath}, config, nullptr, newModel, newContext,
+                               timings, error)) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            setError(error);
+        }
+        isSwapping_ = false;
+        return false;
+    }
+    
+    const auto warmUpStart = std::chrono::steady_clock::now();
+    warmUp(newModel, newContext);
+    timings.warmUpMs = millisecondsSince(warmUpStart);
+    
+    llama_model* oldModel = nullptr;
+    llama_context* oldContext = nullptr;
+    llama_sampler* oldSampler = nullptr;
+    {
+        // Waits for an in-flight generation to finish on the old model;
+        // every request that takes the lock after this point sees the new one
+        std::unique_lock<std::mutex> lock = lockDrained();
+        clearError();
+        
+        oldModel = model_;
+        oldContext = context_;
+        oldSampler = sampler_;
+        
+        model_ = newModel;
+        context_ = newContext;
+        sampler_ = nullptr;
+        setupSampler(config);
+        cachedTokens_.clear();
+        allocateDecodeBuffers();
+        currentConfig_ = config;
+        controlVectorSets_.clear();
+        activeControlVectorSet_ = 0;
+        modelGeneration_++;
+        parallelTokenize_ = true;
+        tokenizeValidateRemaining_ = tokenizeValidateCount_;
+        splitRule_ = splitRuleOf(model_);
+        timings.backendInitMs = loadTimings_.backendInitMs;
+        loadTimings_ = timings;
+        bufferSizes_ = capture.sizes();
+        modelPaths_.clear();
+        for (const std::string& path : expandShardPaths({modelPath})) {
+            modelPaths_.push_back(canonicalPath(path));
+        }
+        allocatorPeakBytes_ = 0;
+        logMemoryStats("after swap");
+        
+        if (scheduler_ != nullptr) {
+            scheduler_->resumeAfterSwap();
+        }
+    }
+    
+    LOGI("Model cutover complete, freeing previous model");
+    
+    // The old model has drained, free it outside the lock
+    if (oldSampler != nullptr) {
+        llama_sampler_free(oldSampler);
+    }
+    if (oldContext != nullptr) {
+        llama_free(oldContext);
+    }
+    if (oldModel != nullptr) {
+        llama_model_free(oldModel);
+    }
+#else
+    LOGW("Using stub implementation - model not actually swapped");
+    {
+        std::unique_lock<std::mutex> lock = lockDrained();
+        clearError();
+        currentConfig_ = config;
+        
+        if (scheduler_ != nullptr) {
+            scheduler_->resumeAfterSwap();
+        }
+    }
+#endif
+    
+    isSwapping_ = false;
+    LOGI("Model swap complete");
+    return true;
+}
+
+std::unique_lock<std::mutex> LlamaContextWrapper::lockIdle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idleCv_.wait(lock, [this] { return !pacingSleep_; });
+    return lock;
+}
+
+std::unique_lock<std::mutex> LlamaContextWrapper::lockDrained() {
+    // Called from swapModel() with swapMutex_ held, so a running scheduler
+    // cannot stop meanwhile; one may still start while mutex_ is released
+    SequenceScheduler* drained = nullptr;
+    for (;;) {
+        std::unique_lock<std::mutex> lock = lockIdle();
+        SequenceScheduler* scheduler = scheduler_;
+        if (scheduler == drained) {
+            return lock;
+        }
+        // The worker needs mutex_ to finish its sequences
+        lock.unlock();
+        scheduler->drainForSwap();
+        drained = scheduler;
+    }
+}
+
+bool LlamaContextWrapper::isSwapping() const {
+    return isSwapping_;
+}
+
 void LlamaContextWrapper::unloadModel() {
     // Note: Don't lock mutex here as it may be called from destructor
     // or from loadModel which already holds the lock
     
     LOGI("Unloading model");
     
+    std::shared_ptr<InferenceHostClient> remote = std::atomic_load(&remote_);
+    if (remote != nullptr) {
+        std::atomic_store(&remote_, std::shared_ptr<InferenceHostClient>());
+        remote->stop();
+        LOGI("Inference host stopped");
+    }
+    
 #if LLAMA_AVAILABLE
     if (sampler_ != nullptr) {
         llama_sampler_free(sampler_);
@@ -122,6 +530,10 @@ void LlamaContextWrapper::unloadModel() {
         context_ = nullptr;
         LOGD("Context freed");
     }
+    cachedTokens_.clear();
+    freeDecodeBuffers();
+    modelPaths_.clear();
+    bufferSizes_ = LlamaBufferSizes();
     
     if (model_ != nullptr) {
         llama_model_free(model_);
@@ -129,11 +541,16 @@ void LlamaContextWrapper::unloadModel() {
         LOGD("Model freed");
     }
 #endif
+    controlVectorSets_.clear();
+    activeControlVectorSet_ = 0;
     
     LOGI("Model unloaded");
 }
 
 bool LlamaContextWrapper::isModelLoaded() const {
+    if (std::atomic_load(&remote_) != nullptr) {
+        return true; // Stays "loaded" after a helper crash so the error surfaces on use
+    }
 #if LLAMA_AVAILABLE
     return model_ != nullptr && context_ != nullptr;
 #else
@@ -141,6 +558,27 @@ bool LlamaContextWrapper::isModelLoaded() const {
 #endif
 }
 
+bool LlamaContextWrapper::warmUp() {
+    std::unique_lock<std::mutex> lock = lockIdle();
+    if (!checkNotScheduled()) {
+        return false;
+    }
+#if LLAMA_AVAILABLE
+    if (model_ == nullptr || context_ == nullptr) {
+        return false;
+    }
+    
+    const auto start = std::chrono::steady_clock::now();
+    warmUp(model_, context_);
+    cachedTokens_.clear();
+    loadTimings_.warmUpMs = millisecondsSince(start);
+    LOGI("Model warmed up in %.1f ms", loadTimings_.warmUpMs);
+    return true;
+#else
+    return true; // Stub has nothing to warm up
+#endif
+}
+
 std::string LlamaContextWrapper::generate(const std::string& prompt, const LlamaConfig* config) {
     std::string result;
     
@@ -152,9 +590,14 @@ std::string LlamaContextWrapper::generate(const std::string& prompt, const Llama
 }
 
 void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallback callback, const LlamaConfig* config) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_lock<std::mutex> lock = lockIdle();
     clearError();
     
+    // A running scheduler decodes sequence 0 as one of its own
+    if (!checkNotScheduled()) {
+        return;
+    }
+    
     if (!isModelLoaded()) {
         setError("Model not loaded");
         LOGE("%s", lastError_.c_str());
@@ -163,126 +606,48 @@ void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallbac
     
     const LlamaConfig& cfg = config ? *config : currentConfig_;
     
-    LOGI("Starting generation for prompt length: %zu", prompt.length());
+    LOGD("Starting generation for prompt length: %zu", prompt.length());
     LOGD("Prompt: %.100s...", prompt.c_str());
     
     isGenerating_ = true;
     shouldCancel_ = false;
     
+    std::shared_ptr<InferenceHostClient> remote = std::atomic_load(&remote_);
+    if (remote != nullptr) {
+        if (!remote->generateStream(prompt, callback, config)) {
+            setError(remote->getLastError());
+        }
+        isGenerating_ = false;
+        return;
+    }
+    
 #if LLAMA_AVAILABLE
     // Update sampler if config changed
     if (config != nullptr) {
         setupSampler(*config);
     }
     
-    // Tokenize prompt
-    std::vector<llama_token> promptTokens = tokenize(prompt, true);
-    if (promptTokens.empty()) {
-        setError("Failed to tokenize prompt");
-        isGenerating_ = false;
-        return;
-    }
-    
-    LOGI("Tokenized prompt: %zu tokens", promptTokens.size());
-    
-    // Check context size
-    const int n_ctx = llama_n_ctx(context_);
-    if ((int)promptTokens.size() > n_ctx - 4) {
-        setError("Prompt too long for context size");
-        LOGE("Prompt tokens (%zu) exceeds context size (%d)", promptTokens.size(), n_ctx);
+    if (!selectControlVectors(cfg.controlVectorSet)) {
         isGenerating_ = false;
         return;
     }
     
-    // Clear memory (KV cache) for new generation - new API uses llama_memory_clear
-    llama_memory_t mem = llama_get_memory(context_);
-    if (mem != nullptr) {
-        llama_memory_clear(mem, true);
-        LOGD("Memory cleared for new generation");
-    }
-    
-    // Reset sampler state for new generation
-    if (sampler_ != nullptr) {
-        llama_sampler_reset(sampler_);
-        LOGD("Sampler reset for new generation");
-    }
-    
-    // Create batch for prompt processing
-    llama_batch batch = llama_batch_init(cfg.batchSize, 0, 1);
-    
-    // Add prompt tokens to batch manually (llama_batch_add was in common.h helper)
-    batch.n_tokens = 0;
-    for (size_t i = 0; i < promptTokens.size(); i++) {
-        batch.token[batch.n_tokens] = promptTokens[i];
-        batch.pos[batch.n_tokens] = i;
-        batch.n_seq_id[batch.n_tokens] = 1;
-        batch.seq_id[batch.n_tokens][0] = 0;
-        batch.logits[batch.n_tokens] = false;
-        batch.n_tokens++;
-    }
-    
-    // Set logits for last token
-    if (batch.n_tokens > 0) {
-        batch.logits[batch.n_tokens - 1] = true;
-    }
-    
-    // Process prompt
-    if (llama_decode(context_, batch) != 0) {
-        setError("Failed to process prompt");
-        llama_batch_free(batch);
+    // Tokenize prompt
+    std::vector<llama_token> promptTokens = tokenize(prompt, true);
+    if (promptTokens.empty()) {
+        setError("Failed to tokenize prompt");
         isGenerating_ = false;
         return;
     }
     
-    LOGI("Prompt processed, starting generation");
-    
-    int n_cur = batch.n_tokens;
-    int n_generated = 0;
-    
-    // Get vocab for token operations
-    const llama_vocab * vocab = llama_model_get_vocab(model_);
-    
-    // Generation loop
-    while (n_generated < cfg.maxTokens && !shouldCancel_) {
-        // Sample next token
-        llama_token newToken = llama_sampler_sample(sampler_, context_, -1);
-        
-        // Check for end of generation
-        if (llama_vocab_is_eog(vocab, newToken)) {
-            LOGI("End of generation token received");
-            break;
-        }
-        
-        // Convert token to text
-        std::string tokenStr = detokenize({newToken});
-        
-        // Call callback with new token
-        callback(tokenStr);
-        
-        // Prepare batch for next token
-        batch.n_tokens = 0;
-        batch.token[0] = newToken;
-        batch.pos[0] = n_cur;
-        batch.n_seq_id[0] = 1;
-        batch.seq_id[0][0] = 0;
-        batch.logits[0] = true;
-        batch.n_tokens = 1;
-        
-        // Decode
-        if (llama_decode(context_, batch) != 0) {
-            setError("Failed to decode token");
-            break;
-        }
-        
-        n_cur++;
-        n_generated++;
-    }
-    
-    llama_batch_free(batch);
+    LOGD("Tokenized prompt: %zu tokens", promptTokens.size());
     
-    LOGI("Generation complete: %d tokens generated", n_generated);
+    runGeneration(promptTokens, callback, cfg, lock);
+    logMemoryStats("after generation");
     
 #else
+    (void)cfg;
+    
     // Stub implementation for testing
     LOGW("Using stub generation");
     
@@ -301,28 +666,600 @@ void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallbac
     isGenerating_ = false;
 }
 
-void LlamaContextWrapper::cancelGeneration() {
-    LOGI("Generation cancellation requested");
-    shouldCancel_ = true;
-}
-
-bool LlamaContextWrapper::isGenerating() const {
-    return isGenerating_;
-}
-
-std::string LlamaContextWrapper::getLastError() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return lastError_;
-}
-
-std::string LlamaContextWrapper::getVersion() {
+void LlamaContextWrapper::generateStreamTokens(const std::vector<int32_t>& promptTokens, TokenCallback callback,
+                                               const LlamaConfig* config) {
+    std::unique_lock<std::mutex> lock = lockIdle();
+    clearError();
+    
+    if (!checkNotScheduled()) {
+        return;
+    }
+    
+    if (!isModelLoaded()) {
+        setError("Model not loaded");
+        LOGE("%s", lastError_.c_str());
+        return;
+    }
+    
+    if (std::atomic_load(&remote_) != nullptr) {
+        setError("Pre-tokenised prompts are not supported out of process");
+        return;
+    }
+    
+    if (promptTokens.empty()) {
+        setError("Empty prompt");
+        return;
+    }
+    
+    isGenerating_ = true;
+    shouldCancel_ = false;
+    
+#if LLAMA_AVAILABLE
+    // Ids may come from a tokenisation made before a model swap
+    const int32_t nVocab = llama_vocab_n_tokens(llama_model_get_vocab(model_));
+    for (int32_t token : promptTokens) {
+        if (token < 0 || token >= nVocab) {
+            setError("Prompt token out of vocabulary range");
+            isGenerating_ = false;
+            return;
+        }
+    }
+    
+    if (config != nullptr) {
+        setupSampler(*config);
+    }
+    
+    const LlamaConfig& cfg = config ? *config : currentConfig_;
+    if (!selectControlVectors(cfg.controlVectorSet)) {
+        isGenerating_ = false;
+        return;
+    }
+    
+    LOGD("Starting generation for %zu pre-tokenised prompt tokens", promptTokens.size());
+    
+    runGeneration(promptTokens, callback, cfg, lock);
+    logMemoryStats("after generation");
+#else
+    (void)config;
+    LOGW("Using stub generation");
+    
+    std::string stubResponse = "Hello! This is a test response from llama-kotlin-android. ";
+    stubResponse += "The library is working but llama.cpp is not compiled in.";
+    
+    std::istringstream iss(stubResponse);
+    std::string word;
+    while (iss >> word && !shouldCancel_) {
+        callback(word + " ");
+    }
+#endif
+    
+    isGenerating_ = false;
+}
+
+bool LlamaContextWrapper::applyChatTemplate(const std::vector<ChatMessage>& messages, std::string& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+#if LLAMA_AVAILABLE
+    if (model_ == nullptr) {
+        setError("Model not loaded");
+        return false;
+    }
+    
+    const char* tmpl = llama_model_chat_template(model_, nullptr);
+    if (tmpl == nullptr) {
+        setError("Model has no chat template");
+        return false;
+    }
+    
+    std::vector<llama_chat_message> chat;
+    size_t totalLength = 0;
+    chat.reserve(messages.size());
+    for (const ChatMessage& message : messages) {
+        chat.push_back({message.role.c_str(), message.content.c_str()});
+        totalLength += message.role.size() + message.content.size();
+    }
+    
+    std::vector<char> buf(totalLength * 2 + 256);
+    int32_t n = llama_chat_apply_template(tmpl, chat.data(), chat.size(), true,
+                                          buf.data(), static_cast<int32_t>(buf.size()));
+    if (n > static_cast<int32_t>(buf.size())) {
+        buf.resize(n);
+        n = llama_chat_apply_template(tmpl, chat.data(), chat.size(), true,
+                                      buf.data(), static_cast<int32_t>(buf.size()));
+    }
+    if (n < 0) {
+        setError("Chat template is not supported");
+        return false;
+    }
+    
+    out.assign(buf.data(), n);
+#else
+    // Stub: plain "role: content" transcript
+    out.clear();
+    for (const ChatMessage& message : messages) {
+        out += message.role + ": " + message.content + "\n";
+    }
+    out += "assistant: ";
+#endif
+    return true;
+}
+
+bool LlamaContextWrapper::saveState(std::vector<uint8_t>& out) {
+    std::unique_lock<std::mutex> lock = lockIdle();
+    if (!checkNotScheduled()) {
+        return false;
+    }
+    return saveStateLocked(out);
+}
+    
+bool LlamaContextWrapper::saveStateLocked(std::vector<uint8_t>& out) {
+    // Called with mutex_ held
+#if LLAMA_AVAILABLE
+    if (context_ == nullptr) {
+        setError("Model not loaded");
+        return false;
+    }
+    
+    out.resize(llama_state_get_size(context_));
+    size_t written = llama_state_get_data(context_, out.data(), out.size());
+    if (written == 0) {
+        setError("Failed to save context state");
+        out.clear();
+        return false;
+    }
+    out.resize(written);
+    
+    LOGD("Context state saved: %zu bytes", written);
+#else
+    out.clear();
+#endif
+    return true;
+}
+
+bool LlamaContextWrapper::restoreState(const std::vector<uint8_t>& state) {
+    std::unique_lock<std::mutex> lock = lockIdle();
+    if (!checkNotScheduled()) {
+        return false;
+    }
+    
+#if LLAMA_AVAILABLE
+    if (context_ == nullptr) {
+        setError("Model not loaded");
+        return false;
+    }
+    
+    // Whatever sequence 0 held before is gone; start prefix reuse afresh
+    cachedTokens_.clear();
+    
+    if (llama_state_set_data(context_, state.data(), state.size()) == 0) {
+        setError("Failed to restore context state");
+        return false;
+    }
+    
+    LOGD("Context state restored: %zu bytes", state.size());
+#else
+    (void)state;
+#endif
+    return true;
+}
+
+bool LlamaContextWrapper::tryUnload(std::vector<uint8_t>* state) {
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (!lock.owns_lock() || isGenerating_ || scheduler_ != nullptr) {
+        return false;
+    }
+    
+    if (state != nullptr && !saveStateLocked(*state)) {
+        LOGW("Unloading without a state snapshot: %s", lastError_.c_str());
+        state->clear();
+    }
+    unloadModel();
+    return true;
+}
+
+size_t LlamaContextWrapper::getMemoryFootprint() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+#if LLAMA_AVAILABLE
+    if (model_ == nullptr || context_ == nullptr) {
+        return 0;
+    }
+    
+    // The KV buffers llama.cpp reported while creating the context, in
+    // whatever type the cache uses
+    size_t kvBytes = bufferSizes_.kvBytes;
+    if (kvBytes == 0) {
+        // Not reported: K and V for every layer and every context cell; GQA
+        // models store n_head_kv / n_head of the embedding width per cell.
+        // Q8_0 and Q4_0 pack 32 elements into 34 and 18 bytes.
+        const size_t nCtx = llama_n_ctx(context_);
+        const size_t nLayer = llama_model_n_layer(model_);
+        const size_t nEmbd = llama_model_n_embd(model_);
+        const size_t nHead = std::max(1, llama_model_n_head(model_));
+        const size_t nHeadKv = std::max(1, llama_model_n_head_kv(model_));
+        const size_t elements = 2 * nCtx * nLayer * (nEmbd * nHeadKv / nHead);
+        switch (currentConfig_.kvCacheType) {
+            case KvCacheType::Q8_0:
+                kvBytes = elements / 32 * 34;
+                break;
+            case KvCacheType::Q4_0:
+                kvBytes = elements / 32 * 18;
+                break;
+            default:
+                kvBytes = elements * sizeof(uint16_t);
+                break;
+        }
+    }
+    
+    return static_cast<size_t>(llama_model_size(model_)) + kvBytes;
+#else
+    return 0;
+#endif
+}
+
+MemoryStats LlamaContextWrapper::getMemoryStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return collectMemoryStats();
+}
+
+MemoryStats LlamaContextWrapper::collectMemoryStats() {
+    // Called with mutex_ held
+    MemoryStats stats;
+    
+    ProcessMemory process;
+    readProcessMemory(process);
+    allocatorPeakBytes_ = std::max(allocatorPeakBytes_, process.allocatorInUseBytes);
+    stats.allocatorInUseBytes = process.allocatorInUseBytes;
+    stats.allocatorMappedBytes = process.allocatorMappedBytes;
+    stats.allocatorPeakBytes = allocatorPeakBytes_;
+    stats.rssBytes = process.rssBytes;
+    stats.peakRssBytes = process.peakRssBytes;
+
+#if LLAMA_AVAILABLE
+    if (model_ == nullptr || context_ == nullptr) {
+        return stats;
+    }
+    
+    stats.modelBytes = static_cast<size_t>(llama_model_size(model_));
+    for (const std::string& path : modelPaths_) {
+        size_t mapped = 0;
+        size_t resident = 0;
+        measureMappedFile(path, mapped, resident);
+        stats.modelMappedBytes += mapped;
+        stats.modelResidentBytes += resident;
+    }
+    stats.kvCacheBytes = bufferSizes_.kvBytes;
+    stats.computeBufferBytes = bufferSizes_.computeBytes;
+    stats.outputBufferBytes = bufferSizes_.outputBytes;
+    
+    llama_memory_t mem = llama_get_memory(context_);
+    stats.sequenceCells.assign(llama_n_seq_max(context_), 0);
+    for (size_t seq = 0; mem != nullptr && seq < stats.sequenceCells.size(); seq++) {
+        const llama_pos first = llama_memory_seq_pos_min(mem, static_cast<llama_seq_id>(seq));
+        const llama_pos last = llama_memory_seq_pos_max(mem, static_cast<llama_seq_id>(seq));
+        if (last >= 0) {
+            stats.sequenceCells[seq] = last - first + 1;
+        }
+    }
+#endif
+    return stats;
+}
+
+void LlamaContextWrapper::logMemoryStats(const char* when) {
+    static const double MIB = 1024.0 * 1024.0;
+    MemoryStats stats = collectMemoryStats();
+    
+    int cells = 0;
+    for (int n : stats.sequenceCells) {
+        cells += n;
+    }
+    
+    LOGI("Memory %s: model %.1f MiB (%.1f of %.1f MiB mapped resident), KV %.1f MiB (%d cells used), "
+         "compute %.1f MiB, output %.1f MiB, heap %.1f MiB (peak %.1f), RSS %.1f MiB (peak %.1f)",
+         when, stats.modelBytes / MIB, stats.modelResidentBytes / MIB, stats.modelMappedBytes / MIB,
+         stats.kvCacheBytes / MIB, cells, stats.computeBufferBytes / MIB, stats.outputBufferBytes / MIB,
+         stats.allocatorInUseBytes / MIB, stats.allocatorPeakBytes / MIB, stats.rssBytes / MIB,
+         stats.peakRssBytes / MIB);
+}
+
+bool LlamaContextWrapper::embed(const std::vector<std::string>& texts, EmbeddingPooling pooling,
+                                std::vector<std::vector<float>>& vectors) {
+    std::unique_lock<std::mutex> lock = lockIdle();
+    clearError();
+    vectors.clear();
+    
+    // A running scheduler's sequences would be evicted for room
+    if (!checkNotScheduled()) {
+        return false;
+    }
+    if (std::atomic_load(&remote_) != nullptr) {
+        setError("Embeddings are not supported out of process");
+        return false;
+    }
+    if (!isModelLoaded()) {
+        setError("Model not loaded");
+        return false;
+    }
+
+#if LLAMA_AVAILABLE
+    std::vector<std::vector<llama_token>> tokens(texts.size());
+    for (size_t i = 0; i < texts.size(); i++) {
+        tokens[i] = tokenize(texts[i], true);
+        if (tokens[i].empty()) {
+            setError("Failed to tokenize input");
+            return false;
+        }
+    }
+    
+    // As many texts per decode as there are sequences and batch rows for
+    const size_t maxInputs = static_cast<size_t>(embeddingSequenceCount());
+    const size_t nBatch = llama_n_batch(context_);
+    std::vector<const std::vector<llama_token>*> group;
+    std::vector<std::vector<float>> groupVectors;
+    size_t next = 0;
+    while (next < tokens.size()) {
+        group.clear();
+        size_t groupTokens = 0;
+        while (next < tokens.size() && group.size() < maxInputs &&
+               (group.empty() || groupTokens + tokens[next].size() <= nBatch)) {
+            groupTokens += tokens[next].size();
+            group.push_back(&tokens[next++]);
+        }
+        
+        std::string error;
+        if (!embedSequences(group, false, pooling, groupVectors, error)) {
+            setError(error);
+            LOGE("%s", lastError_.c_str());
+            vectors.clear();
+            return false;
+        }
+        for (std::vector<float>& vector : groupVectors) {
+            vectors.push_back(std::move(vector));
+        }
+    }
+#else
+    (void)pooling;
+    
+    // Deterministic pseudo-embedding derived from the input bytes, as in SequenceScheduler
+    for (const std::string& text : texts) {
+        std::vector<float> vector(16, 0.0f);
+        for (size_t i = 0; i < text.size(); i++) {
+            vector[i % vector.size()] += static_cast<unsigned char>(text[i]) / 255.0f;
+        }
+        float norm = 0.0f;
+        for (float v : vector) {
+            norm += v * v;
+        }
+        norm = norm > 0.0f ? std::sqrt(norm) : 1.0f;
+        for (float& v : vector) {
+            v /= norm;
+        }
+        vectors.push_back(std::move(vector));
+    }
+#endif
+    return true;
+}
+
+int LlamaContextWrapper::createControlVectorSet(const std::vector<ControlVectorSpec>& vectors, int layerStart,
+                                                int layerEnd) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+    if (std::atomic_load(&remote_) != nullptr) {
+        setError("Control vectors are not supported out of process");
+        return 0;
+    }
+    if (vectors.empty()) {
+        setError("No control vectors given");
+        return 0;
+    }
+    
+    ControlVectorSet set;
 #if LLAMA_AVAILABLE
-    std::string version = LIBRARY_VERSION;
-    version += " (llama.cpp)";
-    return version;
+    if (model_ == nullptr) {
+        setError("Model not loaded");
+        return 0;
+    }
+    
+    const int32_t nLayer = llama_model_n_layer(model_);
+    set.layerStart = std::max(1, layerStart);
+    set.layerEnd = layerEnd < 0 ? nLayer : std::min(layerEnd, nLayer);
+    if (set.layerStart > set.layerEnd) {
+        setError("Empty control vector layer range");
+        return 0;
+    }
+    
+    set.data.assign(static_cast<size_t>(llama_model_n_embd(model_)) * nLayer, 0.0f);
+    for (const ControlVectorSpec& spec : vectors) {
+        std::string error;
+        if (!addControlVector(model_, spec, set.data, error)) {
+            setError(error);
+            LOGE("%s", lastError_.c_str());
+            return 0;
+        }
+    }
 #else
-    return std::string(LIBRARY_VERSION) + " (stub)";
+    LOGW("Using stub implementation - control vectors not loaded");
+    set.layerStart = layerStart;
+    set.layerEnd = layerEnd;
 #endif
+
+    const int id = nextControlVectorSet_++;
+    controlVectorSets_[id] = std::move(set);
+    LOGI("Control vector set %d: %zu vectors, layers %d-%d", id, vectors.size(),
+         controlVectorSets_[id].layerStart, controlVectorSets_[id].layerEnd);
+    return id;
+}
+
+void LlamaContextWrapper::releaseControlVectorSet(int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The context keeps its copy of an applied set until another is selected
+    controlVectorSets_.erase(id);
+}
+
+void LlamaContextWrapper::cancelGeneration() {
+    LOGI("Generation cancellation requested");
+    shouldCancel_ = true;
+    
+    std::shared_ptr<InferenceHostClient> remote = std::atomic_load(&remote_);
+    if (remote != nullptr) {
+        remote->cancelGeneration();
+    }
+}
+
+bool LlamaContextWrapper::isGenerating() const {
+    return isGenerating_;
+}
+
+void LlamaContextWrapper::setTokenizeValidation(int count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tokenizeValidateCount_ = count;
+    tokenizeValidateRemaining_ = count;
+    parallelTokenize_ = true;
+}
+
+SpeculationStats LlamaContextWrapper::getSpeculationStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return specStats_;
+}
+
+GenerationStats LlamaContextWrapper::getGenerationStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generationStats_;
+}
+
+bool LlamaContextWrapper::evaluatePerplexity(const std::string& text, PerplexityResult& out) {
+    std::unique_lock<std::mutex> lock = lockIdle();
+    clearError();
+    out = PerplexityResult();
+    
+    if (!checkNotScheduled()) {
+        return false;
+    }
+    
+    if (std::atomic_load(&remote_) != nullptr) {
+        setError("Perplexity is not supported out of process");
+        return false;
+    }
+
+#if LLAMA_AVAILABLE
+    if (model_ == nullptr || context_ == nullptr) {
+        setError("Model not loaded");
+        return false;
+    }
+    
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    const std::vector<llama_token> tokens = tokenize(text, false);
+    const int nCtx = static_cast<int>(llama_n_ctx(context_));
+    const int nBatch = static_cast<int>(llama_n_batch(context_));
+    const int nVocab = llama_vocab_n_tokens(vocab);
+    const int chunks = static_cast<int>(tokens.size()) / nCtx;
+    if (chunks == 0) {
+        setError("Text is shorter than the context (" + std::to_string(tokens.size()) + " tokens)");
+        return false;
+    }
+    
+    // Logits at position p predict the token at p + 1; the second half of
+    // each chunk is scored
+    const int firstScored = nCtx / 2;
+    const bool addBos = llama_vocab_get_add_bos(vocab);
+    llama_memory_t mem = llama_get_memory(context_);
+    llama_batch& batch = batch_;
+    cachedTokens_.clear();
+    
+    double nll = 0.0;
+    double nll2 = 0.0;
+    int scored = 0;
+    const auto start = std::chrono::steady_clock::now();
+    
+    for (int chunk = 0; chunk < chunks; chunk++) {
+        const int chunkStart = chunk * nCtx;
+        if (mem != nullptr) {
+            llama_memory_clear(mem, true);
+        }
+        
+        for (int batchStart = 0; batchStart < nCtx; batchStart += nBatch) {
+            const int batchEnd = std::min(batchStart + nBatch, nCtx);
+            
+            batch.n_tokens = 0;
+            for (int pos = batchStart; pos < batchEnd; pos++) {
+                // Each chunk starts like a document, with BOS in place of its first token
+                const bool bos = pos == 0 && addBos;
+                batch.token[batch.n_tokens] = bos ? llama_vocab_bos(vocab) : tokens[chunkStart + pos];
+                batch.pos[batch.n_tokens] = pos;
+                batch.n_seq_id[batch.n_tokens] = 1;
+                batch.seq_id[batch.n_tokens][0] = 0;
+                batch.logits[batch.n_tokens] = pos >= firstScored - 1 && pos < nCtx - 1;
+                batch.n_tokens++;
+            }
+            
+            if (llama_decode(context_, batch) != 0) {
+                resetKvCache();
+                setError("Failed to evaluate chunk " + std::to_string(chunk));
+                return false;
+            }
+            
+            for (int i = 0; i < batch.n_tokens; i++) {
+                if (!batch.logits[i]) {
+                    continue;
+                }
+                const float* logits = llama_get_logits_ith(context_, i);
+                const llama_token next = tokens[chunkStart + batch.pos[i] + 1];
+                
+                float maxLogit = logits[0];
+                for (int t = 1; t < nVocab; t++) {
+                    maxLogit = std::max(maxLogit, logits[t]);
+                }
+                double sum = 0.0;
+                for (int t = 0; t < nVocab; t++) {
+                    sum += std::exp(static_cast<double>(logits[t] - maxLogit));
+                }
+                const double tokenNll = std::log(sum) - (logits[next] - maxLogit);
+                nll += tokenNll;
+                nll2 += tokenNll * tokenNll;
+                scored++;
+            }
+        }
+    }
+    
+    const double elapsedMs = millisecondsSince(start);
+    resetKvCache();
+    
+    const double mean = nll / scored;
+    const double variance = std::max(0.0, nll2 / scored - mean * mean);
+    out.chunks = chunks;
+    out.scoredTokens = scored;
+    out.perplexity = std::exp(mean);
+    out.standardError = scored > 1 ? out.perplexity * std::sqrt(variance / (scored - 1)) : 0.0;
+    out.tokensPerSecond = elapsedMs > 0.0 ? chunks * nCtx * 1000.0 / elapsedMs : 0.0;
+    
+    LOGI("Perplexity %.4f +/- %.4f over %d tokens (%d chunks, %.1f tokens/s)", out.perplexity,
+         out.standardError, scored, chunks, out.tokensPerSecond);
+    return true;
+#else
+    (void)text;
+    setError("Perplexity needs llama.cpp");
+    return false;
+#endif
+}
+
+LoadTimings LlamaContextWrapper::getLoadTimings() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return loadTimings_;
+}
+
+LlamaConfig LlamaContextWrapper::getConfig() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return currentConfig_;
+}
+
+std::string LlamaContextWrapper::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+std::string LlamaContextWrapper::getVersion() {
+    return libraryVersion();
 }
 
 void LlamaContextWrapper::setError(const std::string& error) {
@@ -334,12 +1271,54 @@ void LlamaContextWrapper::clearError() {
     lastError_.clear();
 }
 
+bool LlamaContextWrapper::checkNotScheduled() {
+    // Called with mutex_ held. A running scheduler decodes its own
+    // sequences between steps; anything else that clears or rewrites the
+    // KV cache would corrupt them.
+    if (scheduler_ != nullptr) {
+        setError("Context is serving scheduled requests");
+        return false;
+    }
+    return true;
+}
+
+bool LlamaContextWrapper::loadModelRemote(const std::string& modelPath, const LlamaConfig& config) {
+    // Called with mutex_ held; replaces any in-process or out-of-process model
+    unloadModel();
+    
+    auto remote = std::make_shared<InferenceHostClient>();
+    if (!remote->start(std::string())) {
+        setError(remote->getLastError());
+        return false;
+    }
+    
+    if (!remote->loadModel(modelPath, config)) {
+        setError("Inference host failed to load model: " + remote->getLastError());
+        remote->stop();
+        return false;
+    }
+    
+    std::atomic_store(&remote_, remote);
+    currentConfig_ = config;
+    modelGeneration_++;
+    LOGI("Model loaded in inference host");
+    return true;
+}
+
 #if LLAMA_AVAILABLE
 
 std::vector<llama_token> LlamaContextWrapper::tokenize(const std::string& text, bool addBos) {
     // Get vocab from model
     const llama_vocab * vocab = llama_model_get_vocab(model_);
     
+    std::vector<llama_token> parallel;
+    const bool split = parallelTokenize_ && text.size() >= PARALLEL_TOKENIZE_MIN_CHARS &&
+                       currentConfig_.threadsBatch > 1 &&
+                       tokenizeParallel(vocab, text, addBos, splitRule_, currentConfig_.threadsBatch, parallel);
+    if (split && tokenizeValidateRemaining_ == 0) {
+        return parallel;
+    }
+    
     // Estimate number of tokens (rough: 1 token per 4 chars)
     int n_tokens_estimate = text.length() / 4 + 16;
     std::vector<llama_token> tokens(n_tokens_estimate);
@@ -375,6 +1354,18 @@ std::vector<llama_token> LlamaContextWrapper::tokenize(const std::string& text,
     }
     
     tokens.resize(n_tokens);
+    
+    if (split) {
+        // Validation: the split must reproduce the serial tokenisation
+        if (tokenizeValidateRemaining_ > 0) {
+            tokenizeValidateRemaining_--;
+        }
+        if (parallel != tokens) {
+            LOGW("Parallel tokenisation differs from serial (%zu vs %zu tokens), disabled for this model",
+                 parallel.size(), tokens.size());
+            parallelTokenize_ = false;
+        }
+    }
     return tokens;
 }
 
@@ -401,51 +1392,803 @@ std::string LlamaContextWrapper::detokenize(const std::vector<llama_token>& toke
     return result;
 }
 
+const std::string& LlamaContextWrapper::tokenToPiece(llama_token token) {
+    // Written into piece_'s reserved capacity, so no allocation unless a
+    // piece is longer than any before
+    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    piece_.resize(piece_.capacity());
+    int n = llama_token_to_piece(vocab, token, &piece_[0], static_cast<int32_t>(piece_.size()), 0, true);
+    if (n < 0) {
+        piece_.resize(static_cast<size_t>(-n));
+        n = llama_token_to_piece(vocab, token, &piece_[0], static_cast<int32_t>(piece_.size()), 0, true);
+    }
+    if (n < 0) {
+        LOGW("Failed to detokenize token: %d", token);
+        n = 0;
+    }
+    piece_.resize(static_cast<size_t>(n));
+    return piece_;
+}
+
+llama_token LlamaContextWrapper::sampleToken(int32_t idx) {
+    // Same as llama_sampler_sample(), but over the preallocated candidate
+    // array instead of a vector built for every token
+    const float* logits = llama_get_logits_ith(context_, idx);
+    const size_t nVocab = candidates_.size();
+    for (size_t i = 0; i < nVocab; i++) {
+        candidates_[i] = {static_cast<llama_token>(i), logits[i], 0.0f};
+    }
+    
+    llama_token_data_array cur = {candidates_.data(), nVocab, -1, false};
+    llama_sampler_apply(sampler_, &cur);
+    
+    const llama_token token = cur.data[cur.selected].id;
+    llama_sampler_accept(sampler_, token);
+    return token;
+}
+
+void LlamaContextWrapper::allocateDecodeBuffers() {
+    // Called with mutex_ held once context_ is set
+    freeDecodeBuffers();
+    
+    batch_ = llama_batch_init(static_cast<int32_t>(llama_n_batch(context_)), 0,
+                              static_cast<int32_t>(llama_n_seq_max(context_)));
+    batchAllocated_ = true;
+    candidates_.resize(static_cast<size_t>(llama_vocab_n_tokens(llama_model_get_vocab(model_))));
+    piece_.reserve(256);
+    cachedTokens_.reserve(llama_n_ctx(context_));
+}
+
+void LlamaContextWrapper::freeDecodeBuffers() {
+    if (batchAllocated_) {
+        llama_batch_free(batch_);
+        batch_ = llama_batch{};
+        batchAllocated_ = false;
+    }
+    std::vector<llama_token_data>().swap(candidates_);
+}
+
 void LlamaContextWrapper::setupSampler(const LlamaConfig& config) {
     // Free existing sampler
     if (sampler_ != nullptr) {
         llama_sampler_free(sampler_);
     }
     
+    sampler_ = createSampler(config);
+    
+    LOGD("Sampler configured: temp=%.2f, top_p=%.2f, top_k=%d, repeat_penalty=%.2f, "
+         "frequency_penalty=%.2f, presence_penalty=%.2f, penalty_window=%d, dry=%.2f",
+         config.temperature, config.topP, config.topK, config.repeatPenalty,
+         config.frequencyPenalty, config.presencePenalty, config.penaltyWindow, config.dryMultiplier);
+}
+
+llama_sampler* LlamaContextWrapper::createSampler(const LlamaConfig& config) {
     // Create sampler chain
     llama_sampler_chain_params chainParams = llama_sampler_chain_default_params();
-    sampler_ = llama_sampler_chain_init(chainParams);
+    llama_sampler* sampler = llama_sampler_chain_init(chainParams);
     
     // Add samplers in order
     
-    // Repetition penalty (new signature: 4 args)
-    if (config.repeatPenalty != 1.0f) {
-        llama_sampler_chain_add(sampler_, 
-            llama_sampler_init_penalties(
-                64,                       // penalty_last_n
-                config.repeatPenalty,    // penalty_repeat
-                0.0f,                    // penalty_freq
-                0.0f                     // penalty_present
-            )
-        );
+    // Repetition penalties
+    if (penaltiesEnabled(config)) {
+        llama_sampler_chain_add(sampler, createPenaltySampler(config));
     }
     
     // Top-K sampling
     if (config.topK > 0) {
-        llama_sampler_chain_add(sampler_, llama_sampler_init_top_k(config.topK));
+        llama_sampler_chain_add(sampler, llama_sampler_init_top_k(config.topK));
     }
     
     // Top-P (nucleus) sampling
     if (config.topP < 1.0f) {
-        llama_sampler_chain_add(sampler_, llama_sampler_init_top_p(config.topP, 1));
+        llama_sampler_chain_add(sampler, llama_sampler_init_top_p(config.topP, 1));
     }
     
     // Temperature
     if (config.temperature > 0.0f) {
-        llama_sampler_chain_add(sampler_, llama_sampler_init_temp(config.temperature));
+        llama_sampler_chain_add(sampler, llama_sampler_init_temp(config.temperature));
     }
     
     // Distribution sampling with seed
     uint32_t seed = config.seed >= 0 ? config.seed : static_cast<uint32_t>(std::time(nullptr));
-    llama_sampler_chain_add(sampler_, llama_sampler_init_dist(seed));
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(seed));
+    
+    return sampler;
+}
+
+bool LlamaContextWrapper::prefill(const std::vector<llama_token>& tokens, llama_pos startPos, llama_seq_id seqId) {
+    // Evaluate tokens in chunks of the context's batch size; only the last
+    // token of the last chunk produces logits
+    const int nBatch = static_cast<int>(llama_n_batch(context_));
+    llama_batch& batch = batch_;
+    
+    const int nTokens = static_cast<int>(tokens.size());
+    for (int start = 0; start < nTokens; start += nBatch) {
+        const int end = std::min(start + nBatch, nTokens);
+        
+        batch.n_tokens = 0;
+        for (int i = start; i < end; i++) {
+            batch.token[batch.n_tokens] = tokens[i];
+            batch.pos[batch.n_tokens] = startPos + i;
+            batch.n_seq_id[batch.n_tokens] = 1;
+            batch.seq_id[batch.n_tokens][0] = seqId;
+            batch.logits[batch.n_tokens] = (i == nTokens - 1);
+            batch.n_tokens++;
+        }
+        
+        if (llama_decode(context_, batch) != 0) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * Node of a speculation tree. Node 0 is the last sampled token, which is
+ * not yet in the KV cache; the others are draft tokens.
+ */
+struct DraftNode {
+    llama_token token;
+    int depth;
+    std::vector<int> children;
+    std::vector<llama_seq_id> seqs;  // Branches through this node, first one used for attention
+};
+
+/**
+ * Build a draft tree from earlier occurrences of the context's suffix.
+ * Every match of the last n tokens (longest n first, most recent match
+ * first) proposes the tokens that followed it; continuations sharing a
+ * prefix share nodes, and a new branch is opened only while fewer than
+ * maxBranches exist. The tree never exceeds maxNodes nodes.
+ */
+static void buildDraftTree(const std::vector<llama_token>& history, int maxBranches, int maxDepth,
+                           int maxNodes, std::vector<DraftNode>& tree) {
+    static constexpr int kMaxNgram = 3;
+    static constexpr int kMaxMatches = 16;
+    
+    tree.clear();
+    tree.push_back({history.back(), 0, {}, {0}});
+    if (maxDepth <= 0) {
+        return;
+    }
+    
+    const int size = static_cast<int>(history.size());
+    int leaves = 0;
+    int matches = 0;
+    
+    for (int n = std::min(kMaxNgram, size - 1); n >= 1 && matches < kMaxMatches; n--) {
+        // Unigram matches are only worth drafting from when nothing longer matched
+        if (n == 1 && leaves > 0) {
+            break;
+        }
+        const llama_token* key = history.data() + size - n;
+        for (int i = size - n - 1; i >= 0 && matches < kMaxMatches; i--) {
+            if (!std::equal(key, key + n, history.data() + i)) {
+                continue;
+            }
+            matches++;
+            
+            int cur = 0;
+            const int end = std::min(size, i + n + maxDepth);
+            for (int j = i + n; j < end; j++) {
+                int next = -1;
+                for (int child : tree[cur].children) {
+                    if (tree[child].token == history[j]) {
+                        next = child;
+                        break;
+                    }
+                }
+                if (next < 0) {
+                    if (static_cast<int>(tree.size()) >= maxNodes) {
+                        break;
+                    }
+                    // Extending a leaf keeps the branch count; anything else opens a branch
+                    const bool opensBranch = cur == 0 || !tree[cur].children.empty();
+                    if (opensBranch && leaves >= maxBranches) {
+                        break;
+                    }
+                    leaves += opensBranch ? 1 : 0;
+                    next = static_cast<int>(tree.size());
+                    tree.push_back({history[j], tree[cur].depth + 1, {}, {}});
+                    tree[cur].children.push_back(next);
+                }
+                cur = next;
+            }
+        }
+    }
+    
+    // One sequence per leaf, shared by every node on its path
+    std::vector<int> parent(tree.size(), -1);
+    for (size_t i = 0; i < tree.size(); i++) {
+        for (int child : tree[i].children) {
+            parent[child] = static_cast<int>(i);
+        }
+    }
+    llama_seq_id seq = 1;
+    for (size_t i = 1; i < tree.size(); i++) {
+        if (!tree[i].children.empty()) {
+            continue;
+        }
+        for (int node = static_cast<int>(i); node >= 0; node = parent[node]) {
+            tree[node].seqs.push_back(seq);
+        }
+        seq++;
+    }
+}
+
+void LlamaContextWrapper::runGeneration(const std::vector<llama_token>& promptTokens, TokenSink callback,
+                                        const LlamaConfig& config, std::unique_lock<std::mutex>& lock) {
+    // Called with mutex_ held through lock and isGenerating_ set
+    
+    // Check context size
+    const int n_ctx = llama_n_ctx(context_);
+    if ((int)promptTokens.size() > n_ctx - 4) {
+        setError("Prompt too long for context size");
+        LOGE("Prompt tokens (%zu) exceeds context size (%d)", promptTokens.size(), n_ctx);
+        return;
+    }
+    
+    // Reset sampler state for new generation
+    if (sampler_ != nullptr) {
+        llama_sampler_reset(sampler_);
+        LOGD("Sampler reset for new generation");
+    }
+    specStats_ = SpeculationStats();
+    generationStats_ = GenerationStats();
+    
+    // Keep the KV entries of the longest prefix shared with the previous
+    // request (system prompt, template text, earlier chat turns); the last
+    // prompt token is always re-evaluated so fresh logits are available
+    size_t reuse = 0;
+    while (reuse < cachedTokens_.size() && reuse < promptTokens.size() &&
+           cachedTokens_[reuse] == promptTokens[reuse]) {
+        reuse++;
+    }
+    if (reuse >= promptTokens.size()) {
+        reuse = promptTokens.size() - 1;
+    }
+    
+    llama_memory_t mem = llama_get_memory(context_);
+    if (mem != nullptr && !llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(reuse), -1)) {
+        // Recurrent memory cannot drop a suffix
+        llama_memory_clear(mem, true);
+        reuse = 0;
+    }
+    cachedTokens_.resize(reuse);
+    
+    LOGD("Reusing %zu cached prompt tokens, evaluating %zu", reuse, promptTokens.size() - reuse);
+    
+    std::vector<llama_token> suffix(promptTokens.begin() + reuse, promptTokens.end());
+    const auto prefillStart = std::chrono::steady_clock::now();
+    if (!prefill(suffix, static_cast<llama_pos>(reuse), 0)) {
+        setError("Failed to process prompt");
+        resetKvCache();
+        return;
+    }
+    const double prefillMs = millisecondsSince(prefillStart);
+    cachedTokens_ = promptTokens;
+    
+    // Speculation needs a KV sequence per branch besides sequence 0
+    const int branches = std::min(config.speculativeBranches,
+                                  static_cast<int>(llama_n_seq_max(context_)) - 1);
+    // Pacing sleeps release mutex_ so stats, tokenisation and cancellation
+    // are not held up; calls that would touch the context wait in lockIdle()
+    auto sleepUnlocked = [this, &lock](std::chrono::steady_clock::time_point wake) {
+        pacingSleep_ = true;
+        lock.unlock();
+        std::this_thread::sleep_until(wake);
+        lock.lock();
+        pacingSleep_ = false;
+        idleCv_.notify_all();
+    };
+    GenerationPacer pacer(context_, config, sleepUnlocked);
+    auto pacedCallback = [&callback, &pacer](const std::string& token) {
+        callback(token);
+        pacer.tokenEmitted();
+    };
+    TokenSink sink(pacedCallback);
+    
+    if (branches > 0) {
+        LOGD("Prompt processed, starting tree speculation with %d branches", branches);
+        runSpeculative(static_cast<int>(promptTokens.size()), branches, sink, config);
+        generationStats_ = pacer.finish();
+        generationStats_.promptTokens = static_cast<int>(suffix.size());
+        generationStats_.prefillMs = prefillMs;
+        return;
+    }
+    
+    LOGD("Prompt processed, starting generation");
+    
+    llama_batch& batch = batch_;
+    int n_cur = static_cast<int>(promptTokens.size());
+    int n_generated = 0;
+    
+    // Get vocab for token operations
+    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    
+    // Heap allocations per token outside the callback; only counted in
+    // builds with the allocation hook
+    const bool countAllocations = allocationHookEnabled();
+    uint64_t loopAllocations = 0;
+    uint64_t decodeAllocations = 0;
+    
+    // Generation loop
+    while (n_generated < config.maxTokens && !shouldCancel_) {
+        const uint64_t stepStart = threadAllocationCount();
+        
+        // Sample next token
+        llama_token newToken = sampleToken(-1);
+        
+        // Check for end of generation
+        if (llama_vocab_is_eog(vocab, newToken)) {
+            LOGD("End of generation token received");
+            break;
+        }
+        
+        // Call callback with the token's text
+        const uint64_t callbackStart = threadAllocationCount();
+        sink(tokenToPiece(newToken));
+        const uint64_t callbackEnd = threadAllocationCount();
+        
+        // Prepare batch for next token
+        batch.n_tokens = 1;
+        batch.token[0] = newToken;
+        batch.pos[0] = n_cur;
+        batch.n_seq_id[0] = 1;
+        batch.seq_id[0][0] = 0;
+        batch.logits[0] = true;
+        
+        // Decode
+        const uint64_t decodeStart = threadAllocationCount();
+        if (llama_decode(context_, batch) != 0) {
+            setError("Failed to decode token");
+            resetKvCache();
+            break;
+        }
+        const uint64_t decodeEnd = threadAllocationCount();
+        
+        cachedTokens_.push_back(newToken);
+        n_cur++;
+        n_generated++;
+        
+        // The first token warms up the samplers' state
+        if (countAllocations && n_generated > 1) {
+            loopAllocations += (decodeStart - stepStart) - (callbackEnd - callbackStart) +
+                               (threadAllocationCount() - decodeEnd);
+            decodeAllocations += decodeEnd - decodeStart;
+        }
+    }
+    
+    generationStats_ = pacer.finish();
+    generationStats_.promptTokens = static_cast<int>(suffix.size());
+    generationStats_.prefillMs = prefillMs;
+    generationStats_.loopAllocations = loopAllocations;
+    LOGI("Generation complete: %d tokens generated, %.2f ms CPU per token%s", n_generated,
+         generationStats_.cpuMsPerToken(), generationStats_.paced ? " (paced)" : "");
+    
+    if (countAllocations && n_generated > 1) {
+        LOGI("Allocations after the first token: %llu in the decode loop, %llu inside llama_decode",
+             static_cast<unsigned long long>(loopAllocations),
+             static_cast<unsigned long long>(decodeAllocations));
+        if (loopAllocations != 0) {
+            LOGE("Decode loop allocated on the heap in steady state");
+        }
+    }
+}
+
+void LlamaContextWrapper::runSpeculative(int nCur, int branches, TokenSink callback,
+                                         const LlamaConfig& config) {
+    // Called with mutex_ held after the prompt has been evaluated into
+    // sequence 0. Each pass decodes the last sampled token together with a
+    // tree of draft continuations; every branch has its own sequence id so
+    // that draft tokens at the same position only attend to their own
+    // ancestors. Tokens are then sampled along the tree from the target
+    // logits, so the output is exactly what plain decoding would produce.
+    const int nCtx = static_cast<int>(llama_n_ctx(context_));
+    const int depth = std::max(0, config.speculativeDepth);
+    const int maxNodes = std::min(1 + branches * depth, static_cast<int>(llama_n_batch(context_)));
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    llama_memory_t mem = llama_get_memory(context_);
+    
+    llama_batch& batch = batch_;
+    std::vector<DraftNode> tree;
+    
+    llama_token pending = sampleToken(-1);
+    bool finished = llama_vocab_is_eog(vocab, pending);
+    if (!finished) {
+        callback(tokenToPiece(pending));
+        specStats_.generatedTokens++;
+    }
+    
+    while (!finished && specStats_.generatedTokens < config.maxTokens && !shouldCancel_) {
+        cachedTokens_.push_back(pending);
+        buildDraftTree(cachedTokens_, branches, std::min(depth, nCtx - nCur - 2), maxNodes, tree);
+        
+        // Nodes are stored parent first, so the batch is in causal order
+        batch.n_tokens = static_cast<int32_t>(tree.size());
+        for (size_t i = 0; i < tree.size(); i++) {
+            const DraftNode& node = tree[i];
+            batch.token[i] = node.token;
+            batch.pos[i] = nCur + node.depth;
+            batch.n_seq_id[i] = static_cast<int32_t>(node.seqs.size());
+            for (size_t k = 0; k < node.seqs.size(); k++) {
+                batch.seq_id[i][k] = node.seqs[k];
+            }
+            batch.logits[i] = true;
+        }
+        
+        // Branch sequences see the committed context
+        const llama_seq_id nSeqs = static_cast<llama_seq_id>(tree[0].seqs.size());
+        for (llama_seq_id s = 1; s < nSeqs; s++) {
+            llama_memory_seq_cp(mem, 0, s, -1, -1);
+        }
+        
+        if (llama_decode(context_, batch) != 0) {
+            setError("Failed to decode token");
+            resetKvCache();
+            break;
+        }
+        specStats_.forwardPasses++;
+        specStats_.draftedTokens += static_cast<int>(tree.size()) - 1;
+        
+        // Walk down the tree while the sampled token matches a draft
+        int cur = 0;
+        int accepted = 0;
+        while (true) {
+            llama_token token = sampleToken(static_cast<int32_t>(cur));
+            if (llama_vocab_is_eog(vocab, token)) {
+                LOGD("End of generation token received");
+                finished = true;
+                break;
+            }
+            callback(tokenToPiece(token));
+            specStats_.generatedTokens++;
+            
+            int next = -1;
+            for (int child : tree[cur].children) {
+                if (tree[child].token == token) {
+                    next = child;
+                    break;
+                }
+            }
+            if (next >= 0) {
+                cur = next;
+                accepted++;
+                cachedTokens_.push_back(token);
+            } else {
+                pending = token;
+            }
+            if (specStats_.generatedTokens >= config.maxTokens || shouldCancel_) {
+                finished = true;
+                break;
+            }
+            if (next < 0) {
+                break;
+            }
+        }
+        
+        // Move the accepted path into sequence 0 and drop every branch
+        if (accepted > 0) {
+            llama_memory_seq_cp(mem, tree[cur].seqs[0], 0, nCur + 1, nCur + 1 + accepted);
+        }
+        for (llama_seq_id s = 1; s < nSeqs; s++) {
+            llama_memory_seq_rm(mem, s, -1, -1);
+        }
+        
+        specStats_.acceptedTokens += accepted;
+        nCur += 1 + accepted;
+    }
+    
+    LOGI("Generation complete: %d tokens in %d forward passes, %.2f drafts accepted per pass (%d/%d)",
+         specStats_.generatedTokens, specStats_.forwardPasses, specStats_.acceptancePerPass(),
+         specStats_.acceptedTokens, specStats_.draftedTokens);
+}
+
+void LlamaContextWrapper::resetKvCache() {
+    llama_memory_t mem = llama_get_memory(context_);
+    if (mem != nullptr) {
+        llama_memory_clear(mem, true);
+    }
+    cachedTokens_.clear();
+}
+
+bool LlamaContextWrapper::selectControlVectors(int id) {
+    // Called with mutex_ held
+    if (id == activeControlVectorSet_) {
+        return true;
+    }
+    
+    const int32_t nEmbd = llama_model_n_embd(model_);
+    auto it = controlVectorSets_.find(id);
+    if (id != 0 && it == controlVectorSets_.end()) {
+        setError("Unknown control vector set " + std::to_string(id));
+        return false;
+    }
+    
+    // Cached KV entries were computed under the previous steering
+    resetKvCache();
+    
+    int32_t result = 0;
+    if (id == 0) {
+        result = llama_apply_adapter_cvec(context_, nullptr, 0, nEmbd, 0, 0);
+    } else {
+        const ControlVectorSet& set = it->second;
+        result = llama_apply_adapter_cvec(context_, set.data.data(), set.data.size(), nEmbd, set.layerStart,
+                                          set.layerEnd);
+    }
+    if (result != 0) {
+        llama_apply_adapter_cvec(context_, nullptr, 0, nEmbd, 0, 0);
+        activeControlVectorSet_ = 0;
+        setError("Failed to apply control vector set " + std::to_string(id));
+        return false;
+    }
+    
+    activeControlVectorSet_ = id;
+    LOGD("Control vector set %d selected", id);
+    return true;
+}
+
+int LlamaContextWrapper::embeddingSequenceCount() const {
+    // Sequence 0 keeps the prompt cache when the context has others
+    const int nSeqMax = static_cast<int>(llama_n_seq_max(context_));
+    return nSeqMax > 1 ? nSeqMax - 1 : 1;
+}
+
+bool LlamaContextWrapper::embedSequences(const std::vector<const std::vector<llama_token>*>& inputs, bool addBos,
+                                         EmbeddingPooling pooling, std::vector<std::vector<float>>& vectors,
+                                         std::string& error, llama_seq_id firstSeq) {
+    // Called with mutex_ held. Inputs run in sequences from firstSeq on and
+    // fill the batch in order; an input may continue into the next decode
+    // unless the context pools, which needs a whole input in one ubatch.
+    // Without a firstSeq they run beside the prompt cache in sequence 0,
+    // which is cleared if they do not fit with it; with one (a
+    // SequenceScheduler slot) only the sequences used are touched.
+    const bool besideCache = firstSeq < 0;
+    const int nEmbd = llama_model_n_embd(model_);
+    const int nBatch = static_cast<int>(llama_n_batch(context_));
+    const int nCtx = static_cast<int>(llama_n_ctx(context_));
+    const int nSeqMax = static_cast<int>(llama_n_seq_max(context_));
+    if (besideCache) {
+        firstSeq = nSeqMax > 1 ? 1 : 0;
+    }
+    const bool pooled = llama_pooling_type(context_) != LLAMA_POOLING_TYPE_NONE;
+    const bool lastOnly = !pooled && pooling == EmbeddingPooling::Last;
+    const int maxPooledTokens = std::min(nBatch, static_cast<int>(llama_n_ubatch(context_)));
+    const llama_token bos = llama_vocab_bos(llama_model_get_vocab(model_));
+    
+    vectors.clear();
+    if (inputs.empty()) {
+        return true;
+    }
+    if (firstSeq + static_cast<int>(inputs.size()) > nSeqMax) {
+        error = "Too many inputs for one embedding batch";
+        return false;
+    }
+    
+    size_t totalTokens = 0;
+    for (const std::vector<llama_token>* input : inputs) {
+        const int length = static_cast<int>(input->size()) + (addBos ? 1 : 0);
+        if (length == 0 || length > nCtx) {
+            error = length == 0 ? "Empty embedding input" : "Input too long for context size";
+            return false;
+        }
+        if (pooled && length > maxPooledTokens) {
+            error = "Input exceeds batch size";
+            return false;
+        }
+        totalTokens += length;
+    }
+    
+    // Vectors are computed unsteered, so they stay comparable
+    if (!selectControlVectors(0)) {
+        error = lastError_;
+        return false;
+    }
+    
+    // With a single sequence, or too few free cells beside the cached
+    // prompt, the prompt cache has to go
+    llama_memory_t mem = llama_get_memory(context_);
+    if (besideCache && (firstSeq == 0 || cachedTokens_.size() + totalTokens > static_cast<size_t>(nCtx))) {
+        resetKvCache();
+    } else if (mem != nullptr) {
+        for (size_t i = 0; i < inputs.size(); i++) {
+            llama_memory_seq_rm(mem, firstSeq + static_cast<llama_seq_id>(i), -1, -1);
+        }
+    }
+    
+    vectors.assign(inputs.size(), std::vector<float>(nEmbd, 0.0f));
+    llama_set_embeddings(context_, true);
+    
+    size_t input = 0;
+    int position = 0;  // Next position within the current input, BOS included
+    bool ok = true;
+    while (ok && input < inputs.size()) {
+        batch_.n_tokens = 0;
+        while (input < inputs.size() && batch_.n_tokens < nBatch) {
+            const std::vector<llama_token>& tokens = *inputs[input];
+            const int length = static_cast<int>(tokens.size()) + (addBos ? 1 : 0);
+            if (pooled && position == 0 && batch_.n_tokens + length > nBatch) {
+                break;
+            }
+            
+            const int j = batch_.n_tokens++;
+            const bool last = position == length - 1;
+            batch_.token[j] = addBos ? (position == 0 ? bos : tokens[position - 1]) : tokens[position];
+            batch_.pos[j] = position;
+            batch_.n_seq_id[j] = 1;
+            batch_.seq_id[j][0] = firstSeq + static_cast<llama_seq_id>(input);
+            batch_.logits[j] = pooled || !lastOnly || last;
+            
+            if (last) {
+                input++;
+                position = 0;
+            } else {
+                position++;
+            }
+        }
+        
+        ok = llama_decode(context_, batch_) == 0;
+        
+        // Collect the outputs of the rows just decoded
+        for (int j = 0; j < batch_.n_tokens && ok; j++) {
+            // Pooled inputs lie wholly in this batch: one read per sequence
+            const llama_seq_id seq = batch_.seq_id[j][0];
+            if (!batch_.logits[j] || (pooled && j > 0 && batch_.seq_id[j - 1][0] == seq)) {
+                continue;
+            }
+            const float* embd = pooled ? llama_get_embeddings_seq(context_, seq) : llama_get_embeddings_ith(context_, j);
+            ok = embd != nullptr;
+            if (!ok) {
+                break;
+            }
+            std::vector<float>& vector = vectors[seq - firstSeq];
+            for (int k = 0; k < nEmbd; k++) {
+                vector[k] = pooled || lastOnly ? embd[k] : vector[k] + embd[k];
+            }
+        }
+    }
+    
+    llama_set_embeddings(context_, false);
+    if (besideCache && firstSeq == 0) {
+        resetKvCache();
+    } else if (mem != nullptr) {
+        for (size_t i = 0; i < inputs.size(); i++) {
+            llama_memory_seq_rm(mem, firstSeq + static_cast<llama_seq_id>(i), -1, -1);
+        }
+    }
+    if (!ok) {
+        error = "Failed to compute embeddings";
+        vectors.clear();
+        return false;
+    }
+    
+    for (std::vector<float>& vector : vectors) {
+        double norm = 0.0;
+        for (float v : vector) {
+            norm += static_cast<double>(v) * v;
+        }
+        const float scale = norm > 0.0 ? static_cast<float>(1.0 / std::sqrt(norm)) : 1.0f;
+        for (float& v : vector) {
+            v *= scale;
+        }
+    }
+    return true;
+}
+
+bool LlamaContextWrapper::createModelAndContext(const std::vector<std::string>& shardPaths, const LlamaConfig& config,
+                                                const LoadProgressCallback& onProgress, llama_model*& model,
+                                                llama_context*& context, LoadTimings& timings, std::string& error) {
+    // Set up model parameters
+    llama_model_params modelParams = llama_model_default_params();
+    modelParams.n_gpu_layers = config.gpuLayers;
+    modelParams.use_mmap = config.useMmap;
+    modelParams.use_mlock = config.useMlock;
+    
+    LOGI("Model params: gpu_layers=%d, use_mmap=%d, use_mlock=%d",
+         config.gpuLayers, config.useMmap, config.useMlock);
+    
+    auto start = std::chrono::steady_clock::now();
+    const std::vector<std::string> shards = expandShardPaths(shardPaths);
+    LoadProgressRange progressRange = {&onProgress, 0.0f};
+    if (shards.size() > 1) {
+        if (!prefaultShards(shards, onProgress, error)) {
+            return false;
+        }
+        progressRange.start = PREFAULT_PROGRESS_SHARE;
+        LOGI("Read %zu shards ahead in %.1f ms", shards.size(), millisecondsSince(start));
+    }
+    if (onProgress) {
+        modelParams.progress_callback = reportLoadProgress;
+        modelParams.progress_callback_user_data = &progressRange;
+    }
+    
+    // Load the model using new API
+    if (shards.size() > 1) {
+        std::vector<const char*> paths;
+        for (const std::string& shard : shards) {
+            paths.push_back(shard.c_str());
+        }
+        model = llama_model_load_from_splits(paths.data(), paths.size(), modelParams);
+    } else {
+        model = llama_model_load_from_file(shards[0].c_str(), modelParams);
+    }
+    if (model == nullptr) {
+        error = "Failed to load model from: " + shards[0];
+        if (shards.size() > 1) {
+            error += " (" + std::to_string(shards.size()) + " shards)";
+        }
+        return false;
+    }
+    timings.modelLoadMs = millisecondsSince(start);
+    
+    LOGI("Model loaded successfully in %.1f ms", timings.modelLoadMs);
+    
+    // Set up context parameters
+    llama_context_params ctxParams = llama_context_default_params();
+    ctxParams.n_ctx = config.contextSize;
+    ctxParams.n_batch = config.batchSize;
+    ctxParams.n_threads = config.threads;
+    ctxParams.n_threads_batch = config.threadsBatch;
+    ctxParams.n_seq_max = std::max({1, config.parallelSequences, config.speculativeBranches + 1});
+    switch (config.kvCacheType) {
+        case KvCacheType::Q8_0:
+            ctxParams.type_k = GGML_TYPE_Q8_0;
+            ctxParams.type_v = GGML_TYPE_Q8_0;
+            break;
+        case KvCacheType::Q4_0:
+            ctxParams.type_k = GGML_TYPE_Q4_0;
+            ctxParams.type_v = GGML_TYPE_Q4_0;
+            break;
+        default:
+            ctxParams.type_k = GGML_TYPE_F16;
+            ctxParams.type_v = GGML_TYPE_F16;
+            break;
+    }
+    if (ctxParams.n_seq_max > 1) {
+        // One KV pool shared by all sequences, so a long request can use
+        // the cells that short ones leave free
+        ctxParams.kv_unified = true;
+    }
+    
+    LOGI("Context params: n_ctx=%d, n_batch=%d, n_threads=%d, n_seq_max=%d, kv_type=%s",
+         ctxParams.n_ctx, ctxParams.n_batch, ctxParams.n_threads, ctxParams.n_seq_max,
+         ggml_type_name(ctxParams.type_k));
+    
+    // Create context using new API
+    start = std::chrono::steady_clock::now();
+    context = llama_init_from_model(model, ctxParams);
+    if (context == nullptr) {
+        error = "Failed to create llama context";
+        llama_model_free(model);
+        model = nullptr;
+        return false;
+    }
+    timings.contextCreateMs = millisecondsSince(start);
+    
+    return true;
+}
+
+void LlamaContextWrapper::warmUp(llama_model* model, llama_context* context) {
+    // Run a single token through the model so the weights are paged in and
+    // the compute buffers are allocated before the first real request
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    llama_token token = llama_vocab_bos(vocab);
+    if (token < 0) {
+        token = llama_vocab_eos(vocab);
+    }
+    
+    llama_batch batch = llama_batch_get_one(&token, 1);
+    if (llama_decode(context, batch) != 0) {
+        LOGW("Warm-up decode failed, continuing without warm-up");
+    }
+    
+    llama_memory_t mem = llama_get_memory(context);
+    if (mem != nullptr) {
+        llama_memory_clear(mem, true);
+    }
     
-    LOGI("Sampler configured: temp=%.2f, top_p=%.2f, top_k=%d, repeat_penalty=%.2f",
-         config.temperature, config.topP, config.topK, config.repeatPenalty);
+    LOGD("Model warmed up");
 }
 
 #endif // LLAMA_AVAILABLE
@@ -4,9 +4,15 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <map>
 #include <functional>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include "parallel_tokenizer.h"
+#include "memory_stats.h"
 
 #if LLAMA_AVAILABLE
 #include "llama.h"
@@ -14,6 +20,22 @@
 
 namespace llamaandroid {
 
+class CascadeGenerator;
+class InferenceHostClient;
+class SequenceScheduler;
+class PromptTemplate;
+
+/**
+ * Element type of the KV cache. Q8_0 takes about half the memory of F16
+ * and Q4_0 about a quarter; a quantised V cache needs flash attention,
+ * which llama.cpp turns on where the backend supports it.
+ */
+enum class KvCacheType : int {
+    F16 = 0,
+    Q8_0 = 1,
+    Q4_0 = 2
+};
+
 /**
  * Configuration for LLaMA model loading and inference
  */
@@ -31,6 +53,18 @@ struct LlamaConfig {
     float topP = 0.9f;
     int topK = 40;
     float repeatPenalty = 1.1f;
+    float frequencyPenalty = 0.0f;  // Subtracted once per occurrence in the window
+    float presencePenalty = 0.0f;   // Subtracted once if the token is in the window
+    
+    // Tokens the penalties look back over (0 = penalties off, -1 = context size)
+    int penaltyWindow = 64;
+    
+    // DRY: penalise tokens that would extend a sequence already in the
+    // window by dryMultiplier * dryBase^(length - dryAllowedLength)
+    // (0 = off)
+    float dryMultiplier = 0.0f;
+    float dryBase = 1.75f;
+    int dryAllowedLength = 2;
     
     // Generation limits
     int maxTokens = 512;
@@ -38,12 +72,158 @@ struct LlamaConfig {
     // Memory options
     bool useMmap = true;
     bool useMlock = false;
+    KvCacheType kvCacheType = KvCacheType::F16;
     
     // GPU layers (0 = CPU only)
     int gpuLayers = 0;
     
     // Seed for reproducibility (-1 = random)
     int seed = -1;
+    
+    // Run inference in a separate helper process so native crashes and
+    // OOM kills do not take down the app
+    bool outOfProcess = false;
+    
+    // Number of sequences that can be decoded together in one batch
+    // (concurrent requests served by SequenceScheduler)
+    int parallelSequences = 1;
+    
+    // Tree speculation: draft branches verified per forward pass
+    // (0 = off). Branches come from n-gram matches in the prompt and the
+    // output so far; the KV sequences they need are reserved at load time.
+    int speculativeBranches = 0;
+    
+    // Maximum draft tokens per branch
+    int speculativeDepth = 4;
+    
+    // Paced generation: target output rate in tokens per second (0 = as
+    // fast as possible). Decoding runs in bursts on pacedThreads threads
+    // (0 = half of threads) and sleeps once pacedLeadTokens are buffered
+    // ahead of a reader consuming at that rate.
+    float pacedTokensPerSecond = 0.0f;
+    int pacedLeadTokens = 8;
+    int pacedThreads = 0;
+    
+    // Steering: id of a control vector set from
+    // LlamaContextWrapper::createControlVectorSet (0 = none)
+    int controlVectorSet = 0;
+};
+
+/**
+ * Counters of the last generation with tree speculation
+ */
+struct SpeculationStats {
+    int forwardPasses = 0;    // Target decodes after the prompt
+    int draftedTokens = 0;    // Draft tokens verified
+    int acceptedTokens = 0;   // Draft tokens that matched the sampled token
+    int generatedTokens = 0;  // Tokens emitted
+    
+    // Mean draft tokens accepted per forward pass
+    double acceptancePerPass() const {
+        return forwardPasses > 0 ? static_cast<double>(acceptedTokens) / forwardPasses : 0.0;
+    }
+};
+
+/**
+ * Cost of the prompt and decode phases of the last generation
+ */
+struct GenerationStats {
+    int tokens = 0;        // Tokens emitted
+    bool paced = false;    // Whether pacedTokensPerSecond was in effect
+    double wallMs = 0.0;   // Decode duration, including pacing sleeps
+    double cpuMs = 0.0;    // Process CPU time while decoding, all threads
+    double sleptMs = 0.0;  // Time spent waiting for the reader
+    
+    int promptTokens = 0;     // Prompt tokens evaluated (after prefix reuse)
+    double prefillMs = 0.0;   // Time to evaluate them
+    
+    // Heap allocations in the decode loop after the first token, outside the
+    // callback and llama_decode; only counted in allocation-hook builds
+    uint64_t loopAllocations = 0;
+    
+    double cpuMsPerToken() const {
+        return tokens > 0 ? cpuMs / tokens : 0.0;
+    }
+    
+    double tokensPerSecond() const {
+        return wallMs > 0.0 ? tokens * 1000.0 / wallMs : 0.0;
+    }
+    
+    double prefillTokensPerSecond() const {
+        return prefillMs > 0.0 ? promptTokens * 1000.0 / prefillMs : 0.0;
+    }
+};
+
+/**
+ * Perplexity of the loaded model on a text
+ */
+struct PerplexityResult {
+    int chunks = 0;                // Context-sized chunks evaluated
+    int scoredTokens = 0;          // Tokens whose probability was counted
+    double perplexity = 0.0;
+    double standardError = 0.0;    // Of the perplexity estimate
+    double tokensPerSecond = 0.0;  // Evaluation rate over all chunk tokens
+};
+
+/**
+ * Durations of the steps between creating a wrapper and its first request
+ */
+struct LoadTimings {
+    double backendInitMs = 0.0;    // llama_backend_init, once per wrapper
+    double modelLoadMs = 0.0;      // Reading or mapping the weights
+    double contextCreateMs = 0.0;  // KV cache and compute buffers
+    double warmUpMs = 0.0;         // First decode (0 until warmUp() or a swap runs it)
+};
+
+/**
+ * Where the native memory of a context and its model goes
+ */
+struct MemoryStats {
+    // Model weights
+    size_t modelBytes = 0;          // Tensor data
+    size_t modelMappedBytes = 0;    // Model file mapped into the process (0 without mmap)
+    size_t modelResidentBytes = 0;  // Mapped pages currently in RAM
+    
+    // Context buffers, as allocated by llama.cpp
+    size_t kvCacheBytes = 0;
+    size_t computeBufferBytes = 0;
+    size_t outputBufferBytes = 0;
+    std::vector<int> sequenceCells;  // KV positions held by each sequence
+    
+    // Process
+    size_t allocatorInUseBytes = 0;   // Heap in use (malloc)
+    size_t allocatorMappedBytes = 0;  // Heap held from the OS
+    size_t allocatorPeakBytes = 0;    // Highest heap in use seen since load
+    size_t rssBytes = 0;              // Resident set
+    size_t peakRssBytes = 0;          // Resident high-water mark since load (process lifetime if the kernel cannot reset it)
+};
+
+/**
+ * One message of a chat conversation
+ */
+struct ChatMessage {
+    std::string role;     // "system", "user" or "assistant"
+    std::string content;
+};
+
+/**
+ * How LlamaContextWrapper::embed() reduces per-token outputs to one vector.
+ * Only contexts without pooling of their own (generation models) have
+ * per-token outputs; a model that defines pooling (embedding models)
+ * always uses it.
+ */
+enum class EmbeddingPooling : int {
+    Default = 0,  // The model's pooling, or Mean if it has none
+    Mean = 1,     // Average over every token
+    Last = 2      // Output of the last token, which has attended to all others
+};
+
+/**
+ * One control vector of a steering set
+ */
+struct ControlVectorSpec {
+    std::string path;    // GGUF file with "direction.<layer>" tensors (llama.cpp's cvector-generator)
+    float scale = 1.0f;  // Strength; negative steers away from the direction
 };
 
 /**
@@ -51,6 +231,43 @@ struct LlamaConfig {
  */
 using TokenCallback = std::function<void(const std::string& token)>;
 
+/**
+ * Model load progress callback, from 0 to 1
+ */
+using LoadProgressCallback = std::function<void(float progress)>;
+
+/**
+ * Non-owning reference to a callable. Unlike std::function, creating or
+ * copying one never allocates; the referenced callable must outlive it.
+ */
+template <typename Signature>
+class FunctionRef;
+
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+public:
+    template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, FunctionRef>::value>>
+    FunctionRef(F&& callable)
+        : object_(const_cast<void*>(static_cast<const void*>(std::addressof(callable)))),
+          invoke_([](void* object, Args... args) -> R {
+              return (*static_cast<std::add_pointer_t<std::remove_reference_t<F>>>(object))(
+                  std::forward<Args>(args)...);
+          }) {}
+    
+    R operator()(Args... args) const {
+        return invoke_(object_, std::forward<Args>(args)...);
+    }
+
+private:
+    void* object_;
+    R (*invoke_)(void*, Args...);
+};
+
+/**
+ * Per-token callback of the decode loop; the string is only valid during the call
+ */
+using TokenSink = FunctionRef<void(const std::string& token)>;
+
 /**
  * Wrapper class for llama.cpp context management
  */
@@ -65,12 +282,49 @@ public:
     
     /**
      * Load a GGUF model from the specified path
-     * @param modelPath Path to the .gguf model file
+     * @param modelPath Path to the .gguf model file, or to the first shard
+     *        of a split model (see loadModelShards())
      * @param config Configuration for model loading
      * @return true if successful, false otherwise
      */
     bool loadModel(const std::string& modelPath, const LlamaConfig& config);
     
+    /**
+     * Load a model split into GGUF shards (gguf-split). Before llama.cpp
+     * maps them, the shards are read into the page cache on one thread
+     * each, so storage serves them in parallel rather than one file after
+     * another. This is skipped when they do not fit in available memory.
+     * @param shardPaths Every shard in order, or only the first one when the
+     *        files keep llama.cpp's "<name>-00001-of-00004.gguf" names (out
+     *        of process, only the first one is passed on, so they must)
+     * @param config Configuration for model loading
+     * @param onProgress Called on this thread with the progress of the
+     *        whole load, over all shards
+     * @return true if successful, false otherwise
+     */
+    bool loadModelShards(const std::vector<std::string>& shardPaths, const LlamaConfig& config,
+                         const LoadProgressCallback& onProgress = nullptr);
+    
+    /**
+     * Replace the loaded model without a service gap.
+     * The new model is loaded and warmed up on the calling thread while the
+     * current one keeps serving; new requests are then routed to it, an
+     * in-flight generation finishes on the old model, and the old model is
+     * freed once it has drained. A running SequenceScheduler keeps running:
+     * its active sequences finish on the old model and its queued requests
+     * start on the new one. Call this from a background thread.
+     * @param modelPath Path to the new .gguf model file
+     * @param config Configuration for the new model
+     * @return true if the new model is active, false if it failed to load
+     *         (the current model stays active in that case)
+     */
+    bool swapModel(const std::string& modelPath, const LlamaConfig& config);
+    
+    /**
+     * Check if a model swap is currently in progress
+     */
+    bool isSwapping() const;
+    
     /**
      * Unload the current model and free resources
      */
@@ -81,6 +335,13 @@ public:
      */
     bool isModelLoaded() const;
     
+    /**
+     * Run one token through the loaded model so the first request does not
+     * pay for paging in the weights and allocating compute buffers
+     * @return true if a model is loaded in process
+     */
+    bool warmUp();
+    
     /**
      * Generate a complete response for the given prompt
      * @param prompt Input text prompt
@@ -90,13 +351,162 @@ public:
     std::string generate(const std::string& prompt, const LlamaConfig* config = nullptr);
     
     /**
-     * Generate a streaming response, calling the callback for each token
+     * Generate a streaming response, calling the callback for each token.
+     * Fails while a SequenceScheduler runs on this wrapper; submit to it
+     * instead.
      * @param prompt Input text prompt
      * @param callback Function to call for each generated token
      * @param config Sampling configuration (optional)
      */
     void generateStream(const std::string& prompt, TokenCallback callback, const LlamaConfig* config = nullptr);
     
+    /**
+     * Generate a streaming response for an already tokenised prompt
+     * (for example one rendered by PromptTemplate)
+     * @param promptTokens Prompt token ids, including BOS if the model uses one
+     * @param callback Function to call for each generated token
+     * @param config Sampling configuration (optional)
+     */
+    void generateStreamTokens(const std::vector<int32_t>& promptTokens, TokenCallback callback,
+                              const LlamaConfig* config = nullptr);
+    
+    /**
+     * Format a conversation with the model's built-in chat template
+     * @param messages Conversation so far
+     * @param out Prompt text ending with the assistant turn prefix
+     * @return true if successful, false if the model has no usable template
+     */
+    bool applyChatTemplate(const std::vector<ChatMessage>& messages, std::string& out);
+    
+    /**
+     * Snapshot the context state (KV cache, RNG, logits) into host memory
+     * @param out Buffer receiving the serialised state
+     * @return true if successful
+     */
+    bool saveState(std::vector<uint8_t>& out);
+    
+    /**
+     * Restore a context state previously captured with saveState()
+     * @param state Serialised state for the currently loaded model
+     * @return true if successful
+     */
+    bool restoreState(const std::vector<uint8_t>& state);
+    
+    /**
+     * Snapshot the context state and unload the model, unless the context
+     * is in use. Unlike unloadModel() this never waits and never pulls the
+     * model from under a generation: it fails if another thread holds the
+     * context or a generation is running.
+     * @param state Receives the serialised context state (see saveState()),
+     *        or nullptr to drop it
+     * @return true if the model was unloaded
+     */
+    bool tryUnload(std::vector<uint8_t>* state);
+    
+    /**
+     * Estimate the memory needed by the loaded model and its context
+     * (weights plus a full KV cache, as allocated for its cache type)
+     * @return Size in bytes, or 0 if no model is loaded
+     */
+    size_t getMemoryFootprint() const;
+    
+    /**
+     * Measure the memory of the loaded model and context, and of the
+     * process. Also logged after loading and after each generation.
+     * Model and context figures are zero when running out of process.
+     */
+    MemoryStats getMemoryStats();
+    
+    /**
+     * Counters of the last generation run with speculativeBranches > 0
+     */
+    SpeculationStats getSpeculationStats() const;
+    
+    /**
+     * Duration and CPU cost of the last generation's decode phase, to
+     * compare paced and unpaced runs
+     */
+    GenerationStats getGenerationStats() const;
+    
+    /**
+     * Measure the perplexity of the loaded model on a text, as llama.cpp's
+     * perplexity tool does. The tokens are cut into chunks of the context
+     * size, each evaluated from an empty cache in batches with logits for
+     * every position, and the second half of each chunk is scored, so
+     * every scored token sees at least half a context of history. Clears
+     * the prompt cache.
+     * @param text Text of at least one context of tokens
+     * @param out Result
+     * @return true if successful; on failure see getLastError()
+     */
+    bool evaluatePerplexity(const std::string& text, PerplexityResult& out);
+    
+    /**
+     * Durations of the last load (or swap) and warm-up
+     */
+    LoadTimings getLoadTimings() const;
+    
+    /**
+     * Configuration the model was loaded (or swapped in) with; what
+     * generation uses when no config is passed
+     */
+    LlamaConfig getConfig() const;
+    
+    /**
+     * Control how parallel tokenisation of long texts is checked. Texts of
+     * 8192+ characters are split at points the model's pre-tokeniser never
+     * merges across (line starts, and word starts for the GPT-2, llama3
+     * and qwen2 families) and the segments tokenised on threadsBatch
+     * threads; the first count results per model are also tokenised
+     * serially and compared, and a mismatch turns the parallel path off
+     * for that model.
+     * @param count Results to check per model (default 8; -1 = every one, 0 = none)
+     */
+    void setTokenizeValidation(int count);
+    
+    /**
+     * Compute embeddings with the loaded model's generation context, so one
+     * set of weights serves both chat and retrieval. Embedding mode is
+     * switched on for these decodes only (llama_set_embeddings). The texts
+     * are decoded together in sequences other than 0, so the prompt cache
+     * in sequence 0 stays usable for the next generation; with a single
+     * sequence (parallelSequences = 1), or when the cache leaves too few
+     * cells free, the cache is cleared instead. Control vectors are not
+     * applied. Without llama.cpp, returns deterministic pseudo-embeddings.
+     * @param texts Texts to embed
+     * @param pooling How per-token outputs are pooled
+     * @param vectors Receives one L2-normalised vector per text
+     * @return true if successful; on failure see getLastError()
+     */
+    bool embed(const std::vector<std::string>& texts, EmbeddingPooling pooling,
+               std::vector<std::vector<float>>& vectors);
+    
+    /**
+     * Combine control vectors into a steering set. A request selects a set
+     * with LlamaConfig::controlVectorSet; its directions are then added to
+     * the hidden state after each steered layer, which steers style or
+     * persona without any prompt tokens. The vectors are read from GGUF,
+     * scaled and summed per layer once, here; switching sets between
+     * requests copies them into the context and clears the prompt cache,
+     * whose KV entries were computed under the previous steering.
+     *
+     * A set applies to the whole context: SequenceScheduler and
+     * DocumentIngester run unsteered. Sets belong to the loaded model and
+     * are dropped when another model is loaded or swapped in. Not
+     * available out of process.
+     * @param vectors Files and scales to combine
+     * @param layerStart First steered layer (layers count from 1)
+     * @param layerEnd Last steered layer (-1 = the model's last layer)
+     * @return Set id (> 0), or 0 on failure; see getLastError()
+     */
+    int createControlVectorSet(const std::vector<ControlVectorSpec>& vectors, int layerStart = 1,
+                               int layerEnd = -1);
+    
+    /**
+     * Free a steering set; requests that still select it fail
+     */
+    void releaseControlVectorSet(int id);
+    
     /**
      * Cancel ongoing generation
      */
@@ -118,25 +528,112 @@ public:
     static std::string getVersion();
     
 private:
+    friend class CascadeGenerator;
+    friend class SequenceScheduler;
+    friend class PromptTemplate;
+    friend class ChatContextFitter;
+    friend class DocumentIngester;
+    
 #if LLAMA_AVAILABLE
     llama_model* model_ = nullptr;
     llama_context* context_ = nullptr;
     llama_sampler* sampler_ = nullptr;
+    
+    // Tokens whose KV entries are held in sequence 0, for prefix reuse
+    std::vector<llama_token> cachedTokens_;
+    
+    // Decode buffers, sized when the context is created so that the
+    // per-token loop does not touch the heap
+    llama_batch batch_{};                       // n_batch tokens with n_seq_max sequence ids each
+    bool batchAllocated_ = false;
+    std::vector<llama_token_data> candidates_;  // One entry per vocabulary token
+    std::string piece_;                         // Text of the last sampled token
 #endif
     
+    // Helper process client when running out of process; accessed with
+    // std::atomic_load/store because cancelGeneration() runs unlocked
+    std::shared_ptr<InferenceHostClient> remote_;
+    
     LlamaConfig currentConfig_;
+    SpeculationStats specStats_;
+    GenerationStats generationStats_;
+    LoadTimings loadTimings_;
+    
+    // Memory accounting of the loaded model
+    std::vector<std::string> modelPaths_;    // Canonical, one per shard, to find their mappings
+    LlamaBufferSizes bufferSizes_;
+    size_t allocatorPeakBytes_ = 0;
     std::string lastError_;
     std::atomic<bool> isGenerating_{false};
     std::atomic<bool> shouldCancel_{false};
+    std::atomic<bool> isSwapping_{false};
+    
+    // Parallel tokenisation of long texts; re-enabled and re-validated
+    // for every model
+    bool parallelTokenize_ = true;
+    int tokenizeValidateCount_ = 8;
+    int tokenizeValidateRemaining_ = 8;
+    SplitRule splitRule_ = SplitRule::Lines;  // From the model's pre-tokeniser
+    
+    // Steering sets of the loaded model: n_embd floats per layer from
+    // layer 1, already scaled and summed
+    struct ControlVectorSet {
+        std::vector<float> data;
+        int layerStart = 1;
+        int layerEnd = 0;
+    };
+    std::map<int, ControlVectorSet> controlVectorSets_;
+    int nextControlVectorSet_ = 1;    // Ids are never reused, so a stale id fails
+    int activeControlVectorSet_ = 0;  // Set applied to context_
+    
+    // Incremented whenever a different model becomes active, so cached
+    // tokenisations can tell they are stale
+    uint64_t modelGeneration_ = 0;
+    
+    // Scheduler that owns the context while it runs; set and cleared by
+    // SequenceScheduler with mutex_ held
+    SequenceScheduler* scheduler_ = nullptr;
     mutable std::mutex mutex_;
     
+    // Set while a paced generation sleeps with mutex_ released; calls that
+    // would touch the context wait for it in lockIdle()
+    bool pacingSleep_ = false;
+    std::condition_variable idleCv_;
+    std::mutex swapMutex_;  // Serialises swapModel calls and SequenceScheduler::stop(); never held with mutex_ while loading
+    
     void setError(const std::string& error);
     void clearError();
+    bool checkNotScheduled();
+    std::unique_lock<std::mutex> lockIdle();
+    std::unique_lock<std::mutex> lockDrained();
+    bool saveStateLocked(std::vector<uint8_t>& out);
+    bool loadModelRemote(const std::string& modelPath, const LlamaConfig& config);
+    MemoryStats collectMemoryStats();
+    void logMemoryStats(const char* when);
     
 #if LLAMA_AVAILABLE
     std::vector<llama_token> tokenize(const std::string& text, bool addBos);
     std::string detokenize(const std::vector<llama_token>& tokens);
     void setupSampler(const LlamaConfig& config);
+    static llama_sampler* createSampler(const LlamaConfig& config);
+    bool prefill(const std::vector<llama_token>& tokens, llama_pos startPos, llama_seq_id seqId);
+    void allocateDecodeBuffers();
+    void freeDecodeBuffers();
+    llama_token sampleToken(int32_t idx);
+    const std::string& tokenToPiece(llama_token token);
+    void runGeneration(const std::vector<llama_token>& promptTokens, TokenSink callback,
+                       const LlamaConfig& config, std::unique_lock<std::mutex>& lock);
+    void runSpeculative(int nCur, int branches, TokenSink callback, const LlamaConfig& config);
+    void resetKvCache();
+    bool selectControlVectors(int id);
+    int embeddingSequenceCount() const;
+    bool embedSequences(const std::vector<const std::vector<llama_token>*>& inputs, bool addBos,
+                        EmbeddingPooling pooling, std::vector<std::vector<float>>& vectors, std::string& error,
+                        llama_seq_id firstSeq = -1);
+    bool createModelAndContext(const std::vector<std::string>& shardPaths, const LlamaConfig& config,
+                               const LoadProgressCallback& onProgress, llama_model*& model,
+                               llama_context*& context, LoadTimings& timings, std::string& error);
+    void warmUp(llama_model* model, llama_context* context);
 #endif
 };
 
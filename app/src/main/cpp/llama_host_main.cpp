@@ -0,0 +1,36 @@
+// Entry point of the out-of-process inference host.
+// Started by InferenceHostClient with the control socket and the token ring
+// already open on the descriptors named on the command line.
+
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+
+#include "inference_host.h"
+
+#define LOG_TAG "LlamaHostMain"
+#include "llama_log.h"
+
+int main(int argc, char** argv) {
+    int controlFd = -1;
+    int ringFd = -1;
+    
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--control-fd") == 0) {
+            controlFd = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--ring-fd") == 0) {
+            ringFd = atoi(argv[i + 1]);
+        }
+    }
+    
+    if (controlFd < 0 || ringFd < 0) {
+        LOGE("Usage: %s --control-fd <fd> --ring-fd <fd>", argv[0]);
+        return 2;
+    }
+    
+    // A vanished parent must not kill the host mid-write; the closed control
+    // socket is noticed on the next read instead
+    signal(SIGPIPE, SIG_IGN);
+    
+    return llamaandroid::runInferenceHost(controlFd, ringFd);
+}
@@ -1,24 +1,145 @@
 #include <jni.h>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
-#include <android/log.h>
+#include <algorithm>
+#include <functional>
 
 #include "llama_context_wrapper.h"
+#include "cascade_generator.h"
+#include "api_server.h"
+#include "prompt_template.h"
+#include "chat_context_fitter.h"
+#include "document_ingester.h"
+#include "model_verifier.h"
+#include "model_residency_manager.h"
 
 #define LOG_TAG "LlamaJNI"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#include "llama_log.h"
 
 using namespace llamaandroid;
 
-// Global context manager
-static std::unordered_map<jlong, std::unique_ptr<LlamaContextWrapper>> g_contexts;
+// Global context manager; contexts acquired from a residency manager are
+// shared with it and listed in g_residentContexts
+static std::unordered_map<jlong, std::shared_ptr<LlamaContextWrapper>> g_contexts;
+static std::unordered_set<jlong> g_residentContexts;
 static std::mutex g_contextsMutex;
 static jlong g_nextContextId = 1;
 
+// Residency managers; each keeps its models' wrappers
+static std::unordered_map<jlong, std::unique_ptr<ModelResidencyManager>> g_residencyManagers;
+static std::mutex g_residencyMutex;
+static jlong g_nextResidencyId = 1;
+
+static ModelResidencyManager* getResidencyManager(jlong handle) {
+    std::lock_guard<std::mutex> lock(g_residencyMutex);
+    auto it = g_residencyManagers.find(handle);
+    return it != g_residencyManagers.end() ? it->second.get() : nullptr;
+}
+
+// Local API servers, keyed by the handle of the context they serve
+static std::unordered_map<jlong, std::unique_ptr<ApiServer>> g_servers;
+static std::mutex g_serversMutex;
+
+// Priority schedulers, keyed by context handle; shared by prioritised
+// generation and the context's API server
+static std::unordered_map<jlong, std::shared_ptr<SequenceScheduler>> g_schedulers;
+static std::mutex g_schedulersMutex;
+
+// Compiled prompt templates and the context each one tokenises with
+struct TemplateEntry {
+    jlong contextHandle;
+    std::shared_ptr<PromptTemplate> promptTemplate;
+};
+static std::unordered_map<jlong, TemplateEntry> g_templates;
+static std::mutex g_templatesMutex;
+static jlong g_nextTemplateId = 1;
+
+static std::shared_ptr<PromptTemplate> getTemplate(jlong handle) {
+    std::lock_guard<std::mutex> lock(g_templatesMutex);
+    auto it = g_templates.find(handle);
+    return it != g_templates.end() ? it->second.promptTemplate : nullptr;
+}
+
+// Chat context fitters, keyed by the handle of the context they tokenise
+// with; one per context so its message token cache lives across requests
+static std::unordered_map<jlong, std::shared_ptr<ChatContextFitter>> g_chatFitters;
+static std::mutex g_chatFittersMutex;
+
+static std::shared_ptr<ChatContextFitter> getChatFitter(jlong handle, LlamaContextWrapper* context) {
+    std::lock_guard<std::mutex> lock(g_chatFittersMutex);
+    std::shared_ptr<ChatContextFitter>& fitter = g_chatFitters[handle];
+    if (fitter == nullptr) {
+        fitter = std::make_shared<ChatContextFitter>(*context);
+    }
+    return fitter;
+}
+
+// Serialises document ingestion and index searches, which share index files
+static std::mutex g_indexMutex;
+
+// Stop the server of a context before the context changes underneath it
+static void stopServer(jlong handle) {
+    std::unique_ptr<ApiServer> server;
+    {
+        std::lock_guard<std::mutex> lock(g_serversMutex);
+        auto it = g_servers.find(handle);
+        if (it == g_servers.end()) {
+            return;
+        }
+        server = std::move(it->second);
+        g_servers.erase(it);
+    }
+    server->stop();
+}
+
+// Stop the server and the scheduler of a context before the context
+// changes underneath it
+static void stopScheduler(jlong handle) {
+    stopServer(handle);
+    
+    std::shared_ptr<SequenceScheduler> scheduler;
+    {
+        std::lock_guard<std::mutex> lock(g_schedulersMutex);
+        auto it = g_schedulers.find(handle);
+        if (it == g_schedulers.end()) {
+            return;
+        }
+        scheduler = std::move(it->second);
+        g_schedulers.erase(it);
+    }
+    scheduler->stop();
+}
+
+// Get the running scheduler of a context without starting one
+static std::shared_ptr<SequenceScheduler> findScheduler(jlong handle) {
+    std::lock_guard<std::mutex> lock(g_schedulersMutex);
+    auto it = g_schedulers.find(handle);
+    if (it != g_schedulers.end() && it->second->isRunning()) {
+        return it->second;
+    }
+    return nullptr;
+}
+
+// Get the running scheduler of a context, starting one on first use
+static std::shared_ptr<SequenceScheduler> getScheduler(jlong handle, LlamaContextWrapper& context,
+                                                       std::string& error) {
+    std::lock_guard<std::mutex> lock(g_schedulersMutex);
+    auto it = g_schedulers.find(handle);
+    if (it != g_schedulers.end() && it->second->isRunning()) {
+        return it->second;
+    }
+    
+    auto scheduler = std::make_shared<SequenceScheduler>(context);
+    if (!scheduler->start()) {
+        error = scheduler->getLastError();
+        return nullptr;
+    }
+    g_schedulers[handle] = scheduler;
+    return scheduler;
+}
+
 // Helper to get context from handle
 static LlamaContextWrapper* getContext(jlong handle) {
     std::lock_guard<std::mutex> lock(g_contextsMutex);
@@ -29,6 +150,12 @@ static LlamaContextWrapper* getContext(jlong handle) {
     return nullptr;
 }
 
+// Contexts acquired from a residency manager are loaded and unloaded by it
+static bool isResidentContext(jlong handle) {
+    std::lock_guard<std::mutex> lock(g_contextsMutex);
+    return g_residentContexts.count(handle) != 0;
+}
+
 // Helper to convert jstring to std::string
 static std::string jstringToString(JNIEnv* env, jstring jstr) {
     if (jstr == nullptr) {
@@ -103,29 +230,61 @@ static LlamaConfig configFromJava(JNIEnv* env, jobject jconfig) {
     jfieldID contextSizeField = env->GetFieldID(configClass, "contextSize", "I");
     jfieldID batchSizeField = env->GetFieldID(configClass, "batchSize", "I");
     jfieldID threadsField = env->GetFieldID(configClass, "threads", "I");
+    jfieldID threadsBatchField = env->GetFieldID(configClass, "threadsBatch", "I");
     jfieldID temperatureField = env->GetFieldID(configClass, "temperature", "F");
     jfieldID topPField = env->GetFieldID(configClass, "topP", "F");
     jfieldID topKField = env->GetFieldID(configClass, "topK", "I");
     jfieldID repeatPenaltyField = env->GetFieldID(configClass, "repeatPenalty", "F");
+    jfieldID frequencyPenaltyField = env->GetFieldID(configClass, "frequencyPenalty", "F");
+    jfieldID presencePenaltyField = env->GetFieldID(configClass, "presencePenalty", "F");
+    jfieldID penaltyWindowField = env->GetFieldID(configClass, "penaltyWindow", "I");
+    jfieldID dryMultiplierField = env->GetFieldID(configClass, "dryMultiplier", "F");
+    jfieldID dryBaseField = env->GetFieldID(configClass, "dryBase", "F");
+    jfieldID dryAllowedLengthField = env->GetFieldID(configClass, "dryAllowedLength", "I");
     jfieldID maxTokensField = env->GetFieldID(configClass, "maxTokens", "I");
     jfieldID useMmapField = env->GetFieldID(configClass, "useMmap", "Z");
     jfieldID useMlockField = env->GetFieldID(configClass, "useMlock", "Z");
+    jfieldID kvCacheTypeField = env->GetFieldID(configClass, "kvCacheType", "I");
     jfieldID gpuLayersField = env->GetFieldID(configClass, "gpuLayers", "I");
     jfieldID seedField = env->GetFieldID(configClass, "seed", "I");
+    jfieldID outOfProcessField = env->GetFieldID(configClass, "outOfProcess", "Z");
+    jfieldID parallelSequencesField = env->GetFieldID(configClass, "parallelSequences", "I");
+    jfieldID speculativeBranchesField = env->GetFieldID(configClass, "speculativeBranches", "I");
+    jfieldID speculativeDepthField = env->GetFieldID(configClass, "speculativeDepth", "I");
+    jfieldID pacedTokensPerSecondField = env->GetFieldID(configClass, "pacedTokensPerSecond", "F");
+    jfieldID pacedLeadTokensField = env->GetFieldID(configClass, "pacedLeadTokens", "I");
+    jfieldID pacedThreadsField = env->GetFieldID(configClass, "pacedThreads", "I");
+    jfieldID controlVectorSetField = env->GetFieldID(configClass, "controlVectorSet", "I");
     
     // Read values
     if (contextSizeField) config.contextSize = env->GetIntField(jconfig, contextSizeField);
     if (batchSizeField) config.batchSize = env->GetIntField(jconfig, batchSizeField);
     if (threadsField) config.threads = env->GetIntField(jconfig, threadsField);
+    if (threadsBatchField) config.threadsBatch = env->GetIntField(jconfig, threadsBatchField);
     if (temperatureField) config.temperature = env->GetFloatField(jconfig, temperatureField);
     if (topPField) config.topP = env->GetFloatField(jconfig, topPField);
     if (topKField) config.topK = env->GetIntField(jconfig, topKField);
     if (repeatPenaltyField) config.repeatPenalty = env->GetFloatField(jconfig, repeatPenaltyField);
+    if (frequencyPenaltyField) config.frequencyPenalty = env->GetFloatField(jconfig, frequencyPenaltyField);
+    if (presencePenaltyField) config.presencePenalty = env->GetFloatField(jconfig, presencePenaltyField);
+    if (penaltyWindowField) config.penaltyWindow = env->GetIntField(jconfig, penaltyWindowField);
+    if (dryMultiplierField) config.dryMultiplier = env->GetFloatField(jconfig, dryMultiplierField);
+    if (dryBaseField) config.dryBase = env->GetFloatField(jconfig, dryBaseField);
+    if (dryAllowedLengthField) config.dryAllowedLength = env->GetIntField(jconfig, dryAllowedLengthField);
     if (maxTokensField) config.maxTokens = env->GetIntField(jconfig, maxTokensField);
     if (useMmapField) config.useMmap = env->GetBooleanField(jconfig, useMmapField);
     if (useMlockField) config.useMlock = env->GetBooleanField(jconfig, useMlockField);
+    if (kvCacheTypeField) config.kvCacheType = static_cast<KvCacheType>(env->GetIntField(jconfig, kvCacheTypeField));
     if (gpuLayersField) config.gpuLayers = env->GetIntField(jconfig, gpuLayersField);
     if (seedField) config.seed = env->GetIntField(jconfig, seedField);
+    if (outOfProcessField) config.outOfProcess = env->GetBooleanField(jconfig, outOfProcessField);
+    if (parallelSequencesField) config.parallelSequences = env->GetIntField(jconfig, parallelSequencesField);
+    if (speculativeBranchesField) config.speculativeBranches = env->GetIntField(jconfig, speculativeBranchesField);
+    if (speculativeDepthField) config.speculativeDepth = env->GetIntField(jconfig, speculativeDepthField);
+    if (pacedTokensPerSecondField) config.pacedTokensPerSecond = env->GetFloatField(jconfig, pacedTokensPerSecondField);
+    if (pacedLeadTokensField) config.pacedLeadTokens = env->GetIntField(jconfig, pacedLeadTokensField);
+    if (pacedThreadsField) config.pacedThreads = env->GetIntField(jconfig, pacedThreadsField);
+    if (controlVectorSetField) config.controlVectorSet = env->GetIntField(jconfig, controlVectorSetField);
     
     env->DeleteLocalRef(configClass);
     
@@ -135,14 +294,37 @@ static LlamaConfig configFromJava(JNIEnv* env, jobject jconfig) {
 extern "C" {
 
 // ============================================================================
-// Native Library Management
+// Logging
 // ============================================================================
 
-JNIEXPORT jstring JNICALL
-Java_com_llamakotlin_android_LlamaNative_nativeGetVersion(
-    JNIEnv* env,
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeSetLogLevel(
+    JNIEnv* /* env */,
+    jclass /* clazz */,
+    jint level) {
+    setLogLevel(level);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetLogLevel(
+    JNIEnv* /* env */,
+    jclass /* clazz */) {
+    return getLogLevel();
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeSetLogRateLimit(
+    JNIEnv* /* env */,
+    jclass /* clazz */,
+    jint perSecond) {
+    setLogRateLimit(perSecond);
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeFlushLog(
+    JNIEnv* /* env */,
     jclass /* clazz */) {
-    return stringToJstring(env, LlamaContextWrapper::getVersion());
+    flushLog();
 }
 
 // ============================================================================
@@ -173,14 +355,40 @@ Java_com_llamakotlin_android_LlamaNative_nativeDestroyContext(
     jlong handle) {
     LOGI("Destroying context: %lld", (long long)handle);
     
-    std::lock_guard<std::mutex> lock(g_contextsMutex);
+    stopScheduler(handle);
     
-    auto it = g_contexts.find(handle);
-    if (it != g_contexts.end()) {
-        g_contexts.erase(it);
-        LOGI("Context destroyed: %lld", (long long)handle);
-    } else {
-        LOGW("Context not found for destruction: %lld", (long long)handle);
+    {
+        // Templates reference the context's wrapper
+        std::lock_guard<std::mutex> lock(g_templatesMutex);
+        for (auto it = g_templates.begin(); it != g_templates.end();) {
+            if (it->second.contextHandle == handle) {
+                it = g_templates.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(g_chatFittersMutex);
+        g_chatFitters.erase(handle);
+    }
+    
+    // A resident model's wrapper outlives the handle in its manager; this
+    // only releases the pin
+    std::shared_ptr<LlamaContextWrapper> context;
+    {
+        std::lock_guard<std::mutex> lock(g_contextsMutex);
+    
+        auto it = g_contexts.find(handle);
+        if (it != g_contexts.end()) {
+            context = std::move(it->second);
+            g_contexts.erase(it);
+            g_residentContexts.erase(handle);
+            LOGI("Context destroyed: %lld", (long long)handle);
+        } else {
+            LOGW("Context not found for destruction: %lld", (long long)handle);
+        }
     }
 }
 
@@ -201,12 +409,19 @@ Java_com_llamakotlin_android_LlamaNative_nativeLoadModel(
         throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
         return JNI_FALSE;
     }
+    if (isResidentContext(handle)) {
+        throwGenerationError(env, "Models acquired from a residency manager are loaded by the manager");
+        return JNI_FALSE;
+    }
     
     std::string path = jstringToString(env, modelPath);
     LlamaConfig config = configFromJava(env, jconfig);
     
     LOGI("Loading model: %s", path.c_str());
     
+    // Sequences held by a running server belong to the old context
+    stopScheduler(handle);
+    
     bool success = context->loadModel(path, config);
     
     if (!success) {
@@ -218,6 +433,106 @@ Java_com_llamakotlin_android_LlamaNative_nativeLoadModel(
     return JNI_TRUE;
 }
 
+JNIEXPORT jboolean JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeLoadModelShards(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jobjectArray shardPaths,
+    jobject jconfig,
+    jobject callback) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return JNI_FALSE;
+    }
+    if (isResidentContext(handle)) {
+        throwGenerationError(env, "Models acquired from a residency manager are loaded by the manager");
+        return JNI_FALSE;
+    }
+    
+    std::vector<std::string> paths;
+    jsize count = env->GetArrayLength(shardPaths);
+    for (jsize i = 0; i < count; i++) {
+        jstring jpath = static_cast<jstring>(env->GetObjectArrayElement(shardPaths, i));
+        paths.push_back(jstringToString(env, jpath));
+        env->DeleteLocalRef(jpath);
+    }
+    LlamaConfig config = configFromJava(env, jconfig);
+    
+    LoadProgressCallback onProgress;
+    if (callback != nullptr) {
+        jclass callbackClass = env->GetObjectClass(callback);
+        jmethodID onProgressMethod = env->GetMethodID(callbackClass, "onProgress", "(F)V");
+        env->DeleteLocalRef(callbackClass);
+        if (onProgressMethod == nullptr) {
+            throwException(env, "java/lang/NoSuchMethodException", "Callback must have onProgress(float) method");
+            return JNI_FALSE;
+        }
+        
+        // Called on this thread, during loadModelShards
+        onProgress = [env, callback, onProgressMethod](float progress) {
+            env->CallVoidMethod(callback, onProgressMethod, static_cast<jfloat>(progress));
+            if (env->ExceptionCheck()) {
+                LOGE("Exception in load progress callback");
+                env->ExceptionClear();
+            }
+        };
+    }
+    
+    LOGI("Loading model from %d shard path(s)", static_cast<int>(count));
+    
+    // Sequences held by a running server belong to the old context
+    stopScheduler(handle);
+    
+    bool success = context->loadModelShards(paths, config, onProgress);
+    
+    if (!success) {
+        std::string error = context->getLastError();
+        throwGenerationError(env, error.c_str());
+        return JNI_FALSE;
+    }
+    
+    return JNI_TRUE;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeSwapModel(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring modelPath,
+    jobject jconfig) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return JNI_FALSE;
+    }
+    if (isResidentContext(handle)) {
+        throwGenerationError(env, "Models acquired from a residency manager are loaded by the manager");
+        return JNI_FALSE;
+    }
+    
+    std::string path = jstringToString(env, modelPath);
+    LlamaConfig config = configFromJava(env, jconfig);
+    
+    LOGI("Swapping model: %s", path.c_str());
+    
+    // A running scheduler and server keep serving: the swap drains their
+    // sequences on the old model and hands queued requests to the new one
+    bool success = context->swapModel(path, config);
+    
+    if (!success) {
+        std::string error = context->getLastError();
+        throwGenerationError(env, error.c_str());
+        return JNI_FALSE;
+    }
+    
+    return JNI_TRUE;
+}
+
 JNIEXPORT void JNICALL
 Java_com_llamakotlin_android_LlamaNative_nativeUnloadModel(
     JNIEnv* env,
@@ -229,7 +544,12 @@ Java_com_llamakotlin_android_LlamaNative_nativeUnloadModel(
         LOGW("Invalid context handle for unloadModel");
         return;
     }
+    if (isResidentContext(handle)) {
+        LOGW("Not unloading a model acquired from a residency manager");
+        return;
+    }
     
+    stopScheduler(handle);
     context->unloadModel();
 }
 
@@ -251,6 +571,92 @@ Java_com_llamakotlin_android_LlamaNative_nativeIsModelLoaded(
 // Text Generation
 // ============================================================================
 
+// Requests that plain generation calls routed to a running scheduler, so
+// that nativeCancelGeneration reaches them
+static std::unordered_multimap<jlong, std::shared_ptr<ScheduledRequest>> g_routedRequests;
+static std::mutex g_routedRequestsMutex;
+
+// Stream the pieces of a scheduled request to an onToken(String) callback,
+// or append them to text without one, until the request finishes. The
+// caller's isCancelled() is polled, if given, while the request waits.
+static void awaitScheduledRequest(JNIEnv* env, ScheduledRequest& request, jobject callback,
+                                  jmethodID onTokenMethod, jmethodID isCancelledMethod, std::string* text) {
+    std::string piece;
+    for (;;) {
+        int r = request.next(piece, 50);
+        if (r < 0) {
+            break;
+        }
+        if (r > 0 && text != nullptr) {
+            *text += piece;
+        } else if (r > 0) {
+            jstring jtoken = env->NewStringUTF(piece.c_str());
+            env->CallVoidMethod(callback, onTokenMethod, jtoken);
+            env->DeleteLocalRef(jtoken);
+            
+            if (env->ExceptionCheck()) {
+                LOGE("Exception in token callback");
+                env->ExceptionClear();
+                request.cancel();
+            }
+        }
+        if (isCancelledMethod != nullptr && env->CallBooleanMethod(callback, isCancelledMethod)) {
+            request.cancel();
+        }
+    }
+}
+
+// Run a plain generation call as a Normal-priority request when the
+// context's scheduler is running, since decoding directly would clobber
+// its sequences. Without a config override the request runs with the
+// wrapper's, as the direct path would. Returns false if there is no scheduler; otherwise the
+// request has finished, or a Java exception is pending.
+static bool routeToScheduler(JNIEnv* env, jlong handle, const LlamaConfig* config,
+                             const std::function<std::shared_ptr<ScheduledRequest>(SequenceScheduler&,
+                                                                                   std::string&)>& submit,
+                             jobject callback, jmethodID onTokenMethod, std::string* text) {
+    std::shared_ptr<SequenceScheduler> scheduler = findScheduler(handle);
+    if (scheduler == nullptr) {
+        return false;
+    }
+    
+    // One control vector set would apply to every sequence
+    if (config != nullptr && config->controlVectorSet != 0) {
+        throwGenerationError(env, "Control vectors cannot be applied while the context is serving scheduled requests");
+        return true;
+    }
+    
+    std::string error;
+    std::shared_ptr<ScheduledRequest> request = submit(*scheduler, error);
+    if (request == nullptr) {
+        LOGE("Failed to queue request: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return true;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(g_routedRequestsMutex);
+        g_routedRequests.emplace(handle, request);
+    }
+    awaitScheduledRequest(env, *request, callback, onTokenMethod, nullptr, text);
+    {
+        std::lock_guard<std::mutex> lock(g_routedRequestsMutex);
+        auto range = g_routedRequests.equal_range(handle);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == request) {
+                g_routedRequests.erase(it);
+                break;
+            }
+        }
+    }
+    
+    if (!request->succeeded() && request->finishReason() != "cancelled") {
+        LOGE("Generation error: %s", request->error().c_str());
+        throwGenerationError(env, request->error().c_str());
+    }
+    return true;
+}
+
 JNIEXPORT jstring JNICALL
 Java_com_llamakotlin_android_LlamaNative_nativeGenerate(
     JNIEnv* env,
@@ -274,7 +680,16 @@ Java_com_llamakotlin_android_LlamaNative_nativeGenerate(
         configPtr = &config;
     }
     
-    std::string result = context->generate(promptStr, configPtr);
+    std::string result;
+    if (routeToScheduler(env, handle, configPtr, [&](SequenceScheduler& scheduler, std::string& error) {
+            auto request = scheduler.submitCompletion(promptStr, configPtr);
+            error = request == nullptr ? scheduler.getLastError() : "";
+            return request;
+        }, nullptr, nullptr, &result)) {
+        return env->ExceptionCheck() ? nullptr : stringToJstring(env, result);
+    }
+    
+    result = context->generate(promptStr, configPtr);
     
     if (result.empty() && !context->getLastError().empty()) {
         throwGenerationError(env, context->getLastError().c_str());
@@ -332,6 +747,15 @@ Java_com_llamakotlin_android_LlamaNative_nativeGenerateStream(
         return;
     }
     
+    if (routeToScheduler(env, handle, configPtr, [&](SequenceScheduler& scheduler, std::string& error) {
+            auto request = scheduler.submitCompletion(promptStr, configPtr);
+            error = request == nullptr ? scheduler.getLastError() : "";
+            return request;
+        }, callback, onTokenMethod, nullptr)) {
+        env->DeleteLocalRef(callbackClass);
+        return;
+    }
+    
     // Create global ref for callback
     jobject globalCallback = env->NewGlobalRef(callback);
     
@@ -360,52 +784,1233 @@ Java_com_llamakotlin_android_LlamaNative_nativeGenerateStream(
     }
 }
 
-// ============================================================================
-// Generation Control
-// ============================================================================
-
 JNIEXPORT void JNICALL
-Java_com_llamakotlin_android_LlamaNative_nativeCancelGeneration(
+Java_com_llamakotlin_android_LlamaNative_nativeGenerateScheduledStream(
     JNIEnv* env,
     jclass /* clazz */,
-    jlong handle) {
+    jlong handle,
+    jstring prompt,
+    jint priority,
+    jobject callback,
+    jobject jconfig) {
     
     LlamaContextWrapper* context = getContext(handle);
-    if (context != nullptr) {
-        context->cancelGeneration();
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return;
+    }
+    
+    if (callback == nullptr) {
+        throwException(env, "java/lang/IllegalArgumentException", "Callback cannot be null");
+        return;
+    }
+    
+    std::string promptStr = jstringToString(env, prompt);
+    
+    LlamaConfig config;
+    LlamaConfig* configPtr = nullptr;
+    if (jconfig != nullptr) {
+        config = configFromJava(env, jconfig);
+        configPtr = &config;
+    }
+    
+    RequestPriority requestPriority = RequestPriority::Normal;
+    if (priority == static_cast<jint>(RequestPriority::Foreground)) {
+        requestPriority = RequestPriority::Foreground;
+    } else if (priority == static_cast<jint>(RequestPriority::Background)) {
+        requestPriority = RequestPriority::Background;
+    }
+    
+    jclass callbackClass = env->GetObjectClass(callback);
+    jmethodID onTokenMethod = env->GetMethodID(callbackClass, "onToken", "(Ljava/lang/String;)V");
+    jmethodID isCancelledMethod = env->GetMethodID(callbackClass, "isCancelled", "()Z");
+    
+    if (onTokenMethod == nullptr || isCancelledMethod == nullptr) {
+        env->DeleteLocalRef(callbackClass);
+        throwException(env, "java/lang/NoSuchMethodException",
+                       "Callback must have onToken(String) and isCancelled() methods");
+        return;
+    }
+    
+    std::string error;
+    std::shared_ptr<SequenceScheduler> scheduler = getScheduler(handle, *context, error);
+    if (scheduler == nullptr) {
+        env->DeleteLocalRef(callbackClass);
+        LOGE("Scheduler unavailable: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return;
+    }
+    
+    std::shared_ptr<ScheduledRequest> request = scheduler->submitCompletion(promptStr, configPtr, requestPriority);
+    if (request == nullptr) {
+        env->DeleteLocalRef(callbackClass);
+        error = scheduler->getLastError();
+        LOGE("Failed to queue request: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return;
+    }
+    
+    // Stream pieces until the request finishes, polling the caller for
+    // cancellation while the request waits in the queue
+    awaitScheduledRequest(env, *request, callback, onTokenMethod, isCancelledMethod, nullptr);
+    
+    env->DeleteLocalRef(callbackClass);
+    
+    if (!request->succeeded() && request->finishReason() != "cancelled") {
+        LOGE("Generation error: %s", request->error().c_str());
+        throwGenerationError(env, request->error().c_str());
     }
 }
 
 JNIEXPORT jboolean JNICALL
-Java_com_llamakotlin_android_LlamaNative_nativeIsGenerating(
+Java_com_llamakotlin_android_LlamaNative_nativeGenerateCascadeStream(
     JNIEnv* env,
     jclass /* clazz */,
-    jlong handle) {
+    jlong smallHandle,
+    jlong largeHandle,
+    jstring prompt,
+    jobject callback,
+    jint metric,
+    jfloat threshold,
+    jint patience,
+    jobject jconfig) {
     
-    LlamaContextWrapper* context = getContext(handle);
-    if (context == nullptr) {
+    LlamaContextWrapper* small = getContext(smallHandle);
+    LlamaContextWrapper* large = getContext(largeHandle);
+    if (small == nullptr || large == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
         return JNI_FALSE;
     }
     
-    return context->isGenerating() ? JNI_TRUE : JNI_FALSE;
-}
-
-// ============================================================================
-// Error Handling
-// ============================================================================
-
-JNIEXPORT jstring JNICALL
-Java_com_llamakotlin_android_LlamaNative_nativeGetLastError(
-    JNIEnv* env,
-    jclass /* clazz */,
-    jlong handle) {
+    if (callback == nullptr) {
+        throwException(env, "java/lang/IllegalArgumentException", "Callback cannot be null");
+        return JNI_FALSE;
+    }
     
-    LlamaContextWrapper* context = getContext(handle);
-    if (context == nullptr) {
-        return stringToJstring(env, "Invalid context handle");
+    std::string promptStr = jstringToString(env, prompt);
+    
+    LlamaConfig config;
+    LlamaConfig* configPtr = nullptr;
+    if (jconfig != nullptr) {
+        config = configFromJava(env, jconfig);
+        configPtr = &config;
     }
     
-    return stringToJstring(env, context->getLastError());
+    CascadeConfig cascadeConfig;
+    cascadeConfig.metric = metric == static_cast<jint>(CascadeMetric::Entropy)
+        ? CascadeMetric::Entropy : CascadeMetric::LogProb;
+    cascadeConfig.threshold = threshold;
+    cascadeConfig.patience = patience;
+    
+    jclass callbackClass = env->GetObjectClass(callback);
+    jmethodID onTokenMethod = env->GetMethodID(callbackClass, "onToken", "(Ljava/lang/String;)V");
+    
+    if (onTokenMethod == nullptr) {
+        env->DeleteLocalRef(callbackClass);
+        throwException(env, "java/lang/NoSuchMethodException", "Callback must have onToken(String) method");
+        return JNI_FALSE;
+    }
+    
+    jobject globalCallback = env->NewGlobalRef(callback);
+    
+    CascadeGenerator cascade(*small, *large, cascadeConfig);
+    bool success = cascade.generateStream(promptStr, [env, globalCallback, onTokenMethod](const std::string& token) {
+        jstring jtoken = env->NewStringUTF(token.c_str());
+        env->CallVoidMethod(globalCallback, onTokenMethod, jtoken);
+        env->DeleteLocalRef(jtoken);
+        
+        if (env->ExceptionCheck()) {
+            LOGE("Exception in token callback");
+        }
+    }, configPtr);
+    
+    env->DeleteGlobalRef(globalCallback);
+    env->DeleteLocalRef(callbackClass);
+    
+    if (!success) {
+        LOGE("Cascade generation error: %s", cascade.getLastError().c_str());
+        throwGenerationError(env, cascade.getLastError().c_str());
+        return JNI_FALSE;
+    }
+    
+    CascadeStats stats = cascade.getLastStats();
+    LOGI("Cascade: escalated=%d small=%d large=%d", stats.escalated, stats.smallTokens, stats.largeTokens);
+    return stats.escalated ? JNI_TRUE : JNI_FALSE;
+}
+
+// ============================================================================
+// Prompt Templates
+// ============================================================================
+
+JNIEXPORT jlong JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeCompileTemplate(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring templateText) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    
+    auto promptTemplate = std::make_shared<PromptTemplate>(*context, jstringToString(env, templateText));
+    if (!promptTemplate->compile()) {
+        throwGenerationError(env, promptTemplate->getLastError().c_str());
+        return 0;
+    }
+    
+    std::lock_guard<std::mutex> lock(g_templatesMutex);
+    jlong templateHandle = g_nextTemplateId++;
+    g_templates[templateHandle] = {handle, promptTemplate};
+    return templateHandle;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeReleaseTemplate(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong templateHandle) {
+    
+    std::lock_guard<std::mutex> lock(g_templatesMutex);
+    g_templates.erase(templateHandle);
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetTemplateSlots(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong templateHandle) {
+    
+    std::shared_ptr<PromptTemplate> promptTemplate = getTemplate(templateHandle);
+    if (promptTemplate == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid template handle");
+        return nullptr;
+    }
+    
+    std::vector<std::string> slots = promptTemplate->getSlots();
+    jclass stringClass = env->FindClass("java/lang/String");
+    jobjectArray result = env->NewObjectArray(static_cast<jsize>(slots.size()), stringClass, nullptr);
+    for (size_t i = 0; i < slots.size(); i++) {
+        jstring jslot = stringToJstring(env, slots[i]);
+        env->SetObjectArrayElement(result, static_cast<jsize>(i), jslot);
+        env->DeleteLocalRef(jslot);
+    }
+    env->DeleteLocalRef(stringClass);
+    return result;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGenerateTemplateStream(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong templateHandle,
+    jobjectArray names,
+    jobjectArray values,
+    jobject callback,
+    jobject jconfig) {
+    
+    std::shared_ptr<PromptTemplate> promptTemplate = getTemplate(templateHandle);
+    if (promptTemplate == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid template handle");
+        return;
+    }
+    
+    if (callback == nullptr) {
+        throwException(env, "java/lang/IllegalArgumentException", "Callback cannot be null");
+        return;
+    }
+    
+    std::map<std::string, std::string> slotValues;
+    const jsize count = names != nullptr ? env->GetArrayLength(names) : 0;
+    for (jsize i = 0; i < count; i++) {
+        jstring jname = (jstring)env->GetObjectArrayElement(names, i);
+        jstring jvalue = (jstring)env->GetObjectArrayElement(values, i);
+        slotValues[jstringToString(env, jname)] = jstringToString(env, jvalue);
+        env->DeleteLocalRef(jname);
+        env->DeleteLocalRef(jvalue);
+    }
+    
+    LlamaConfig config;
+    LlamaConfig* configPtr = nullptr;
+    if (jconfig != nullptr) {
+        config = configFromJava(env, jconfig);
+        configPtr = &config;
+    }
+    
+    jclass callbackClass = env->GetObjectClass(callback);
+    jmethodID onTokenMethod = env->GetMethodID(callbackClass, "onToken", "(Ljava/lang/String;)V");
+    
+    if (onTokenMethod == nullptr) {
+        env->DeleteLocalRef(callbackClass);
+        throwException(env, "java/lang/NoSuchMethodException", "Callback must have onToken(String) method");
+        return;
+    }
+    
+    jlong contextHandle = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_templatesMutex);
+        auto it = g_templates.find(templateHandle);
+        contextHandle = it != g_templates.end() ? it->second.contextHandle : 0;
+    }
+    if (routeToScheduler(env, contextHandle, configPtr, [&](SequenceScheduler& scheduler, std::string& error) {
+            auto request = promptTemplate->submit(scheduler, slotValues, configPtr, RequestPriority::Normal);
+            error = request == nullptr ? promptTemplate->getLastError() : "";
+            return request;
+        }, callback, onTokenMethod, nullptr)) {
+        env->DeleteLocalRef(callbackClass);
+        return;
+    }
+    
+    jobject globalCallback = env->NewGlobalRef(callback);
+    
+    bool success = promptTemplate->generateStream(slotValues, [env, globalCallback, onTokenMethod](const std::string& token) {
+        jstring jtoken = env->NewStringUTF(token.c_str());
+        env->CallVoidMethod(globalCallback, onTokenMethod, jtoken);
+        env->DeleteLocalRef(jtoken);
+        
+        if (env->ExceptionCheck()) {
+            LOGE("Exception in token callback");
+        }
+    }, configPtr);
+    
+    env->DeleteGlobalRef(globalCallback);
+    env->DeleteLocalRef(callbackClass);
+    
+    if (!success) {
+        LOGE("Template generation error: %s", promptTemplate->getLastError().c_str());
+        throwGenerationError(env, promptTemplate->getLastError().c_str());
+    }
+}
+
+// ============================================================================
+// Chat Context Fitting
+// ============================================================================
+
+static std::vector<ChatMessage> chatFromJava(JNIEnv* env, jobjectArray roles, jobjectArray contents) {
+    std::vector<ChatMessage> messages;
+    const jsize count = roles != nullptr ? env->GetArrayLength(roles) : 0;
+    messages.reserve(count);
+    for (jsize i = 0; i < count; i++) {
+        jstring jrole = (jstring)env->GetObjectArrayElement(roles, i);
+        jstring jcontent = (jstring)env->GetObjectArrayElement(contents, i);
+        messages.push_back({jstringToString(env, jrole), jstringToString(env, jcontent)});
+        env->DeleteLocalRef(jrole);
+        env->DeleteLocalRef(jcontent);
+    }
+    return messages;
+}
+
+static ContextFitOptions fitOptionsFromJava(jint policy, jint keepLastTurns, jint reserveTokens) {
+    ContextFitOptions options;
+    if (policy >= static_cast<jint>(ContextFitPolicy::None) &&
+        policy <= static_cast<jint>(ContextFitPolicy::SystemAndLastTurns)) {
+        options.policy = static_cast<ContextFitPolicy>(policy);
+    }
+    options.keepLastTurns = keepLastTurns;
+    options.reserveTokens = reserveTokens;
+    return options;
+}
+
+JNIEXPORT jintArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeFitChat(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jobjectArray roles,
+    jobjectArray contents,
+    jint policy,
+    jint keepLastTurns,
+    jint reserveTokens,
+    jobject jconfig) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    LlamaConfig config;
+    LlamaConfig* configPtr = nullptr;
+    if (jconfig != nullptr) {
+        config = configFromJava(env, jconfig);
+        configPtr = &config;
+    }
+    
+    std::shared_ptr<ChatContextFitter> fitter = getChatFitter(handle, context);
+    std::vector<int32_t> tokens;
+    ContextFitResult result;
+    if (!fitter->fit(chatFromJava(env, roles, contents), fitOptionsFromJava(policy, keepLastTurns, reserveTokens),
+                     configPtr, tokens, &result)) {
+        throwGenerationError(env, fitter->getLastError().c_str());
+        return nullptr;
+    }
+    
+    // Counters followed by the kept message indices
+    std::vector<jint> values = {
+        static_cast<jint>(result.promptTokens),
+        static_cast<jint>(result.truncatedTokens),
+        static_cast<jint>(result.cachedMessages),
+        static_cast<jint>(result.tokenizedMessages),
+    };
+    values.insert(values.end(), result.keptMessages.begin(), result.keptMessages.end());
+    
+    jintArray array = env->NewIntArray(static_cast<jsize>(values.size()));
+    env->SetIntArrayRegion(array, 0, static_cast<jsize>(values.size()), values.data());
+    return array;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGenerateChatStream(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jobjectArray roles,
+    jobjectArray contents,
+    jint policy,
+    jint keepLastTurns,
+    jint reserveTokens,
+    jobject callback,
+    jobject jconfig) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return;
+    }
+    
+    if (callback == nullptr) {
+        throwException(env, "java/lang/IllegalArgumentException", "Callback cannot be null");
+        return;
+    }
+    
+    LlamaConfig config;
+    LlamaConfig* configPtr = nullptr;
+    if (jconfig != nullptr) {
+        config = configFromJava(env, jconfig);
+        configPtr = &config;
+    }
+    
+    jclass callbackClass = env->GetObjectClass(callback);
+    jmethodID onTokenMethod = env->GetMethodID(callbackClass, "onToken", "(Ljava/lang/String;)V");
+    
+    if (onTokenMethod == nullptr) {
+        env->DeleteLocalRef(callbackClass);
+        throwException(env, "java/lang/NoSuchMethodException", "Callback must have onToken(String) method");
+        return;
+    }
+    
+    std::shared_ptr<ChatContextFitter> fitter = getChatFitter(handle, context);
+    std::vector<ChatMessage> messages = chatFromJava(env, roles, contents);
+    ContextFitOptions options = fitOptionsFromJava(policy, keepLastTurns, reserveTokens);
+    if (routeToScheduler(env, handle, configPtr, [&](SequenceScheduler& scheduler, std::string& error) {
+            auto request = fitter->submit(scheduler, messages, options, configPtr, RequestPriority::Normal);
+            error = request == nullptr ? fitter->getLastError() : "";
+            return request;
+        }, callback, onTokenMethod, nullptr)) {
+        env->DeleteLocalRef(callbackClass);
+        return;
+    }
+    
+    jobject globalCallback = env->NewGlobalRef(callback);
+    
+    bool success = fitter->generateStream(messages, options,
+                                          [env, globalCallback, onTokenMethod](const std::string& token) {
+        jstring jtoken = env->NewStringUTF(token.c_str());
+        env->CallVoidMethod(globalCallback, onTokenMethod, jtoken);
+        env->DeleteLocalRef(jtoken);
+        
+        if (env->ExceptionCheck()) {
+            LOGE("Exception in token callback");
+        }
+    }, configPtr);
+    
+    env->DeleteGlobalRef(globalCallback);
+    env->DeleteLocalRef(callbackClass);
+    
+    if (!success) {
+        LOGE("Chat generation error: %s", fitter->getLastError().c_str());
+        throwGenerationError(env, fitter->getLastError().c_str());
+    }
+}
+
+// ============================================================================
+// Embeddings
+// ============================================================================
+
+JNIEXPORT jfloatArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeEmbed(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jobjectArray texts,
+    jint pooling) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    std::vector<std::string> inputs;
+    const jsize count = env->GetArrayLength(texts);
+    for (jsize i = 0; i < count; i++) {
+        jstring jtext = static_cast<jstring>(env->GetObjectArrayElement(texts, i));
+        inputs.push_back(jstringToString(env, jtext));
+        env->DeleteLocalRef(jtext);
+    }
+    
+    std::vector<std::vector<float>> vectors;
+    if (std::shared_ptr<SequenceScheduler> scheduler = findScheduler(handle)) {
+        // Embedding directly would take cells from the scheduler's sequences
+        std::shared_ptr<ScheduledRequest> request =
+            scheduler->submitEmbedding(inputs, RequestPriority::Normal, static_cast<EmbeddingPooling>(pooling));
+        if (request == nullptr) {
+            throwGenerationError(env, scheduler->getLastError().c_str());
+            return nullptr;
+        }
+        request->wait();
+        if (!request->succeeded() || request->finishReason() == "cancelled") {
+            std::string error = request->succeeded() ? "Embedding request was cancelled" : request->error();
+            throwGenerationError(env, error.c_str());
+            return nullptr;
+        }
+        vectors = request->embeddings();
+    } else if (!context->embed(inputs, static_cast<EmbeddingPooling>(pooling), vectors)) {
+        throwGenerationError(env, context->getLastError().c_str());
+        return nullptr;
+    }
+    
+    // All vectors back to back; each is length / count floats
+    std::vector<jfloat> values;
+    for (const std::vector<float>& vector : vectors) {
+        values.insert(values.end(), vector.begin(), vector.end());
+    }
+    jfloatArray result = env->NewFloatArray(static_cast<jsize>(values.size()));
+    if (result != nullptr && !values.empty()) {
+        env->SetFloatArrayRegion(result, 0, static_cast<jsize>(values.size()), values.data());
+    }
+    return result;
+}
+
+// ============================================================================
+// Document Index
+// ============================================================================
+
+JNIEXPORT jlongArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeIngestDocuments(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring indexDir,
+    jobjectArray documentPaths,
+    jint chunkTokens,
+    jint overlapTokens,
+    jboolean prune,
+    jobject callback) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    std::vector<std::string> paths;
+    const jsize count = env->GetArrayLength(documentPaths);
+    for (jsize i = 0; i < count; i++) {
+        jstring jpath = static_cast<jstring>(env->GetObjectArrayElement(documentPaths, i));
+        paths.push_back(jstringToString(env, jpath));
+        env->DeleteLocalRef(jpath);
+    }
+    
+    IngestOptions options;
+    options.chunkTokens = chunkTokens;
+    options.overlapTokens = overlapTokens;
+    options.prune = prune == JNI_TRUE;
+    
+    IngestProgressCallback onProgress;
+    if (callback != nullptr) {
+        jclass callbackClass = env->GetObjectClass(callback);
+        jmethodID onProgressMethod = env->GetMethodID(callbackClass, "onProgress", "(II)Z");
+        env->DeleteLocalRef(callbackClass);
+        if (onProgressMethod == nullptr) {
+            throwException(env, "java/lang/NoSuchMethodException", "Callback must have onProgress(int, int) method");
+            return nullptr;
+        }
+        
+        // Called on this thread; false (or an exception) cancels
+        onProgress = [env, callback, onProgressMethod](size_t done, size_t total) {
+            jboolean keepGoing = env->CallBooleanMethod(callback, onProgressMethod,
+                                                        static_cast<jint>(done), static_cast<jint>(total));
+            if (env->ExceptionCheck()) {
+                LOGE("Exception in ingestion progress callback");
+                env->ExceptionClear();
+                return false;
+            }
+            return keepGoing == JNI_TRUE;
+        };
+    }
+    
+    IngestStats stats;
+    DocumentIngester ingester(*context);
+    bool success;
+    {
+        std::lock_guard<std::mutex> lock(g_indexMutex);
+        success = ingester.ingest(jstringToString(env, indexDir), paths, options, onProgress, stats);
+    }
+    if (!success) {
+        throwGenerationError(env, ingester.getLastError().c_str());
+        return nullptr;
+    }
+    
+    jlong values[] = {
+        static_cast<jlong>(stats.files),
+        static_cast<jlong>(stats.unchangedFiles),
+        static_cast<jlong>(stats.failedFiles),
+        static_cast<jlong>(stats.removedFiles),
+        static_cast<jlong>(stats.chunks),
+        static_cast<jlong>(stats.embeddedChunks),
+        static_cast<jlong>(stats.reusedChunks),
+        static_cast<jlong>(stats.tokens),
+        static_cast<jlong>(stats.decodes),
+        static_cast<jlong>(stats.elapsedMs),
+    };
+    const jsize size = static_cast<jsize>(sizeof(values) / sizeof(values[0]));
+    jlongArray array = env->NewLongArray(size);
+    env->SetLongArrayRegion(array, 0, size, values);
+    return array;
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeSearchIndex(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring indexDir,
+    jstring query,
+    jint limit,
+    jdoubleArray hitValues) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    const jsize capacity = hitValues != nullptr ? env->GetArrayLength(hitValues) / 3 : 0;
+    std::vector<IndexHit> hits;
+    DocumentIngester ingester(*context);
+    bool success;
+    {
+        std::lock_guard<std::mutex> lock(g_indexMutex);
+        success = ingester.search(jstringToString(env, indexDir), jstringToString(env, query),
+                                  static_cast<size_t>(std::min(limit, capacity)), hits);
+    }
+    if (!success) {
+        throwGenerationError(env, ingester.getLastError().c_str());
+        return nullptr;
+    }
+    
+    // Score, byte offset and byte length of each hit
+    std::vector<jdouble> values;
+    jclass stringClass = env->FindClass("java/lang/String");
+    jobjectArray paths = env->NewObjectArray(static_cast<jsize>(hits.size()), stringClass, nullptr);
+    for (size_t i = 0; i < hits.size(); i++) {
+        jstring jpath = stringToJstring(env, hits[i].path);
+        env->SetObjectArrayElement(paths, static_cast<jsize>(i), jpath);
+        env->DeleteLocalRef(jpath);
+        values.push_back(hits[i].score);
+        values.push_back(static_cast<jdouble>(hits[i].offset));
+        values.push_back(static_cast<jdouble>(hits[i].length));
+    }
+    env->DeleteLocalRef(stringClass);
+    if (!values.empty()) {
+        env->SetDoubleArrayRegion(hitValues, 0, static_cast<jsize>(values.size()), values.data());
+    }
+    return paths;
+}
+
+// ============================================================================
+// Control Vectors
+// ============================================================================
+
+JNIEXPORT jint JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeCreateControlVectorSet(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jobjectArray vectorPaths,
+    jfloatArray scales,
+    jint layerStart,
+    jint layerEnd) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    
+    const jsize count = env->GetArrayLength(vectorPaths);
+    if (env->GetArrayLength(scales) != count) {
+        throwException(env, "java/lang/IllegalArgumentException", "One scale per control vector is required");
+        return 0;
+    }
+    
+    std::vector<jfloat> scaleValues(count);
+    env->GetFloatArrayRegion(scales, 0, count, scaleValues.data());
+    std::vector<ControlVectorSpec> vectors(count);
+    for (jsize i = 0; i < count; i++) {
+        jstring jpath = static_cast<jstring>(env->GetObjectArrayElement(vectorPaths, i));
+        vectors[i].path = jstringToString(env, jpath);
+        vectors[i].scale = scaleValues[i];
+        env->DeleteLocalRef(jpath);
+    }
+    
+    const int id = context->createControlVectorSet(vectors, layerStart, layerEnd);
+    if (id == 0) {
+        throwGenerationError(env, context->getLastError().c_str());
+    }
+    return id;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeReleaseControlVectorSet(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jint setId) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context != nullptr) {
+        context->releaseControlVectorSet(setId);
+    }
+}
+
+// ============================================================================
+// Generation Control
+// ============================================================================
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeCancelGeneration(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context != nullptr) {
+        context->cancelGeneration();
+    }
+    
+    std::lock_guard<std::mutex> lock(g_routedRequestsMutex);
+    auto range = g_routedRequests.equal_range(handle);
+    for (auto it = range.first; it != range.second; ++it) {
+        it->second->cancel();
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeIsGenerating(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        return JNI_FALSE;
+    }
+    
+    return context->isGenerating() ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jintArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetSpeculationStats(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    SpeculationStats stats = context->getSpeculationStats();
+    jint values[4] = {
+        stats.forwardPasses,
+        stats.draftedTokens,
+        stats.acceptedTokens,
+        stats.generatedTokens
+    };
+    
+    jintArray result = env->NewIntArray(4);
+    env->SetIntArrayRegion(result, 0, 4, values);
+    return result;
+}
+
+JNIEXPORT jdoubleArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetGenerationStats(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    GenerationStats stats = context->getGenerationStats();
+    jdouble values[7] = {
+        static_cast<jdouble>(stats.tokens),
+        stats.paced ? 1.0 : 0.0,
+        stats.wallMs,
+        stats.cpuMs,
+        stats.sleptMs,
+        static_cast<jdouble>(stats.promptTokens),
+        stats.prefillMs
+    };
+    
+    jdoubleArray result = env->NewDoubleArray(7);
+    env->SetDoubleArrayRegion(result, 0, 7, values);
+    return result;
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetMemoryStats(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    MemoryStats stats = context->getMemoryStats();
+    std::vector<jlong> values = {
+        static_cast<jlong>(stats.modelBytes),
+        static_cast<jlong>(stats.modelMappedBytes),
+        static_cast<jlong>(stats.modelResidentBytes),
+        static_cast<jlong>(stats.kvCacheBytes),
+        static_cast<jlong>(stats.computeBufferBytes),
+        static_cast<jlong>(stats.outputBufferBytes),
+        static_cast<jlong>(stats.allocatorInUseBytes),
+        static_cast<jlong>(stats.allocatorMappedBytes),
+        static_cast<jlong>(stats.allocatorPeakBytes),
+        static_cast<jlong>(stats.rssBytes),
+        static_cast<jlong>(stats.peakRssBytes)
+    };
+    for (int cells : stats.sequenceCells) {
+        values.push_back(cells);
+    }
+    
+    jlongArray result = env->NewLongArray(static_cast<jsize>(values.size()));
+    env->SetLongArrayRegion(result, 0, static_cast<jsize>(values.size()), values.data());
+    return result;
+}
+
+// ============================================================================
+// Model Residency
+// ============================================================================
+
+JNIEXPORT jlong JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeCreateResidencyManager(
+    JNIEnv* /* env */,
+    jclass /* clazz */,
+    jlong budgetBytes) {
+    
+    std::lock_guard<std::mutex> lock(g_residencyMutex);
+    jlong handle = g_nextResidencyId++;
+    g_residencyManagers[handle] = std::make_unique<ModelResidencyManager>(
+        static_cast<size_t>(std::max<jlong>(budgetBytes, 0)));
+    LOGI("Created residency manager with handle: %lld", (long long)handle);
+    return handle;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeDestroyResidencyManager(
+    JNIEnv* /* env */,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    // Models still acquired stay loaded until their LlamaModel is closed
+    std::unique_ptr<ModelResidencyManager> manager;
+    {
+        std::lock_guard<std::mutex> lock(g_residencyMutex);
+        auto it = g_residencyManagers.find(handle);
+        if (it == g_residencyManagers.end()) {
+            LOGW("Residency manager not found for destruction: %lld", (long long)handle);
+            return;
+        }
+        manager = std::move(it->second);
+        g_residencyManagers.erase(it);
+    }
+    LOGI("Residency manager destroyed: %lld", (long long)handle);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeRegisterResidentModel(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring name,
+    jstring modelPath,
+    jobject jconfig) {
+    
+    ModelResidencyManager* manager = getResidencyManager(handle);
+    if (manager == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid residency manager handle");
+        return JNI_FALSE;
+    }
+    
+    LlamaConfig config = configFromJava(env, jconfig);
+    if (!manager->registerModel(jstringToString(env, name), jstringToString(env, modelPath), config)) {
+        throwGenerationError(env, manager->getLastError().c_str());
+        return JNI_FALSE;
+    }
+    return JNI_TRUE;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeUnregisterResidentModel(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring name) {
+    
+    ModelResidencyManager* manager = getResidencyManager(handle);
+    if (manager == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid residency manager handle");
+        return JNI_FALSE;
+    }
+    return manager->unregisterModel(jstringToString(env, name)) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeAcquireResidentModel(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring name) {
+    
+    ModelResidencyManager* manager = getResidencyManager(handle);
+    if (manager == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid residency manager handle");
+        return 0;
+    }
+    
+    std::shared_ptr<LlamaContextWrapper> context = manager->acquire(jstringToString(env, name));
+    if (!context) {
+        throwGenerationError(env, manager->getLastError().c_str());
+        return 0;
+    }
+    
+    // The context handle keeps the model pinned until it is destroyed
+    std::lock_guard<std::mutex> lock(g_contextsMutex);
+    jlong contextHandle = g_nextContextId++;
+    g_contexts[contextHandle] = std::move(context);
+    g_residentContexts.insert(contextHandle);
+    LOGI("Acquired resident model with context handle: %lld", (long long)contextHandle);
+    return contextHandle;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeEvictResidentModel(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring name) {
+    
+    ModelResidencyManager* manager = getResidencyManager(handle);
+    if (manager == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid residency manager handle");
+        return JNI_FALSE;
+    }
+    return manager->evict(jstringToString(env, name)) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeSetResidencyBudget(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jlong budgetBytes) {
+    
+    ModelResidencyManager* manager = getResidencyManager(handle);
+    if (manager == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid residency manager handle");
+        return;
+    }
+    manager->setBudget(static_cast<size_t>(std::max<jlong>(budgetBytes, 0)));
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetResidencyStats(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    ModelResidencyManager* manager = getResidencyManager(handle);
+    if (manager == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid residency manager handle");
+        return nullptr;
+    }
+    
+    ResidencyStats stats = manager->getStats();
+    const jlong values[] = {
+        static_cast<jlong>(stats.budgetBytes),
+        static_cast<jlong>(stats.residentBytes),
+        static_cast<jlong>(stats.hibernatedBytes),
+        static_cast<jlong>(stats.registeredModels),
+        static_cast<jlong>(stats.residentModels),
+        static_cast<jlong>(stats.hits),
+        static_cast<jlong>(stats.loads),
+        static_cast<jlong>(stats.loadFailures),
+        static_cast<jlong>(stats.evictions),
+        static_cast<jlong>(stats.cheapEvictions),
+        static_cast<jlong>(stats.overBudgetLoads)
+    };
+    const jsize count = static_cast<jsize>(sizeof(values) / sizeof(values[0]));
+    jlongArray result = env->NewLongArray(count);
+    env->SetLongArrayRegion(result, 0, count, values);
+    return result;
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetResidentModels(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jlongArray modelValues) {
+    
+    ModelResidencyManager* manager = getResidencyManager(handle);
+    if (manager == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid residency manager handle");
+        return nullptr;
+    }
+    
+    std::vector<ModelResidencyInfo> models = manager->getModels();
+    const jsize capacity = modelValues != nullptr ? env->GetArrayLength(modelValues) / 8 : 0;
+    if (models.size() > static_cast<size_t>(capacity)) {
+        models.resize(static_cast<size_t>(capacity));
+    }
+    
+    // Name and path of each model, then its flags, sizes and counters
+    std::vector<jlong> values;
+    jclass stringClass = env->FindClass("java/lang/String");
+    jobjectArray names = env->NewObjectArray(static_cast<jsize>(models.size() * 2), stringClass, nullptr);
+    for (size_t i = 0; i < models.size(); i++) {
+        const ModelResidencyInfo& info = models[i];
+        jstring jname = stringToJstring(env, info.name);
+        jstring jpath = stringToJstring(env, info.modelPath);
+        env->SetObjectArrayElement(names, static_cast<jsize>(i * 2), jname);
+        env->SetObjectArrayElement(names, static_cast<jsize>(i * 2 + 1), jpath);
+        env->DeleteLocalRef(jname);
+        env->DeleteLocalRef(jpath);
+        values.push_back(info.resident ? 1 : 0);
+        values.push_back(info.pinned ? 1 : 0);
+        values.push_back(info.cheapToEvict ? 1 : 0);
+        values.push_back(static_cast<jlong>(info.bytes));
+        values.push_back(static_cast<jlong>(info.hibernatedBytes));
+        values.push_back(static_cast<jlong>(info.lastUsed));
+        values.push_back(static_cast<jlong>(info.loadCount));
+        values.push_back(static_cast<jlong>(info.evictionCount));
+    }
+    env->DeleteLocalRef(stringClass);
+    if (!values.empty()) {
+        env->SetLongArrayRegion(modelValues, 0, static_cast<jsize>(values.size()), values.data());
+    }
+    return names;
+}
+
+// ============================================================================
+// Local API Server
+// ============================================================================
+
+JNIEXPORT jint JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeStartServer(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring socketPath,
+    jint port,
+    jstring modelName,
+    jobject jconfig) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return -1;
+    }
+    
+    ApiServerConfig serverConfig;
+    serverConfig.socketPath = jstringToString(env, socketPath);
+    serverConfig.port = port;
+    serverConfig.modelName = jstringToString(env, modelName);
+    // Without explicit defaults, requests that set no sampling fields run
+    // with the configuration the model was loaded with
+    serverConfig.defaults = jconfig != nullptr ? configFromJava(env, jconfig) : context->getConfig();
+    
+    stopServer(handle);
+    
+    // Requests from the server share the scheduler with prioritised
+    // generation on the same model
+    std::string schedulerError;
+    std::shared_ptr<SequenceScheduler> scheduler = getScheduler(handle, *context, schedulerError);
+    if (scheduler == nullptr) {
+        std::string error = "Failed to start server: " + schedulerError;
+        LOGE("%s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return -1;
+    }
+    
+    auto server = std::make_unique<ApiServer>(*context, serverConfig, scheduler);
+    if (!server->start()) {
+        std::string error = "Failed to start server: " + server->getLastError();
+        LOGE("%s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return -1;
+    }
+    
+    jint boundPort = server->getPort();
+    
+    std::lock_guard<std::mutex> lock(g_serversMutex);
+    g_servers[handle] = std::move(server);
+    return boundPort;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeStopServer(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    stopServer(handle);
+}
+
+// ============================================================================
+// Model Verification
+// ============================================================================
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeVerifyModel(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jstring modelPath,
+    jstring digestCachePath,
+    jint threads) {
+    
+    ModelVerifyOptions options;
+    options.threads = threads;
+    options.digestCachePath = jstringToString(env, digestCachePath);
+    
+    ModelVerification verification;
+    std::string error;
+    if (!verifyModelFile(jstringToString(env, modelPath), options, verification, error)) {
+        throwException(env, "java/io/IOException", error.c_str());
+        return nullptr;
+    }
+    
+    jclass stringClass = env->FindClass("java/lang/String");
+    jobjectArray result = env->NewObjectArray(2, stringClass, nullptr);
+    jstring digest = stringToJstring(env, verification.digest);
+    jstring structureError = stringToJstring(env, verification.structureError);
+    env->SetObjectArrayElement(result, 0, digest);
+    env->SetObjectArrayElement(result, 1, structureError);
+    env->DeleteLocalRef(digest);
+    env->DeleteLocalRef(structureError);
+    env->DeleteLocalRef(stringClass);
+    return result;
+}
+
+// ============================================================================
+// Error Handling
+// ============================================================================
+
+JNIEXPORT jstring JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetLastError(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        return stringToJstring(env, "Invalid context handle");
+    }
+    
+    return stringToJstring(env, context->getLastError());
+}
+
+// ============================================================================
+// Registration
+// ============================================================================
+
+// Bound by the JNI shim (llama_jni_shim.cpp), which dlopens this library on
+// first use; nativeGetVersion and nativeGetMinLogLevel stay in the shim.
+// Signatures must match the external declarations in LlamaNative.kt.
+#define SIG_STRING "Ljava/lang/String;"
+#define SIG_CONFIG "Lcom/llamakotlin/android/LlamaNative$NativeConfig;"
+#define SIG_TOKEN_CALLBACK "Lcom/llamakotlin/android/LlamaNative$NativeTokenCallback;"
+#define SIG_SCHEDULED_CALLBACK "Lcom/llamakotlin/android/LlamaNative$NativeScheduledCallback;"
+#define SIG_LOAD_PROGRESS_CALLBACK "Lcom/llamakotlin/android/LlamaNative$NativeLoadProgressCallback;"
+#define SIG_INGEST_PROGRESS_CALLBACK "Lcom/llamakotlin/android/LlamaNative$NativeIngestProgressCallback;"
+#define NATIVE_METHOD(name, signature) \
+    { #name, signature, reinterpret_cast<void*>(Java_com_llamakotlin_android_LlamaNative_##name) }
+
+static const JNINativeMethod NATIVE_METHODS[] = {
+    NATIVE_METHOD(nativeSetLogLevel, "(I)V"),
+    NATIVE_METHOD(nativeGetLogLevel, "()I"),
+    NATIVE_METHOD(nativeSetLogRateLimit, "(I)V"),
+    NATIVE_METHOD(nativeFlushLog, "()V"),
+    NATIVE_METHOD(nativeCreateContext, "()J"),
+    NATIVE_METHOD(nativeDestroyContext, "(J)V"),
+    NATIVE_METHOD(nativeLoadModel, "(J" SIG_STRING SIG_CONFIG ")Z"),
+    NATIVE_METHOD(nativeLoadModelShards, "(J[" SIG_STRING SIG_CONFIG SIG_LOAD_PROGRESS_CALLBACK ")Z"),
+    NATIVE_METHOD(nativeSwapModel, "(J" SIG_STRING SIG_CONFIG ")Z"),
+    NATIVE_METHOD(nativeUnloadModel, "(J)V"),
+    NATIVE_METHOD(nativeIsModelLoaded, "(J)Z"),
+    NATIVE_METHOD(nativeGenerate, "(J" SIG_STRING SIG_CONFIG ")" SIG_STRING),
+    NATIVE_METHOD(nativeGenerateStream, "(J" SIG_STRING SIG_TOKEN_CALLBACK SIG_CONFIG ")V"),
+    NATIVE_METHOD(nativeGenerateScheduledStream, "(J" SIG_STRING "I" SIG_SCHEDULED_CALLBACK SIG_CONFIG ")V"),
+    NATIVE_METHOD(nativeGenerateCascadeStream, "(JJ" SIG_STRING SIG_TOKEN_CALLBACK "IFI" SIG_CONFIG ")Z"),
+    NATIVE_METHOD(nativeCompileTemplate, "(J" SIG_STRING ")J"),
+    NATIVE_METHOD(nativeReleaseTemplate, "(J)V"),
+    NATIVE_METHOD(nativeGetTemplateSlots, "(J)[" SIG_STRING),
+    NATIVE_METHOD(nativeGenerateTemplateStream, "(J[" SIG_STRING "[" SIG_STRING SIG_TOKEN_CALLBACK SIG_CONFIG ")V"),
+    NATIVE_METHOD(nativeFitChat, "(J[" SIG_STRING "[" SIG_STRING "III" SIG_CONFIG ")[I"),
+    NATIVE_METHOD(nativeGenerateChatStream, "(J[" SIG_STRING "[" SIG_STRING "III" SIG_TOKEN_CALLBACK SIG_CONFIG ")V"),
+    NATIVE_METHOD(nativeEmbed, "(J[" SIG_STRING "I)[F"),
+    NATIVE_METHOD(nativeIngestDocuments, "(J" SIG_STRING "[" SIG_STRING "IIZ" SIG_INGEST_PROGRESS_CALLBACK ")[J"),
+    NATIVE_METHOD(nativeSearchIndex, "(J" SIG_STRING SIG_STRING "I[D)[" SIG_STRING),
+    NATIVE_METHOD(nativeCreateControlVectorSet, "(J[" SIG_STRING "[FII)I"),
+    NATIVE_METHOD(nativeReleaseControlVectorSet, "(JI)V"),
+    NATIVE_METHOD(nativeCancelGeneration, "(J)V"),
+    NATIVE_METHOD(nativeIsGenerating, "(J)Z"),
+    NATIVE_METHOD(nativeGetSpeculationStats, "(J)[I"),
+    NATIVE_METHOD(nativeGetGenerationStats, "(J)[D"),
+    NATIVE_METHOD(nativeGetMemoryStats, "(J)[J"),
+    NATIVE_METHOD(nativeCreateResidencyManager, "(J)J"),
+    NATIVE_METHOD(nativeDestroyResidencyManager, "(J)V"),
+    NATIVE_METHOD(nativeRegisterResidentModel, "(J" SIG_STRING SIG_STRING SIG_CONFIG ")Z"),
+    NATIVE_METHOD(nativeUnregisterResidentModel, "(J" SIG_STRING ")Z"),
+    NATIVE_METHOD(nativeAcquireResidentModel, "(J" SIG_STRING ")J"),
+    NATIVE_METHOD(nativeEvictResidentModel, "(J" SIG_STRING ")Z"),
+    NATIVE_METHOD(nativeSetResidencyBudget, "(JJ)V"),
+    NATIVE_METHOD(nativeGetResidencyStats, "(J)[J"),
+    NATIVE_METHOD(nativeGetResidentModels, "(J[J)[" SIG_STRING),
+    NATIVE_METHOD(nativeStartServer, "(J" SIG_STRING "I" SIG_STRING SIG_CONFIG ")I"),
+    NATIVE_METHOD(nativeStopServer, "(J)V"),
+    NATIVE_METHOD(nativeVerifyModel, "(" SIG_STRING SIG_STRING "I)[" SIG_STRING),
+    NATIVE_METHOD(nativeGetLastError, "(J)" SIG_STRING),
+};
+
+JNIEXPORT jint llamaAndroidRegisterNatives(JNIEnv* env, jclass clazz) {
+    const jint count = static_cast<jint>(sizeof(NATIVE_METHODS) / sizeof(NATIVE_METHODS[0]));
+    const jint result = env->RegisterNatives(clazz, NATIVE_METHODS, count);
+    LOGI("Inference engine loaded, %d native methods %s", count, result == JNI_OK ? "bound" : "failed to bind");
+    return result;
 }
 
 } // extern "C"
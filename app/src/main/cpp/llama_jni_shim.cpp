@@ -0,0 +1,85 @@
+// JNI shim, the library LlamaNative loads with System.loadLibrary.
+//
+// It is deliberately small: it answers the queries that do not need the
+// inference engine (version, compiled-in log level) and loads the engine,
+// libllama-android-engine.so with the statically linked llama.cpp and ggml
+// code, on first real use. The engine then binds the remaining LlamaNative
+// methods with RegisterNatives, so calls do not pass through the shim.
+
+#include <jni.h>
+#include <dlfcn.h>
+#include <string>
+
+#include "library_version.h"
+#include "llama_log.h"
+
+using namespace llamaandroid;
+
+static const char* ENGINE_LIBRARY = "libllama-android-engine.so";
+static const char* ENGINE_REGISTER_SYMBOL = "llamaAndroidRegisterNatives";
+
+// Engine entry point: binds the engine's LlamaNative methods, returns JNI_OK on success
+using EngineRegisterFunction = jint (*)(JNIEnv* env, jclass clazz);
+
+// Set once the engine's natives are bound; the Kotlin side serialises loading
+static void* g_engine = nullptr;
+
+static void throwLinkError(JNIEnv* env, const std::string& message) {
+    jclass errorClass = env->FindClass("java/lang/UnsatisfiedLinkError");
+    if (errorClass != nullptr) {
+        env->ThrowNew(errorClass, message.c_str());
+        env->DeleteLocalRef(errorClass);
+    }
+}
+
+extern "C" {
+
+JNIEXPORT jstring JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetVersion(
+    JNIEnv* env,
+    jclass /* clazz */) {
+    return env->NewStringUTF(libraryVersion().c_str());
+}
+
+JNIEXPORT jint JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeGetMinLogLevel(
+    JNIEnv* /* env */,
+    jclass /* clazz */) {
+    return LLAMA_LOG_MIN_LEVEL;
+}
+
+JNIEXPORT void JNICALL
+Java_com_llamakotlin_android_LlamaNative_nativeLoadEngine(
+    JNIEnv* env,
+    jclass clazz) {
+    if (g_engine != nullptr) {
+        return;
+    }
+    
+    // Found through the app's linker namespace, like System.loadLibrary
+    void* engine = dlopen(ENGINE_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+    if (engine == nullptr) {
+        const char* error = dlerror();
+        throwLinkError(env, error != nullptr ? error : ENGINE_LIBRARY);
+        return;
+    }
+    
+    auto registerNatives = reinterpret_cast<EngineRegisterFunction>(dlsym(engine, ENGINE_REGISTER_SYMBOL));
+    if (registerNatives == nullptr) {
+        dlclose(engine);
+        throwLinkError(env, std::string(ENGINE_LIBRARY) + " does not export " + ENGINE_REGISTER_SYMBOL);
+        return;
+    }
+    
+    // Some methods may already be bound on failure, so the engine stays loaded
+    if (registerNatives(env, clazz) != JNI_OK) {
+        if (!env->ExceptionCheck()) {
+            throwLinkError(env, std::string("Failed to register the natives of ") + ENGINE_LIBRARY);
+        }
+        return;
+    }
+    
+    g_engine = engine;
+}
+
+} // extern "C"
@@ -0,0 +1,312 @@
+#define LOG_TAG "LlamaLog"
+#include "llama_log.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#if defined(__ANDROID__)
+#include <android/log.h>
+#endif
+
+#if LLAMA_AVAILABLE
+#include "llama.h"
+#endif
+
+namespace llamaandroid {
+
+// Longest message kept; longer ones are truncated
+static const size_t LOG_MESSAGE_MAX = 480;
+
+// Queued messages (power of two); further ones are dropped until the writer catches up
+static const size_t LOG_QUEUE_SIZE = 128;
+
+// Longest the writer thread sleeps if a wake-up is missed
+static const int LOG_IDLE_WAIT_MS = 250;
+
+std::atomic<int> g_logLevel{LLAMA_LOG_MIN_LEVEL};
+static std::atomic<int> g_rateLimit{50};
+static std::atomic<bool> g_async{true};
+
+static void emit(int level, const char* tag, const char* text) {
+#if defined(__ANDROID__)
+    static const int priorities[] = {ANDROID_LOG_DEBUG, ANDROID_LOG_INFO, ANDROID_LOG_WARN, ANDROID_LOG_ERROR};
+    __android_log_write(priorities[level], tag, text);
+#else
+    // Host builds (tools, out-of-process host, benchmarks) log to stderr
+    static const char names[] = "DIWE";
+    std::fprintf(stderr, "%c/%s: %s\n", names[level], tag, text);
+#endif
+}
+
+namespace {
+
+struct LogRecord {
+    std::atomic<size_t> sequence{0};
+    int level = 0;
+    const char* tag = nullptr;  // LOG_TAG literals live as long as the process
+    char text[LOG_MESSAGE_MAX];
+};
+
+/**
+ * Bounded multi-producer queue (Vyukov). A producer claims a slot with one
+ * compare-and-swap, formats into it and publishes it by advancing the
+ * slot's sequence number; nothing on the producer side takes a lock.
+ * Slots are drained by the writer thread, or by flushLog(), under a mutex
+ * that only consumers use.
+ */
+class LogQueue {
+public:
+    LogQueue() {
+        for (size_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+            records_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    LogRecord* claim(size_t& pos) {
+        pos = enqueuePos_.load(std::memory_order_relaxed);
+        while (true) {
+            LogRecord& record = records_[pos & (LOG_QUEUE_SIZE - 1)];
+            const size_t sequence = record.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return &record;
+                }
+            } else if (diff < 0) {
+                return nullptr;  // Full
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    void publish(LogRecord* record, size_t pos) {
+        record->sequence.store(pos + 1, std::memory_order_release);
+        if (idle_.load(std::memory_order_acquire)) {
+            wakeCv_.notify_one();
+        }
+    }
+    
+    void drain() {
+        std::lock_guard<std::mutex> lock(drainMutex_);
+        while (true) {
+            LogRecord& record = records_[dequeuePos_ & (LOG_QUEUE_SIZE - 1)];
+            if (record.sequence.load(std::memory_order_acquire) != dequeuePos_ + 1) {
+                break;
+            }
+            emit(record.level, record.tag, record.text);
+            record.sequence.store(dequeuePos_ + LOG_QUEUE_SIZE, std::memory_order_release);
+            dequeuePos_++;
+        }
+        
+        const uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            char text[64];
+            std::snprintf(text, sizeof(text), "%llu log messages dropped", static_cast<unsigned long long>(dropped));
+            emit(LLAMA_LOG_LEVEL_WARN, LOG_TAG, text);
+        }
+    }
+    
+    bool empty() {
+        std::lock_guard<std::mutex> lock(drainMutex_);
+        const LogRecord& record = records_[dequeuePos_ & (LOG_QUEUE_SIZE - 1)];
+        return record.sequence.load(std::memory_order_acquire) != dequeuePos_ + 1;
+    }
+    
+    void countDrop() {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    void startWriter() {
+        std::call_once(started_, [this] {
+            std::thread([this] { run(); }).detach();
+            std::atexit(flushLog);
+        });
+    }
+
+private:
+    LogRecord records_[LOG_QUEUE_SIZE];
+    std::atomic<size_t> enqueuePos_{0};
+    size_t dequeuePos_ = 0;  // Guarded by drainMutex_
+    std::mutex drainMutex_;
+    std::atomic<uint64_t> dropped_{0};
+    
+    std::atomic<bool> idle_{false};
+    std::mutex wakeMutex_;
+    std::condition_variable wakeCv_;
+    std::once_flag started_;
+    
+    void run() {
+        while (true) {
+            drain();
+            std::unique_lock<std::mutex> lock(wakeMutex_);
+            idle_.store(true, std::memory_order_release);
+            if (empty()) {
+                wakeCv_.wait_for(lock, std::chrono::milliseconds(LOG_IDLE_WAIT_MS));
+            }
+            idle_.store(false, std::memory_order_relaxed);
+        }
+    }
+};
+
+} // namespace
+
+static LogQueue& logQueue() {
+    // Never destroyed: the writer thread and late log calls may outlive
+    // static destructors
+    static LogQueue* queue = new LogQueue();
+    return *queue;
+}
+
+static uint32_t currentSecond() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(now).count());
+}
+
+void setLogLevel(int level) {
+    g_logLevel.store(level, std::memory_order_relaxed);
+}
+
+int getLogLevel() {
+    return g_logLevel.load(std::memory_order_relaxed);
+}
+
+void setLogRateLimit(int perSecond) {
+    g_rateLimit.store(perSecond < 0 ? 0 : perSecond, std::memory_order_relaxed);
+}
+
+void setLogAsync(bool async) {
+    g_async.store(async, std::memory_order_relaxed);
+    if (!async) {
+        flushLog();
+    }
+}
+
+void flushLog() {
+    logQueue().drain();
+}
+
+static int formatMessage(char* out, size_t size, uint32_t suppressed, const char* format, va_list args) {
+    int n = std::vsnprintf(out, size, format, args);
+    if (n < 0) {
+        out[0] = '\0';
+        n = 0;
+    }
+    size_t length = std::min(static_cast<size_t>(n), size - 1);
+    if (suppressed > 0) {
+        std::snprintf(out + length, size - length, " (%u similar messages suppressed)", suppressed);
+    }
+    return n;
+}
+
+void logWrite(int level, const char* tag, LogSite& site, const char* format, ...) {
+    if (level < LLAMA_LOG_LEVEL_DEBUG || level > LLAMA_LOG_LEVEL_ERROR) {
+        return;
+    }
+    
+    uint32_t suppressed = 0;
+    const int limit = g_rateLimit.load(std::memory_order_relaxed);
+    if (limit > 0) {
+        // Concurrent callers may both reset the budget at a second
+        // boundary; the count is approximate by design
+        const uint32_t now = currentSecond() + 1;
+        if (site.second.load(std::memory_order_relaxed) != now) {
+            site.second.store(now, std::memory_order_relaxed);
+            site.count.store(0, std::memory_order_relaxed);
+        }
+        if (site.count.fetch_add(1, std::memory_order_relaxed) >= static_cast<uint32_t>(limit) &&
+            level < LLAMA_LOG_LEVEL_ERROR) {
+            site.suppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+    }
+    
+    va_list args;
+    va_start(args, format);
+    
+    LogQueue& queue = logQueue();
+    if (level < LLAMA_LOG_LEVEL_ERROR && g_async.load(std::memory_order_relaxed)) {
+        queue.startWriter();
+        size_t pos = 0;
+        LogRecord* record = queue.claim(pos);
+        if (record != nullptr) {
+            record->level = level;
+            record->tag = tag;
+            formatMessage(record->text, sizeof(record->text), suppressed, format, args);
+            queue.publish(record, pos);
+        } else {
+            queue.countDrop();
+        }
+        va_end(args);
+        return;
+    }
+    
+    // Errors (and everything in synchronous mode) go out in order before
+    // the caller continues, so they survive a crash right after
+    char text[LOG_MESSAGE_MAX];
+    formatMessage(text, sizeof(text), suppressed, format, args);
+    va_end(args);
+    queue.drain();
+    emit(level, tag, text);
+}
+
+static thread_local LlamaLogTap g_tap = nullptr;
+static thread_local void* g_tapUser = nullptr;
+
+void setLlamaLogTap(LlamaLogTap tap, void* user) {
+    g_tap = tap;
+    g_tapUser = user;
+}
+
+#if LLAMA_AVAILABLE
+static void llamaLogCallback(ggml_log_level level, const char* text, void* /*userData*/) {
+    if (g_tap != nullptr) {
+        g_tap(text, g_tapUser);
+    }
+    
+    // Continuation fragments keep the level of the line they continue
+    static thread_local int lastLevel = LLAMA_LOG_LEVEL_INFO;
+    static LogSite sites[4];
+    
+    int mapped;
+    switch (level) {
+        case GGML_LOG_LEVEL_DEBUG: mapped = LLAMA_LOG_LEVEL_DEBUG; break;
+        case GGML_LOG_LEVEL_INFO:  mapped = LLAMA_LOG_LEVEL_INFO; break;
+        case GGML_LOG_LEVEL_WARN:  mapped = LLAMA_LOG_LEVEL_WARN; break;
+        case GGML_LOG_LEVEL_ERROR: mapped = LLAMA_LOG_LEVEL_ERROR; break;
+        case GGML_LOG_LEVEL_CONT:  mapped = lastLevel; break;
+        default: return;
+    }
+    lastLevel = mapped;
+    
+    if (mapped < LLAMA_LOG_MIN_LEVEL || !logEnabled(mapped)) {
+        return;
+    }
+    
+    // Lines arrive with their newline; progress dots arrive one by one
+    size_t length = std::strlen(text);
+    while (length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r')) {
+        length--;
+    }
+    if (std::strspn(text, ".") >= length) {
+        return;
+    }
+    
+    logWrite(mapped, "llama.cpp", sites[mapped], "%.*s", static_cast<int>(length), text);
+}
+#endif
+
+void routeLlamaLogs() {
+#if LLAMA_AVAILABLE
+    llama_log_set(llamaLogCallback, nullptr);
+#endif
+}
+
+} // namespace llamaandroid
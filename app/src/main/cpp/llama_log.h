@@ -0,0 +1,105 @@
+#ifndef LLAMA_LOG_H
+#define LLAMA_LOG_H
+
+// Logging macros shared by all native sources.
+// Define LOG_TAG before including this header.
+//
+// Messages below LLAMA_LOG_MIN_LEVEL compile to nothing, arguments
+// included (set with the LLAMA_ANDROID_LOG_LEVEL CMake option; release
+// builds keep INFO and above). The rest are filtered by a runtime level,
+// rate-limited per call site and handed to a writer thread through a
+// lock-free queue, so a log line on the decode path never waits for logd
+// or stderr. Errors flush the queue and are written synchronously.
+
+#include <atomic>
+#include <cstdint>
+
+#define LLAMA_LOG_LEVEL_DEBUG 0
+#define LLAMA_LOG_LEVEL_INFO 1
+#define LLAMA_LOG_LEVEL_WARN 2
+#define LLAMA_LOG_LEVEL_ERROR 3
+#define LLAMA_LOG_LEVEL_NONE 4
+
+#ifndef LLAMA_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LLAMA_LOG_MIN_LEVEL LLAMA_LOG_LEVEL_INFO
+#else
+#define LLAMA_LOG_MIN_LEVEL LLAMA_LOG_LEVEL_DEBUG
+#endif
+#endif
+
+namespace llamaandroid {
+
+/**
+ * Rate-limit state of one call site. Constant-initialised, so the
+ * function-local static in LLAMA_LOG_AT needs no guard.
+ */
+struct LogSite {
+    std::atomic<uint32_t> second{0};      // Second the budget belongs to (+1; 0 = never used)
+    std::atomic<uint32_t> count{0};       // Messages in that second
+    std::atomic<uint32_t> suppressed{0};  // Messages dropped since the last one written
+};
+
+// Runtime level; messages below it are skipped before formatting
+extern std::atomic<int> g_logLevel;
+
+inline bool logEnabled(int level) {
+    return level >= g_logLevel.load(std::memory_order_relaxed);
+}
+
+/**
+ * Set the runtime level (one of LLAMA_LOG_LEVEL_*); levels below
+ * LLAMA_LOG_MIN_LEVEL stay compiled out
+ */
+void setLogLevel(int level);
+int getLogLevel();
+
+/**
+ * Messages per second and call site before further ones are suppressed
+ * (0 = unlimited). Errors are never suppressed.
+ */
+void setLogRateLimit(int perSecond);
+
+/**
+ * Write messages on the calling thread instead of the writer thread
+ */
+void setLogAsync(bool async);
+
+/**
+ * Write every queued message before returning
+ */
+void flushLog();
+
+void logWrite(int level, const char* tag, LogSite& site, const char* format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/**
+ * Send llama.cpp's and ggml's own log output through this layer
+ * (tag "llama.cpp") instead of stderr
+ */
+void routeLlamaLogs();
+
+/**
+ * Observer of llama.cpp's log lines written on the calling thread, called
+ * whatever the log level (nullptr removes it). Used to pick up figures
+ * llama.cpp reports but does not expose, such as buffer sizes.
+ */
+using LlamaLogTap = void (*)(const char* text, void* user);
+void setLlamaLogTap(LlamaLogTap tap, void* user);
+
+} // namespace llamaandroid
+
+#define LLAMA_LOG_AT(level, ...) \
+    do { \
+        if ((level) >= LLAMA_LOG_MIN_LEVEL && ::llamaandroid::logEnabled(level)) { \
+            static ::llamaandroid::LogSite llamaLogSite; \
+            ::llamaandroid::logWrite((level), LOG_TAG, llamaLogSite, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOGI(...) LLAMA_LOG_AT(LLAMA_LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOGW(...) LLAMA_LOG_AT(LLAMA_LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOGE(...) LLAMA_LOG_AT(LLAMA_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOGD(...) LLAMA_LOG_AT(LLAMA_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif // LLAMA_LOG_H
@@ -0,0 +1,147 @@
+#define LOG_TAG "MemoryStats"
+#include "memory_stats.h"
+#include "llama_log.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace llamaandroid {
+
+// Pages checked per mincore call
+static const size_t MINCORE_CHUNK_PAGES = 4096;
+
+bool readProcessMemory(ProcessMemory& out) {
+    out = ProcessMemory();
+
+#if defined(__GLIBC__)
+    // glibc counts blocks served by their own mmap separately
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    out.allocatorInUseBytes = static_cast<size_t>(info.uordblks) + static_cast<size_t>(info.hblkhd);
+    out.allocatorMappedBytes = static_cast<size_t>(info.arena) + static_cast<size_t>(info.hblkhd);
+#else
+    // bionic (scudo, jemalloc): allocated and free-but-retained bytes
+    struct mallinfo info = mallinfo();
+    out.allocatorInUseBytes = static_cast<size_t>(info.uordblks);
+    out.allocatorMappedBytes = static_cast<size_t>(info.uordblks) + static_cast<size_t>(info.fordblks);
+#endif
+
+    FILE* file = std::fopen("/proc/self/status", "r");
+    if (file == nullptr) {
+        return false;
+    }
+    
+    char line[256];
+    unsigned long kb = 0;
+    bool found = false;
+    while (std::fgets(line, sizeof(line), file) != nullptr) {
+        if (std::sscanf(line, "VmRSS: %lu kB", &kb) == 1) {
+            out.rssBytes = static_cast<size_t>(kb) * 1024;
+            found = true;
+        } else if (std::sscanf(line, "VmHWM: %lu kB", &kb) == 1) {
+            out.peakRssBytes = static_cast<size_t>(kb) * 1024;
+        }
+    }
+    std::fclose(file);
+    return found;
+}
+
+bool resetPeakRss() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, "5", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+void measureMappedFile(const std::string& path, size_t& mappedBytes, size_t& residentBytes) {
+    mappedBytes = 0;
+    residentBytes = 0;
+    if (path.empty()) {
+        return;
+    }
+    
+    FILE* maps = std::fopen("/proc/self/maps", "r");
+    if (maps == nullptr) {
+        return;
+    }
+    
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    unsigned char residency[MINCORE_CHUNK_PAGES];
+    char line[4096 + 128];
+    
+    while (std::fgets(line, sizeof(line), maps) != nullptr) {
+        unsigned long start = 0;
+        unsigned long end = 0;
+        int pathStart = 0;
+        if (std::sscanf(line, "%lx-%lx %*s %*s %*s %*s %n", &start, &end, &pathStart) < 2 || pathStart == 0) {
+            continue;
+        }
+        char* name = line + pathStart;
+        name[std::strcspn(name, "\n")] = '\0';
+        if (path != name) {
+            continue;
+        }
+        
+        mappedBytes += end - start;
+        for (unsigned long addr = start; addr < end; addr += MINCORE_CHUNK_PAGES * pageSize) {
+            const size_t length = std::min<size_t>(end - addr, MINCORE_CHUNK_PAGES * pageSize);
+            if (mincore(reinterpret_cast<void*>(addr), length, residency) != 0) {
+                break;
+            }
+            const size_t pages = (length + pageSize - 1) / pageSize;
+            for (size_t i = 0; i < pages; i++) {
+                if (residency[i] & 1) {
+                    residentBytes += pageSize;
+                }
+            }
+        }
+    }
+    std::fclose(maps);
+}
+
+LlamaBufferCapture::LlamaBufferCapture() {
+    setLlamaLogTap(&LlamaBufferCapture::onLogLine, this);
+}
+
+LlamaBufferCapture::~LlamaBufferCapture() {
+    setLlamaLogTap(nullptr, nullptr);
+}
+
+void LlamaBufferCapture::onLogLine(const char* text, void* user) {
+    // e.g. "llama_context:        CPU compute buffer size =    10.01 MiB"
+    static const char marker[] = " buffer size =";
+    const char* at = std::strstr(text, marker);
+    if (at == nullptr) {
+        return;
+    }
+    
+    const char* kind = at;
+    while (kind > text && kind[-1] != ' ') {
+        kind--;
+    }
+    const size_t kindLength = static_cast<size_t>(at - kind);
+    const size_t bytes = static_cast<size_t>(std::strtod(at + sizeof(marker) - 1, nullptr) * 1024.0 * 1024.0);
+    
+    LlamaBufferSizes& sizes = static_cast<LlamaBufferCapture*>(user)->sizes_;
+    if ((kindLength == 2 && std::strncmp(kind, "KV", 2) == 0) ||
+        (kindLength == 2 && std::strncmp(kind, "RS", 2) == 0)) {
+        sizes.kvBytes += bytes;
+    } else if (kindLength == 7 && std::strncmp(kind, "compute", 7) == 0) {
+        sizes.computeBytes += bytes;
+    } else if (kindLength == 6 && std::strncmp(kind, "output", 6) == 0) {
+        sizes.outputBytes += bytes;
+    }
+}
+
+} // namespace llamaandroid
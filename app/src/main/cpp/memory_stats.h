@@ -0,0 +1,70 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <string>
+#include <cstddef>
+
+namespace llamaandroid {
+
+/**
+ * Memory of the whole process
+ */
+struct ProcessMemory {
+    size_t rssBytes = 0;              // Resident set (VmRSS)
+    size_t peakRssBytes = 0;          // High-water mark of the resident set (VmHWM)
+    size_t allocatorInUseBytes = 0;   // malloc'd and not yet freed
+    size_t allocatorMappedBytes = 0;  // Held by malloc from the OS (arenas and large blocks)
+};
+
+/**
+ * Read /proc/self/status and the allocator's counters
+ * @return false if the RSS figures are unavailable
+ */
+bool readProcessMemory(ProcessMemory& out);
+
+/**
+ * Restart the VmHWM high-water mark from the current RSS (Linux 4.0+)
+ * @return false if the kernel does not allow it; VmHWM then covers the
+ *         whole process lifetime
+ */
+bool resetPeakRss();
+
+/**
+ * Bytes of a file mapped into the process, and how many of them are in
+ * RAM (mincore)
+ * @param path Canonical path, as in /proc/self/maps
+ */
+void measureMappedFile(const std::string& path, size_t& mappedBytes, size_t& residentBytes);
+
+/**
+ * Buffer sizes llama.cpp reports while creating a context
+ */
+struct LlamaBufferSizes {
+    size_t kvBytes = 0;       // KV cache (or recurrent state) buffers
+    size_t computeBytes = 0;  // Graph compute buffers
+    size_t outputBytes = 0;   // Logits and embeddings output buffer
+};
+
+/**
+ * Collects the "<kind> buffer size = <n> MiB" lines llama.cpp logs on this
+ * thread for as long as it exists
+ */
+class LlamaBufferCapture {
+public:
+    LlamaBufferCapture();
+    ~LlamaBufferCapture();
+    
+    LlamaBufferCapture(const LlamaBufferCapture&) = delete;
+    LlamaBufferCapture& operator=(const LlamaBufferCapture&) = delete;
+    
+    const LlamaBufferSizes& sizes() const { return sizes_; }
+
+private:
+    LlamaBufferSizes sizes_;
+    
+    static void onLogLine(const char* text, void* user);
+};
+
+} // namespace llamaandroid
+
+#endif // MEMORY_STATS_H
@@ -0,0 +1,318 @@
+#include "model_residency_manager.h"
+#include <algorithm>
+#include <sys/stat.h>
+
+#define LOG_TAG "LlamaResidency"
+#include "llama_log.h"
+
+namespace llamaandroid {
+
+ModelResidencyManager::ModelResidencyManager(size_t budgetBytes, ModelLoadFunction load)
+    : budgetBytes_(budgetBytes), load_(std::move(load)) {
+    if (!load_) {
+        load_ = [](LlamaContextWrapper& wrapper, const std::string& modelPath, const LlamaConfig& config) {
+            return wrapper.loadModel(modelPath, config);
+        };
+    }
+    LOGI("ModelResidencyManager created with budget: %zu bytes", budgetBytes);
+}
+
+ModelResidencyManager::~ModelResidencyManager() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Models still acquired by a caller are unloaded by their wrapper's
+    // destructor once the last reference goes
+    for (auto& it : entries_) {
+        if (it.second.resident && !isPinned(it.second)) {
+            it.second.wrapper->tryUnload(nullptr);
+        }
+    }
+    entries_.clear();
+    LOGI("ModelResidencyManager destroyed");
+}
+
+bool ModelResidencyManager::registerModel(const std::string& name, const std::string& modelPath,
+                                          const LlamaConfig& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    if (entries_.count(name) != 0) {
+        lastError_ = "Model already registered: " + name;
+        LOGE("%s", lastError_.c_str());
+        return false;
+    }
+    
+    Entry entry;
+    entry.modelPath = modelPath;
+    entry.config = config;
+    entry.wrapper = std::make_shared<LlamaContextWrapper>();
+    entries_.emplace(name, std::move(entry));
+    
+    LOGI("Registered model '%s': %s", name.c_str(), modelPath.c_str());
+    return true;
+}
+
+bool ModelResidencyManager::unregisterModel(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto it = entries_.find(name);
+    if (it == entries_.end()) {
+        lastError_ = "Unknown model: " + name;
+        return false;
+    }
+    if (it->second.loading || isPinned(it->second) ||
+        (it->second.resident && !it->second.wrapper->tryUnload(nullptr))) {
+        lastError_ = "Model is in use: " + name;
+        return false;
+    }
+    
+    entries_.erase(it);
+    
+    LOGI("Unregistered model '%s'", name.c_str());
+    return true;
+}
+
+std::shared_ptr<LlamaContextWrapper> ModelResidencyManager::acquire(const std::string& name) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    
+    // Share a load already in progress rather than starting another
+    auto it = entries_.find(name);
+    while (it != entries_.end() && it->second.loading) {
+        loadCv_.wait(lock);
+        it = entries_.find(name);
+    }
+    if (it == entries_.end()) {
+        lastError_ = "Unknown model: " + name;
+        LOGE("%s", lastError_.c_str());
+        return nullptr;
+    }
+    
+    Entry& entry = it->second;
+    entry.lastUsed = ++clock_;
+    
+    if (entry.resident) {
+        stats_.hits++;
+        return entry.wrapper;
+    }
+    
+    // Load on demand, making room first
+    size_t needed = estimateBytes(entry);
+    if (!makeRoomLocked(needed, name)) {
+        stats_.overBudgetLoads++;
+        LOGW("Loading '%s' over budget: every other model is pinned", name.c_str());
+    }
+    
+    LOGI("Loading model '%s' (estimated %zu bytes)", name.c_str(), needed);
+    
+    // Load without the manager's lock. The entry is not resident, so nothing
+    // evicts it, and while it is loading it is not unregistered; its room is
+    // held by counting the estimate as resident.
+    entry.loading = true;
+    entry.bytes = needed;
+    std::shared_ptr<LlamaContextWrapper> wrapper = entry.wrapper;
+    std::vector<uint8_t> hibernatedState = std::move(entry.hibernatedState);
+    entry.hibernatedState.clear();
+    lock.unlock();
+    
+    const bool loaded = load_(*wrapper, entry.modelPath, entry.config);
+    // Bring back the contexts hibernated at eviction time
+    if (loaded && !hibernatedState.empty() && !wrapper->restoreState(hibernatedState)) {
+        LOGW("Failed to restore hibernated state for '%s'", name.c_str());
+    }
+    
+    lock.lock();
+    entry.loading = false;
+    loadCv_.notify_all();
+    
+    if (!loaded) {
+        // Keep the snapshot for the next attempt
+        entry.hibernatedState = std::move(hibernatedState);
+        stats_.loadFailures++;
+        lastError_ = wrapper->getLastError();
+        LOGE("Failed to load '%s': %s", name.c_str(), lastError_.c_str());
+        return nullptr;
+    }
+    
+    entry.resident = true;
+    entry.loadCount++;
+    stats_.loads++;
+    
+    size_t measured = entry.wrapper->getMemoryFootprint();
+    if (measured > 0) {
+        entry.bytes = measured;
+    }
+    
+    // The estimate may have been low; settle the budget with the real size
+    if (budgetBytes_ > 0 && residentBytesLocked() > budgetBytes_) {
+        makeRoomLocked(0, name);
+    }
+    
+    return entry.wrapper;
+}
+
+bool ModelResidencyManager::evict(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto it = entries_.find(name);
+    if (it == entries_.end() || !it->second.resident) {
+        return false;
+    }
+    if (isPinned(it->second) || !evictLocked(name, it->second)) {
+        lastError_ = "Model is in use: " + name;
+        return false;
+    }
+    return true;
+}
+
+void ModelResidencyManager::setBudget(size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budgetBytes_ = budgetBytes;
+    makeRoomLocked(0, "");
+}
+
+ResidencyStats ModelResidencyManager::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    ResidencyStats stats = stats_;
+    stats.budgetBytes = budgetBytes_;
+    stats.registeredModels = static_cast<int>(entries_.size());
+    stats.residentBytes = 0;
+    stats.hibernatedBytes = 0;
+    stats.residentModels = 0;
+    for (const auto& it : entries_) {
+        if (it.second.resident) {
+            stats.residentBytes += it.second.bytes;
+            stats.residentModels++;
+        }
+        stats.hibernatedBytes += it.second.hibernatedState.size();
+    }
+    return stats;
+}
+
+std::vector<ModelResidencyInfo> ModelResidencyManager::getModels() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    std::vector<ModelResidencyInfo> models;
+    models.reserve(entries_.size());
+    for (const auto& it : entries_) {
+        const Entry& entry = it.second;
+        ModelResidencyInfo info;
+        info.name = it.first;
+        info.modelPath = entry.modelPath;
+        info.resident = entry.resident;
+        info.pinned = isPinned(entry);
+        info.cheapToEvict = isCheapToEvict(entry);
+        info.bytes = entry.resident ? entry.bytes : estimateBytes(entry);
+        info.hibernatedBytes = entry.hibernatedState.size();
+        info.lastUsed = entry.lastUsed;
+        info.loadCount = entry.loadCount;
+        info.evictionCount = entry.evictionCount;
+        models.push_back(std::move(info));
+    }
+    return models;
+}
+
+std::string ModelResidencyManager::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+bool ModelResidencyManager::isPinned(const Entry& entry) {
+    // The manager holds one reference; any other means a caller is using it
+    return entry.wrapper.use_count() > 1 || entry.wrapper->isGenerating();
+}
+
+bool ModelResidencyManager::isCheapToEvict(const Entry& entry) {
+    return entry.config.useMmap && !entry.config.useMlock;
+}
+
+size_t ModelResidencyManager::estimateBytes(const Entry& entry) {
+    // Reuse the measured size from a previous load, otherwise fall back to
+    // the file size (weights dominate; the KV cache is settled after load)
+    if (entry.bytes > 0) {
+        return entry.bytes;
+    }
+    
+    struct stat st;
+    if (stat(entry.modelPath.c_str(), &st) == 0) {
+        return static_cast<size_t>(st.st_size);
+    }
+    return 0;
+}
+
+size_t ModelResidencyManager::residentBytesLocked() const {
+    size_t total = 0;
+    for (const auto& it : entries_) {
+        if (it.second.resident || it.second.loading) {
+            total += it.second.bytes;
+        }
+    }
+    return total;
+}
+
+bool ModelResidencyManager::makeRoomLocked(size_t needed, const std::string& exclude) {
+    if (budgetBytes_ == 0) {
+        return true;
+    }
+    
+    // Models found busy when it came to unloading them
+    std::vector<const Entry*> busy;
+    
+    while (residentBytesLocked() + needed > budgetBytes_) {
+        // Least recently used unpinned model, mmapped models first: their
+        // clean pages are dropped for free and come back from page cache
+        std::string victimName;
+        Entry* victim = nullptr;
+        for (auto& it : entries_) {
+            Entry& entry = it.second;
+            if (!entry.resident || it.first == exclude || isPinned(entry) ||
+                std::find(busy.begin(), busy.end(), &entry) != busy.end()) {
+                continue;
+            }
+            if (victim == nullptr) {
+                victim = &entry;
+                victimName = it.first;
+                continue;
+            }
+            bool cheap = isCheapToEvict(entry);
+            bool victimCheap = isCheapToEvict(*victim);
+            if ((cheap && !victimCheap) ||
+                (cheap == victimCheap && entry.lastUsed < victim->lastUsed)) {
+                victim = &entry;
+                victimName = it.first;
+            }
+        }
+        
+        if (victim == nullptr) {
+            return false;
+        }
+        
+        if (!evictLocked(victimName, *victim)) {
+            busy.push_back(victim);
+        }
+    }
+    
+    return true;
+}
+
+bool ModelResidencyManager::evictLocked(const std::string& name, Entry& entry) {
+    // Hibernate the context so the next load resumes where it left off.
+    // The wrapper's lock is only tried: a request may have started on it
+    // since it was picked, and then it stays.
+    if (!entry.wrapper->tryUnload(&entry.hibernatedState)) {
+        LOGD("Not evicting model '%s': in use", name.c_str());
+        return false;
+    }
+    
+    LOGI("Evicted model '%s' (%zu bytes, last used %llu, %zu bytes hibernated)",
+         name.c_str(), entry.bytes, (unsigned long long)entry.lastUsed, entry.hibernatedState.size());
+    
+    entry.resident = false;
+    entry.evictionCount++;
+    
+    stats_.evictions++;
+    if (isCheapToEvict(entry)) {
+        stats_.cheapEvictions++;
+    }
+    return true;
+}
+
+} // namespace llamaandroid
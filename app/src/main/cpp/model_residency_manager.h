@@ -0,0 +1,158 @@
+#ifndef MODEL_RESIDENCY_MANAGER_H
+#define MODEL_RESIDENCY_MANAGER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+
+#include "llama_context_wrapper.h"
+
+namespace llamaandroid {
+
+/**
+ * Residency state of a single registered model
+ */
+struct ModelResidencyInfo {
+    std::string name;
+    std::string modelPath;
+    bool resident = false;
+    bool pinned = false;          // In use by a caller, cannot be evicted
+    bool cheapToEvict = false;    // mmapped and not mlocked: pages are clean and droppable
+    size_t bytes = 0;             // Measured footprint when resident, estimate otherwise
+    size_t hibernatedBytes = 0;   // Context state kept in host memory while evicted
+    uint64_t lastUsed = 0;        // Logical clock of the last acquire()
+    uint64_t loadCount = 0;
+    uint64_t evictionCount = 0;
+};
+
+/**
+ * Aggregate residency and eviction counters
+ */
+struct ResidencyStats {
+    size_t budgetBytes = 0;
+    size_t residentBytes = 0;
+    size_t hibernatedBytes = 0;
+    int registeredModels = 0;
+    int residentModels = 0;
+    uint64_t hits = 0;            // acquire() served by a resident model
+    uint64_t loads = 0;           // acquire() that had to load the model
+    uint64_t loadFailures = 0;
+    uint64_t evictions = 0;
+    uint64_t cheapEvictions = 0;  // Evictions of mmapped models
+    uint64_t overBudgetLoads = 0; // Loads that exceeded the budget because everything else was pinned
+};
+
+/**
+ * Loads a registered model into its wrapper
+ */
+using ModelLoadFunction = std::function<bool(LlamaContextWrapper& wrapper, const std::string& modelPath,
+                                             const LlamaConfig& config)>;
+
+/**
+ * Keeps a set of named models resident within a RAM budget.
+ *
+ * Models are registered up front and loaded on demand by acquire(). When a
+ * load would exceed the budget, the least recently used unpinned models are
+ * evicted first, preferring mmapped models whose clean pages the kernel can
+ * drop and re-read cheaply. Contexts are hibernated (state snapshotted to
+ * host memory) before eviction and restored on the next load.
+ *
+ * A model is pinned while a caller holds the shared_ptr returned by acquire()
+ * or while it is generating, so it is never unloaded under a running request.
+ * Eviction also only tries the wrapper's lock, and skips a model that turns
+ * out to be busy.
+ *
+ * Loads run without the manager's lock: acquire() of a resident model, or a
+ * load of another one, is not held up by a slow load. Callers acquiring the
+ * model being loaded wait for that load instead of starting their own.
+ */
+class ModelResidencyManager {
+public:
+    /**
+     * @param budgetBytes Total bytes allowed for resident models (0 = unlimited)
+     * @param load Loads a model on demand (default: LlamaContextWrapper::loadModel)
+     */
+    explicit ModelResidencyManager(size_t budgetBytes, ModelLoadFunction load = nullptr);
+    ~ModelResidencyManager();
+    
+    // Prevent copying
+    ModelResidencyManager(const ModelResidencyManager&) = delete;
+    ModelResidencyManager& operator=(const ModelResidencyManager&) = delete;
+    
+    /**
+     * Register a model under a name without loading it
+     * @param name Unique name used with acquire()
+     * @param modelPath Path to the .gguf model file
+     * @param config Configuration used whenever the model is loaded
+     * @return true if registered, false if the name is already taken
+     */
+    bool registerModel(const std::string& name, const std::string& modelPath, const LlamaConfig& config);
+    
+    /**
+     * Unload and forget a model
+     * @return false if the model is unknown, currently pinned or being loaded
+     */
+    bool unregisterModel(const std::string& name);
+    
+    /**
+     * Get a loaded model, loading it and evicting others if needed.
+     * Hold the returned pointer only for the duration of a request.
+     * @param name Registered model name
+     * @return The model, or nullptr on failure (see getLastError())
+     */
+    std::shared_ptr<LlamaContextWrapper> acquire(const std::string& name);
+    
+    /**
+     * Evict a specific model if it is resident and not in use
+     */
+    bool evict(const std::string& name);
+    
+    /**
+     * Change the budget, evicting models immediately if now over it
+     */
+    void setBudget(size_t budgetBytes);
+    
+    ResidencyStats getStats() const;
+    std::vector<ModelResidencyInfo> getModels() const;
+    std::string getLastError() const;
+    
+private:
+    struct Entry {
+        std::string modelPath;
+        LlamaConfig config;
+        std::shared_ptr<LlamaContextWrapper> wrapper;
+        std::vector<uint8_t> hibernatedState;
+        size_t bytes = 0;
+        bool resident = false;
+        bool loading = false;         // Being loaded by an acquire() outside the lock
+        uint64_t lastUsed = 0;
+        uint64_t loadCount = 0;
+        uint64_t evictionCount = 0;
+    };
+    
+    size_t budgetBytes_;
+    ModelLoadFunction load_;
+    uint64_t clock_ = 0;
+    ResidencyStats stats_;
+    std::string lastError_;
+    std::unordered_map<std::string, Entry> entries_;
+    mutable std::mutex mutex_;
+    std::condition_variable loadCv_;  // Signalled when a load finishes
+    
+    static bool isPinned(const Entry& entry);
+    static bool isCheapToEvict(const Entry& entry);
+    static size_t estimateBytes(const Entry& entry);
+    
+    size_t residentBytesLocked() const;
+    bool makeRoomLocked(size_t needed, const std::string& exclude);
+    bool evictLocked(const std::string& name, Entry& entry);
+};
+
+} // namespace llamaandroid
+
+#endif // MODEL_RESIDENCY_MANAGER_H
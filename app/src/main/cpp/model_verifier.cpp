@@ -0,0 +1,817 @@
+#define LOG_TAG "ModelVerifier"
+#include "model_verifier.h"
+#include "llama_log.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#if LLAMA_AVAILABLE
+#include "ggml.h"
+#endif
+
+namespace llamaandroid {
+
+// ============================================================================
+// BLAKE3
+// ============================================================================
+
+static const size_t BLAKE3_BLOCK_LEN = 64;
+static const size_t BLAKE3_CHUNK_LEN = 1024;
+
+static const uint32_t BLAKE3_CHUNK_START = 1 << 0;
+static const uint32_t BLAKE3_CHUNK_END = 1 << 1;
+static const uint32_t BLAKE3_PARENT = 1 << 2;
+static const uint32_t BLAKE3_ROOT = 1 << 3;
+
+static const uint32_t BLAKE3_IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint8_t BLAKE3_MSG_PERMUTATION[16] = {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+
+// Chunks hashed by one task: a complete subtree of the hash tree (1 MiB)
+static const size_t SUBTREE_CHUNKS = 1024;
+static const size_t SUBTREE_BYTES = SUBTREE_CHUNKS * BLAKE3_CHUNK_LEN;
+
+static inline uint32_t rotateRight(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline void mix(uint32_t* s, int a, int b, int c, int d, uint32_t mx, uint32_t my) {
+    s[a] = s[a] + s[b] + mx;
+    s[d] = rotateRight(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];
+    s[b] = rotateRight(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + my;
+    s[d] = rotateRight(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];
+    s[b] = rotateRight(s[b] ^ s[c], 7);
+}
+
+static void compress(const uint32_t cv[8], const uint32_t block[16], uint64_t counter,
+                     uint32_t blockLen, uint32_t flags, uint32_t out[16]) {
+    uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        BLAKE3_IV[0], BLAKE3_IV[1], BLAKE3_IV[2], BLAKE3_IV[3],
+        static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), blockLen, flags
+    };
+    uint32_t m[16];
+    std::memcpy(m, block, sizeof(m));
+    
+    for (int round = 0; round < 7; round++) {
+        mix(s, 0, 4, 8, 12, m[0], m[1]);
+        mix(s, 1, 5, 9, 13, m[2], m[3]);
+        mix(s, 2, 6, 10, 14, m[4], m[5]);
+        mix(s, 3, 7, 11, 15, m[6], m[7]);
+        mix(s, 0, 5, 10, 15, m[8], m[9]);
+        mix(s, 1, 6, 11, 12, m[10], m[11]);
+        mix(s, 2, 7, 8, 13, m[12], m[13]);
+        mix(s, 3, 4, 9, 14, m[14], m[15]);
+        
+        uint32_t permuted[16];
+        for (int i = 0; i < 16; i++) {
+            permuted[i] = m[BLAKE3_MSG_PERMUTATION[i]];
+        }
+        std::memcpy(m, permuted, sizeof(m));
+    }
+    
+    for (int i = 0; i < 8; i++) {
+        out[i] = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+    }
+}
+
+static void loadBlock(const uint8_t* bytes, size_t length, uint32_t block[16]) {
+    uint8_t padded[BLAKE3_BLOCK_LEN] = {};
+    std::memcpy(padded, bytes, length);
+    for (int i = 0; i < 16; i++) {
+        const uint8_t* p = padded + i * 4;
+        block[i] = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                   (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+}
+
+static void parentCv(const uint32_t left[8], const uint32_t right[8], uint32_t out[8]) {
+    uint32_t block[16];
+    std::memcpy(block, left, 8 * sizeof(uint32_t));
+    std::memcpy(block + 8, right, 8 * sizeof(uint32_t));
+    uint32_t state[16];
+    compress(BLAKE3_IV, block, 0, BLAKE3_BLOCK_LEN, BLAKE3_PARENT, state);
+    std::memcpy(out, state, 8 * sizeof(uint32_t));
+}
+
+static void fullChunkCv(const uint8_t* chunk, uint64_t chunkIndex, uint32_t out[8]) {
+    uint32_t cv[8];
+    std::memcpy(cv, BLAKE3_IV, sizeof(cv));
+    const size_t blocks = BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN;
+    for (size_t i = 0; i < blocks; i++) {
+        uint32_t flags = (i == 0 ? BLAKE3_CHUNK_START : 0) | (i == blocks - 1 ? BLAKE3_CHUNK_END : 0);
+        uint32_t block[16];
+        uint32_t state[16];
+        loadBlock(chunk + i * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN, block);
+        compress(cv, block, chunkIndex, BLAKE3_BLOCK_LEN, flags, state);
+        std::memcpy(cv, state, sizeof(cv));
+    }
+    std::memcpy(out, cv, sizeof(cv));
+}
+
+/**
+ * Chaining value of a complete subtree: a power-of-two number of whole
+ * chunks, starting at a chunk index that is a multiple of that number
+ */
+static void subtreeCv(const uint8_t* data, size_t chunks, uint64_t firstChunk, uint32_t out[8]) {
+    if (chunks == 1) {
+        fullChunkCv(data, firstChunk, out);
+        return;
+    }
+    size_t half = chunks / 2;
+    uint32_t left[8];
+    uint32_t right[8];
+    subtreeCv(data, half, firstChunk, left);
+    subtreeCv(data + half * BLAKE3_CHUNK_LEN, half, firstChunk + half, right);
+    parentCv(left, right, out);
+}
+
+namespace {
+
+/**
+ * Incremental BLAKE3 hasher (unkeyed, 32-byte output) that also accepts
+ * the chaining values of complete subtrees hashed elsewhere
+ */
+class Blake3Hasher {
+public:
+    Blake3Hasher() {
+        resetChunk(0);
+    }
+    
+    /**
+     * Append a complete subtree of `chunks` chunks (a power of two). Only
+     * valid on a chunk boundary that is a multiple of `chunks`, and only
+     * if more input follows, since the root is never a pushed subtree.
+     */
+    void pushSubtree(const uint32_t cv[8], uint64_t chunks) {
+        uint64_t total = (chunkCounter_ + chunks) / chunks;
+        pushCv(cv, total);
+        resetChunk(chunkCounter_ + chunks);
+    }
+    
+    void update(const uint8_t* data, size_t length) {
+        while (length > 0) {
+            // A full chunk is only closed once more input arrives, so the
+            // last chunk is still open in finish() and can become the root
+            if (chunkBytes() == BLAKE3_CHUNK_LEN) {
+                uint32_t state[16];
+                uint32_t cv[8];
+                compress(cv_, block_, chunkCounter_, blockLen_, chunkFlags() | BLAKE3_CHUNK_END, state);
+                std::memcpy(cv, state, sizeof(cv));
+                pushCv(cv, chunkCounter_ + 1);
+                resetChunk(chunkCounter_ + 1);
+            }
+            
+            if (blockLen_ == BLAKE3_BLOCK_LEN) {
+                uint32_t state[16];
+                compress(cv_, block_, chunkCounter_, BLAKE3_BLOCK_LEN, chunkFlags(), state);
+                std::memcpy(cv_, state, sizeof(cv_));
+                blocksCompressed_++;
+                blockLen_ = 0;
+                std::memset(blockBytes_, 0, sizeof(blockBytes_));
+            }
+            
+            size_t take = std::min(BLAKE3_BLOCK_LEN - blockLen_, length);
+            take = std::min(take, BLAKE3_CHUNK_LEN - chunkBytes());
+            std::memcpy(blockBytes_ + blockLen_, data, take);
+            blockLen_ += take;
+            loadBlock(blockBytes_, blockLen_, block_);
+            data += take;
+            length -= take;
+        }
+    }
+    
+    void finish(uint8_t digest[32]) const {
+        // Output of the open chunk, then folded into each pending subtree
+        uint32_t inputCv[8];
+        uint32_t block[16];
+        std::memcpy(inputCv, cv_, sizeof(inputCv));
+        std::memcpy(block, block_, sizeof(block));
+        uint64_t counter = chunkCounter_;
+        uint32_t blockLen = static_cast<uint32_t>(blockLen_);
+        uint32_t flags = chunkFlags() | BLAKE3_CHUNK_END;
+        
+        for (size_t i = stack_.size(); i > 0; i--) {
+            uint32_t state[16];
+            compress(inputCv, block, counter, blockLen, flags, state);
+            std::memcpy(block, stack_[i - 1].words, 8 * sizeof(uint32_t));
+            std::memcpy(block + 8, state, 8 * sizeof(uint32_t));
+            std::memcpy(inputCv, BLAKE3_IV, sizeof(inputCv));
+            counter = 0;
+            blockLen = BLAKE3_BLOCK_LEN;
+            flags = BLAKE3_PARENT;
+        }
+        
+        uint32_t state[16];
+        compress(inputCv, block, counter, blockLen, flags | BLAKE3_ROOT, state);
+        for (int i = 0; i < 8; i++) {
+            digest[i * 4] = static_cast<uint8_t>(state[i]);
+            digest[i * 4 + 1] = static_cast<uint8_t>(state[i] >> 8);
+            digest[i * 4 + 2] = static_cast<uint8_t>(state[i] >> 16);
+            digest[i * 4 + 3] = static_cast<uint8_t>(state[i] >> 24);
+        }
+    }
+
+private:
+    struct ChainingValue {
+        uint32_t words[8];
+    };
+    
+    std::vector<ChainingValue> stack_;
+    uint32_t cv_[8];
+    uint32_t block_[16];
+    uint8_t blockBytes_[BLAKE3_BLOCK_LEN];
+    size_t blockLen_ = 0;
+    size_t blocksCompressed_ = 0;
+    uint64_t chunkCounter_ = 0;
+    
+    size_t chunkBytes() const {
+        return blocksCompressed_ * BLAKE3_BLOCK_LEN + blockLen_;
+    }
+    
+    uint32_t chunkFlags() const {
+        return blocksCompressed_ == 0 ? BLAKE3_CHUNK_START : 0;
+    }
+    
+    void resetChunk(uint64_t counter) {
+        std::memcpy(cv_, BLAKE3_IV, sizeof(cv_));
+        std::memset(block_, 0, sizeof(block_));
+        std::memset(blockBytes_, 0, sizeof(blockBytes_));
+        blockLen_ = 0;
+        blocksCompressed_ = 0;
+        chunkCounter_ = counter;
+    }
+    
+    // `total` counts the stack's leaves in units of the new subtree; each
+    // trailing zero bit is a completed pair of equal subtrees to merge
+    void pushCv(const uint32_t cv[8], uint64_t total) {
+        ChainingValue value;
+        std::memcpy(value.words, cv, sizeof(value.words));
+        while ((total & 1) == 0) {
+            parentCv(stack_.back().words, value.words, value.words);
+            stack_.pop_back();
+            total >>= 1;
+        }
+        stack_.push_back(value);
+    }
+};
+
+} // namespace
+
+// ============================================================================
+// File access
+// ============================================================================
+
+static bool readAt(int fd, void* buffer, size_t length, uint64_t offset) {
+    uint8_t* p = static_cast<uint8_t*>(buffer);
+    while (length > 0) {
+        ssize_t n = pread(fd, p, length, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;  // File shrank under us
+            }
+            return false;
+        }
+        p += n;
+        length -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+static bool hashFile(int fd, uint64_t fileBytes, int threads, uint8_t digest[32], std::string& error) {
+    // Whole subtrees, leaving at least one byte for the hasher so that the
+    // root node is always finished there
+    uint64_t subtrees = fileBytes > 0 ? (fileBytes - 1) / SUBTREE_BYTES : 0;
+    std::vector<uint32_t> cvs(subtrees * 8);
+    
+    if (subtrees > 0) {
+        size_t workers = threads > 0 ? static_cast<size_t>(threads) : std::max(1u, std::thread::hardware_concurrency());
+        workers = static_cast<size_t>(std::min<uint64_t>(workers, subtrees));
+        
+        std::atomic<uint64_t> next{0};
+        std::atomic<int> readErrno{0};
+        auto work = [&]() {
+            std::vector<uint8_t> buffer(SUBTREE_BYTES);
+            while (readErrno.load(std::memory_order_relaxed) == 0) {
+                uint64_t index = next.fetch_add(1);
+                if (index >= subtrees) {
+                    break;
+                }
+                if (!readAt(fd, buffer.data(), SUBTREE_BYTES, index * SUBTREE_BYTES)) {
+                    readErrno.store(errno);
+                    break;
+                }
+                subtreeCv(buffer.data(), SUBTREE_CHUNKS, index * SUBTREE_CHUNKS, &cvs[index * 8]);
+            }
+        };
+        
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < workers; i++) {
+            pool.emplace_back(work);
+        }
+        work();
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+        
+        if (readErrno.load() != 0) {
+            error = std::string("Read failed: ") + std::strerror(readErrno.load());
+            return false;
+        }
+    }
+    
+    Blake3Hasher hasher;
+    for (uint64_t i = 0; i < subtrees; i++) {
+        hasher.pushSubtree(&cvs[i * 8], SUBTREE_CHUNKS);
+    }
+    
+    uint64_t tailOffset = subtrees * SUBTREE_BYTES;
+    std::vector<uint8_t> tail(static_cast<size_t>(fileBytes - tailOffset));
+    if (!tail.empty() && !readAt(fd, tail.data(), tail.size(), tailOffset)) {
+        error = std::string("Read failed: ") + std::strerror(errno);
+        return false;
+    }
+    hasher.update(tail.data(), tail.size());
+    hasher.finish(digest);
+    return true;
+}
+
+// ============================================================================
+// GGUF structure
+// ============================================================================
+
+static const uint32_t GGUF_DEFAULT_ALIGNMENT = 32;
+static const size_t GGUF_MAX_TENSOR_NAME = 63;  // GGML_MAX_NAME - 1
+static const uint32_t GGUF_MAX_DIMS = 4;
+
+enum GgufValueType : uint32_t {
+    GGUF_UINT8 = 0, GGUF_INT8 = 1, GGUF_UINT16 = 2, GGUF_INT16 = 3,
+    GGUF_UINT32 = 4, GGUF_INT32 = 5, GGUF_FLOAT32 = 6, GGUF_BOOL = 7,
+    GGUF_STRING = 8, GGUF_ARRAY = 9, GGUF_UINT64 = 10, GGUF_INT64 = 11,
+    GGUF_FLOAT64 = 12
+};
+
+static size_t ggufScalarSize(uint32_t type) {
+    switch (type) {
+        case GGUF_UINT8: case GGUF_INT8: case GGUF_BOOL: return 1;
+        case GGUF_UINT16: case GGUF_INT16: return 2;
+        case GGUF_UINT32: case GGUF_INT32: case GGUF_FLOAT32: return 4;
+        case GGUF_UINT64: case GGUF_INT64: case GGUF_FLOAT64: return 8;
+        default: return 0;
+    }
+}
+
+namespace {
+
+/**
+ * Buffered sequential reader over the start of a file; every length read
+ * from the file is checked against what is left of it before use
+ */
+class GgufReader {
+public:
+    GgufReader(int fd, uint64_t fileBytes) : fd_(fd), fileBytes_(fileBytes), buffer_(64 * 1024) {}
+    
+    uint64_t position() const { return position_; }
+    uint64_t remaining() const { return fileBytes_ - position_; }
+    
+    bool read(void* out, size_t length) {
+        if (length > remaining()) {
+            return false;
+        }
+        uint8_t* p = static_cast<uint8_t*>(out);
+        while (length > 0) {
+            if (bufferPos_ == bufferLen_ && !fill()) {
+                return false;
+            }
+            size_t take = std::min(length, bufferLen_ - bufferPos_);
+            std::memcpy(p, buffer_.data() + bufferPos_, take);
+            bufferPos_ += take;
+            position_ += take;
+            p += take;
+            length -= take;
+        }
+        return true;
+    }
+    
+    bool skip(uint64_t length) {
+        if (length > remaining()) {
+            return false;
+        }
+        uint64_t buffered = bufferLen_ - bufferPos_;
+        if (length <= buffered) {
+            bufferPos_ += static_cast<size_t>(length);
+        } else {
+            bufferPos_ = bufferLen_ = 0;
+        }
+        position_ += length;
+        return true;
+    }
+    
+    template <typename T>
+    bool read(T& value) {
+        return read(&value, sizeof(T));
+    }
+    
+    // Reads the string when out is non-null, skips it otherwise
+    bool readString(std::string* out) {
+        uint64_t length = 0;
+        if (!read(length) || length > remaining()) {
+            return false;
+        }
+        if (out == nullptr) {
+            return skip(length);
+        }
+        out->resize(static_cast<size_t>(length));
+        return read(&(*out)[0], static_cast<size_t>(length));
+    }
+
+private:
+    int fd_;
+    uint64_t fileBytes_;
+    uint64_t position_ = 0;
+    std::vector<uint8_t> buffer_;
+    size_t bufferPos_ = 0;
+    size_t bufferLen_ = 0;
+    
+    bool fill() {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(buffer_.size(), remaining()));
+        if (!readAt(fd_, buffer_.data(), length, position_)) {
+            return false;
+        }
+        bufferPos_ = 0;
+        bufferLen_ = length;
+        return true;
+    }
+};
+
+struct GgufTensor {
+    std::string name;
+    uint64_t offset = 0;
+    uint64_t bytes = 0;
+};
+
+} // namespace
+
+static bool skipGgufValue(GgufReader& reader, uint32_t type) {
+    if (type == GGUF_STRING) {
+        return reader.readString(nullptr);
+    }
+    if (type == GGUF_ARRAY) {
+        uint32_t elementType = 0;
+        uint64_t count = 0;
+        if (!reader.read(elementType) || !reader.read(count)) {
+            return false;
+        }
+        if (elementType == GGUF_STRING) {
+            // Each string takes at least its 8-byte length
+            if (count > reader.remaining() / 8) {
+                return false;
+            }
+            for (uint64_t i = 0; i < count; i++) {
+                if (!reader.readString(nullptr)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        size_t size = ggufScalarSize(elementType);
+        return size > 0 && count <= reader.remaining() / size && reader.skip(count * size);
+    }
+    size_t size = ggufScalarSize(type);
+    return size > 0 && reader.skip(size);
+}
+
+/**
+ * Size of a tensor's data, or 0 if it is unknown (no ggml in stub builds)
+ * @return false if the type or shape is invalid
+ */
+static bool tensorBytes(uint32_t type, const int64_t* dims, uint32_t nDims, uint64_t& bytes) {
+    bytes = 0;
+#if LLAMA_AVAILABLE
+    if (type >= GGML_TYPE_COUNT) {
+        return false;
+    }
+    ggml_type ggmlType = static_cast<ggml_type>(type);
+    int64_t blockSize = ggml_blck_size(ggmlType);
+    size_t typeSize = ggml_type_size(ggmlType);
+    if (blockSize <= 0 || typeSize == 0) {
+        return false;  // Removed type
+    }
+    if (nDims > 0 && dims[0] % blockSize != 0) {
+        return false;
+    }
+    uint64_t elements = 1;
+    for (uint32_t i = 0; i < nDims; i++) {
+        elements *= static_cast<uint64_t>(dims[i]);
+    }
+    bytes = elements / static_cast<uint64_t>(blockSize) * typeSize;
+#else
+    (void) type;
+    (void) dims;
+    (void) nDims;
+#endif
+    return true;
+}
+
+/**
+ * Walk the GGUF header, metadata and tensor table
+ * @return Problem found, or an empty string
+ */
+static std::string checkGgufStructure(int fd, uint64_t fileBytes) {
+    GgufReader reader(fd, fileBytes);
+    
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t tensorCount = 0;
+    uint64_t kvCount = 0;
+    if (!reader.read(magic, sizeof(magic)) || std::memcmp(magic, "GGUF", 4) != 0) {
+        return "Not a GGUF file";
+    }
+    if (!reader.read(version) || !reader.read(tensorCount) || !reader.read(kvCount)) {
+        return "Truncated GGUF header";
+    }
+    if (version < 2 || version > 3) {
+        return "Unsupported GGUF version " + std::to_string(version);
+    }
+    
+    uint32_t alignment = GGUF_DEFAULT_ALIGNMENT;
+    std::string key;
+    for (uint64_t i = 0; i < kvCount; i++) {
+        uint32_t type = 0;
+        if (!reader.readString(&key) || !reader.read(type)) {
+            return "Truncated metadata (entry " + std::to_string(i) + ")";
+        }
+        if (key == "general.alignment") {
+            if (type != GGUF_UINT32 || !reader.read(alignment)) {
+                return "Invalid general.alignment";
+            }
+            if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+                return "general.alignment " + std::to_string(alignment) + " is not a power of two";
+            }
+            continue;
+        }
+        if (!skipGgufValue(reader, type)) {
+            return "Invalid or truncated metadata value for " + key;
+        }
+    }
+    
+    // A tensor entry takes at least 24 bytes: name length, dims, type, offset
+    if (tensorCount > reader.remaining() / 24) {
+        return "Tensor count " + std::to_string(tensorCount) + " does not fit in the file";
+    }
+    
+    std::vector<GgufTensor> tensors(static_cast<size_t>(tensorCount));
+    std::set<std::string> names;
+    for (GgufTensor& tensor : tensors) {
+        uint32_t nDims = 0;
+        int64_t dims[GGUF_MAX_DIMS] = {};
+        uint32_t type = 0;
+        if (!reader.readString(&tensor.name) || !reader.read(nDims)) {
+            return "Truncated tensor table";
+        }
+        if (tensor.name.size() > GGUF_MAX_TENSOR_NAME) {
+            return "Tensor name too long: " + tensor.name.substr(0, GGUF_MAX_TENSOR_NAME);
+        }
+        if (!names.insert(tensor.name).second) {
+            return "Duplicate tensor " + tensor.name;
+        }
+        if (nDims > GGUF_MAX_DIMS) {
+            return "Tensor " + tensor.name + " has " + std::to_string(nDims) + " dimensions";
+        }
+        if (!reader.read(dims, nDims * sizeof(int64_t)) || !reader.read(type) || !reader.read(tensor.offset)) {
+            return "Truncated tensor table";
+        }
+        
+        // Element count must not overflow int64_t, as in ggml
+        int64_t elements = 1;
+        for (uint32_t d = 0; d < nDims; d++) {
+            if (dims[d] < 0 || (dims[d] > 0 && elements > INT64_MAX / dims[d])) {
+                return "Tensor " + tensor.name + " has an invalid shape";
+            }
+            elements *= dims[d];
+        }
+        if (!tensorBytes(type, dims, nDims, tensor.bytes)) {
+            return "Tensor " + tensor.name + " has an invalid type (" + std::to_string(type) + ") for its shape";
+        }
+        if (tensor.offset % alignment != 0) {
+            return "Tensor " + tensor.name + " is not aligned";
+        }
+    }
+    
+    uint64_t dataStart = (reader.position() + alignment - 1) / alignment * alignment;
+    std::sort(tensors.begin(), tensors.end(), [](const GgufTensor& a, const GgufTensor& b) {
+        return a.offset < b.offset;
+    });
+    uint64_t previousEnd = 0;
+    for (const GgufTensor& tensor : tensors) {
+        if (tensor.offset < previousEnd) {
+            return "Tensor " + tensor.name + " overlaps the previous tensor";
+        }
+        if (dataStart > fileBytes || tensor.offset > fileBytes - dataStart ||
+            tensor.bytes > fileBytes - dataStart - tensor.offset) {
+            return "Tensor " + tensor.name + " extends past the end of the file (truncated download?)";
+        }
+        previousEnd = tensor.offset + tensor.bytes;
+    }
+    return "";
+}
+
+// ============================================================================
+// Digest cache
+// ============================================================================
+
+// Most recent files kept in the digest cache
+static const size_t DIGEST_CACHE_ENTRIES = 64;
+
+static std::mutex g_digestCacheMutex;
+
+namespace {
+
+/**
+ * What identifies an unchanged file: the same inode with the same size
+ * and modification time
+ */
+struct FileIdentity {
+    unsigned long long device = 0;
+    unsigned long long inode = 0;
+    unsigned long long size = 0;
+    long long mtimeSec = 0;
+    long mtimeNsec = 0;
+    
+    explicit FileIdentity(const struct stat& st)
+        : device(st.st_dev), inode(st.st_ino), size(static_cast<unsigned long long>(st.st_size)),
+          mtimeSec(st.st_mtim.tv_sec), mtimeNsec(st.st_mtim.tv_nsec) {}
+    FileIdentity() = default;
+    
+    bool operator==(const FileIdentity& other) const {
+        return device == other.device && inode == other.inode && size == other.size &&
+               mtimeSec == other.mtimeSec && mtimeNsec == other.mtimeNsec;
+    }
+};
+
+struct DigestCacheEntry {
+    FileIdentity identity;
+    std::string digest;
+};
+
+} // namespace
+
+static std::vector<DigestCacheEntry> readDigestCache(const std::string& path) {
+    std::vector<DigestCacheEntry> entries;
+    FILE* file = std::fopen(path.c_str(), "r");
+    if (file == nullptr) {
+        return entries;
+    }
+    
+    char line[256];
+    while (std::fgets(line, sizeof(line), file) != nullptr) {
+        DigestCacheEntry entry;
+        char digest[65];
+        if (std::sscanf(line, "%llu %llu %llu %lld %ld %64s", &entry.identity.device, &entry.identity.inode,
+                        &entry.identity.size, &entry.identity.mtimeSec, &entry.identity.mtimeNsec, digest) == 6 &&
+            std::strlen(digest) == 64) {
+            entry.digest = digest;
+            entries.push_back(entry);
+        }
+    }
+    std::fclose(file);
+    return entries;
+}
+
+// Replaced through a rename so that readers never see a partial file
+static void writeDigestCache(const std::string& path, const std::vector<DigestCacheEntry>& entries) {
+    std::string temporary = path + ".tmp" + std::to_string(getpid());
+    FILE* file = std::fopen(temporary.c_str(), "w");
+    if (file == nullptr) {
+        LOGW("Cannot write digest cache %s: %s", path.c_str(), std::strerror(errno));
+        return;
+    }
+    for (const DigestCacheEntry& entry : entries) {
+        std::fprintf(file, "%llu %llu %llu %lld %ld %s\n", entry.identity.device, entry.identity.inode,
+                     entry.identity.size, entry.identity.mtimeSec, entry.identity.mtimeNsec, entry.digest.c_str());
+    }
+    bool written = std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    std::fclose(file);
+    if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        LOGW("Cannot write digest cache %s: %s", path.c_str(), std::strerror(errno));
+        std::remove(temporary.c_str());
+    }
+}
+
+static bool lookupDigest(const std::string& cachePath, const FileIdentity& identity, std::string& digest) {
+    std::lock_guard<std::mutex> lock(g_digestCacheMutex);
+    for (const DigestCacheEntry& entry : readDigestCache(cachePath)) {
+        if (entry.identity == identity) {
+            digest = entry.digest;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void storeDigest(const std::string& cachePath, const FileIdentity& identity, const std::string& digest) {
+    std::lock_guard<std::mutex> lock(g_digestCacheMutex);
+    std::vector<DigestCacheEntry> entries = readDigestCache(cachePath);
+    
+    // One entry per inode: a rewritten file replaces its old digest
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const DigestCacheEntry& entry) {
+        return entry.identity.device == identity.device && entry.identity.inode == identity.inode;
+    }), entries.end());
+    if (entries.size() >= DIGEST_CACHE_ENTRIES) {
+        entries.erase(entries.begin(), entries.end() - (DIGEST_CACHE_ENTRIES - 1));
+    }
+    
+    DigestCacheEntry entry;
+    entry.identity = identity;
+    entry.digest = digest;
+    entries.push_back(entry);
+    writeDigestCache(cachePath, entries);
+}
+
+// ============================================================================
+// Verification
+// ============================================================================
+
+bool verifyModelFile(const std::string& path, const ModelVerifyOptions& options,
+                     ModelVerification& out, std::string& error) {
+    out = ModelVerification();
+    
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = "Cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    
+    struct stat before;
+    if (fstat(fd, &before) != 0 || !S_ISREG(before.st_mode)) {
+        error = path + " is not a regular file";
+        close(fd);
+        return false;
+    }
+    FileIdentity identity(before);
+    out.fileBytes = identity.size;
+    out.structureError = checkGgufStructure(fd, out.fileBytes);
+    
+    bool useCache = !options.digestCachePath.empty();
+    if (useCache && lookupDigest(options.digestCachePath, identity, out.digest)) {
+        out.digestCached = true;
+        close(fd);
+        LOGI("Model %s: digest from cache", path.c_str());
+        return true;
+    }
+    
+    // Readahead for the whole file; the tasks take 1 MiB runs in order
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    auto start = std::chrono::steady_clock::now();
+    uint8_t digest[32];
+    if (!hashFile(fd, out.fileBytes, options.threads, digest, error)) {
+        close(fd);
+        return false;
+    }
+    out.hashMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    
+    static const char HEX[] = "0123456789abcdef";
+    for (uint8_t byte : digest) {
+        out.digest += HEX[byte >> 4];
+        out.digest += HEX[byte & 0xf];
+    }
+    
+    struct stat after;
+    bool unchanged = fstat(fd, &after) == 0 && FileIdentity(after) == identity;
+    close(fd);
+    if (!unchanged) {
+        LOGW("Model %s changed while it was hashed; digest not cached", path.c_str());
+    } else if (useCache) {
+        storeDigest(options.digestCachePath, identity, out.digest);
+    }
+    
+    LOGI("Model %s: %llu bytes hashed in %.0f ms (%.0f MB/s)%s", path.c_str(),
+         static_cast<unsigned long long>(out.fileBytes), out.hashMs,
+         out.hashMs > 0 ? out.fileBytes / 1e3 / out.hashMs : 0.0,
+         out.structureError.empty() ? "" : ", invalid GGUF structure");
+    return true;
+}
+
+} // namespace llamaandroid
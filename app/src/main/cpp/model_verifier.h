@@ -0,0 +1,50 @@
+#ifndef MODEL_VERIFIER_H
+#define MODEL_VERIFIER_H
+
+#include <string>
+#include <cstdint>
+
+namespace llamaandroid {
+
+/**
+ * Options for verifyModelFile()
+ */
+struct ModelVerifyOptions {
+    int threads = 0;             // Hashing threads; 0 uses one per core
+    std::string digestCachePath; // File of digests by file identity; empty to always hash
+};
+
+/**
+ * What verifyModelFile() found out about a model file
+ */
+struct ModelVerification {
+    std::string digest;          // BLAKE3 of the file, 64 lowercase hex digits
+    std::string structureError;  // Why the file is not a well-formed GGUF; empty if it is
+    bool digestCached = false;   // The digest came from the cache, the file was not read
+    uint64_t fileBytes = 0;
+    double hashMs = 0;           // Time spent hashing (0 when cached)
+};
+
+/**
+ * Hash a model file and check its GGUF structure.
+ *
+ * The digest is the standard BLAKE3 hash (as printed by b3sum). BLAKE3 is a
+ * tree hash: 1 MiB runs of the file are complete subtrees, so they are
+ * hashed on separate threads and only their chaining values are combined
+ * in order. The structure check walks the header, metadata and tensor
+ * table and makes sure every tensor's data lies inside the file, so a
+ * truncated download is caught without loading it.
+ *
+ * With a digest cache, the digest is stored under the file's device,
+ * inode, size and modification time, and an unchanged file is not read
+ * again. A file that changes while it is hashed is not cached.
+ *
+ * @return false if the file cannot be read (error says why); a damaged
+ *         file is reported through out.structureError and its digest
+ */
+bool verifyModelFile(const std::string& path, const ModelVerifyOptions& options,
+                     ModelVerification& out, std::string& error);
+
+} // namespace llamaandroid
+
+#endif // MODEL_VERIFIER_H
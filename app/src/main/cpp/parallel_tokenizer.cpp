@@ -0,0 +1,285 @@
+#define LOG_TAG "ParallelTokenizer"
+#include "parallel_tokenizer.h"
+#include "llama_log.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace llamaandroid {
+
+// Shortest segment worth handing to another thread (characters)
+static const size_t MIN_SEGMENT_CHARS = 4096;
+
+std::vector<size_t> safeBoundaries(const std::string& text) {
+    std::vector<size_t> bounds;
+    for (size_t p = 1; p < text.size(); p++) {
+        if (text[p - 1] == '\n' && !std::isspace(static_cast<unsigned char>(text[p]))) {
+            bounds.push_back(p);
+        }
+    }
+    return bounds;
+}
+
+// Pre-tokenisers by regex family (names as in llama.cpp's vocabulary loader)
+static const char* const GPT2_PRE_TOKENIZERS[] = {
+    "gpt-2", "phi-2", "olmo",
+    "starcoder", "refact", "command-r", "smollm", "codeshell", "exaone", "minerva-7b",
+};
+static const char* const LLAMA3_PRE_TOKENIZERS[] = {
+    "llama3", "llama-v3", "llama-bpe", "falcon3", "dbrx", "smaug-bpe", "pixtral",
+    "qwen2", "stablelm2", "deepseek-r1-qwen",
+};
+
+SplitRule splitRuleFor(const std::string& preTokenizer) {
+    for (const char* name : GPT2_PRE_TOKENIZERS) {
+        if (preTokenizer == name) {
+            return SplitRule::Gpt2;
+        }
+    }
+    for (const char* name : LLAMA3_PRE_TOKENIZERS) {
+        if (preTokenizer == name) {
+            return SplitRule::Llama3;
+        }
+    }
+    return SplitRule::Lines;
+}
+
+static inline bool isPrintableAscii(char c) {
+    return c > ' ' && c < 0x7f;
+}
+
+// Whether 16 bytes contain a space or a newline
+static inline bool hasSeparator(const char* p) {
+#if defined(__SSE2__)
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    return _mm_movemask_epi8(hits) != 0;
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    const uint8x16_t hits = vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\n')));
+    return vmaxvq_u8(hits) != 0;
+#else
+    (void)p;
+    return true;
+#endif
+}
+
+size_t nextSplitPoint(const std::string& text, size_t from, SplitRule rule) {
+    const char* s = text.data();
+    const size_t n = text.size();
+    
+    // A newline just before from makes from itself a candidate
+    size_t i = from > 0 ? from - 1 : 0;
+    while (i < n) {
+        while (i + 16 <= n && !hasSeparator(s + i)) {
+            i += 16;
+        }
+        if (i >= n) {
+            break;
+        }
+        
+        if (s[i] == '\n' && i + 1 < n && isPrintableAscii(s[i + 1]) &&
+            (rule == SplitRule::Llama3 || (i > 0 && isPrintableAscii(s[i - 1])))) {
+            return i + 1;
+        }
+        if (s[i] == ' ' && rule != SplitRule::Lines && i >= from && i > 0 && isPrintableAscii(s[i - 1])) {
+            return i;
+        }
+        i++;
+    }
+    return std::string::npos;
+}
+
+#if LLAMA_AVAILABLE
+
+SplitRule splitRuleOf(const llama_model* model) {
+    char name[64];
+    if (llama_model_meta_val_str(model, "tokenizer.ggml.pre", name, sizeof(name)) < 0) {
+        return SplitRule::Lines;
+    }
+    return splitRuleFor(name);
+}
+
+namespace {
+
+/**
+ * Process-wide worker threads for tokenisation. Workers are started on
+ * first use, up to one less than the hardware threads, and live as long as
+ * the process. The submitting thread works on its own job too, so a job
+ * completes even when every worker is busy with another.
+ */
+class TokenizerPool {
+public:
+    void run(size_t count, int threads, const std::function<void(size_t)>& task) {
+        auto job = std::make_shared<Job>();
+        job->count = count;
+        job->remaining = count;
+        job->task = &task;
+        
+        size_t helpers = std::min(count, static_cast<size_t>(std::max(1, threads))) - 1;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            startWorkers(helpers);
+            helpers = std::min(helpers, workers_);
+            for (size_t i = 0; i < helpers; i++) {
+                jobs_.push_back(job);
+            }
+        }
+        cv_.notify_all();
+        
+        work(*job);
+        
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->done.wait(lock, [&job] { return job->remaining == 0; });
+    }
+
+private:
+    struct Job {
+        size_t count = 0;
+        std::atomic<size_t> next{0};
+        size_t remaining = 0;  // Guarded by mutex
+        const std::function<void(size_t)>* task = nullptr;  // Only used while items remain
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<Job>> jobs_;
+    size_t workers_ = 0;
+    
+    static void work(Job& job) {
+        while (true) {
+            const size_t i = job.next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= job.count) {
+                return;
+            }
+            (*job.task)(i);
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (--job.remaining == 0) {
+                job.done.notify_all();
+            }
+        }
+    }
+    
+    void startWorkers(size_t wanted) {
+        const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+        wanted = std::min(wanted, hardware - 1);
+        while (workers_ < wanted) {
+            std::thread([this] { loop(); }).detach();
+            workers_++;
+        }
+    }
+    
+    void loop() {
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return !jobs_.empty(); });
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            work(*job);
+        }
+    }
+};
+
+} // namespace
+
+static TokenizerPool& tokenizerPool() {
+    // Never destroyed: detached workers wait on it until the process exits
+    static TokenizerPool* pool = new TokenizerPool();
+    return *pool;
+}
+
+static bool tokenizeSegment(const llama_vocab* vocab, const char* text, size_t length,
+                            std::vector<llama_token>& out) {
+    out.resize(length / 3 + 16);
+    int n = llama_tokenize(vocab, text, static_cast<int32_t>(length), out.data(),
+                           static_cast<int32_t>(out.size()), false, true);
+    if (n < 0) {
+        out.resize(-n);
+        n = llama_tokenize(vocab, text, static_cast<int32_t>(length), out.data(),
+                           static_cast<int32_t>(out.size()), false, true);
+    }
+    if (n < 0) {
+        return false;
+    }
+    out.resize(n);
+    return true;
+}
+
+bool tokenizeParallel(const llama_vocab* vocab, const std::string& text, bool addSpecial, SplitRule rule,
+                      int threads, std::vector<llama_token>& out) {
+    if (llama_vocab_type(vocab) != LLAMA_VOCAB_TYPE_BPE) {
+        return false;
+    }
+    
+    const size_t pieces = std::min(static_cast<size_t>(std::max(1, threads)), text.size() / MIN_SEGMENT_CHARS);
+    if (pieces < 2) {
+        return false;
+    }
+    
+    // Cut at the first split point after each even share of the text
+    std::vector<size_t> cuts{0};
+    for (size_t i = 1; i < pieces; i++) {
+        const size_t cut = nextSplitPoint(text, std::max(text.size() * i / pieces, cuts.back() + 1), rule);
+        if (cut == std::string::npos) {
+            break;
+        }
+        cuts.push_back(cut);
+    }
+    cuts.push_back(text.size());
+    if (cuts.size() < 3) {
+        return false;
+    }
+    
+    const size_t segments = cuts.size() - 1;
+    std::vector<std::vector<llama_token>> parts(segments);
+    std::atomic<bool> failed{false};
+    tokenizerPool().run(segments, threads, [&](size_t i) {
+        if (!tokenizeSegment(vocab, text.data() + cuts[i], cuts[i + 1] - cuts[i], parts[i])) {
+            failed.store(true, std::memory_order_relaxed);
+        }
+    });
+    if (failed.load()) {
+        LOGW("Segment tokenisation failed");
+        return false;
+    }
+    
+    size_t total = 2;
+    for (const auto& part : parts) {
+        total += part.size();
+    }
+    out.clear();
+    out.reserve(total);
+    if (addSpecial && llama_vocab_get_add_bos(vocab)) {
+        out.push_back(llama_vocab_bos(vocab));
+    }
+    for (const auto& part : parts) {
+        out.insert(out.end(), part.begin(), part.end());
+    }
+    if (addSpecial && llama_vocab_get_add_eos(vocab)) {
+        out.push_back(llama_vocab_eos(vocab));
+    }
+    
+    LOGD("Tokenised %zu chars in %zu segments: %zu tokens", text.size(), segments, out.size());
+    return true;
+}
+
+#endif
+
+} // namespace llamaandroid
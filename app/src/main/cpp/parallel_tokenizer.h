@@ -0,0 +1,81 @@
+#ifndef PARALLEL_TOKENIZER_H
+#define PARALLEL_TOKENIZER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#if LLAMA_AVAILABLE
+#include "llama.h"
+#endif
+
+namespace llamaandroid {
+
+/**
+ * Positions where tokenisation can be split: right after a newline that is
+ * followed by a non-space character. Pre-tokenisers of all BPE families end
+ * a word at a newline (a run of newlines and the whitespace before it stays
+ * in one piece), and a following non-space character starts a new one, so
+ * no merge crosses these positions.
+ */
+std::vector<size_t> safeBoundaries(const std::string& text);
+
+/**
+ * Where long text may be cut for parallel tokenisation. A cut is only made
+ * between printable ASCII characters and a following space or newline, so
+ * that no pattern can see Unicode whitespace across it.
+ */
+enum class SplitRule {
+    Lines,   // After a newline between printable characters; any BPE pre-tokeniser
+    Gpt2,    // Lines, and before a space that follows a printable character
+    Llama3,  // Gpt2, and after a newline that follows other whitespace
+};
+
+/**
+ * Split rule for a pre-tokeniser name (GGUF tokenizer.ggml.pre). The GPT-2,
+ * llama3 and qwen2 regex families (and those that only split digits first)
+ * have no lookbehind and never match a printable character together with
+ * a following space, so text cut there tokenises the same as the whole.
+ * GPT-2's "\s+(?!\S)" does treat a whitespace run differently at the end of
+ * the text, which llama3's "\s*[\r\n]+" does not. Unrecognised names keep to
+ * Lines.
+ */
+SplitRule splitRuleFor(const std::string& preTokenizer);
+
+/**
+ * First split point at or after a position. Runs without a space or
+ * newline are skipped 16 bytes at a time where SSE2 or AArch64 NEON is
+ * available; non-ASCII text is never cut inside, so it needs no Unicode
+ * classification.
+ * @return Split point, or std::string::npos if there is none
+ */
+size_t nextSplitPoint(const std::string& text, size_t from, SplitRule rule);
+
+#if LLAMA_AVAILABLE
+/**
+ * Split rule of a loaded model, from its tokenizer.ggml.pre metadata
+ */
+SplitRule splitRuleOf(const llama_model* model);
+
+/**
+ * Tokenise long text in segments split at split points, on a shared
+ * thread pool, and concatenate the results. Only BPE vocabularies can be
+ * split this way; SentencePiece-style tokenisers prefix every call with a
+ * space and merge across newlines.
+ *
+ * @param vocab Vocabulary; llama_tokenize is thread-safe on a shared vocab
+ * @param text Text to tokenise (special tokens are parsed)
+ * @param addSpecial Add BOS/EOS as the vocabulary requires, as llama_tokenize does
+ * @param rule Where the text may be cut (see splitRuleOf())
+ * @param threads Maximum segments tokenised concurrently
+ * @param out Receives the tokens
+ * @return false if the text was not split (too short, wrong vocabulary
+ *         type, no split points) or tokenisation failed; out is then unspecified
+ */
+bool tokenizeParallel(const llama_vocab* vocab, const std::string& text, bool addSpecial, SplitRule rule,
+                      int threads, std::vector<llama_token>& out);
+#endif
+
+} // namespace llamaandroid
+
+#endif // PARALLEL_TOKENIZER_H
@@ -0,0 +1,308 @@
+#include "penalty_sampler.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace llamaandroid {
+
+// Repeats longer than this are penalised as if they had this length
+static const int DRY_MAX_MATCH = 48;
+
+// Earlier occurrences of the last token examined per DRY step
+static const int DRY_MAX_OCCURRENCES = 128;
+
+bool penaltiesEnabled(const LlamaConfig& config) {
+    if (config.penaltyWindow == 0) {
+        return false;
+    }
+    return config.repeatPenalty != 1.0f || config.frequencyPenalty != 0.0f ||
+           config.presencePenalty != 0.0f || config.dryMultiplier > 0.0f;
+}
+
+#if LLAMA_AVAILABLE
+
+/**
+ * Sliding window of accepted tokens with incrementally maintained counts.
+ *
+ * Positions are absolute (0 for the first accepted token) and stored + 1 so
+ * that 0 can mean "none". Each ring slot also records where the same token
+ * occurred before, which lets DRY visit the earlier occurrences of the last
+ * token without scanning the window.
+ *
+ * Counts are kept in an open-addressing table sized for a window of
+ * distinct tokens, so accepting a token never allocates.
+ */
+class PenaltyState {
+public:
+    explicit PenaltyState(const LlamaConfig& config)
+        : repeat_(config.repeatPenalty),
+          frequency_(config.frequencyPenalty),
+          presence_(config.presencePenalty),
+          dryMultiplier_(config.dryMultiplier),
+          dryBase_(config.dryBase),
+          dryAllowedLength_(std::max(1, config.dryAllowedLength)) {
+        // No more tokens than the context holds can be in the window
+        int window = config.penaltyWindow < 0 ? config.contextSize
+                                              : std::min(config.penaltyWindow, config.contextSize);
+        window_ = static_cast<size_t>(std::max(1, window));
+        tokens_.resize(window_);
+        previous_.resize(window_);
+        
+        // At most half full
+        int bits = 4;
+        while ((size_t(1) << bits) < 2 * window_) {
+            bits++;
+        }
+        table_.resize(size_t(1) << bits);
+        shift_ = 32 - bits;
+        active_.reserve(window_);
+        repeats_.reserve(DRY_MAX_OCCURRENCES);
+    }
+    
+    void accept(llama_token token) {
+        if (total_ >= window_) {
+            const size_t evicted = find(at(total_ - window_));
+            if (--table_[evicted].count == 0) {
+                erase(evicted);
+            }
+        }
+        
+        Entry& entry = table_[insert(token)];
+        const size_t slot = total_ % window_;
+        tokens_[slot] = token;
+        previous_[slot] = entry.count > 0 ? entry.last : 0;
+        entry.count++;
+        entry.last = total_ + 1;
+        total_++;
+    }
+    
+    void reset() {
+        std::fill(table_.begin(), table_.end(), Entry());
+        active_.clear();
+        total_ = 0;
+    }
+    
+    void apply(llama_token_data_array* cur_p) {
+        if (active_.empty()) {
+            return;
+        }
+        
+        indexed_ = false;
+        
+        for (llama_token token : active_) {
+            llama_token_data* candidate = candidateOf(cur_p, token);
+            if (candidate == nullptr) {
+                continue;
+            }
+            if (repeat_ != 1.0f) {
+                candidate->logit = candidate->logit <= 0.0f ? candidate->logit * repeat_
+                                                            : candidate->logit / repeat_;
+            }
+            candidate->logit -= table_[find(token)].count * frequency_ + presence_;
+        }
+        
+        if (dryMultiplier_ > 0.0f) {
+            findRepeats();
+            for (const auto& match : repeats_) {
+                llama_token_data* candidate = candidateOf(cur_p, match.first);
+                if (candidate != nullptr && match.second >= dryAllowedLength_) {
+                    candidate->logit -= dryMultiplier_ * std::pow(dryBase_, match.second - dryAllowedLength_);
+                }
+            }
+        }
+        
+        cur_p->sorted = false;
+    }
+
+private:
+    struct Entry {
+        llama_token token = -1;  // -1 marks an empty slot
+        int count = 0;           // Occurrences in the window
+        uint32_t active = 0;     // Index in active_
+        uint64_t last = 0;       // Position + 1 of the latest occurrence
+    };
+    
+    float repeat_;
+    float frequency_;
+    float presence_;
+    float dryMultiplier_;
+    float dryBase_;
+    int dryAllowedLength_;
+    size_t window_;
+    
+    std::vector<llama_token> tokens_;  // Ring buffer indexed by position % window_
+    std::vector<uint64_t> previous_;   // Position + 1 of the previous occurrence of the same token
+    uint64_t total_ = 0;               // Tokens accepted so far
+    std::vector<Entry> table_;         // Linear probing, indexed by hash
+    int shift_ = 28;
+    std::vector<llama_token> active_;  // Tokens in the window, in no particular order
+    
+    // Scratch space reused across steps
+    std::vector<std::pair<llama_token, int>> repeats_;  // Next token of a repeat and its length
+    std::unordered_map<llama_token, size_t> index_;
+    bool indexed_ = false;
+    
+    uint64_t first() const { return total_ > window_ ? total_ - window_ : 0; }
+    llama_token at(uint64_t pos) const { return tokens_[pos % window_]; }
+    
+    size_t home(llama_token token) const {
+        return static_cast<size_t>((static_cast<uint32_t>(token) * 2654435769u) >> shift_);
+    }
+    
+    // Slot of a token that is in the window
+    size_t find(llama_token token) const {
+        const size_t mask = table_.size() - 1;
+        size_t i = home(token);
+        while (table_[i].token != token) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+    
+    size_t insert(llama_token token) {
+        const size_t mask = table_.size() - 1;
+        size_t i = home(token);
+        while (table_[i].token != token) {
+            if (table_[i].token < 0) {
+                table_[i].token = token;
+                table_[i].active = static_cast<uint32_t>(active_.size());
+                active_.push_back(token);
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+    
+    void erase(size_t i) {
+        // Swap-remove from the active list
+        const uint32_t index = table_[i].active;
+        const llama_token moved = active_.back();
+        active_[index] = moved;
+        active_.pop_back();
+        if (moved != table_[i].token) {
+            table_[find(moved)].active = index;
+        }
+        
+        // Backward-shift deletion keeps every probe sequence unbroken
+        const size_t mask = table_.size() - 1;
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (table_[j].token < 0) {
+                break;
+            }
+            const size_t k = home(table_[j].token);
+            const bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stays) {
+                table_[i] = table_[j];
+                i = j;
+            }
+        }
+        table_[i] = Entry();
+    }
+    
+    llama_token_data* candidateOf(llama_token_data_array* cur_p, llama_token token) {
+        // The unfiltered candidate array is in vocabulary order
+        if (token >= 0 && static_cast<size_t>(token) < cur_p->size && cur_p->data[token].id == token) {
+            return &cur_p->data[token];
+        }
+        if (!indexed_) {
+            index_.clear();
+            for (size_t i = 0; i < cur_p->size; i++) {
+                index_[cur_p->data[i].id] = i;
+            }
+            indexed_ = true;
+        }
+        auto it = index_.find(token);
+        return it != index_.end() ? &cur_p->data[it->second] : nullptr;
+    }
+    
+    /**
+     * For every earlier occurrence of the last token, measure how many
+     * tokens before it match the tokens before the end of the window; the
+     * token that followed it would extend a repeat of that length.
+     */
+    void findRepeats() {
+        repeats_.clear();
+        if (total_ < 2) {
+            return;
+        }
+        
+        const uint64_t start = first();
+        const uint64_t last = total_ - 1;
+        uint64_t previous = previous_[last % window_];
+        int examined = 0;
+        
+        while (previous != 0 && previous - 1 >= start && examined++ < DRY_MAX_OCCURRENCES) {
+            const uint64_t pos = previous - 1;
+            int length = 1;
+            while (length < DRY_MAX_MATCH && pos >= start + length && at(pos - length) == at(last - length)) {
+                length++;
+            }
+            
+            const llama_token next = at(pos + 1);
+            auto it = std::find_if(repeats_.begin(), repeats_.end(),
+                                   [next](const std::pair<llama_token, int>& r) { return r.first == next; });
+            if (it == repeats_.end()) {
+                repeats_.emplace_back(next, length);
+            } else {
+                it->second = std::max(it->second, length);
+            }
+            
+            previous = previous_[pos % window_];
+        }
+    }
+};
+
+static const char* penaltyName(const llama_sampler* /*smpl*/) {
+    return "llama-android-penalties";
+}
+
+static void penaltyAccept(llama_sampler* smpl, llama_token token) {
+    static_cast<PenaltyState*>(smpl->ctx)->accept(token);
+}
+
+static void penaltyApply(llama_sampler* smpl, llama_token_data_array* cur_p) {
+    static_cast<PenaltyState*>(smpl->ctx)->apply(cur_p);
+}
+
+static void penaltyReset(llama_sampler* smpl) {
+    static_cast<PenaltyState*>(smpl->ctx)->reset();
+}
+
+static llama_sampler* penaltyClone(const llama_sampler* smpl);
+
+static void penaltyFree(llama_sampler* smpl) {
+    delete static_cast<PenaltyState*>(smpl->ctx);
+}
+
+static const llama_sampler_i* penaltyInterface() {
+    // Assigned by name so that fields added by newer llama.cpp stay null
+    static const llama_sampler_i iface = [] {
+        llama_sampler_i i{};
+        i.name = penaltyName;
+        i.accept = penaltyAccept;
+        i.apply = penaltyApply;
+        i.reset = penaltyReset;
+        i.clone = penaltyClone;
+        i.free = penaltyFree;
+        return i;
+    }();
+    return &iface;
+}
+
+static llama_sampler* penaltyClone(const llama_sampler* smpl) {
+    const auto* state = static_cast<const PenaltyState*>(smpl->ctx);
+    return llama_sampler_init(penaltyInterface(), new PenaltyState(*state));
+}
+
+llama_sampler* createPenaltySampler(const LlamaConfig& config) {
+    return llama_sampler_init(penaltyInterface(), new PenaltyState(config));
+}
+
+#endif
+
+} // namespace llamaandroid
@@ -0,0 +1,35 @@
+#ifndef PENALTY_SAMPLER_H
+#define PENALTY_SAMPLER_H
+
+#include "llama_context_wrapper.h"
+
+namespace llamaandroid {
+
+/**
+ * Whether the configuration asks for any repetition penalty
+ */
+bool penaltiesEnabled(const LlamaConfig& config);
+
+#if LLAMA_AVAILABLE
+/**
+ * Create the penalty stage of a sampler chain.
+ *
+ * Applies the repeat, frequency and presence penalties over the last
+ * LlamaConfig::penaltyWindow accepted tokens, and the DRY ("don't repeat
+ * yourself") penalty to tokens that would extend a sequence already seen in
+ * the window. Token counts live in a hash map updated as tokens enter and
+ * leave the window, and the candidates of a repeated sequence are found by
+ * following a per-token chain of previous occurrences, so each step costs
+ * O(penalised ids) however long the window is.
+ *
+ * Must come first in the chain: logits are looked up by token id, which is
+ * O(1) while the candidate array is still in vocabulary order.
+ *
+ * @return Sampler to add with llama_sampler_chain_add()
+ */
+llama_sampler* createPenaltySampler(const LlamaConfig& config);
+#endif
+
+} // namespace llamaandroid
+
+#endif // PENALTY_SAMPLER_H
@@ -0,0 +1,375 @@
+#include "prompt_template.h"
+#include "parallel_tokenizer.h"
+#include <algorithm>
+#include <cctype>
+
+#define LOG_TAG "PromptTemplate"
+#include "llama_log.h"
+
+namespace llamaandroid {
+
+static bool isIdentChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+PromptTemplate::PromptTemplate(LlamaContextWrapper& wrapper, const std::string& text)
+    : wrapper_(wrapper), text_(text) {
+    parse();
+}
+
+bool PromptTemplate::compile() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> wrapperLock(wrapper_.mutex_);
+    return compileLocked();
+}
+
+std::vector<std::string> PromptTemplate::getSlots() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return slots_;
+}
+
+void PromptTemplate::setValidation(int count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    validateRemaining_ = count;
+}
+
+TemplateStats PromptTemplate::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::string PromptTemplate::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+void PromptTemplate::parse() {
+    std::string current;
+    const size_t n = text_.size();
+    size_t i = 0;
+    
+    while (i < n) {
+        const char c = text_[i];
+        
+        if ((c == '{' || c == '}') && i + 1 < n && text_[i + 1] == c) {
+            current.push_back(c);
+            i += 2;
+            continue;
+        }
+        
+        if (c == '{') {
+            size_t j = i + 1;
+            while (j < n && isIdentChar(text_[j])) {
+                j++;
+            }
+            if (j > i + 1 && j < n && text_[j] == '}' &&
+                !std::isdigit(static_cast<unsigned char>(text_[i + 1]))) {
+                statics_.push_back(current);
+                current.clear();
+                slotOrder_.push_back(text_.substr(i + 1, j - i - 1));
+                i = j + 1;
+                continue;
+            }
+        }
+        
+        current.push_back(c);
+        i++;
+    }
+    statics_.push_back(current);
+    
+    for (const std::string& name : slotOrder_) {
+        if (std::find(slots_.begin(), slots_.end(), name) == slots_.end()) {
+            slots_.push_back(name);
+        }
+    }
+}
+
+bool PromptTemplate::tokenize(const std::string& text, bool addBos, std::vector<int32_t>& out) {
+    // Called with wrapper_.mutex_ held
+    out.clear();
+    if (text.empty() && !addBos) {
+        return true;
+    }
+#if LLAMA_AVAILABLE
+    std::vector<llama_token> tokens = wrapper_.tokenize(text, addBos);
+    if (tokens.empty() && !text.empty()) {
+        return false;
+    }
+    out.assign(tokens.begin(), tokens.end());
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool PromptTemplate::compileLocked() {
+    // Called with mutex_ and wrapper_.mutex_ held
+    lastError_.clear();
+    parts_.clear();
+    stats_.staticTokens = 0;
+    compiled_ = false;
+    
+    auto addText = [this](const std::string& text) {
+        if (text.empty()) {
+            return;
+        }
+        if (!parts_.empty() && parts_.back().type == PartType::Text) {
+            parts_.back().text += text;
+        } else {
+            parts_.push_back({PartType::Text, {}, text});
+        }
+    };
+    
+    bool canTokenize = std::atomic_load(&wrapper_.remote_) == nullptr;
+#if LLAMA_AVAILABLE
+    canTokenize = canTokenize && wrapper_.model_ != nullptr;
+#else
+    canTokenize = false;
+#endif
+
+    for (size_t i = 0; i < statics_.size(); i++) {
+        if (i > 0) {
+            parts_.push_back({PartType::Slot, {}, slotOrder_[i - 1]});
+        }
+        
+        const std::string& segment = statics_[i];
+        if (segment.empty()) {
+            continue;
+        }
+        if (!canTokenize) {
+            addText(segment);
+            continue;
+        }
+        
+        // Text between a slot and the nearest boundary is tokenised at
+        // render time together with the slot value
+        const bool hasPrev = i > 0;
+        const bool hasNext = i + 1 < statics_.size();
+        const bool bos = i == 0;
+        std::vector<size_t> bounds = safeBoundaries(segment);
+        
+        size_t a = 0;
+        size_t b = segment.size();
+        if (hasPrev) {
+            a = bounds.empty() ? std::string::npos : bounds.front();
+        }
+        if (hasNext) {
+            b = bounds.empty() ? std::string::npos : bounds.back();
+        }
+        if (a == std::string::npos || b == std::string::npos || b <= a) {
+            addText(segment);
+            continue;
+        }
+        
+        std::vector<int32_t> whole;
+        std::vector<int32_t> head;
+        std::vector<int32_t> core;
+        std::vector<int32_t> tail;
+        bool ok = tokenize(segment, bos, whole) &&
+                  tokenize(segment.substr(0, a), false, head) &&
+                  tokenize(segment.substr(a, b - a), bos && a == 0, core) &&
+                  tokenize(segment.substr(b), false, tail);
+        
+        // Keep the split only if it reproduces the segment's own tokenisation
+        std::vector<int32_t> joined = head;
+        joined.insert(joined.end(), core.begin(), core.end());
+        joined.insert(joined.end(), tail.begin(), tail.end());
+        if (!ok || joined != whole) {
+            LOGD("Segment %zu is not splittable, tokenising it per request", i);
+            addText(segment);
+            continue;
+        }
+        
+        addText(segment.substr(0, a));
+        parts_.push_back({PartType::Tokens, core, std::string()});
+        addText(segment.substr(b));
+        stats_.staticTokens += core.size();
+    }
+    
+    modelGeneration_ = wrapper_.modelGeneration_;
+    spliceEnabled_ = stats_.staticTokens > 0;
+    compiled_ = true;
+    
+    LOGI("Template compiled: %zu slots, %zu parts, %zu pre-tokenised tokens",
+         slots_.size(), parts_.size(), stats_.staticTokens);
+    return true;
+}
+
+bool PromptTemplate::renderText(const std::map<std::string, std::string>& values, std::string& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return renderTextLocked(values, out);
+}
+
+bool PromptTemplate::renderTextLocked(const std::map<std::string, std::string>& values, std::string& out) {
+    out = statics_[0];
+    for (size_t i = 1; i < statics_.size(); i++) {
+        auto it = values.find(slotOrder_[i - 1]);
+        if (it == values.end()) {
+            lastError_ = "No value for slot: " + slotOrder_[i - 1];
+            return false;
+        }
+        out += it->second;
+        out += statics_[i];
+    }
+    return true;
+}
+
+bool PromptTemplate::render(const std::map<std::string, std::string>& values, std::vector<int32_t>& tokens) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> wrapperLock(wrapper_.mutex_);
+    lastError_.clear();
+    tokens.clear();
+
+#if LLAMA_AVAILABLE
+    if (wrapper_.model_ == nullptr) {
+        lastError_ = "Model not loaded";
+        return false;
+    }
+#else
+    lastError_ = "Tokenisation requires llama.cpp";
+    return false;
+#endif
+
+    // Token ids are only valid for the model they were produced with
+    if (!compiled_ || modelGeneration_ != wrapper_.modelGeneration_) {
+        compileLocked();
+    }
+    
+    stats_.renders++;
+    
+    if (!spliceEnabled_) {
+        std::string text;
+        if (!renderTextLocked(values, text)) {
+            return false;
+        }
+        stats_.lastDynamicChars = text.size();
+        if (!tokenize(text, true, tokens)) {
+            lastError_ = "Failed to tokenize prompt";
+            return false;
+        }
+        return true;
+    }
+    
+    std::string pending;
+    size_t dynamicChars = 0;
+    std::vector<int32_t> piece;
+    
+    auto flush = [&]() {
+        if (pending.empty()) {
+            return true;
+        }
+        if (!tokenize(pending, tokens.empty(), piece)) {
+            return false;
+        }
+        tokens.insert(tokens.end(), piece.begin(), piece.end());
+        dynamicChars += pending.size();
+        pending.clear();
+        return true;
+    };
+    
+    for (const Part& part : parts_) {
+        if (part.type == PartType::Slot) {
+            auto it = values.find(part.text);
+            if (it == values.end()) {
+                lastError_ = "No value for slot: " + part.text;
+                return false;
+            }
+            pending += it->second;
+        } else if (part.type == PartType::Text) {
+            pending += part.text;
+        } else {
+            if (!flush()) {
+                lastError_ = "Failed to tokenize slot values";
+                return false;
+            }
+            tokens.insert(tokens.end(), part.tokens.begin(), part.tokens.end());
+        }
+    }
+    if (!flush()) {
+        lastError_ = "Failed to tokenize slot values";
+        return false;
+    }
+    
+    stats_.splicedRenders++;
+    stats_.lastDynamicChars = dynamicChars;
+    
+    if (validateRemaining_ != 0) {
+        if (validateRemaining_ > 0) {
+            validateRemaining_--;
+        }
+        stats_.validatedRenders++;
+        
+        std::string text;
+        std::vector<int32_t> full;
+        if (renderTextLocked(values, text) && tokenize(text, true, full) && full != tokens) {
+            // A slot value merged across a boundary; never splice this
+            // template again
+            stats_.mismatches++;
+            spliceEnabled_ = false;
+            LOGW("Spliced tokens differ from full tokenisation (%zu vs %zu), disabling splicing",
+                 tokens.size(), full.size());
+            tokens.swap(full);
+        }
+    }
+    
+    return true;
+}
+
+bool PromptTemplate::generateStream(const std::map<std::string, std::string>& values, TokenCallback callback,
+                                    const LlamaConfig* config) {
+    bool byText = std::atomic_load(&wrapper_.remote_) != nullptr;
+#if !LLAMA_AVAILABLE
+    byText = true;
+#endif
+
+    if (byText) {
+        // No local vocabulary: send the rendered text
+        std::string text;
+        if (!renderText(values, text)) {
+            return false;
+        }
+        wrapper_.generateStream(text, callback, config);
+    } else {
+        std::vector<int32_t> tokens;
+        if (!render(values, tokens)) {
+            return false;
+        }
+        wrapper_.generateStreamTokens(tokens, callback, config);
+    }
+    
+    std::string error = wrapper_.getLastError();
+    if (!error.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = error;
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<ScheduledRequest> PromptTemplate::submit(SequenceScheduler& scheduler,
+                                                         const std::map<std::string, std::string>& values,
+                                                         const LlamaConfig* config, RequestPriority priority) {
+    std::shared_ptr<ScheduledRequest> request;
+#if LLAMA_AVAILABLE
+    std::vector<int32_t> tokens;
+    if (!render(values, tokens)) {
+        return nullptr;
+    }
+    request = scheduler.submitCompletion(tokens, config, priority);
+#else
+    // No local vocabulary: queue the rendered text
+    std::string text;
+    if (!renderText(values, text)) {
+        return nullptr;
+    }
+    request = scheduler.submitCompletion(text, config, priority);
+#endif
+
+    if (request == nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastError_ = scheduler.getLastError();
+    }
+    return request;
+}
+
+} // namespace llamaandroid
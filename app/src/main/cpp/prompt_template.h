@@ -0,0 +1,148 @@
+#ifndef PROMPT_TEMPLATE_H
+#define PROMPT_TEMPLATE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+#include "llama_context_wrapper.h"
+#include "sequence_scheduler.h"
+
+namespace llamaandroid {
+
+/**
+ * Template counters
+ */
+struct TemplateStats {
+    uint64_t renders = 0;
+    uint64_t splicedRenders = 0;     // Renders that used the pre-tokenised segments
+    uint64_t validatedRenders = 0;   // Renders compared with a full tokenisation
+    uint64_t mismatches = 0;         // Validations that found a different tokenisation
+    size_t staticTokens = 0;         // Tokens cached at compile time
+    size_t lastDynamicChars = 0;     // Text tokenised at request time by the last render
+};
+
+/**
+ * Prompt template with pre-tokenised static text.
+ *
+ * A template is text with `{name}` slots (`{{` and `}}` produce literal
+ * braces; braces that do not enclose an identifier are kept as text, so
+ * JSON examples need no escaping). Compiling splits every static segment at
+ * safe merge boundaries - after a newline that is followed by a non-space
+ * character - and tokenises the part between the first and the last
+ * boundary once. At render time only the slot values, together with the
+ * few characters of static text between a slot and the nearest boundary,
+ * are tokenised; the token arrays are then spliced together.
+ *
+ * A split is only kept if tokenising the pieces separately gives the same
+ * tokens as tokenising the whole segment. The first renders are also
+ * compared with a full tokenisation of the rendered text; on any mismatch
+ * the template falls back to full tokenisation for good. Tokenisers that
+ * insert a space prefix at the start of every call (SentencePiece llama/
+ * mistral vocabularies) therefore fall back automatically.
+ *
+ * Generation from the spliced tokens goes through
+ * LlamaContextWrapper::generateStreamTokens, whose prefix KV reuse skips
+ * re-evaluating the leading static segment between requests.
+ */
+class PromptTemplate {
+public:
+    /**
+     * @param wrapper Wrapper whose model's vocabulary is used; must outlive the template
+     * @param text Template text
+     */
+    PromptTemplate(LlamaContextWrapper& wrapper, const std::string& text);
+    
+    /**
+     * Tokenise the static segments with the loaded model's vocabulary
+     * @return true if successful; on failure see getLastError()
+     */
+    bool compile();
+    
+    /**
+     * Slot names in order of first appearance
+     */
+    std::vector<std::string> getSlots() const;
+    
+    /**
+     * Substitute the slot values as text
+     * @param values Value for every slot
+     * @param out Rendered prompt
+     * @return true if successful, false if a slot has no value
+     */
+    bool renderText(const std::map<std::string, std::string>& values, std::string& out);
+    
+    /**
+     * Produce the prompt tokens for the given slot values
+     * @param values Value for every slot
+     * @param tokens Receives the token ids, starting with BOS if the model adds one
+     * @return true if successful; on failure see getLastError()
+     */
+    bool render(const std::map<std::string, std::string>& values, std::vector<int32_t>& tokens);
+    
+    /**
+     * Render and generate a streaming response
+     * @param values Value for every slot
+     * @param callback Function to call for each generated token
+     * @param config Sampling configuration (optional)
+     * @return true if successful; on failure see getLastError()
+     */
+    bool generateStream(const std::map<std::string, std::string>& values, TokenCallback callback,
+                        const LlamaConfig* config = nullptr);
+    
+    /**
+     * Render and queue the prompt on a scheduler running on the same wrapper
+     * @param scheduler Scheduler that owns the wrapper's context
+     * @param values Value for every slot
+     * @param config Sampling configuration and token limit (nullptr uses the wrapper's)
+     * @param priority Scheduling class
+     * @return Request handle, or nullptr on failure (see getLastError())
+     */
+    std::shared_ptr<ScheduledRequest> submit(SequenceScheduler& scheduler,
+                                             const std::map<std::string, std::string>& values,
+                                             const LlamaConfig* config, RequestPriority priority);
+    
+    /**
+     * Number of renders to compare with a full tokenisation
+     * @param count Renders still to validate; -1 validates every render
+     */
+    void setValidation(int count);
+    
+    TemplateStats getStats() const;
+    std::string getLastError() const;
+
+private:
+    enum class PartType { Tokens, Text, Slot };
+    
+    struct Part {
+        PartType type;
+        std::vector<int32_t> tokens;  // Tokens: pre-tokenised static text
+        std::string text;             // Text: static text tokenised with its neighbours; Slot: name
+    };
+    
+    LlamaContextWrapper& wrapper_;
+    std::string text_;
+    std::vector<std::string> statics_;    // Static text around the slots
+    std::vector<std::string> slotOrder_;  // Slot between statics_[i] and statics_[i + 1]
+    std::vector<std::string> slots_;      // Unique slot names
+    std::vector<Part> parts_;
+    uint64_t modelGeneration_ = 0;
+    bool compiled_ = false;
+    bool spliceEnabled_ = true;
+    int validateRemaining_ = 8;
+    
+    TemplateStats stats_;
+    std::string lastError_;
+    mutable std::mutex mutex_;
+    
+    void parse();
+    bool compileLocked();
+    bool renderTextLocked(const std::map<std::string, std::string>& values, std::string& out);
+    bool tokenize(const std::string& text, bool addBos, std::vector<int32_t>& out);
+};
+
+} // namespace llamaandroid
+
+#endif // PROMPT_TEMPLATE_H
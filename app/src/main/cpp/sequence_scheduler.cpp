@@ -0,0 +1,1107 @@
+#include "sequence_scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <tuple>
+
+#define LOG_TAG "SequenceScheduler"
+#include "llama_log.h"
+
+namespace llamaandroid {
+
+// ============================================================================
+// ScheduledRequest
+// ============================================================================
+
+struct ScheduledRequest::Suspension {
+    std::vector<uint8_t> state;  // llama_state_seq_get_data() of the sequence
+    int nPast = 0;
+    int generated = 0;
+    std::string utf8Carry;
+#if LLAMA_AVAILABLE
+    llama_sampler* sampler = nullptr;  // Keeps penalty history and RNG state
+    llama_token pending = 0;
+    
+    ~Suspension() {
+        if (sampler != nullptr) {
+            llama_sampler_free(sampler);
+        }
+    }
+#else
+    std::vector<std::string> stubWords;
+#endif
+};
+
+ScheduledRequest::ScheduledRequest() = default;
+
+ScheduledRequest::~ScheduledRequest() = default;
+
+int ScheduledRequest::next(std::string& piece, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto ready = [this] { return !pieces_.empty() || finished_; };
+    if (timeoutMs < 0) {
+        cv_.wait(lock, ready);
+    } else if (!cv_.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready)) {
+        return 0;
+    }
+    
+    if (!pieces_.empty()) {
+        piece = std::move(pieces_.front());
+        pieces_.pop_front();
+        return 1;
+    }
+    return -1;
+}
+
+void ScheduledRequest::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return finished_; });
+}
+
+void ScheduledRequest::cancel() {
+    cancelled_ = true;
+}
+
+bool ScheduledRequest::succeeded() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finished_ && !failed_;
+}
+
+std::string ScheduledRequest::error() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+std::string ScheduledRequest::finishReason() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finishReason_;
+}
+
+int ScheduledRequest::promptTokens() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return promptTokens_;
+}
+
+int ScheduledRequest::completionTokens() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return completionTokens_;
+}
+
+int ScheduledRequest::preemptions() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return preemptions_;
+}
+
+std::vector<std::vector<float>> ScheduledRequest::embeddings() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return embeddings_;
+}
+
+void ScheduledRequest::push(std::string piece) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pieces_.push_back(std::move(piece));
+    }
+    cv_.notify_all();
+}
+
+void ScheduledRequest::finish(const std::string& reason) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finished_) {
+            return;
+        }
+        finished_ = true;
+        finishReason_ = reason;
+    }
+    cv_.notify_all();
+}
+
+void ScheduledRequest::fail(const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finished_) {
+            return;
+        }
+        finished_ = true;
+        failed_ = true;
+        error_ = error;
+        finishReason_ = "error";
+    }
+    cv_.notify_all();
+    LOGW("Request failed: %s", error.c_str());
+}
+
+// ============================================================================
+// SequenceScheduler
+// ============================================================================
+
+struct SequenceScheduler::Slot {
+    int seq = 0;
+    std::shared_ptr<ScheduledRequest> request;
+    int nPast = 0;
+    int generated = 0;
+    int batchIndex = -1;
+    std::string utf8Carry;  // Bytes of a character split across tokens
+#if LLAMA_AVAILABLE
+    llama_sampler* sampler = nullptr;
+    llama_token pending = 0;  // Sampled, emitted, not yet decoded
+#else
+    std::vector<std::string> stubWords;
+#endif
+};
+
+/**
+ * Length of the longest prefix of text that ends on a UTF-8 character boundary
+ */
+static size_t completeUtf8Length(const std::string& text) {
+    const size_t n = text.size();
+    size_t start = n;
+    // A character is at most 4 bytes; look back for its lead byte
+    for (size_t back = 1; back <= 4 && back <= n; back++) {
+        unsigned char c = static_cast<unsigned char>(text[n - back]);
+        if ((c & 0xC0) != 0x80) {
+            start = n - back;
+            break;
+        }
+    }
+    if (start == n) {
+        return n;
+    }
+    
+    unsigned char lead = static_cast<unsigned char>(text[start]);
+    size_t expected = 1;
+    if ((lead & 0xE0) == 0xC0) {
+        expected = 2;
+    } else if ((lead & 0xF0) == 0xE0) {
+        expected = 3;
+    } else if ((lead & 0xF8) == 0xF0) {
+        expected = 4;
+    }
+    return n - start >= expected ? n : start;
+}
+
+/**
+ * Generation headroom reserved on admission on top of the prompt, so a new
+ * sequence does not fill the cache on its first steps
+ */
+static constexpr int kAdmissionHeadroom = 32;
+
+/**
+ * Tokens a request still has to generate
+ */
+static int remainingTokens(int maxTokens, int generated) {
+    return std::max(0, maxTokens - generated);
+}
+
+SequenceScheduler::SequenceScheduler(LlamaContextWrapper& wrapper, size_t maxQueue)
+    : wrapper_(wrapper), maxQueue_(maxQueue) {
+}
+
+SequenceScheduler::~SequenceScheduler() {
+    stop();
+}
+
+bool SequenceScheduler::start() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        if (running_) {
+            return true;
+        }
+        lastError_.clear();
+    }
+    
+    // The worker takes wrapper_.mutex_ before queueMutex_; never hold them
+    // the other way round
+    std::string error;
+    int nSeq = 1;
+    int nCtx = 0;
+    {
+        std::unique_lock<std::mutex> wrapperLock = wrapper_.lockIdle();
+        if (std::atomic_load(&wrapper_.remote_) != nullptr) {
+            error = "Scheduler needs an in-process model";
+        } else if (wrapper_.scheduler_ != nullptr && wrapper_.scheduler_ != this) {
+            error = "Another scheduler is running on this context";
+        }
+#if LLAMA_AVAILABLE
+        else if (wrapper_.context_ == nullptr) {
+            error = "Model not loaded";
+        } else {
+            // The context may hold extra sequences for tree speculation
+            nSeq = std::min(static_cast<int>(llama_n_seq_max(wrapper_.context_)),
+                            std::max(1, wrapper_.currentConfig_.parallelSequences));
+            
+            nCtx = static_cast<int>(llama_n_ctx(wrapper_.context_));
+            
+            // Sequences start from an empty cache and run unsteered; one
+            // control vector set would apply to all of them
+            wrapper_.selectControlVectors(0);
+            wrapper_.resetKvCache();
+            batch_ = llama_batch_init(nSeq, 0, 1);
+        }
+#else
+        nSeq = std::max(1, wrapper_.currentConfig_.parallelSequences);
+        nCtx = wrapper_.currentConfig_.contextSize;
+#endif
+
+        // From here on the wrapper refuses calls that would touch the cache
+        if (error.empty()) {
+            wrapper_.scheduler_ = this;
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    if (!error.empty()) {
+        lastError_ = error;
+        LOGE("%s", error.c_str());
+        return false;
+    }
+    
+    nSeq_ = nSeq;
+    nCtx_ = nCtx;
+    slots_.assign(nSeq_, Slot());
+    for (int i = 0; i < nSeq_; i++) {
+        slots_[i].seq = i;
+    }
+    stats_ = SchedulerStats();
+    draining_ = false;
+    drained_ = false;
+    
+    running_ = true;
+    worker_ = std::thread(&SequenceScheduler::run, this);
+    
+    LOGI("Scheduler started with %d parallel sequences", nSeq_);
+    return true;
+}
+
+void SequenceScheduler::stop() {
+    // A model swap may be draining this scheduler; let it finish first
+    std::lock_guard<std::mutex> swapLock(wrapper_.swapMutex_);
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    queueCv_.notify_all();
+    drainCv_.notify_all();
+    
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+
+#if LLAMA_AVAILABLE
+    llama_batch_free(batch_);
+    batch_ = llama_batch{};
+#endif
+
+    {
+        std::lock_guard<std::mutex> wrapperLock(wrapper_.mutex_);
+        if (wrapper_.scheduler_ == this) {
+            wrapper_.scheduler_ = nullptr;
+        }
+    }
+    
+    LOGI("Scheduler stopped");
+}
+
+std::shared_ptr<ScheduledRequest> SequenceScheduler::submitCompletion(const std::string& prompt,
+                                                                      const LlamaConfig* config,
+                                                                      RequestPriority priority) {
+    auto request = std::make_shared<ScheduledRequest>();
+    request->kind_ = ScheduledRequest::Kind::Completion;
+    request->priority_ = priority;
+    request->prompt_ = prompt;
+    request->config_ = config != nullptr ? *config : wrapper_.getConfig();
+    return enqueue(request);
+}
+
+std::shared_ptr<ScheduledRequest> SequenceScheduler::submitCompletion(const std::vector<int32_t>& tokens,
+                                                                      const LlamaConfig* config,
+                                                                      RequestPriority priority) {
+    auto request = std::make_shared<ScheduledRequest>();
+    request->kind_ = ScheduledRequest::Kind::Completion;
+    request->priority_ = priority;
+    request->tokens_ = tokens;
+    request->tokenized_ = true;
+    request->pretokenized_ = true;
+    request->config_ = config != nullptr ? *config : wrapper_.getConfig();
+    return enqueue(request);
+}
+
+std::shared_ptr<ScheduledRequest> SequenceScheduler::submitEmbedding(const std::vector<std::string>& inputs,
+                                                                     RequestPriority priority,
+                                                                     EmbeddingPooling pooling) {
+    auto request = std::make_shared<ScheduledRequest>();
+    request->kind_ = ScheduledRequest::Kind::Embedding;
+    request->priority_ = priority;
+    request->inputs_ = inputs;
+    request->pooling_ = pooling;
+    request->config_.maxTokens = 0;  // Ranks ahead of completions of its class
+    return enqueue(request);
+}
+
+bool SequenceScheduler::isRunning() const {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    return running_;
+}
+
+std::shared_ptr<ScheduledRequest> SequenceScheduler::enqueue(std::shared_ptr<ScheduledRequest> request) {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        if (!running_) {
+            lastError_ = "Scheduler is not running";
+            return nullptr;
+        }
+        if (queue_.size() >= maxQueue_) {
+            lastError_ = "Request queue is full";
+            return nullptr;
+        }
+        request->order_ = nextOrder_++;
+        queue_.push_back(request);
+        stats_.queued = static_cast<int>(queue_.size());
+    }
+    queueCv_.notify_all();
+    return request;
+}
+
+SchedulerStats SequenceScheduler::getStats() const {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    return stats_;
+}
+
+std::string SequenceScheduler::getLastError() const {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    return lastError_;
+}
+
+void SequenceScheduler::drainForSwap() {
+    std::unique_lock<std::mutex> lock(queueMutex_);
+    draining_ = true;
+    drained_ = false;
+    queueCv_.notify_all();
+    drainCv_.wait(lock, [this] { return drained_ || !running_; });
+}
+
+void SequenceScheduler::resumeAfterSwap() {
+    int nSeq = 1;
+    int nCtx = 0;
+#if LLAMA_AVAILABLE
+    nSeq = std::min(static_cast<int>(llama_n_seq_max(wrapper_.context_)),
+                    std::max(1, wrapper_.currentConfig_.parallelSequences));
+    nCtx = static_cast<int>(llama_n_ctx(wrapper_.context_));
+    wrapper_.resetKvCache();
+    llama_batch_free(batch_);
+    batch_ = llama_batch_init(nSeq, 0, 1);
+#else
+    nSeq = std::max(1, wrapper_.currentConfig_.parallelSequences);
+    nCtx = wrapper_.currentConfig_.contextSize;
+#endif
+
+    std::vector<std::shared_ptr<ScheduledRequest>> stale;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        nSeq_ = nSeq;
+        nCtx_ = nCtx;
+        // Every sequence finished during the drain
+        slots_.assign(nSeq_, Slot());
+        for (int i = 0; i < nSeq_; i++) {
+            slots_[i].seq = i;
+        }
+        
+        // Text is tokenised again with the new vocabulary; token ids
+        // submitted by the caller belong to the old one
+        for (auto it = queue_.begin(); it != queue_.end();) {
+            ScheduledRequest& request = **it;
+            if (request.pretokenized_) {
+                stale.push_back(*it);
+                it = queue_.erase(it);
+                continue;
+            }
+            request.tokens_.clear();
+            request.inputTokens_.clear();
+            request.tokenized_ = false;
+            ++it;
+        }
+        stats_.queued = static_cast<int>(queue_.size());
+        stats_.completed += stale.size();
+        
+        draining_ = false;
+        drained_ = false;
+    }
+    queueCv_.notify_all();
+    
+    for (auto& request : stale) {
+        request->fail("Model was swapped before the request started");
+    }
+    LOGI("Scheduler resumed on the new model with %d parallel sequences", nSeq);
+}
+
+void SequenceScheduler::run() {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex_);
+            queueCv_.wait(lock, [this] {
+                if (!running_) {
+                    return true;
+                }
+                if (draining_) {
+                    return !drained_;
+                }
+                if (!queue_.empty()) {
+                    return true;
+                }
+                for (const Slot& slot : slots_) {
+                    if (slot.request != nullptr) {
+                        return true;
+                    }
+                }
+                return false;
+            });
+            if (!running_) {
+                break;
+            }
+        }
+        
+        // The context is only touched with the wrapper's lock held, one
+        // step at a time, so loads and unloads wait for a step boundary
+        std::lock_guard<std::mutex> wrapperLock(wrapper_.mutex_);
+        
+        for (Slot& slot : slots_) {
+            if (slot.request != nullptr && slot.request->cancelled_) {
+                release(slot, "cancelled");
+            }
+        }
+        
+        schedule();
+        
+        int active = 0;
+        for (const Slot& slot : slots_) {
+            if (slot.request != nullptr) {
+                active++;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            stats_.active = active;
+            
+            if (draining_ && active == 0) {
+                // Swapped-out sequences also hold state of the old model
+                const bool suspended = std::any_of(queue_.begin(), queue_.end(),
+                    [](const std::shared_ptr<ScheduledRequest>& r) { return r->suspension_ != nullptr; });
+                if (!suspended) {
+                    drained_ = true;
+                    drainCv_.notify_all();
+                }
+            }
+        }
+        
+        if (active > 0) {
+            step();
+        }
+    }
+    
+    // Drain on shutdown
+    std::lock_guard<std::mutex> wrapperLock(wrapper_.mutex_);
+    for (Slot& slot : slots_) {
+        if (slot.request != nullptr) {
+            release(slot, "cancelled");
+        }
+    }
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    for (auto& request : queue_) {
+        request->suspension_.reset();
+        request->finish("cancelled");
+    }
+    queue_.clear();
+    stats_.queued = 0;
+    stats_.active = 0;
+    stats_.swappedBytes = 0;
+}
+
+void SequenceScheduler::schedule() {
+    // Called on the worker with wrapper_.mutex_ held
+    for (;;) {
+        std::vector<std::shared_ptr<ScheduledRequest>> cancelled;
+        std::shared_ptr<ScheduledRequest> request;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            for (auto it = queue_.begin(); it != queue_.end();) {
+                if ((*it)->cancelled_) {
+                    cancelled.push_back(*it);
+                    it = queue_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            
+            // Highest class first, then shortest remaining job, then oldest
+            auto rank = [](const std::shared_ptr<ScheduledRequest>& r) {
+                const int generated = r->suspension_ != nullptr ? r->suspension_->generated : 0;
+                return std::make_tuple(static_cast<int>(r->priority_),
+                                       remainingTokens(r->config_.maxTokens, generated), r->order_);
+            };
+            for (const auto& waiting : queue_) {
+                // While draining for a model swap only swapped-out sequences
+                // come back; new requests wait for the new model
+                if (draining_ && waiting->suspension_ == nullptr) {
+                    continue;
+                }
+                if (request == nullptr || rank(waiting) < rank(request)) {
+                    request = waiting;
+                }
+            }
+            stats_.queued = static_cast<int>(queue_.size());
+        }
+        
+        for (auto& waiting : cancelled) {
+            if (waiting->suspension_ != nullptr) {
+                std::lock_guard<std::mutex> lock(queueMutex_);
+                stats_.swappedBytes -= waiting->suspension_->state.size();
+            }
+            {
+                std::lock_guard<std::mutex> lock(waiting->mutex_);
+                waiting->completionTokens_ = waiting->suspension_ != nullptr ? waiting->suspension_->generated : 0;
+            }
+            waiting->suspension_.reset();
+            waiting->finish("cancelled");
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            stats_.completed++;
+        }
+        if (request == nullptr) {
+            return;
+        }
+        
+        const int need = cellsNeeded(*request);
+        if (need < 0) {
+            // Rejected while tokenising
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            queue_.erase(std::find(queue_.begin(), queue_.end(), request));
+            stats_.queued = static_cast<int>(queue_.size());
+            stats_.completed++;
+            continue;
+        }
+        
+        Slot* freeSlot = nullptr;
+        int usedCells = 0;
+        for (Slot& slot : slots_) {
+            if (slot.request == nullptr) {
+                freeSlot = freeSlot != nullptr ? freeSlot : &slot;
+            } else {
+                usedCells += slot.nPast;
+            }
+        }
+        
+        if (freeSlot == nullptr || usedCells + need > nCtx_) {
+            // Make room by swapping out the lowest-class sequence with the
+            // most work left, if it is of a lower class than the request
+            Slot* victim = nullptr;
+            for (Slot& slot : slots_) {
+                if (slot.request == nullptr || slot.request->priority_ <= request->priority_) {
+                    continue;
+                }
+                if (victim == nullptr || slot.request->priority_ > victim->request->priority_ ||
+                    (slot.request->priority_ == victim->request->priority_ &&
+                     remainingTokens(slot.request->config_.maxTokens, slot.generated) >
+                     remainingTokens(victim->request->config_.maxTokens, victim->generated))) {
+                    victim = &slot;
+                }
+            }
+            if (victim == nullptr || !preempt(*victim)) {
+                // Wait for a sequence to finish
+                return;
+            }
+            continue;
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            queue_.erase(std::find(queue_.begin(), queue_.end(), request));
+            stats_.queued = static_cast<int>(queue_.size());
+        }
+        
+        if (request->kind_ == ScheduledRequest::Kind::Embedding) {
+            embed(*freeSlot, request);
+        } else if (request->suspension_ != nullptr) {
+            resume(*freeSlot, request);
+        } else {
+            admit(*freeSlot, request);
+        }
+    }
+}
+
+int SequenceScheduler::cellsNeeded(ScheduledRequest& request) {
+    if (request.suspension_ != nullptr) {
+        return request.suspension_->nPast + 1;
+    }
+    
+    if (request.kind_ == ScheduledRequest::Kind::Embedding) {
+        // Inputs run one after another in the borrowed sequence
+        int longest = 0;
+#if LLAMA_AVAILABLE
+        if (!request.tokenized_) {
+            request.inputTokens_.clear();
+            for (const std::string& input : request.inputs_) {
+                std::vector<llama_token> tokens = wrapper_.tokenize(input, true);
+                if (tokens.empty()) {
+                    request.fail("Failed to tokenize input");
+                    return -1;
+                }
+                request.inputTokens_.emplace_back(tokens.begin(), tokens.end());
+            }
+            request.tokenized_ = true;
+        }
+        for (const std::vector<int32_t>& tokens : request.inputTokens_) {
+            longest = std::max(longest, static_cast<int>(tokens.size()));
+        }
+#else
+        for (const std::string& input : request.inputs_) {
+            longest = std::max(longest, static_cast<int>(input.size() / 4 + 1));
+        }
+#endif
+        if (longest > nCtx_) {
+            request.fail("Input too long for context size");
+            return -1;
+        }
+        return longest;
+    }
+    
+    int promptTokens = 0;
+#if LLAMA_AVAILABLE
+    if (!request.tokenized_) {
+        std::vector<llama_token> tokens = wrapper_.tokenize(request.prompt_, true);
+        request.tokens_.assign(tokens.begin(), tokens.end());
+        request.tokenized_ = true;
+    } else if (request.pretokenized_) {
+        // Ids may come from a tokenisation made before a model swap
+        const int32_t nVocab = llama_vocab_n_tokens(llama_model_get_vocab(wrapper_.model_));
+        for (int32_t token : request.tokens_) {
+            if (token < 0 || token >= nVocab) {
+                request.fail("Prompt token out of vocabulary range");
+                return -1;
+            }
+        }
+    }
+    promptTokens = static_cast<int>(request.tokens_.size());
+    if (promptTokens == 0) {
+        request.fail(request.pretokenized_ ? "Empty prompt" : "Failed to tokenize prompt");
+        return -1;
+    }
+#else
+    promptTokens = static_cast<int>(request.pretokenized_ ? request.tokens_.size() : request.prompt_.size() / 4 + 1);
+#endif
+
+    if (promptTokens > nCtx_ - 4) {
+        request.fail("Prompt too long for context size");
+        return -1;
+    }
+    return std::min(nCtx_, promptTokens + std::min(request.config_.maxTokens, kAdmissionHeadroom));
+}
+
+void SequenceScheduler::suspend(Slot& slot, std::unique_ptr<ScheduledRequest::Suspension> suspension) {
+    const size_t bytes = suspension->state.size();
+    suspension->nPast = slot.nPast;
+    suspension->generated = slot.generated;
+    suspension->utf8Carry = std::move(slot.utf8Carry);
+    
+    LOGI("Sequence %d preempted after %d tokens, %zu bytes swapped out", slot.seq, slot.nPast, bytes);
+    
+    std::shared_ptr<ScheduledRequest> request = std::move(slot.request);
+    request->suspension_ = std::move(suspension);
+    {
+        std::lock_guard<std::mutex> lock(request->mutex_);
+        request->preemptions_++;
+    }
+    
+    slot.request.reset();
+    slot.nPast = 0;
+    slot.generated = 0;
+    slot.batchIndex = -1;
+    slot.utf8Carry.clear();
+    
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    queue_.push_back(request);
+    stats_.queued = static_cast<int>(queue_.size());
+    stats_.preemptions++;
+    stats_.swappedBytes += bytes;
+}
+
+void SequenceScheduler::release(Slot& slot, const std::string& reason) {
+#if LLAMA_AVAILABLE
+    llama_memory_t mem = llama_get_memory(wrapper_.context_);
+    if (mem != nullptr) {
+        llama_memory_seq_rm(mem, slot.seq, -1, -1);
+    }
+    if (slot.sampler != nullptr) {
+        llama_sampler_free(slot.sampler);
+        slot.sampler = nullptr;
+    }
+#else
+    slot.stubWords.clear();
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(slot.request->mutex_);
+        slot.request->completionTokens_ = slot.generated;
+    }
+    slot.request->finish(reason);
+    slot.request.reset();
+    slot.nPast = 0;
+    slot.generated = 0;
+    slot.batchIndex = -1;
+    slot.utf8Carry.clear();
+    
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    stats_.completed++;
+}
+
+void SequenceScheduler::emit(Slot& slot, const std::string& text) {
+    slot.utf8Carry += text;
+    const size_t n = completeUtf8Length(slot.utf8Carry);
+    if (n == 0) {
+        return;
+    }
+    slot.request->push(slot.utf8Carry.substr(0, n));
+    slot.utf8Carry.erase(0, n);
+}
+
+#if LLAMA_AVAILABLE
+
+bool SequenceScheduler::admit(Slot& slot, const std::shared_ptr<ScheduledRequest>& request) {
+    slot.request = request;
+    
+    if (wrapper_.context_ == nullptr) {
+        request->fail("Model not loaded");
+        release(slot, "error");
+        return false;
+    }
+    
+    // Tokenised by cellsNeeded() when the request was considered
+    std::vector<llama_token> tokens(request->tokens_.begin(), request->tokens_.end());
+    request->tokens_.clear();
+    request->tokens_.shrink_to_fit();
+    
+    {
+        std::lock_guard<std::mutex> lock(request->mutex_);
+        request->promptTokens_ = static_cast<int>(tokens.size());
+    }
+    
+    llama_memory_t mem = llama_get_memory(wrapper_.context_);
+    if (mem != nullptr) {
+        llama_memory_seq_rm(mem, slot.seq, -1, -1);
+    }
+    
+    if (!wrapper_.prefill(tokens, 0, slot.seq)) {
+        request->fail("Failed to process prompt");
+        release(slot, "error");
+        return false;
+    }
+    
+    slot.sampler = LlamaContextWrapper::createSampler(request->config_);
+    slot.nPast = static_cast<int>(tokens.size());
+    slot.generated = 0;
+    
+    LOGD("Sequence %d admitted: %zu prompt tokens", slot.seq, tokens.size());
+    
+    // The prefill left logits for the last prompt token only
+    accept(slot, llama_sampler_sample(slot.sampler, wrapper_.context_, -1));
+    return true;
+}
+
+bool SequenceScheduler::preempt(Slot& slot) {
+    llama_context* ctx = wrapper_.context_;
+    auto suspension = std::make_unique<ScheduledRequest::Suspension>();
+    
+    const size_t size = llama_state_seq_get_size(ctx, slot.seq);
+    suspension->state.resize(size);
+    if (size == 0 || llama_state_seq_get_data(ctx, suspension->state.data(), size, slot.seq) != size) {
+        LOGW("Failed to snapshot sequence %d, not preempting it", slot.seq);
+        return false;
+    }
+    
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (mem != nullptr) {
+        llama_memory_seq_rm(mem, slot.seq, -1, -1);
+    }
+    
+    // The sampled token has been emitted but not decoded yet; it is the
+    // first token decoded after resuming
+    suspension->sampler = slot.sampler;
+    suspension->pending = slot.pending;
+    slot.sampler = nullptr;
+    
+    suspend(slot, std::move(suspension));
+    return true;
+}
+
+bool SequenceScheduler::resume(Slot& slot, const std::shared_ptr<ScheduledRequest>& request) {
+    slot.request = request;
+    std::unique_ptr<ScheduledRequest::Suspension> suspension = std::move(request->suspension_);
+    const size_t size = suspension->state.size();
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        stats_.swappedBytes -= size;
+        stats_.resumptions++;
+    }
+    
+    llama_memory_t mem = llama_get_memory(wrapper_.context_);
+    if (mem != nullptr) {
+        llama_memory_seq_rm(mem, slot.seq, -1, -1);
+    }
+    
+    // The cells may land in a different sequence than they were taken from
+    if (llama_state_seq_set_data(wrapper_.context_, suspension->state.data(), size, slot.seq) != size) {
+        request->fail("Failed to restore swapped-out sequence");
+        release(slot, "error");
+        return false;
+    }
+    
+    slot.nPast = suspension->nPast;
+    slot.generated = suspension->generated;
+    slot.utf8Carry = std::move(suspension->utf8Carry);
+    slot.sampler = suspension->sampler;
+    slot.pending = suspension->pending;
+    suspension->sampler = nullptr;
+    
+    LOGI("Sequence %d resumed after %d tokens without re-prefill", slot.seq, slot.nPast);
+    return true;
+}
+
+void SequenceScheduler::accept(Slot& slot, int token) {
+    const llama_vocab* vocab = llama_model_get_vocab(wrapper_.model_);
+    if (llama_vocab_is_eog(vocab, token)) {
+        release(slot, "stop");
+        return;
+    }
+    
+    emit(slot, wrapper_.detokenize({token}));
+    slot.generated++;
+    
+    const int nCtx = static_cast<int>(llama_n_ctx(wrapper_.context_));
+    if (slot.generated >= slot.request->config_.maxTokens || slot.nPast >= nCtx) {
+        release(slot, "length");
+        return;
+    }
+    
+    slot.pending = token;
+}
+
+void SequenceScheduler::step() {
+    batch_.n_tokens = 0;
+    for (Slot& slot : slots_) {
+        if (slot.request == nullptr) {
+            slot.batchIndex = -1;
+            continue;
+        }
+        const int i = batch_.n_tokens++;
+        batch_.token[i] = slot.pending;
+        batch_.pos[i] = slot.nPast;
+        batch_.n_seq_id[i] = 1;
+        batch_.seq_id[i][0] = slot.seq;
+        batch_.logits[i] = true;
+        slot.batchIndex = i;
+    }
+    
+    const int ret = llama_decode(wrapper_.context_, batch_);
+    if (ret == 1) {
+        // No room in the KV cache: swap out the lowest-class, longest
+        // sequence so the others can continue on the next step. It resumes
+        // once enough cells are free; a sequence alone has nowhere to go.
+        Slot* victim = nullptr;
+        for (Slot& slot : slots_) {
+            if (slot.request != nullptr &&
+                (victim == nullptr || slot.request->priority_ > victim->request->priority_ ||
+                 (slot.request->priority_ == victim->request->priority_ && slot.nPast > victim->nPast))) {
+                victim = &slot;
+            }
+        }
+        if (victim != nullptr && (batch_.n_tokens < 2 || !preempt(*victim))) {
+            victim->request->fail("Context is full");
+            release(*victim, "error");
+        }
+        return;
+    }
+    if (ret != 0) {
+        for (Slot& slot : slots_) {
+            if (slot.request != nullptr) {
+                slot.request->fail("Failed to decode token");
+                release(slot, "error");
+            }
+        }
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        stats_.decodeSteps++;
+        stats_.decodedTokens += batch_.n_tokens;
+    }
+    
+    for (Slot& slot : slots_) {
+        if (slot.request == nullptr || slot.batchIndex < 0) {
+            continue;
+        }
+        slot.nPast++;
+        accept(slot, llama_sampler_sample(slot.sampler, wrapper_.context_, slot.batchIndex));
+    }
+}
+
+void SequenceScheduler::embed(Slot& slot, const std::shared_ptr<ScheduledRequest>& request) {
+    if (wrapper_.context_ == nullptr) {
+        request->fail("Model not loaded");
+        return;
+    }
+    
+    // Tokenised by cellsNeeded(); one input at a time in the borrowed
+    // sequence, so the other sequences keep their cells
+    std::vector<std::vector<float>> results;
+    std::vector<std::vector<float>> vectors;
+    std::string error;
+    int promptTokens = 0;
+    for (const std::vector<int32_t>& tokens : request->inputTokens_) {
+        if (!wrapper_.embedSequences({&tokens}, false, request->pooling_, vectors, error, slot.seq)) {
+            break;
+        }
+        promptTokens += static_cast<int>(tokens.size());
+        results.push_back(std::move(vectors[0]));
+    }
+    request->inputTokens_.clear();
+    
+    {
+        std::lock_guard<std::mutex> lock(request->mutex_);
+        request->promptTokens_ = promptTokens;
+        request->embeddings_ = std::move(results);
+    }
+    
+    if (!error.empty()) {
+        request->fail(error);
+    } else {
+        request->finish("stop");
+    }
+    
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    stats_.completed++;
+}
+
+#else
+
+// Stub scheduler: each sequence emits one word of a canned reply per step,
+// so the batching and streaming paths can be exercised without llama.cpp
+
+bool SequenceScheduler::admit(Slot& slot, const std::shared_ptr<ScheduledRequest>& request) {
+    slot.request = request;
+    
+    std::string reply = "Hello! This is a test response from llama-kotlin-android. ";
+    reply += "The library is working but llama.cpp is not compiled in. ";
+    reply += "Your prompt was: " + request->prompt_.substr(0, 50) + "...";
+    
+    std::istringstream iss(reply);
+    std::string word;
+    while (iss >> word) {
+        slot.stubWords.push_back(word + " ");
+    }
+    std::reverse(slot.stubWords.begin(), slot.stubWords.end());
+    
+    const int promptTokens = static_cast<int>(request->pretokenized_ ? request->tokens_.size()
+                                                                      : request->prompt_.size() / 4 + 1);
+    {
+        std::lock_guard<std::mutex> lock(request->mutex_);
+        request->promptTokens_ = promptTokens;
+    }
+    slot.nPast = promptTokens;
+    return true;
+}
+
+bool SequenceScheduler::preempt(Slot& slot) {
+    auto suspension = std::make_unique<ScheduledRequest::Suspension>();
+    suspension->stubWords = std::move(slot.stubWords);
+    slot.stubWords.clear();
+    suspend(slot, std::move(suspension));
+    return true;
+}
+
+bool SequenceScheduler::resume(Slot& slot, const std::shared_ptr<ScheduledRequest>& request) {
+    slot.request = request;
+    std::unique_ptr<ScheduledRequest::Suspension> suspension = std::move(request->suspension_);
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        stats_.resumptions++;
+    }
+    
+    slot.nPast = suspension->nPast;
+    slot.generated = suspension->generated;
+    slot.utf8Carry = std::move(suspension->utf8Carry);
+    slot.stubWords = std::move(suspension->stubWords);
+    return true;
+}
+
+void SequenceScheduler::accept(Slot& slot, int token) {
+    (void)token;
+    if (slot.stubWords.empty()) {
+        release(slot, "stop");
+        return;
+    }
+    
+    emit(slot, slot.stubWords.back());
+    slot.stubWords.pop_back();
+    slot.generated++;
+    slot.nPast++;
+    
+    if (slot.generated >= slot.request->config_.maxTokens) {
+        release(slot, "length");
+    }
+}
+
+void SequenceScheduler::step() {
+    int tokens = 0;
+    for (Slot& slot : slots_) {
+        if (slot.request != nullptr) {
+            accept(slot, 0);
+            tokens++;
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    stats_.decodeSteps++;
+    stats_.decodedTokens += tokens;
+}
+
+void SequenceScheduler::embed(Slot& slot, const std::shared_ptr<ScheduledRequest>& request) {
+    (void)slot;
+    
+    // Deterministic pseudo-embedding derived from the input bytes
+    std::vector<std::vector<float>> results;
+    int promptTokens = 0;
+    for (const std::string& input : request->inputs_) {
+        std::vector<float> vec(16, 0.0f);
+        for (size_t i = 0; i < input.size(); i++) {
+            vec[i % vec.size()] += static_cast<unsigned char>(input[i]) / 255.0f;
+        }
+        float norm = 0.0f;
+        for (float v : vec) {
+            norm += v * v;
+        }
+        norm = norm > 0.0f ? std::sqrt(norm) : 1.0f;
+        for (float& v : vec) {
+            v /= norm;
+        }
+        results.push_back(std::move(vec));
+        promptTokens += static_cast<int>(input.size() / 4 + 1);
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(request->mutex_);
+        request->promptTokens_ = promptTokens;
+        request->embeddings_ = std::move(results);
+    }
+    request->finish("stop");
+    
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    stats_.completed++;
+}
+
+#endif // LLAMA_AVAILABLE
+
+} // namespace llamaandroid
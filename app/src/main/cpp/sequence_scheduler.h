@@ -0,0 +1,286 @@
+#ifndef SEQUENCE_SCHEDULER_H
+#define SEQUENCE_SCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include "llama_context_wrapper.h"
+
+namespace llamaandroid {
+
+/**
+ * Scheduling class of a request; lower values are served first and may
+ * preempt higher ones
+ */
+enum class RequestPriority {
+    Foreground = 0,  // A user is waiting on the response
+    Normal = 1,
+    Background = 2   // Summaries, indexing and other deferred work
+};
+
+/**
+ * A request queued on a SequenceScheduler.
+ *
+ * The submitting thread drains generated text with next() while the
+ * scheduler's worker fills it; cancel() may be called from any thread.
+ */
+class ScheduledRequest {
+public:
+    enum class Kind { Completion, Embedding };
+    
+    ScheduledRequest();
+    ~ScheduledRequest();
+    
+    /**
+     * Wait for the next piece of generated text
+     * @param piece Receives the text (always complete UTF-8 sequences)
+     * @param timeoutMs Maximum wait; negative waits indefinitely
+     * @return 1 if a piece was returned, 0 on timeout, -1 once the request has finished
+     */
+    int next(std::string& piece, int timeoutMs = -1);
+    
+    /**
+     * Block until the request has finished
+     */
+    void wait();
+    
+    /**
+     * Stop the request; its sequence is released at the next scheduler step
+     */
+    void cancel();
+    
+    Kind kind() const { return kind_; }
+    RequestPriority priority() const { return priority_; }
+    
+    // Sampling configuration and token limit the request runs with
+    const LlamaConfig& config() const { return config_; }
+    bool succeeded() const;
+    std::string error() const;
+    
+    // "stop" (end of generation), "length" (token limit) or "cancelled"
+    std::string finishReason() const;
+    
+    int promptTokens() const;
+    int completionTokens() const;
+    
+    // Number of times the request was swapped out for a higher-priority one
+    int preemptions() const;
+    
+    // Pooled, L2-normalised vectors of an embedding request, one per input
+    std::vector<std::vector<float>> embeddings() const;
+
+private:
+    friend class SequenceScheduler;
+    
+    // Sequence state of a preempted request, held in host memory
+    struct Suspension;
+    
+    Kind kind_ = Kind::Completion;
+    RequestPriority priority_ = RequestPriority::Normal;
+    uint64_t order_ = 0;  // Submission order, breaks ties
+    std::string prompt_;
+    std::vector<std::string> inputs_;
+    EmbeddingPooling pooling_ = EmbeddingPooling::Default;
+    LlamaConfig config_;
+    
+    // Owned by the scheduler's worker
+    std::vector<int32_t> tokens_;  // Prompt tokens, once tokenised
+    bool tokenized_ = false;
+    bool pretokenized_ = false;    // Submitted as tokens rather than text
+    std::vector<std::vector<int32_t>> inputTokens_;  // Embedding inputs, once tokenised
+    std::unique_ptr<Suspension> suspension_;
+    
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::string> pieces_;
+    bool finished_ = false;
+    bool failed_ = false;
+    std::string error_;
+    std::string finishReason_;
+    int promptTokens_ = 0;
+    int completionTokens_ = 0;
+    int preemptions_ = 0;
+    std::vector<std::vector<float>> embeddings_;
+    std::atomic<bool> cancelled_{false};
+    
+    void push(std::string piece);
+    void finish(const std::string& reason);
+    void fail(const std::string& error);
+};
+
+/**
+ * Scheduler counters
+ */
+struct SchedulerStats {
+    int queued = 0;              // Requests waiting for a free sequence
+    int active = 0;              // Requests currently decoding
+    uint64_t completed = 0;      // Finished requests, including failures
+    uint64_t decodeSteps = 0;    // Batched decode calls for generation
+    uint64_t decodedTokens = 0;  // Tokens generated across all steps
+    uint64_t preemptions = 0;    // Sequences swapped out to host memory
+    uint64_t resumptions = 0;    // Swapped-out sequences restored
+    size_t swappedBytes = 0;     // Host memory currently holding swapped-out sequences
+};
+
+/**
+ * Continuous-batching scheduler over one loaded model.
+ *
+ * Each admitted request gets its own sequence id in the context (up to
+ * LlamaConfig::parallelSequences). A worker thread prefills new requests as
+ * soon as a sequence is free, then advances every active sequence by one
+ * token per llama_decode call, so concurrent clients share each pass over
+ * the weights instead of queueing behind one another. Embedding requests
+ * borrow a free sequence between generation steps.
+ *
+ * Waiting requests are admitted by priority class, then shortest remaining
+ * job (fewest tokens left to generate), then submission order. A request is
+ * only admitted while its prompt plus a short generation headroom fits in
+ * the free KV cells. When a higher-class request cannot be admitted, the
+ * lowest-class sequence with the most work left is preempted at the token
+ * boundary: its KV cells are copied to host memory with
+ * llama_state_seq_get_data() and freed, and it goes back into the queue.
+ * When it is admitted again the cells are restored into whichever sequence
+ * is free and decoding continues without re-evaluating the prompt.
+ *
+ * While a scheduler is running it owns the wrapper's context: calls that
+ * would clear or rewrite the KV cache (generation, embeddings, state
+ * save/restore, loading) fail on the wrapper until stop(); submit the work
+ * to the scheduler instead. LlamaContextWrapper::swapModel() is the
+ * exception: the scheduler stops admitting new requests, lets the active
+ * and swapped-out sequences finish on the old model, then carries on with
+ * the queued requests on the new one.
+ */
+class SequenceScheduler {
+public:
+    /**
+     * @param wrapper Wrapper with a loaded in-process model
+     * @param maxQueue Maximum number of requests waiting for a sequence
+     */
+    explicit SequenceScheduler(LlamaContextWrapper& wrapper, size_t maxQueue = 64);
+    ~SequenceScheduler();
+    
+    SequenceScheduler(const SequenceScheduler&) = delete;
+    SequenceScheduler& operator=(const SequenceScheduler&) = delete;
+    
+    /**
+     * Start the worker thread
+     * @return true if successful; on failure see getLastError()
+     */
+    bool start();
+    
+    /**
+     * Stop the worker; pending and active requests finish as cancelled
+     */
+    void stop();
+    
+    /**
+     * Queue a text completion
+     * @param prompt Prompt text (special tokens are parsed)
+     * @param config Sampling configuration and token limit (nullptr uses
+     *        the wrapper's, as LlamaContextWrapper::generateStream() does)
+     * @param priority Scheduling class
+     * @return Request handle, or nullptr if the queue is full or stopped
+     */
+    std::shared_ptr<ScheduledRequest> submitCompletion(const std::string& prompt, const LlamaConfig* config,
+                                                       RequestPriority priority = RequestPriority::Normal);
+    
+    /**
+     * Queue a completion of an already tokenised prompt (for example one
+     * rendered by PromptTemplate or fitted by ChatContextFitter)
+     * @param tokens Prompt token ids, including BOS if the model uses one
+     * @param config Sampling configuration and token limit (nullptr uses the wrapper's)
+     * @param priority Scheduling class
+     * @return Request handle, or nullptr if the queue is full or stopped
+     */
+    std::shared_ptr<ScheduledRequest> submitCompletion(const std::vector<int32_t>& tokens, const LlamaConfig* config,
+                                                       RequestPriority priority = RequestPriority::Normal);
+    
+    /**
+     * Queue an embedding request
+     * @param inputs Texts to embed
+     * @param priority Scheduling class
+     * @param pooling How per-token outputs are pooled (see LlamaContextWrapper::embed())
+     * @return Request handle, or nullptr if the queue is full or stopped
+     */
+    std::shared_ptr<ScheduledRequest> submitEmbedding(const std::vector<std::string>& inputs,
+                                                      RequestPriority priority = RequestPriority::Normal,
+                                                      EmbeddingPooling pooling = EmbeddingPooling::Default);
+    
+    bool isRunning() const;
+    
+    /**
+     * Number of sequences decoded together
+     */
+    int getParallelSequences() const { return nSeq_; }
+    
+    SchedulerStats getStats() const;
+    std::string getLastError() const;
+
+private:
+    friend class LlamaContextWrapper;
+    
+    struct Slot;
+    
+    LlamaContextWrapper& wrapper_;
+    size_t maxQueue_;
+    int nSeq_ = 1;
+    int nCtx_ = 0;  // KV cells shared by all sequences
+    
+    std::vector<Slot> slots_;
+    std::deque<std::shared_ptr<ScheduledRequest>> queue_;
+    mutable std::mutex queueMutex_;
+    std::condition_variable queueCv_;
+    std::thread worker_;
+    bool running_ = false;
+    uint64_t nextOrder_ = 0;
+    
+    // Model swap handshake, see drainForSwap()
+    bool draining_ = false;
+    bool drained_ = false;
+    std::condition_variable drainCv_;
+    
+    SchedulerStats stats_;
+    std::string lastError_;
+
+#if LLAMA_AVAILABLE
+    llama_batch batch_{};  // One token per sequence for each decode step
+#endif
+
+    std::shared_ptr<ScheduledRequest> enqueue(std::shared_ptr<ScheduledRequest> request);
+    void run();
+    void schedule();
+    int cellsNeeded(ScheduledRequest& request);
+    bool admit(Slot& slot, const std::shared_ptr<ScheduledRequest>& request);
+    bool resume(Slot& slot, const std::shared_ptr<ScheduledRequest>& request);
+    bool preempt(Slot& slot);
+    void suspend(Slot& slot, std::unique_ptr<ScheduledRequest::Suspension> suspension);
+    void step();
+    void release(Slot& slot, const std::string& reason);
+    void accept(Slot& slot, int token);
+    void emit(Slot& slot, const std::string& text);
+    void embed(Slot& slot, const std::shared_ptr<ScheduledRequest>& request);
+    
+    /**
+     * Hold new requests and wait until every sequence on the current model
+     * has finished. Called by LlamaContextWrapper::swapModel() without
+     * wrapper_.mutex_ held.
+     */
+    void drainForSwap();
+    
+    /**
+     * Rebind to the wrapper's new context and admit the held requests.
+     * Called by LlamaContextWrapper::swapModel() with wrapper_.mutex_ held.
+     */
+    void resumeAfterSwap();
+};
+
+} // namespace llamaandroid
+
+#endif // SEQUENCE_SCHEDULER_H
@@ -0,0 +1,134 @@
+// Checks that the decode loop stays off the heap.
+//
+// Built with the allocation hook compiled in, so malloc and friends are
+// counted per thread. Verifies that the hook sees allocations, that the
+// per-token callback path (TokenSink over a TokenCallback, as in
+// LlamaContextWrapper::runGeneration) does not allocate, and, with a model
+// given, that a real generation reports no heap allocation in its decode
+// loop after the first token.
+//
+// Usage: alloc-hook-test [model.gguf]   (or set LLAMA_TEST_MODEL)
+// Exits with 77 (skipped) where the hook cannot be active.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "alloc_hook.h"
+#include "llama_context_wrapper.h"
+
+using namespace llamaandroid;
+
+static int g_failures = 0;
+
+// Keeps the test allocation observable, so it cannot be elided
+static std::unique_ptr<std::vector<int>> g_kept;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        g_failures++;
+    }
+}
+
+static void checkHookCounts() {
+    const uint64_t before = threadAllocationCount();
+    g_kept = std::make_unique<std::vector<int>>(64);
+    check(threadAllocationCount() > before, "hook counts heap allocations");
+}
+
+static void checkPosixMemalign() {
+    void* ptr = nullptr;
+    check(posix_memalign(&ptr, 64, 128) == 0 && ptr != nullptr, "posix_memalign allocates with a valid alignment");
+    free(ptr);
+    
+    ptr = nullptr;
+    check(posix_memalign(&ptr, 24, 128) == EINVAL, "posix_memalign rejects an alignment that is not a power of two");
+    check(posix_memalign(&ptr, sizeof(void*) / 2, 128) == EINVAL,
+          "posix_memalign rejects an alignment below sizeof(void*)");
+    check(posix_memalign(&ptr, 0, 128) == EINVAL, "posix_memalign rejects a zero alignment");
+    check(ptr == nullptr, "posix_memalign leaves the pointer alone on EINVAL");
+}
+
+static void checkTokenSinkLoop() {
+    const std::string pieces[] = { "Hello", ",", " world", "!", " \xE2\x9C\x93" };
+    
+    std::string received;
+    received.reserve(64);
+    TokenCallback callback = [&received](const std::string& token) {
+        received.assign(token);
+    };
+    auto forward = [&callback](const std::string& token) {
+        callback(token);
+    };
+    TokenSink sink(forward);
+    
+    // The first token warms up, as in the decode loop
+    sink(pieces[0]);
+    
+    const uint64_t before = threadAllocationCount();
+    for (int i = 0; i < 10000; i++) {
+        sink(pieces[i % 5]);
+    }
+    const uint64_t allocations = threadAllocationCount() - before;
+    
+    printf("token sink loop: %llu allocations over 10000 tokens\n", static_cast<unsigned long long>(allocations));
+    check(allocations == 0, "token sink loop does not allocate");
+}
+
+static void checkDecodeLoop(const char* modelPath) {
+#if LLAMA_AVAILABLE
+    LlamaConfig config;
+    config.contextSize = 512;
+    config.maxTokens = 64;
+    
+    LlamaContextWrapper wrapper;
+    if (!wrapper.loadModel(modelPath, config)) {
+        fprintf(stderr, "FAIL: loading %s: %s\n", modelPath, wrapper.getLastError().c_str());
+        g_failures++;
+        return;
+    }
+    
+    size_t bytes = 0;
+    wrapper.generateStream("Once upon a time", [&bytes](const std::string& token) {
+        bytes += token.size();
+    }, &config);
+    check(wrapper.getLastError().empty(), "generation succeeds");
+    
+    const GenerationStats stats = wrapper.getGenerationStats();
+    printf("decode loop: %llu allocations over %d tokens (%zu bytes)\n",
+           static_cast<unsigned long long>(stats.loopAllocations), stats.tokens, bytes);
+    check(stats.tokens > 1, "generation decodes past the first token");
+    check(stats.loopAllocations == 0, "decode loop does not allocate");
+#else
+    printf("decode loop: skipped, built without llama.cpp (%s)\n", modelPath);
+#endif
+}
+
+int main(int argc, char** argv) {
+    if (!allocationHookEnabled()) {
+        printf("Allocation hook is not available on this host, skipping\n");
+        return 77;
+    }
+    
+    checkHookCounts();
+    checkPosixMemalign();
+    checkTokenSinkLoop();
+    
+    const char* modelPath = argc > 1 ? argv[1] : getenv("LLAMA_TEST_MODEL");
+    if (modelPath != nullptr && modelPath[0] != '\0') {
+        checkDecodeLoop(modelPath);
+    } else {
+        printf("decode loop: skipped, no model given\n");
+    }
+    
+    if (g_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
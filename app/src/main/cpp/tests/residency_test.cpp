@@ -0,0 +1,143 @@
+// Checks that a slow model load does not hold up the residency manager.
+//
+// The manager is given a load function that blocks loading model B until
+// released. While B is loading, acquiring the resident model A must return
+// at once, and a second caller acquiring B must wait for the load under way
+// instead of loading B again.
+//
+// Usage: residency-test [model.gguf]   (or set LLAMA_TEST_MODEL)
+// Builds with llama.cpp need a model and exit with 77 (skipped) without one.
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "model_residency_manager.h"
+
+using namespace llamaandroid;
+
+static int g_failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        g_failures++;
+    }
+}
+
+/**
+ * Holds loads of the model configured with GATED_SEED until released
+ */
+class LoadGate {
+public:
+    // Marks the gated model's config, since the load function sees no name
+    static const int GATED_SEED = 4242;
+    
+    bool load(LlamaContextWrapper& wrapper, const std::string& modelPath, const LlamaConfig& config) {
+        if (config.seed == GATED_SEED) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            started_++;
+            cv_.notify_all();
+            cv_.wait(lock, [this] { return released_; });
+        }
+        return wrapper.loadModel(modelPath, config);
+    }
+    
+    bool waitStarted(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, timeout, [this] { return started_ > 0; });
+    }
+    
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        released_ = true;
+        cv_.notify_all();
+    }
+    
+    int started() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return started_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int started_ = 0;
+    bool released_ = false;
+};
+
+int main(int argc, char** argv) {
+    const char* modelPath = argc > 1 ? argv[1] : getenv("LLAMA_TEST_MODEL");
+#if LLAMA_AVAILABLE
+    if (modelPath == nullptr || modelPath[0] == '\0') {
+        printf("No model given, skipping\n");
+        return 77;
+    }
+#else
+    if (modelPath == nullptr || modelPath[0] == '\0') {
+        modelPath = "stub.gguf";
+    }
+#endif
+
+    const auto timeout = std::chrono::seconds(10);
+    
+    LoadGate gate;
+    ModelResidencyManager manager(0, [&gate](LlamaContextWrapper& wrapper, const std::string& path,
+                                             const LlamaConfig& config) {
+        return gate.load(wrapper, path, config);
+    });
+    
+    LlamaConfig config;
+    config.contextSize = 512;
+    LlamaConfig gatedConfig = config;
+    gatedConfig.seed = LoadGate::GATED_SEED;
+    check(manager.registerModel("a", modelPath, config), "model A registers");
+    check(manager.registerModel("b", modelPath, gatedConfig), "model B registers");
+    
+    check(manager.acquire("a") != nullptr, "model A loads");
+    
+    // Two callers acquire B; only one may load it
+    auto firstB = std::async(std::launch::async, [&manager] { return manager.acquire("b"); });
+    check(gate.waitStarted(timeout), "load of model B starts");
+    auto secondB = std::async(std::launch::async, [&manager] { return manager.acquire("b"); });
+    
+    // A hit on A while B is still loading
+    auto hitA = std::async(std::launch::async, [&manager] { return manager.acquire("a"); });
+    const bool hitReturned = hitA.wait_for(timeout) == std::future_status::ready;
+    check(hitReturned, "acquire of resident model A does not wait for the load of model B");
+    check(firstB.wait_for(std::chrono::seconds(0)) != std::future_status::ready, "model B is still loading");
+    check(!manager.unregisterModel("b"), "model B cannot be unregistered while loading");
+    if (hitReturned) {
+        check(hitA.get() != nullptr, "acquire of model A succeeds during the load");
+    }
+    
+    gate.release();
+    
+    std::shared_ptr<LlamaContextWrapper> first = firstB.get();
+    std::shared_ptr<LlamaContextWrapper> second = secondB.get();
+    check(first != nullptr && second != nullptr, "both callers get model B");
+    check(first == second, "both callers get the same wrapper for model B");
+    check(gate.started() == 1, "model B is loaded once");
+    if (!hitReturned) {
+        hitA.wait();
+    }
+    
+    const ResidencyStats stats = manager.getStats();
+    printf("loads %llu, hits %llu, resident models %d\n", static_cast<unsigned long long>(stats.loads),
+           static_cast<unsigned long long>(stats.hits), stats.residentModels);
+    check(stats.loads == 2, "each model is loaded once");
+    check(stats.hits == 2, "the hit on A and the waiting caller of B count as hits");
+    check(stats.residentModels == 2, "both models are resident");
+    
+    if (g_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
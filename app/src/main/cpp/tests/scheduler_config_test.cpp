@@ -0,0 +1,103 @@
+// Checks which configuration scheduled requests run with.
+//
+// A request submitted without a config override (what the JNI layer does
+// when Kotlin passes no configOverride) must sample with, and stop at the
+// token limit of, the configuration the model was loaded with; an override
+// replaces it.
+//
+// Usage: scheduler-config-test [model.gguf]   (or set LLAMA_TEST_MODEL)
+// Builds with llama.cpp need a model and exit with 77 (skipped) without one.
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "sequence_scheduler.h"
+
+using namespace llamaandroid;
+
+static int g_failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        g_failures++;
+    }
+}
+
+static void checkRequest(SequenceScheduler& scheduler, const LlamaConfig* custom, const LlamaConfig& expected,
+                         const char* label) {
+    std::shared_ptr<ScheduledRequest> request = scheduler.submitCompletion("Tell me a story", custom);
+    check(request != nullptr, "request is queued");
+    if (request == nullptr) {
+        return;
+    }
+    request->wait();
+    
+    const LlamaConfig& used = request->config();
+    printf("%s: temperature %.2f, top-k %d, top-p %.2f, repeat penalty %.2f, max tokens %d; generated %d (%s)\n",
+           label, used.temperature, used.topK, used.topP, used.repeatPenalty, used.maxTokens,
+           request->completionTokens(), request->finishReason().c_str());
+    
+    check(request->succeeded(), "request succeeds");
+    check(used.temperature == expected.temperature, "request samples with the expected temperature");
+    check(used.topK == expected.topK, "request samples with the expected top-k");
+    check(used.topP == expected.topP, "request samples with the expected top-p");
+    check(used.repeatPenalty == expected.repeatPenalty, "request samples with the expected repeat penalty");
+    check(used.maxTokens == expected.maxTokens, "request runs with the expected token limit");
+    check(request->completionTokens() <= expected.maxTokens, "generation stops at the token limit");
+}
+
+int main(int argc, char** argv) {
+    const char* modelPath = argc > 1 ? argv[1] : getenv("LLAMA_TEST_MODEL");
+#if LLAMA_AVAILABLE
+    if (modelPath == nullptr || modelPath[0] == '\0') {
+        printf("No model given, skipping\n");
+        return 77;
+    }
+#else
+    if (modelPath == nullptr || modelPath[0] == '\0') {
+        modelPath = "stub.gguf";
+    }
+#endif
+
+    // Deliberately far from the library defaults
+    LlamaConfig loadConfig;
+    loadConfig.contextSize = 512;
+    loadConfig.parallelSequences = 2;
+    loadConfig.temperature = 0.15f;
+    loadConfig.topK = 7;
+    loadConfig.topP = 0.5f;
+    loadConfig.repeatPenalty = 1.3f;
+    loadConfig.maxTokens = 3;
+    
+    LlamaContextWrapper wrapper;
+    if (!wrapper.loadModel(modelPath, loadConfig)) {
+        fprintf(stderr, "FAIL: loading %s: %s\n", modelPath, wrapper.getLastError().c_str());
+        return 1;
+    }
+    
+    SequenceScheduler scheduler(wrapper);
+    if (!scheduler.start()) {
+        fprintf(stderr, "FAIL: starting scheduler: %s\n", scheduler.getLastError().c_str());
+        return 1;
+    }
+    
+    checkRequest(scheduler, nullptr, loadConfig, "no override");
+    
+    LlamaConfig custom = loadConfig;
+    custom.temperature = 0.9f;
+    custom.topK = 50;
+    custom.maxTokens = 5;
+    checkRequest(scheduler, &custom, custom, "override");
+    
+    scheduler.stop();
+    
+    if (g_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,300 @@
+// Differential test of the parallel tokeniser's split points.
+//
+// For each SplitRule, text cut at every point nextSplitPoint() returns
+// must pre-tokenise to the same pieces as the whole text, under the
+// pre-tokeniser regex of every family the rule is used for. Texts are a
+// fixed set of edge cases plus seeded random mixes of words, digits,
+// punctuation, contractions and whitespace runs, with runs longer than 16
+// bytes so the SIMD skip is exercised.
+//
+// Limitation: the regexes are llama.cpp's restricted to ASCII (\p{L} as
+// [A-Za-z], \p{N} as [0-9]), since std::regex has no Unicode classes, so
+// the differential check only covers ASCII text. Non-ASCII text (accented
+// and CJK letters, other scripts' digits, Unicode spaces, emoji) is instead
+// checked against split points worked out by hand, and no split point may
+// touch a non-ASCII byte; that is what keeps Unicode classes out of the
+// question.
+//
+// Usage: split-point-test [random-texts]
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "parallel_tokenizer.h"
+
+using namespace llamaandroid;
+
+struct PreTokenizer {
+    const char* name;
+    std::regex pattern;
+};
+
+static const PreTokenizer& gpt2() {
+    static const PreTokenizer pre = {
+        "gpt-2",
+        std::regex("'s|'t|'re|'ve|'m|'ll|'d| ?[A-Za-z]+| ?[0-9]+| ?[^\\sA-Za-z0-9]+|\\s+(?!\\S)|\\s+"),
+    };
+    return pre;
+}
+
+static const PreTokenizer& llama3() {
+    static const PreTokenizer pre = {
+        "llama3",
+        std::regex("'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD]|[^\\r\\nA-Za-z0-9]?[A-Za-z]+|"
+                   "[0-9]{1,3}| ?[^\\sA-Za-z0-9]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+"),
+    };
+    return pre;
+}
+
+static const PreTokenizer& qwen2() {
+    static const PreTokenizer pre = {
+        "qwen2",
+        std::regex("'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD]|[^\\r\\nA-Za-z0-9]?[A-Za-z]+|"
+                   "[0-9]| ?[^\\sA-Za-z0-9]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+"),
+    };
+    return pre;
+}
+
+static int g_failures = 0;
+
+static std::string printable(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        switch (c) {
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: out += c; break;
+        }
+    }
+    return out;
+}
+
+/**
+ * Pieces of text under a pre-tokeniser regex
+ */
+static std::vector<std::string> preTokenize(const PreTokenizer& pre, const std::string& text) {
+    std::vector<std::string> pieces;
+    for (auto it = std::sregex_iterator(text.begin(), text.end(), pre.pattern); it != std::sregex_iterator(); ++it) {
+        pieces.push_back(it->str());
+    }
+    return pieces;
+}
+
+static std::vector<size_t> splitPoints(const std::string& text, SplitRule rule) {
+    std::vector<size_t> points;
+    size_t from = 1;
+    while (from < text.size()) {
+        const size_t p = nextSplitPoint(text, from, rule);
+        if (p == std::string::npos || p >= text.size()) {
+            break;
+        }
+        points.push_back(p);
+        from = p + 1;
+    }
+    return points;
+}
+
+/**
+ * Whether cutting text at points pre-tokenises the same as the whole
+ * @param failedAt Receives the first point after which the pieces differ
+ */
+static bool cutMatchesWhole(const PreTokenizer& pre, const std::string& text, const std::vector<size_t>& points,
+                            size_t& failedAt) {
+    const std::vector<std::string> whole = preTokenize(pre, text);
+    std::vector<std::string> cut;
+    size_t start = 0;
+    for (size_t i = 0; i <= points.size(); i++) {
+        const size_t end = i < points.size() ? points[i] : text.size();
+        for (std::string& piece : preTokenize(pre, text.substr(start, end - start))) {
+            cut.push_back(std::move(piece));
+        }
+        // Compare as we go to name the offending cut
+        for (size_t k = 0; k < cut.size(); k++) {
+            if (k >= whole.size() || cut[k] != whole[k]) {
+                failedAt = i > 0 ? points[i - 1] : 0;
+                return false;
+            }
+        }
+        start = end;
+    }
+    failedAt = 0;
+    return cut.size() == whole.size();
+}
+
+static void checkRule(const char* ruleName, SplitRule rule, const std::vector<const PreTokenizer*>& families,
+                      const std::vector<std::string>& corpus, size_t& pointCount) {
+    for (const std::string& text : corpus) {
+        const std::vector<size_t> points = splitPoints(text, rule);
+        pointCount += points.size();
+        for (const PreTokenizer* pre : families) {
+            size_t failedAt = 0;
+            if (!cutMatchesWhole(*pre, text, points, failedAt)) {
+                fprintf(stderr, "FAIL: %s split at %zu changes %s pieces of \"%s\"\n", ruleName, failedAt, pre->name,
+                        printable(text).c_str());
+                g_failures++;
+            }
+        }
+    }
+}
+
+static std::vector<std::string> fixedCorpus() {
+    return {
+        "Hello world",
+        "Hello  world",
+        "line one\nline two\nline three",
+        "trailing spaces   \nnext",
+        "a \nb",
+        "a\t\nb",
+        "a\n\nb",
+        "a\r\nb\r\n\r\nc",
+        "end with space ",
+        "end with newline\n",
+        "\nleading newline",
+        " leading space",
+        "It's what they'll say, we'd've done it; DON'T.",
+        "numbers 1234567 and 12 34, 3.14159 and 1,000,000",
+        "punctuation!!! ?? ... --- ((nested)) [x] {y}",
+        "mixed\tTabs\t\tand  spaces",
+        "averyveryverylongwordwithoutanyspacesthatspansmanysimdblocks next",
+        "0123456789012345678901234567890123456789 digits",
+        "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! bang",
+        "code(x) {\n    return x + 1;\n}\n",
+        "key: value\n  - item one\n  - item two\n",
+        "a\n b\n  c\n\td",
+        "x \n \n y",
+    };
+}
+
+struct ExpectedSplits {
+    const char* text;
+    std::vector<size_t> lines;
+    std::vector<size_t> gpt2;
+    std::vector<size_t> llama3;
+};
+
+/**
+ * Non-ASCII texts with split points worked out by hand from the rules:
+ * a space or newline next to a non-ASCII byte is never a split point
+ */
+static std::vector<ExpectedSplits> unicodeCases() {
+    return {
+        // Space after "e" at 6; the newline at 12 follows a byte of "é"
+        { "na\xC3\xAFve caf\xC3\xA9\nnext", {}, {6}, {6, 13} },
+        // CJK runs longer than 16 bytes, with spaces and a newline after them
+        { "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E\xE3\x81\xAE\xE3\x83\x86\xE3\x82\xAD\xE3\x82\xB9"
+          "\xE3\x83\x88\xE3\x81\xA7\xE3\x81\x99 end\n\xE6\x9D\xB1\xE4\xBA\xAC 2024\xE5\xB9\xB4",
+          {}, {}, {} },
+        // Emoji: the space at 2 follows "k"; the newline at 12 precedes an emoji
+        { "ok \xF0\x9F\x98\x80 fine\n\xF0\x9F\x98\x80 next", {}, {2}, {2} },
+        // Arabic-Indic digits before a space; the newline at 9 is ASCII on both sides
+        { "x\xD9\xA1\xD9\xA2\xD9\xA3 y\nz", {10}, {10}, {10} },
+        // No-break space and ideographic space are not split at; the ASCII spaces are
+        { "a\xC2\xA0" "b c\xE3\x80\x80" "d e", {}, {4, 10}, {4, 10} },
+        // Only Llama3 cuts after a newline that follows whitespace
+        { "\xC3\xA9\n\nx", {}, {}, {4} },
+    };
+}
+
+static void checkExpected(const char* ruleName, SplitRule rule, const char* text, const std::vector<size_t>& expected) {
+    const std::string input(text);
+    const std::vector<size_t> points = splitPoints(input, rule);
+    if (points != expected) {
+        std::string got;
+        for (size_t p : points) {
+            got += (got.empty() ? "" : ", ") + std::to_string(p);
+        }
+        fprintf(stderr, "FAIL: %s split points of \"%s\" are [%s]\n", ruleName, printable(input).c_str(),
+                got.c_str());
+        g_failures++;
+    }
+    for (size_t p : points) {
+        if ((input[p - 1] & 0x80) != 0 || (input[p] & 0x80) != 0) {
+            fprintf(stderr, "FAIL: %s split at %zu touches a non-ASCII byte in \"%s\"\n", ruleName, p,
+                    printable(input).c_str());
+            g_failures++;
+        }
+    }
+}
+
+static std::vector<std::string> randomCorpus(size_t count) {
+    static const char* const PARTS[] = {
+        "word", "Token", "BPE", "a", "I", "ok", "'s", "'t", "'re", "'LL", "'d", "'m", "'ve",
+        "0", "42", "2024", "1234567", "3.5", ",", ".", "!", "?", ";", ":", "-", "--", "(", ")",
+        "\"", "#", "@", "/", "==", "->", "_", "~", "averyveryverylongidentifier",
+        " ", " ", " ", "  ", "   ", "\t", "\n", "\n", "\n\n", "\r\n", " \n", "\t\n", "\n ", "\n  ",
+    };
+    const size_t partCount = sizeof(PARTS) / sizeof(PARTS[0]);
+    
+    // Fixed seed, so a failure reproduces
+    std::mt19937 random(20240611);
+    std::uniform_int_distribution<size_t> pick(0, partCount - 1);
+    std::uniform_int_distribution<int> length(1, 40);
+    
+    std::vector<std::string> corpus;
+    for (size_t i = 0; i < count; i++) {
+        std::string text;
+        const int parts = length(random);
+        for (int p = 0; p < parts; p++) {
+            text += PARTS[pick(random)];
+        }
+        corpus.push_back(std::move(text));
+    }
+    return corpus;
+}
+
+int main(int argc, char** argv) {
+    const size_t randomTexts = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 2000;
+    
+    std::vector<std::string> corpus = fixedCorpus();
+    for (std::string& text : randomCorpus(randomTexts)) {
+        corpus.push_back(std::move(text));
+    }
+    
+    // Lines holds for every BPE family, Gpt2 for the GPT-2 and llama3
+    // families; Llama3 also cuts after whitespace before a newline, which
+    // GPT-2's "\s+(?!\S)" pieces differently at the end of a segment
+    size_t linesPoints = 0;
+    size_t gpt2Points = 0;
+    size_t llama3Points = 0;
+    checkRule("Lines", SplitRule::Lines, {&gpt2(), &llama3(), &qwen2()}, corpus, linesPoints);
+    checkRule("Gpt2", SplitRule::Gpt2, {&gpt2(), &llama3(), &qwen2()}, corpus, gpt2Points);
+    checkRule("Llama3", SplitRule::Llama3, {&llama3(), &qwen2()}, corpus, llama3Points);
+    printf("%zu texts: %zu Lines, %zu Gpt2 and %zu Llama3 split points checked\n", corpus.size(), linesPoints, gpt2Points,
+           llama3Points);
+    
+    // Non-ASCII text, which the ASCII regexes above cannot judge
+    const std::vector<ExpectedSplits> unicode = unicodeCases();
+    for (const ExpectedSplits& c : unicode) {
+        checkExpected("Lines", SplitRule::Lines, c.text, c.lines);
+        checkExpected("Gpt2", SplitRule::Gpt2, c.text, c.gpt2);
+        checkExpected("Llama3", SplitRule::Llama3, c.text, c.llama3);
+    }
+    printf("%zu non-ASCII texts checked against hand-worked split points\n", unicode.size());
+    
+    // The comparison must be able to fail: Llama3's cut in "a \nb" is not
+    // safe under GPT-2's regex
+    size_t failedAt = 0;
+    if (cutMatchesWhole(gpt2(), "a \nb", splitPoints("a \nb", SplitRule::Llama3), failedAt)) {
+        fprintf(stderr, "FAIL: Llama3 cut of \"a \\nb\" not detected as unsafe for gpt-2\n");
+        g_failures++;
+    }
+    
+    // Rules map to the families they were checked against
+    if (splitRuleFor("gpt-2") != SplitRule::Gpt2 || splitRuleFor("llama-bpe") != SplitRule::Llama3 ||
+        splitRuleFor("qwen2") != SplitRule::Llama3 || splitRuleFor("unknown") != SplitRule::Lines) {
+        fprintf(stderr, "FAIL: splitRuleFor maps a family to the wrong rule\n");
+        g_failures++;
+    }
+    
+    if (g_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
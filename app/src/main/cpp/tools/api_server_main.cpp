@@ -0,0 +1,92 @@
+// Host build of the local OpenAI-compatible server, for testing clients
+// against a real model (or the stub) with curl.
+//
+// Usage: llama-api-server [--model <path.gguf>] [--socket <path|@name> | --port <n>]
+//                         [--parallel <n>] [--ctx <n>] [--threads <n>] [--name <id>]
+//
+// Example:
+//   llama-api-server --model model.gguf --socket /tmp/llama.sock --parallel 4
+//   curl --unix-socket /tmp/llama.sock http://localhost/v1/chat/completions
+//        -d '{"messages":[{"role":"user","content":"Hi"}],"stream":true}'
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <string>
+
+#include "api_server.h"
+
+using namespace llamaandroid;
+
+int main(int argc, char** argv) {
+    std::string modelPath;
+    LlamaConfig modelConfig;
+    ApiServerConfig serverConfig;
+    modelConfig.parallelSequences = 4;
+    
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char* arg = argv[i];
+        const char* value = argv[i + 1];
+        if (strcmp(arg, "--model") == 0) {
+            modelPath = value;
+        } else if (strcmp(arg, "--socket") == 0) {
+            serverConfig.socketPath = value;
+        } else if (strcmp(arg, "--port") == 0) {
+            serverConfig.port = atoi(value);
+        } else if (strcmp(arg, "--parallel") == 0) {
+            modelConfig.parallelSequences = atoi(value);
+        } else if (strcmp(arg, "--ctx") == 0) {
+            modelConfig.contextSize = atoi(value);
+        } else if (strcmp(arg, "--threads") == 0) {
+            modelConfig.threads = atoi(value);
+            modelConfig.threadsBatch = modelConfig.threads;
+        } else if (strcmp(arg, "--name") == 0) {
+            serverConfig.modelName = value;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return 2;
+        }
+    }
+    
+    // Block the stop signals before any thread starts so only sigwait sees them
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    
+    LlamaContextWrapper wrapper;
+    if (!wrapper.loadModel(modelPath, modelConfig)) {
+        fprintf(stderr, "Failed to load model: %s\n", wrapper.getLastError().c_str());
+        return 1;
+    }
+    
+    serverConfig.defaults = modelConfig;
+    ApiServer server(wrapper, serverConfig);
+    if (!server.start()) {
+        fprintf(stderr, "Failed to start server: %s\n", server.getLastError().c_str());
+        return 1;
+    }
+    
+    if (serverConfig.socketPath.empty()) {
+        printf("Listening on http://127.0.0.1:%d\n", server.getPort());
+    } else {
+        printf("Listening on %s\n", serverConfig.socketPath.c_str());
+    }
+    fflush(stdout);
+    
+    int sig = 0;
+    sigwait(&stopSignals, &sig);
+    
+    SchedulerStats stats = server.getStats();
+    printf("Stopping: %llu requests, %llu decode steps, %.2f tokens/step\n",
+           static_cast<unsigned long long>(stats.completed),
+           static_cast<unsigned long long>(stats.decodeSteps),
+           stats.decodeSteps > 0 ? static_cast<double>(stats.decodedTokens) / stats.decodeSteps : 0.0);
+    
+    server.stop();
+    return 0;
+}
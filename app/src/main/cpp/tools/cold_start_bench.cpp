@@ -0,0 +1,612 @@
+// Benchmark of the time from process start to the first generated token.
+//
+// Every run is a fresh process (this binary re-executed), so each one pays
+// the dynamic linking, backend initialisation and model load an app pays
+// on launch. The phases are timed separately:
+//
+//   process_start    fork/exec until main() runs (dynamic linking, static init)
+//   library_load     dlopen of --library, e.g. libllama-android.so
+//   backend_init     llama_backend_init in the LlamaContextWrapper constructor
+//   model_load       llama_model_load_from_file (mmap or read, per scenario)
+//   context_create   KV cache and compute buffer allocation
+//   warm_up          LlamaContextWrapper::warmUp (skipped with --no-warmup)
+//   first_token      generateStream until the first token arrives
+//   total            fork until the first token
+//
+// Scenarios combine a cold or warm page cache with mmap on or off. Before a
+// cold run the model (and library) pages are evicted with
+// posix_fadvise(DONTNEED), or the whole page cache is dropped with
+// --drop-caches (needs root). Eviction does not reach pages another process
+// has mapped, so the fraction of the model still cached when each run
+// starts is reported as model_cached_fraction.
+//
+// A summary table goes to stderr and the results, with every sample, go to
+// stdout (or --json) as JSON for trend tracking.
+//
+// Usage: cold-start-bench --model <path.gguf> [--runs <n>] [--cache cold|warm|both]
+//                         [--mmap on|off|both] [--library <path.so>] [--prompt <text>]
+//                         [--ctx <n>] [--threads <n>] [--no-warmup] [--drop-caches]
+//                         [--json <path>] [--verbose]
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "json_util.h"
+#include "llama_context_wrapper.h"
+#include "llama_log.h"
+
+using namespace llamaandroid;
+
+enum Phase {
+    PROCESS_START,
+    LIBRARY_LOAD,
+    BACKEND_INIT,
+    MODEL_LOAD,
+    CONTEXT_CREATE,
+    WARM_UP,
+    FIRST_TOKEN,
+    TOTAL,
+    PHASE_COUNT
+};
+
+static const char* const PHASE_NAMES[PHASE_COUNT] = {
+    "process_start", "library_load", "backend_init", "model_load",
+    "context_create", "warm_up", "first_token", "total"
+};
+
+struct Options {
+    std::string modelPath;
+    std::string libraryPath;
+    std::string prompt = "Write one sentence about the sea.";
+    std::string jsonPath;
+    int runs = 5;
+    int contextSize = 512;
+    int threads = 4;
+    bool cold = true;
+    bool warm = true;
+    bool mmapOn = true;
+    bool mmapOff = true;
+    bool warmUp = true;
+    bool dropCaches = false;
+    bool verbose = false;
+};
+
+struct Scenario {
+    bool cold;
+    bool mmap;
+    std::vector<double> samples[PHASE_COUNT];
+    std::vector<double> cachedFraction;
+    int failures = 0;
+    std::string lastError;
+};
+
+static int64_t monotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static double msSince(int64_t startNs) {
+    return (monotonicNs() - startNs) / 1e6;
+}
+
+static bool parseOptions(int argc, char** argv, int first, Options& options) {
+    for (int i = first; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        
+        if (strcmp(arg, "--no-warmup") == 0) {
+            options.warmUp = false;
+            continue;
+        }
+        if (strcmp(arg, "--drop-caches") == 0) {
+            options.dropCaches = true;
+            continue;
+        }
+        if (strcmp(arg, "--verbose") == 0) {
+            options.verbose = true;
+            continue;
+        }
+        if (value == nullptr) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        i++;
+        
+        if (strcmp(arg, "--model") == 0) {
+            options.modelPath = value;
+        } else if (strcmp(arg, "--library") == 0) {
+            options.libraryPath = value;
+        } else if (strcmp(arg, "--prompt") == 0) {
+            options.prompt = value;
+        } else if (strcmp(arg, "--json") == 0) {
+            options.jsonPath = value;
+        } else if (strcmp(arg, "--runs") == 0) {
+            options.runs = std::max(1, atoi(value));
+        } else if (strcmp(arg, "--ctx") == 0) {
+            options.contextSize = atoi(value);
+        } else if (strcmp(arg, "--threads") == 0) {
+            options.threads = atoi(value);
+        } else if (strcmp(arg, "--cache") == 0 || strcmp(arg, "--mmap") == 0) {
+            const bool cache = strcmp(arg, "--cache") == 0;
+            const char* first = cache ? "cold" : "on";
+            const char* second = cache ? "warm" : "off";
+            const bool both = strcmp(value, "both") == 0;
+            const bool a = both || strcmp(value, first) == 0;
+            const bool b = both || strcmp(value, second) == 0;
+            if (!a && !b) {
+                fprintf(stderr, "%s takes %s, %s or both\n", arg, first, second);
+                return false;
+            }
+            (cache ? options.cold : options.mmapOn) = a;
+            (cache ? options.warm : options.mmapOff) = b;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+    
+    if (options.modelPath.empty()) {
+        fprintf(stderr, "--model is required\n");
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Child: one measured start-up, results written to stdout as one line
+// ----------------------------------------------------------------------------
+
+static int runChild(int64_t spawnNs, bool useMmap, const Options& options) {
+    double phases[PHASE_COUNT] = {};
+    phases[PROCESS_START] = msSince(spawnNs);
+    
+    setLogLevel(options.verbose ? LLAMA_LOG_LEVEL_INFO : LLAMA_LOG_LEVEL_WARN);
+    
+    if (!options.libraryPath.empty()) {
+        const int64_t start = monotonicNs();
+        void* library = dlopen(options.libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+        phases[LIBRARY_LOAD] = msSince(start);
+        if (library == nullptr) {
+            printf("error dlopen: %s\n", dlerror());
+            return 1;
+        }
+    }
+    
+    LlamaContextWrapper wrapper;
+    
+    LlamaConfig config;
+    config.contextSize = options.contextSize;
+    config.threads = options.threads;
+    config.threadsBatch = options.threads;
+    config.useMmap = useMmap;
+    config.maxTokens = 1;
+    config.seed = 1;
+    if (!wrapper.loadModel(options.modelPath, config)) {
+        printf("error %s\n", wrapper.getLastError().c_str());
+        return 1;
+    }
+    if (options.warmUp) {
+        wrapper.warmUp();
+    }
+    
+    int64_t firstTokenNs = 0;
+    const int64_t start = monotonicNs();
+    wrapper.generateStream(options.prompt, [&firstTokenNs](const std::string&) {
+        if (firstTokenNs == 0) {
+            firstTokenNs = monotonicNs();
+        }
+    }, &config);
+    if (firstTokenNs == 0) {
+        printf("error no token generated: %s\n", wrapper.getLastError().c_str());
+        return 1;
+    }
+    phases[FIRST_TOKEN] = (firstTokenNs - start) / 1e6;
+    phases[TOTAL] = (firstTokenNs - spawnNs) / 1e6;
+    
+    const LoadTimings timings = wrapper.getLoadTimings();
+    phases[BACKEND_INIT] = timings.backendInitMs;
+    phases[MODEL_LOAD] = timings.modelLoadMs;
+    phases[CONTEXT_CREATE] = timings.contextCreateMs;
+    phases[WARM_UP] = timings.warmUpMs;
+    
+    printf("ok");
+    for (double value : phases) {
+        printf(" %.4f", value);
+    }
+    printf("\n");
+    fflush(stdout);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// Parent: page cache control, process launch and statistics
+// ----------------------------------------------------------------------------
+
+static bool evictFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    // Dirty pages cannot be dropped, so a freshly copied model is written back first
+    fdatasync(fd);
+    const bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+}
+
+static bool dropPageCache() {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    const bool ok = write(fd, "3", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+// Read the whole file so its pages are cached
+static void primeFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    std::vector<char> buffer(1 << 20);
+    while (read(fd, buffer.data(), buffer.size()) > 0) {
+    }
+    close(fd);
+}
+
+// Fraction of the file's pages in the page cache
+static double cachedFraction(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1.0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1.0;
+    }
+    
+    const size_t length = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return -1.0;
+    }
+    
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> residency((length + pageSize - 1) / pageSize);
+    double fraction = -1.0;
+    if (mincore(mapping, length, residency.data()) == 0) {
+        size_t resident = 0;
+        for (unsigned char page : residency) {
+            resident += page & 1;
+        }
+        fraction = static_cast<double>(resident) / residency.size();
+    }
+    munmap(mapping, length);
+    return fraction;
+}
+
+static bool prepareCache(const Scenario& scenario, const Options& options) {
+    if (!scenario.cold) {
+        primeFile(options.modelPath);
+        if (!options.libraryPath.empty()) {
+            primeFile(options.libraryPath);
+        }
+        return true;
+    }
+    if (options.dropCaches) {
+        return dropPageCache();
+    }
+    bool ok = evictFile(options.modelPath);
+    if (!options.libraryPath.empty()) {
+        ok = evictFile(options.libraryPath) && ok;
+    }
+    return ok;
+}
+
+// Run one child and parse its result line
+static bool runOnce(const char* self, bool useMmap, int argc, char** argv, double* phases, std::string& error) {
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0) {
+        error = strerror(errno);
+        return false;
+    }
+    
+    char spawn[32];
+    char mmapFlag[2] = { useMmap ? '1' : '0', '\0' };
+    std::vector<char*> childArgs;
+    childArgs.push_back(const_cast<char*>(self));
+    childArgs.push_back(const_cast<char*>("--child"));
+    childArgs.push_back(spawn);
+    childArgs.push_back(mmapFlag);
+    for (int i = 1; i < argc; i++) {
+        childArgs.push_back(argv[i]);
+    }
+    childArgs.push_back(nullptr);
+    
+    snprintf(spawn, sizeof(spawn), "%lld", static_cast<long long>(monotonicNs()));
+    pid_t pid = fork();
+    if (pid < 0) {
+        error = strerror(errno);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(pipeFds[1], STDOUT_FILENO);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        execv(self, childArgs.data());
+        _exit(127);
+    }
+    
+    close(pipeFds[1]);
+    std::string output;
+    char buffer[512];
+    ssize_t n;
+    while ((n = read(pipeFds[0], buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) {
+            output.append(buffer, static_cast<size_t>(n));
+        }
+    }
+    close(pipeFds[0]);
+    
+    int status = 0;
+    waitpid(pid, &status, 0);
+    
+    // Only the last line is ours; the library may print before it
+    while (!output.empty() && output.back() == '\n') {
+        output.pop_back();
+    }
+    const size_t lineStart = output.rfind('\n');
+    const std::string line = lineStart == std::string::npos ? output : output.substr(lineStart + 1);
+    
+    if (line.compare(0, 3, "ok ") == 0) {
+        const char* cursor = line.c_str() + 3;
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            char* end = nullptr;
+            phases[phase] = strtod(cursor, &end);
+            if (end == cursor) {
+                error = "Malformed result: " + line;
+                return false;
+            }
+            cursor = end;
+        }
+        return true;
+    }
+    
+    if (line.compare(0, 6, "error ") == 0) {
+        error = line.substr(6);
+    } else if (WIFSIGNALED(status)) {
+        error = "Child killed by signal " + std::to_string(WTERMSIG(status));
+    } else {
+        error = "Child exited with status " + std::to_string(WEXITSTATUS(status));
+    }
+    return false;
+}
+
+struct Summary {
+    double min = 0.0;
+    double median = 0.0;
+    double mean = 0.0;
+    double p90 = 0.0;
+    double max = 0.0;
+    double stddev = 0.0;
+};
+
+static Summary summarize(std::vector<double> samples) {
+    Summary summary;
+    if (samples.empty()) {
+        return summary;
+    }
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    summary.min = samples.front();
+    summary.max = samples.back();
+    summary.median = n % 2 == 1 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2.0;
+    summary.p90 = samples[std::min(n - 1, static_cast<size_t>(std::ceil(0.9 * n)) - 1)];
+    
+    double sum = 0.0;
+    for (double value : samples) {
+        sum += value;
+    }
+    summary.mean = sum / n;
+    
+    double squares = 0.0;
+    for (double value : samples) {
+        squares += (value - summary.mean) * (value - summary.mean);
+    }
+    summary.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0.0;
+    return summary;
+}
+
+static std::string jsonNumber(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f", value);
+    return text;
+}
+
+static std::string jsonSeries(const std::vector<double>& samples) {
+    const Summary s = summarize(samples);
+    std::string json = "{\"min\":" + jsonNumber(s.min) + ",\"median\":" + jsonNumber(s.median) +
+                       ",\"mean\":" + jsonNumber(s.mean) + ",\"p90\":" + jsonNumber(s.p90) +
+                       ",\"max\":" + jsonNumber(s.max) + ",\"stddev\":" + jsonNumber(s.stddev) +
+                       ",\"samples\":[";
+    for (size_t i = 0; i < samples.size(); i++) {
+        json += (i > 0 ? "," : "") + jsonNumber(samples[i]);
+    }
+    return json + "]}";
+}
+
+static std::string toJson(const std::vector<Scenario>& scenarios, const Options& options) {
+    struct stat st;
+    const long long modelBytes = stat(options.modelPath.c_str(), &st) == 0 ? static_cast<long long>(st.st_size) : -1;
+    
+    std::string json = "{\"benchmark\":\"cold_start\"";
+    json += ",\"timestamp\":" + std::to_string(static_cast<long long>(time(nullptr)));
+    json += ",\"version\":" + jsonQuote(LlamaContextWrapper::getVersion());
+    json += ",\"model\":" + jsonQuote(options.modelPath);
+    json += ",\"model_bytes\":" + std::to_string(modelBytes);
+    json += ",\"library\":" + jsonQuote(options.libraryPath);
+    json += ",\"runs\":" + std::to_string(options.runs);
+    json += ",\"context_size\":" + std::to_string(options.contextSize);
+    json += ",\"threads\":" + std::to_string(options.threads);
+    json += ",\"warm_up\":" + std::string(options.warmUp ? "true" : "false");
+    json += ",\"cache_eviction\":" + jsonQuote(options.dropCaches ? "drop_caches" : "fadvise");
+    json += ",\"scenarios\":[";
+    
+    for (size_t i = 0; i < scenarios.size(); i++) {
+        const Scenario& scenario = scenarios[i];
+        json += i > 0 ? "," : "";
+        json += "{\"cache\":" + jsonQuote(scenario.cold ? "cold" : "warm");
+        json += ",\"mmap\":" + std::string(scenario.mmap ? "true" : "false");
+        json += ",\"failures\":" + std::to_string(scenario.failures);
+        if (!scenario.lastError.empty()) {
+            json += ",\"last_error\":" + jsonQuote(scenario.lastError);
+        }
+        json += ",\"model_cached_fraction\":" + jsonSeries(scenario.cachedFraction);
+        json += ",\"phases_ms\":{";
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            json += phase > 0 ? "," : "";
+            json += jsonQuote(PHASE_NAMES[phase]) + ":" + jsonSeries(scenario.samples[phase]);
+        }
+        json += "}}";
+    }
+    return json + "]}\n";
+}
+
+static void printTable(const std::vector<Scenario>& scenarios) {
+    fprintf(stderr, "\n%-16s", "median ms");
+    for (const Scenario& scenario : scenarios) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s/%s", scenario.cold ? "cold" : "warm", scenario.mmap ? "mmap" : "read");
+        fprintf(stderr, " %12s", name);
+    }
+    fprintf(stderr, "\n");
+    
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        fprintf(stderr, "%-16s", PHASE_NAMES[phase]);
+        for (const Scenario& scenario : scenarios) {
+            fprintf(stderr, " %12.1f", summarize(scenario.samples[phase]).median);
+        }
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "%-16s", "cached before");
+    for (const Scenario& scenario : scenarios) {
+        fprintf(stderr, " %11.0f%%", summarize(scenario.cachedFraction).median * 100.0);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+    // Re-executed child: --child <spawn-ns> <mmap 0|1> <options...>
+    if (argc > 3 && strcmp(argv[1], "--child") == 0) {
+        const int64_t spawnNs = strtoll(argv[2], nullptr, 10);
+        Options options;
+        if (!parseOptions(argc, argv, 4, options)) {
+            printf("error bad options\n");
+            return 2;
+        }
+        return runChild(spawnNs, argv[3][0] == '1', options);
+    }
+    
+    Options options;
+    if (!parseOptions(argc, argv, 1, options)) {
+        fprintf(stderr,
+                "Usage: %s --model <path.gguf> [--runs <n>] [--cache cold|warm|both]\n"
+                "       [--mmap on|off|both] [--library <path.so>] [--prompt <text>] [--ctx <n>]\n"
+                "       [--threads <n>] [--no-warmup] [--drop-caches] [--json <path>] [--verbose]\n",
+                argv[0]);
+        return 2;
+    }
+    
+    // Children are started from the resolved binary so a relative argv[0] works
+    char self[4096];
+    const ssize_t selfLength = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (selfLength <= 0) {
+        fprintf(stderr, "Cannot resolve /proc/self/exe: %s\n", strerror(errno));
+        return 1;
+    }
+    self[selfLength] = '\0';
+    
+    std::vector<Scenario> scenarios;
+    for (int cold = 1; cold >= 0; cold--) {
+        if (!(cold ? options.cold : options.warm)) {
+            continue;
+        }
+        for (int useMmap = 1; useMmap >= 0; useMmap--) {
+            if (useMmap ? options.mmapOn : options.mmapOff) {
+                Scenario scenario;
+                scenario.cold = cold == 1;
+                scenario.mmap = useMmap == 1;
+                scenarios.push_back(scenario);
+            }
+        }
+    }
+    
+    for (Scenario& scenario : scenarios) {
+        for (int run = 0; run < options.runs; run++) {
+            if (!prepareCache(scenario, options)) {
+                fprintf(stderr, "Cannot %s the page cache: %s\n",
+                        scenario.cold ? "evict" : "prime", strerror(errno));
+                return 1;
+            }
+            scenario.cachedFraction.push_back(std::max(0.0, cachedFraction(options.modelPath)));
+            
+            double phases[PHASE_COUNT];
+            std::string error;
+            if (!runOnce(self, scenario.mmap, argc, argv, phases, error)) {
+                scenario.failures++;
+                scenario.lastError = error;
+                fprintf(stderr, "%s/%s run %d failed: %s\n", scenario.cold ? "cold" : "warm",
+                        scenario.mmap ? "mmap" : "read", run + 1, error.c_str());
+                continue;
+            }
+            for (int phase = 0; phase < PHASE_COUNT; phase++) {
+                scenario.samples[phase].push_back(phases[phase]);
+            }
+            fprintf(stderr, "%s/%s run %d: %.1f ms to first token\n", scenario.cold ? "cold" : "warm",
+                    scenario.mmap ? "mmap" : "read", run + 1, phases[TOTAL]);
+        }
+    }
+    
+    printTable(scenarios);
+    
+    const std::string json = toJson(scenarios, options);
+    if (options.jsonPath.empty()) {
+        fputs(json.c_str(), stdout);
+    } else {
+        FILE* file = fopen(options.jsonPath.c_str(), "w");
+        if (file == nullptr) {
+            fprintf(stderr, "Cannot write %s: %s\n", options.jsonPath.c_str(), strerror(errno));
+            return 1;
+        }
+        fputs(json.c_str(), file);
+        fclose(file);
+    }
+    
+    for (const Scenario& scenario : scenarios) {
+        if (scenario.failures == options.runs) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,347 @@
+// Benchmark of prompt-based against vector-based steering.
+//
+// Apps steer tone and persona with a block of style instructions in front
+// of every request, which the model has to evaluate before the first
+// token. A control vector steers the same way without prompt tokens. This
+// tool measures the time to first token of both on the same questions:
+//
+//   prompt_cold     style instructions + question, empty prompt cache (the
+//                   first request, or one after the style changed)
+//   prompt_cached   style instructions + question, the instructions still
+//                   cached from the previous request
+//   vector          question only, steered by the control vector set
+//   vector_switch   question only, alternating between the set and no
+//                   steering, so every request pays for applying the set
+//
+// The prompt cache is cleared with warmUp() outside the timed region. The
+// style text is a built-in persona of about 300 tokens unless --style is
+// given; the control vectors (--vector, repeatable, optionally with a
+// ":scale" suffix) should steer towards the same persona. Without
+// llama.cpp (stub build) the stub backend is exercised and --model and
+// --vector may be omitted. A table goes to stderr; --json writes the
+// results.
+//
+// Usage: control-vector-bench --model <path.gguf> --vector <path.gguf[:scale]> [--vector ...]
+//                             [--layers <start-end>] [--style <file>] [--runs <n>] [--gen <n>]
+//                             [--ctx <n>] [--threads <n>] [--json <path>]
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "json_util.h"
+#include "llama_context_wrapper.h"
+#include "llama_log.h"
+
+using namespace llamaandroid;
+
+static const char* const DEFAULT_STYLE =
+    "You are Captain Meridian, the retired skipper of a North Sea trawler who now runs a small harbour "
+    "cafe. You answer every question the way you would talk to a regular at the counter: warm, unhurried "
+    "and plain-spoken, with the occasional nautical turn of phrase. Keep your sentences short. Prefer "
+    "concrete examples from life at sea and on the quay over abstract explanations, and when a question "
+    "is technical, explain it as you would to a deckhand on their first trip: start with what it is for, "
+    "then how it works, then what can go wrong. Never use bullet points, headings or other formatting; "
+    "speak in paragraphs. Do not mention that you are playing a character and do not break the persona, "
+    "even if asked. If you do not know something, say so honestly and suggest who on the harbour might "
+    "know instead. Avoid jargon unless you explain it straight away. Be kind about mistakes and never "
+    "talk down to anyone. When someone is worried, reassure them first and give advice second. Keep "
+    "answers under a hundred and fifty words unless the question truly needs more, and end with a short, "
+    "friendly remark about the weather or the tide where it fits naturally. Use British spelling. Do not "
+    "give medical, legal or financial advice beyond common sense; point people to a professional "
+    "instead. Humour is welcome but gentle, and never at the expense of the person asking.";
+
+static const char* const QUESTIONS[] = {
+    "How does a refrigerator keep food cold?",
+    "Why do we have leap years?",
+    "What is the difference between weather and climate?",
+    "How should I prepare for a job interview?",
+    "Why is the sky blue?",
+    "How do noise-cancelling headphones work?",
+    "What makes bread rise?",
+    "How can I get better at remembering names?",
+};
+
+static const int QUESTION_COUNT = static_cast<int>(sizeof(QUESTIONS) / sizeof(QUESTIONS[0]));
+
+enum Scenario {
+    PROMPT_COLD,
+    PROMPT_CACHED,
+    VECTOR,
+    VECTOR_SWITCH,
+    SCENARIO_COUNT
+};
+
+static const char* const SCENARIO_NAMES[SCENARIO_COUNT] = {
+    "prompt_cold", "prompt_cached", "vector", "vector_switch"
+};
+
+struct Options {
+    std::string modelPath;
+    std::string stylePath;
+    std::string jsonPath;
+    std::vector<ControlVectorSpec> vectors;
+    int layerStart = 1;
+    int layerEnd = -1;
+    int runs = 16;
+    int generate = 4;
+    int contextSize = 1024;
+    int threads = 4;
+};
+
+struct Result {
+    std::vector<double> ttftMs;
+    std::vector<double> promptTokens;  // Evaluated, after prefix reuse
+    std::vector<double> prefillMs;
+    int failures = 0;
+    std::string lastError;
+};
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+static double mean(const std::vector<double>& values) {
+    double sum = 0.0;
+    for (double value : values) {
+        sum += value;
+    }
+    return values.empty() ? 0.0 : sum / values.size();
+}
+
+static std::string jsonNumber(double value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", value);
+    return buffer;
+}
+
+static std::string toJson(const Options& options, int styleTokens, const Result* results) {
+    std::string json = "{\"benchmark\":\"control_vector\"";
+    json += ",\"timestamp\":" + std::to_string(static_cast<long long>(time(nullptr)));
+    json += ",\"version\":" + jsonQuote(LlamaContextWrapper::getVersion());
+    json += ",\"model\":" + jsonQuote(options.modelPath);
+    json += ",\"vectors\":[";
+    for (size_t i = 0; i < options.vectors.size(); i++) {
+        json += i > 0 ? "," : "";
+        json += "{\"path\":" + jsonQuote(options.vectors[i].path);
+        json += ",\"scale\":" + jsonNumber(options.vectors[i].scale) + "}";
+    }
+    json += "],\"layer_start\":" + std::to_string(options.layerStart);
+    json += ",\"layer_end\":" + std::to_string(options.layerEnd);
+    json += ",\"style_tokens\":" + std::to_string(styleTokens);
+    json += ",\"runs\":" + std::to_string(options.runs);
+    json += ",\"scenarios\":{";
+    for (int s = 0; s < SCENARIO_COUNT; s++) {
+        const Result& result = results[s];
+        json += s > 0 ? "," : "";
+        json += jsonQuote(SCENARIO_NAMES[s]) + ":{\"ttft_p50_ms\":" + jsonNumber(percentile(result.ttftMs, 0.5));
+        json += ",\"ttft_p90_ms\":" + jsonNumber(percentile(result.ttftMs, 0.9));
+        json += ",\"prompt_tokens\":" + jsonNumber(mean(result.promptTokens));
+        json += ",\"prefill_ms\":" + jsonNumber(mean(result.prefillMs));
+        json += ",\"failures\":" + std::to_string(result.failures);
+        json += ",\"ttft_ms\":[";
+        for (size_t i = 0; i < result.ttftMs.size(); i++) {
+            json += (i > 0 ? "," : "") + jsonNumber(result.ttftMs[i]);
+        }
+        json += "]}";
+    }
+    json += "}}\n";
+    return json;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char* arg = argv[i];
+        const char* value = argv[i + 1];
+        if (strcmp(arg, "--model") == 0) {
+            options.modelPath = value;
+        } else if (strcmp(arg, "--vector") == 0) {
+            ControlVectorSpec spec;
+            spec.path = value;
+            const size_t colon = spec.path.rfind(':');
+            if (colon != std::string::npos) {
+                spec.scale = static_cast<float>(atof(spec.path.c_str() + colon + 1));
+                spec.path.resize(colon);
+            }
+            options.vectors.push_back(spec);
+        } else if (strcmp(arg, "--layers") == 0) {
+            if (sscanf(value, "%d-%d", &options.layerStart, &options.layerEnd) != 2) {
+                fprintf(stderr, "--layers expects <start-end>\n");
+                return false;
+            }
+        } else if (strcmp(arg, "--style") == 0) {
+            options.stylePath = value;
+        } else if (strcmp(arg, "--json") == 0) {
+            options.jsonPath = value;
+        } else if (strcmp(arg, "--runs") == 0) {
+            options.runs = std::max(1, atoi(value));
+        } else if (strcmp(arg, "--gen") == 0) {
+            options.generate = std::max(1, atoi(value));
+        } else if (strcmp(arg, "--ctx") == 0) {
+            options.contextSize = atoi(value);
+        } else if (strcmp(arg, "--threads") == 0) {
+            options.threads = atoi(value);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+    return (argc % 2) == 1;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr,
+                "Usage: %s --model <path.gguf> --vector <path.gguf[:scale]> [--vector ...]\n"
+                "       [--layers <start-end>] [--style <file>] [--runs <n>] [--gen <n>] [--ctx <n>]\n"
+                "       [--threads <n>] [--json <path>]\n",
+                argv[0]);
+        return 2;
+    }
+#if LLAMA_AVAILABLE
+    if (options.modelPath.empty() || options.vectors.empty()) {
+        fprintf(stderr, "--model and --vector are required when built with llama.cpp\n");
+        return 2;
+    }
+#else
+    if (options.modelPath.empty()) {
+        options.modelPath = "stub";
+    }
+    if (options.vectors.empty()) {
+        options.vectors.push_back(ControlVectorSpec{"stub", 1.0f});
+    }
+#endif
+
+    std::string style = DEFAULT_STYLE;
+    if (!options.stylePath.empty()) {
+        std::ifstream file(options.stylePath, std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "Cannot read %s\n", options.stylePath.c_str());
+            return 1;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        style = contents.str();
+    }
+    
+    setLogLevel(LLAMA_LOG_LEVEL_ERROR);
+    
+    LlamaConfig config;
+    config.contextSize = options.contextSize;
+    config.threads = options.threads;
+    config.threadsBatch = options.threads;
+    config.maxTokens = options.generate;
+    config.temperature = 0.0f;
+    config.seed = 1;
+    
+    LlamaContextWrapper wrapper;
+    if (!wrapper.loadModel(options.modelPath, config)) {
+        fprintf(stderr, "Cannot load %s: %s\n", options.modelPath.c_str(), wrapper.getLastError().c_str());
+        return 1;
+    }
+    
+    const int setId = wrapper.createControlVectorSet(options.vectors, options.layerStart, options.layerEnd);
+    if (setId == 0) {
+        fprintf(stderr, "Cannot create control vector set: %s\n", wrapper.getLastError().c_str());
+        return 1;
+    }
+    
+    Result results[SCENARIO_COUNT];
+    for (int s = 0; s < SCENARIO_COUNT; s++) {
+        const bool styled = s == PROMPT_COLD || s == PROMPT_CACHED;
+        LlamaConfig requestConfig = config;
+        requestConfig.controlVectorSet = styled ? 0 : setId;
+        
+        // Untimed request that selects the steering and, for prompt_cached,
+        // leaves the style text in the cache
+        const std::string prime = (styled ? style + "\n\n" : "") + "Question: Hello!\nAnswer:";
+        wrapper.generateStream(prime, [](const std::string&) {}, &requestConfig);
+        
+        for (int run = 0; run < options.runs; run++) {
+            if (s == PROMPT_COLD || s == VECTOR) {
+                wrapper.warmUp();
+            }
+            if (s == VECTOR_SWITCH) {
+                // Unsteered in between, so the timed request has to apply the set again
+                LlamaConfig plain = config;
+                wrapper.generateStream("Question: Hello!\nAnswer:", [](const std::string&) {}, &plain);
+            }
+            
+            const std::string question = std::string("Question: ") + QUESTIONS[run % QUESTION_COUNT] + "\nAnswer:";
+            const std::string prompt = styled ? style + "\n\n" + question : question;
+            
+            double ttftMs = -1.0;
+            const auto start = std::chrono::steady_clock::now();
+            wrapper.generateStream(prompt, [&](const std::string&) {
+                if (ttftMs < 0.0) {
+                    ttftMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                }
+            }, &requestConfig);
+            
+            Result& result = results[s];
+            const std::string error = wrapper.getLastError();
+            if (!error.empty() || ttftMs < 0.0) {
+                result.failures++;
+                result.lastError = error.empty() ? "no token generated" : error;
+                continue;
+            }
+            const GenerationStats stats = wrapper.getGenerationStats();
+            result.ttftMs.push_back(ttftMs);
+            result.promptTokens.push_back(stats.promptTokens);
+            result.prefillMs.push_back(stats.prefillMs);
+        }
+    }
+    
+    // Prompt tokens the style text adds
+    const int styleTokens = static_cast<int>(mean(results[PROMPT_COLD].promptTokens) -
+                                             mean(results[VECTOR].promptTokens) + 0.5);
+    
+    fprintf(stderr, "%-14s %5s %9s %10s %10s %10s\n", "scenario", "runs", "prompt tk", "prefill ms", "TTFT p50",
+            "TTFT p90");
+    for (int s = 0; s < SCENARIO_COUNT; s++) {
+        const Result& result = results[s];
+        fprintf(stderr, "%-14s %5zu %9.1f %10.2f %10.2f %10.2f\n", SCENARIO_NAMES[s], result.ttftMs.size(),
+                mean(result.promptTokens), mean(result.prefillMs), percentile(result.ttftMs, 0.5),
+                percentile(result.ttftMs, 0.9));
+        if (result.failures > 0) {
+            fprintf(stderr, "  %d failed: %s\n", result.failures, result.lastError.c_str());
+        }
+    }
+    const double vectorP50 = percentile(results[VECTOR].ttftMs, 0.5);
+    if (vectorP50 > 0.0) {
+        fprintf(stderr, "\nstyle text: %d tokens, prompt_cold / vector TTFT: %.2fx\n", styleTokens,
+                percentile(results[PROMPT_COLD].ttftMs, 0.5) / vectorP50);
+    }
+    
+    if (!options.jsonPath.empty()) {
+        FILE* out = fopen(options.jsonPath.c_str(), "w");
+        if (out == nullptr) {
+            fprintf(stderr, "Cannot write %s: %s\n", options.jsonPath.c_str(), strerror(errno));
+            return 1;
+        }
+        fputs(toJson(options, styleTokens, results).c_str(), out);
+        fclose(out);
+    }
+    
+    flushLog();
+    
+    int failures = 0;
+    for (const Result& result : results) {
+        failures += result.failures;
+    }
+    return failures == 0 ? 0 : 1;
+}
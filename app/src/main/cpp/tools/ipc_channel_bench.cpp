@@ -0,0 +1,75 @@
+// Benchmark of the out-of-process token channel.
+//
+// Starts the llama-host helper with fork/exec, has it stream records of
+// typical token sizes through the shared-memory ring and compares the
+// per-token cost with an in-process std::function callback, which is what
+// LlamaContextWrapper::generateStream pays without process isolation.
+//
+// Usage: ipc-channel-bench <path-to-llama-host> [tokens-per-run]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "inference_host.h"
+
+using namespace llamaandroid;
+
+static double inProcessNsPerToken(uint32_t count, uint32_t recordSize) {
+    std::string sink;
+    sink.reserve(recordSize);
+    TokenCallback callback = [&sink](const std::string& token) {
+        sink.assign(token);
+    };
+    
+    std::string token(recordSize, 'x');
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++) {
+        callback(token);
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(ns) / count;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path-to-llama-host> [tokens-per-run]\n", argv[0]);
+        return 2;
+    }
+    
+    const uint32_t count = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 200000;
+    const int runs = 5;
+    const uint32_t sizes[] = { 4, 16, 64, 256 };
+    
+    InferenceHostClient client;
+    if (!client.start(argv[1])) {
+        fprintf(stderr, "Failed to start host: %s\n", client.getLastError().c_str());
+        return 1;
+    }
+    
+    printf("%-12s %16s %16s %14s\n", "token bytes", "ring ns/token", "in-proc ns/token", "tokens/s");
+    
+    for (uint32_t size : sizes) {
+        std::vector<double> samples;
+        for (int r = 0; r < runs; r++) {
+            int64_t ns = client.benchmarkChannel(count, size);
+            if (ns < 0) {
+                fprintf(stderr, "Channel benchmark failed: %s\n", client.getLastError().c_str());
+                return 1;
+            }
+            samples.push_back(static_cast<double>(ns) / count);
+        }
+        std::sort(samples.begin(), samples.end());
+        const double median = samples[samples.size() / 2];
+        
+        printf("%-12u %16.1f %16.1f %14.0f\n",
+               size, median, inProcessNsPerToken(count, size), 1e9 / median);
+    }
+    
+    client.stop();
+    return 0;
+}
@@ -0,0 +1,395 @@
+// Quantisation trade-off benchmark.
+//
+// Measures every combination of model file (e.g. Q4_0, Q4_K_M, Q5_K_M and
+// Q8_0 builds of one model) and KV cache type, each in a fresh process so
+// that its peak memory is its own:
+//
+//   prefill   prompt evaluation rate, tokens/s (median over --reps prompts)
+//   decode    generation rate, tokens/s (median over --reps generations)
+//   peak RSS  resident high-water mark from the load to the end of the cell
+//   KV        KV cache size as allocated by llama.cpp
+//   PPL       perplexity on the text sample, scored in batches of whole
+//             contexts (LlamaContextWrapper::evaluatePerplexity), with its
+//             standard error
+//
+// The default text is the sample bundled in tools/data; perplexities are
+// only comparable between runs on the same text and context size. One
+// markdown table goes to stdout, and --json also writes the results as
+// JSON.
+//
+// Usage: quant-matrix-bench --model <a.gguf> [--model <b.gguf> ...] [--kv f16,q8_0,q4_0]
+//                           [--text <file>] [--ctx <n>] [--batch <n>] [--threads <n>]
+//                           [--gen <n>] [--reps <n>] [--json <path>]
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "json_util.h"
+#include "llama_context_wrapper.h"
+#include "llama_log.h"
+
+using namespace llamaandroid;
+
+#ifndef PERPLEXITY_SAMPLE_PATH
+#define PERPLEXITY_SAMPLE_PATH "tools/data/perplexity_sample.txt"
+#endif
+
+// Prompt used for the throughput runs: PROMPT_CHARS characters of the
+// text, starting PROMPT_STRIDE characters further on for each repetition
+// so that no run reuses the previous one's cached prefix
+static const size_t PROMPT_CHARS = 1200;
+static const size_t PROMPT_STRIDE = 700;
+
+static const double MIB = 1024.0 * 1024.0;
+
+struct Options {
+    std::vector<std::string> models;
+    std::vector<KvCacheType> kvTypes;
+    std::string textPath = PERPLEXITY_SAMPLE_PATH;
+    std::string jsonPath;
+    int contextSize = 512;
+    int batchSize = 512;
+    int threads = 4;
+    int generate = 64;
+    int reps = 3;
+};
+
+// Sent from the cell's process to the parent as raw bytes
+struct CellResult {
+    bool loaded = false;
+    char error[256] = {};
+    double modelMiB = 0.0;
+    double prefillTps = 0.0;
+    double decodeTps = 0.0;
+    double peakRssMiB = 0.0;
+    double kvMiB = 0.0;
+    bool perplexityOk = false;
+    char perplexityError[256] = {};
+    double perplexity = 0.0;
+    double perplexityError95 = 0.0;  // 1.96 standard errors
+    int scoredTokens = 0;
+    double scoringTps = 0.0;
+};
+
+static const char* kvTypeName(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::Q8_0: return "q8_0";
+        case KvCacheType::Q4_0: return "q4_0";
+        default: return "f16";
+    }
+}
+
+static bool parseKvTypes(const char* list, std::vector<KvCacheType>& out) {
+    out.clear();
+    std::stringstream stream(list);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        if (name == "f16") {
+            out.push_back(KvCacheType::F16);
+        } else if (name == "q8_0") {
+            out.push_back(KvCacheType::Q8_0);
+        } else if (name == "q4_0") {
+            out.push_back(KvCacheType::Q4_0);
+        } else {
+            fprintf(stderr, "Unknown KV cache type: %s (f16, q8_0 or q4_0)\n", name.c_str());
+            return false;
+        }
+    }
+    return !out.empty();
+}
+
+static double median(std::vector<double> values) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t n = values.size();
+    return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+}
+
+static std::string baseName(const std::string& path) {
+    const size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static void copyError(char (&out)[256], const std::string& text) {
+    snprintf(out, sizeof(out), "%s", text.c_str());
+}
+
+// Runs in the cell's own process
+static CellResult measureCell(const std::string& modelPath, KvCacheType kvType,
+                              const std::string& text, const Options& options) {
+    CellResult result;
+    setLogLevel(LLAMA_LOG_LEVEL_WARN);
+    
+    LlamaConfig config;
+    config.contextSize = options.contextSize;
+    config.batchSize = options.batchSize;
+    config.threads = options.threads;
+    config.threadsBatch = options.threads;
+    config.kvCacheType = kvType;
+    config.maxTokens = options.generate;
+    config.temperature = 0.0f;
+    config.seed = 1;
+    
+    LlamaContextWrapper wrapper;
+    if (!wrapper.loadModel(modelPath, config)) {
+        copyError(result.error, wrapper.getLastError());
+        return result;
+    }
+    result.loaded = true;
+    wrapper.warmUp();
+    
+    std::vector<double> prefill;
+    std::vector<double> decode;
+    for (int rep = 0; rep < options.reps; rep++) {
+        const size_t offset = std::min(rep * PROMPT_STRIDE, text.size() - std::min(text.size(), PROMPT_CHARS));
+        wrapper.generate(text.substr(offset, PROMPT_CHARS), &config);
+        const GenerationStats stats = wrapper.getGenerationStats();
+        prefill.push_back(stats.prefillTokensPerSecond());
+        decode.push_back(stats.tokensPerSecond());
+    }
+    result.prefillTps = median(prefill);
+    result.decodeTps = median(decode);
+    
+    PerplexityResult perplexity;
+    if (wrapper.evaluatePerplexity(text, perplexity)) {
+        result.perplexityOk = true;
+        result.perplexity = perplexity.perplexity;
+        result.perplexityError95 = 1.96 * perplexity.standardError;
+        result.scoredTokens = perplexity.scoredTokens;
+        result.scoringTps = perplexity.tokensPerSecond;
+    } else {
+        copyError(result.perplexityError, wrapper.getLastError());
+    }
+    
+    const MemoryStats memory = wrapper.getMemoryStats();
+    result.modelMiB = memory.modelBytes / MIB;
+    result.peakRssMiB = memory.peakRssBytes / MIB;
+    result.kvMiB = memory.kvCacheBytes / MIB;
+    return result;
+}
+
+static bool runCell(const std::string& modelPath, KvCacheType kvType, const std::string& text,
+                    const Options& options, CellResult& result) {
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0) {
+        copyError(result.error, strerror(errno));
+        return false;
+    }
+    
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        copyError(result.error, strerror(errno));
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(pipeFds[0]);
+        const CellResult cell = measureCell(modelPath, kvType, text, options);
+        const bool written = write(pipeFds[1], &cell, sizeof(cell)) == static_cast<ssize_t>(sizeof(cell));
+        flushLog();
+        _exit(written ? 0 : 1);
+    }
+    
+    close(pipeFds[1]);
+    size_t received = 0;
+    char* bytes = reinterpret_cast<char*>(&result);
+    while (received < sizeof(result)) {
+        const ssize_t n = read(pipeFds[0], bytes + received, sizeof(result) - received);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        received += static_cast<size_t>(n);
+    }
+    close(pipeFds[0]);
+    
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (received == sizeof(result)) {
+        return result.loaded;
+    }
+    
+    result = CellResult();
+    if (WIFSIGNALED(status)) {
+        copyError(result.error, "Killed by signal " + std::to_string(WTERMSIG(status)));
+    } else {
+        copyError(result.error, "Exited with status " + std::to_string(WEXITSTATUS(status)));
+    }
+    return false;
+}
+
+static std::string jsonNumber(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f", value);
+    return text;
+}
+
+static std::string toJson(const std::vector<std::string>& names, const std::vector<CellResult>& cells,
+                          const Options& options) {
+    std::string json = "{\"benchmark\":\"quant_matrix\"";
+    json += ",\"timestamp\":" + std::to_string(static_cast<long long>(time(nullptr)));
+    json += ",\"version\":" + jsonQuote(LlamaContextWrapper::getVersion());
+    json += ",\"text\":" + jsonQuote(options.textPath);
+    json += ",\"context_size\":" + std::to_string(options.contextSize);
+    json += ",\"batch_size\":" + std::to_string(options.batchSize);
+    json += ",\"threads\":" + std::to_string(options.threads);
+    json += ",\"generate\":" + std::to_string(options.generate);
+    json += ",\"reps\":" + std::to_string(options.reps);
+    json += ",\"cells\":[";
+    
+    size_t index = 0;
+    for (size_t m = 0; m < options.models.size(); m++) {
+        for (KvCacheType kvType : options.kvTypes) {
+            const CellResult& cell = cells[index++];
+            json += index > 1 ? "," : "";
+            json += "{\"model\":" + jsonQuote(names[m]);
+            json += ",\"path\":" + jsonQuote(options.models[m]);
+            json += ",\"kv_type\":" + jsonQuote(kvTypeName(kvType));
+            if (!cell.loaded) {
+                json += ",\"error\":" + jsonQuote(cell.error) + "}";
+                continue;
+            }
+            json += ",\"model_mib\":" + jsonNumber(cell.modelMiB);
+            json += ",\"prefill_tps\":" + jsonNumber(cell.prefillTps);
+            json += ",\"decode_tps\":" + jsonNumber(cell.decodeTps);
+            json += ",\"peak_rss_mib\":" + jsonNumber(cell.peakRssMiB);
+            json += ",\"kv_mib\":" + jsonNumber(cell.kvMiB);
+            if (cell.perplexityOk) {
+                json += ",\"perplexity\":" + jsonNumber(cell.perplexity);
+                json += ",\"perplexity_error95\":" + jsonNumber(cell.perplexityError95);
+                json += ",\"scored_tokens\":" + std::to_string(cell.scoredTokens);
+                json += ",\"scoring_tps\":" + jsonNumber(cell.scoringTps);
+            } else {
+                json += ",\"perplexity_error\":" + jsonQuote(cell.perplexityError);
+            }
+            json += "}";
+        }
+    }
+    return json + "]}\n";
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    parseKvTypes("f16,q8_0", options.kvTypes);
+    
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char* arg = argv[i];
+        const char* value = argv[i + 1];
+        if (strcmp(arg, "--model") == 0) {
+            options.models.push_back(value);
+        } else if (strcmp(arg, "--kv") == 0) {
+            if (!parseKvTypes(value, options.kvTypes)) {
+                return 2;
+            }
+        } else if (strcmp(arg, "--text") == 0) {
+            options.textPath = value;
+        } else if (strcmp(arg, "--json") == 0) {
+            options.jsonPath = value;
+        } else if (strcmp(arg, "--ctx") == 0) {
+            options.contextSize = atoi(value);
+        } else if (strcmp(arg, "--batch") == 0) {
+            options.batchSize = atoi(value);
+        } else if (strcmp(arg, "--threads") == 0) {
+            options.threads = atoi(value);
+        } else if (strcmp(arg, "--gen") == 0) {
+            options.generate = std::max(1, atoi(value));
+        } else if (strcmp(arg, "--reps") == 0) {
+            options.reps = std::max(1, atoi(value));
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return 2;
+        }
+    }
+    
+    if (options.models.empty()) {
+        fprintf(stderr,
+                "Usage: %s --model <a.gguf> [--model <b.gguf> ...] [--kv f16,q8_0,q4_0]\n"
+                "       [--text <file>] [--ctx <n>] [--batch <n>] [--threads <n>] [--gen <n>]\n"
+                "       [--reps <n>] [--json <path>]\n",
+                argv[0]);
+        return 2;
+    }
+    
+    std::ifstream file(options.textPath, std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "Cannot read %s\n", options.textPath.c_str());
+        return 1;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    const std::string text = contents.str();
+    
+    std::vector<std::string> names;
+    std::vector<CellResult> cells;
+    for (const std::string& model : options.models) {
+        names.push_back(baseName(model));
+        for (KvCacheType kvType : options.kvTypes) {
+            fprintf(stderr, "Measuring %s with %s KV cache...\n", names.back().c_str(), kvTypeName(kvType));
+            CellResult cell;
+            if (!runCell(model, kvType, text, options, cell)) {
+                fprintf(stderr, "  failed: %s\n", cell.error);
+            }
+            cells.push_back(cell);
+        }
+    }
+    
+    printf("| %-32s | %-4s | %9s | %11s | %10s | %12s | %8s | %16s |\n", "model", "kv", "size MiB",
+           "prefill t/s", "decode t/s", "peak RSS MiB", "KV MiB", "PPL (95%)");
+    printf("|%s|%s|%s|%s|%s|%s|%s|%s|\n", std::string(34, '-').c_str(), std::string(6, '-').c_str(),
+           std::string(11, '-').c_str(), std::string(13, '-').c_str(), std::string(12, '-').c_str(),
+           std::string(14, '-').c_str(), std::string(10, '-').c_str(), std::string(18, '-').c_str());
+    
+    size_t index = 0;
+    for (size_t m = 0; m < options.models.size(); m++) {
+        for (KvCacheType kvType : options.kvTypes) {
+            const CellResult& cell = cells[index++];
+            if (!cell.loaded) {
+                printf("| %-32s | %-4s | %9s | %11s | %10s | %12s | %8s | %16s |\n", names[m].c_str(),
+                       kvTypeName(kvType), "-", "-", "-", "-", "-", "failed");
+                continue;
+            }
+            char perplexity[32] = "n/a";
+            if (cell.perplexityOk) {
+                snprintf(perplexity, sizeof(perplexity), "%.3f +/- %.3f", cell.perplexity, cell.perplexityError95);
+            }
+            printf("| %-32s | %-4s | %9.1f | %11.1f | %10.2f | %12.1f | %8.1f | %16s |\n", names[m].c_str(),
+                   kvTypeName(kvType), cell.modelMiB, cell.prefillTps, cell.decodeTps, cell.peakRssMiB,
+                   cell.kvMiB, perplexity);
+        }
+    }
+    
+    if (!options.jsonPath.empty()) {
+        FILE* out = fopen(options.jsonPath.c_str(), "w");
+        if (out == nullptr) {
+            fprintf(stderr, "Cannot write %s: %s\n", options.jsonPath.c_str(), strerror(errno));
+            return 1;
+        }
+        fputs(toJson(names, cells, options).c_str(), out);
+        fclose(out);
+    }
+    
+    for (const CellResult& cell : cells) {
+        if (!cell.loaded) {
+            return 1;
+        }
+    }
+    return 0;
+}
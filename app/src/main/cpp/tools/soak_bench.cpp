@@ -0,0 +1,439 @@
+// Soak benchmark: memory drift and latency stability over many requests.
+//
+// Runs a long mixed workload against one LlamaContextWrapper, the way a
+// long-lived app process uses it:
+//
+//   - prompts of 40, 400 and 2000 characters taken from the text sample
+//   - a share of requests with their own sampler settings, so the sampler
+//     chain is rebuilt (setupSampler) for each of them
+//   - a share of requests cancelled from the token callback part-way
+//   - an unload and reload of the model every --reload-every requests
+//
+// Every --window requests it samples RSS, the allocator's in-use and
+// mapped bytes, request latency percentiles and, in builds configured with
+// -DLLAMA_ANDROID_ALLOC_HOOK=ON, heap allocations per request. The first
+// window is warm-up. Drift is the least-squares slope over the remaining
+// windows times the number of requests they span, so one noisy window
+// does not decide the verdict. The run fails (exit status 1) when a
+// request fails or a drift exceeds its threshold:
+//
+//   --max-rss-drift-mib       growth of the resident set (default 32)
+//   --max-heap-drift-mib      growth of the allocator's in-use bytes (default 16)
+//   --max-latency-drift       ratio of the fitted end and start p50 latency (default 1.25)
+//   --max-alloc-drift         growth in allocations per request (default 1)
+//
+// Without llama.cpp (stub build) the stub backend is exercised and --model
+// may be omitted. A window table goes to stderr; --json writes the samples
+// and the verdict.
+//
+// Usage: soak-bench [--model <tiny.gguf>] [--requests <n>] [--window <n>] [--reload-every <n>]
+//                   [--cancel-rate <0..1>] [--config-rate <0..1>] [--gen <n>] [--ctx <n>]
+//                   [--threads <n>] [--seed <n>] [--text <file>] [--json <path>]
+//                   [--max-rss-drift-mib <x>] [--max-heap-drift-mib <x>]
+//                   [--max-latency-drift <x>] [--max-alloc-drift <x>]
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "alloc_hook.h"
+#include "json_util.h"
+#include "llama_context_wrapper.h"
+#include "llama_log.h"
+#include "memory_stats.h"
+
+using namespace llamaandroid;
+
+#ifndef PERPLEXITY_SAMPLE_PATH
+#define PERPLEXITY_SAMPLE_PATH "tools/data/perplexity_sample.txt"
+#endif
+
+// Prompt lengths (characters) and how often each is used
+static const size_t PROMPT_CHARS[] = {40, 400, 2000};
+static const double PROMPT_WEIGHTS[] = {0.5, 0.35, 0.15};
+
+static const double MIB = 1024.0 * 1024.0;
+
+struct Options {
+    std::string modelPath;
+    std::string textPath = PERPLEXITY_SAMPLE_PATH;
+    std::string jsonPath;
+    int requests = 20000;
+    int window = 500;
+    int reloadEvery = 2000;
+    double cancelRate = 0.1;
+    double configRate = 0.2;
+    int generate = 16;
+    int contextSize = 1024;
+    int threads = 4;
+    unsigned seed = 1;
+    double maxRssDriftMiB = 32.0;
+    double maxHeapDriftMiB = 16.0;
+    double maxLatencyDrift = 1.25;
+    double maxAllocDrift = 1.0;
+};
+
+struct WindowSample {
+    int requests = 0;           // Requests completed at the end of the window
+    double elapsedS = 0.0;
+    double rssMiB = 0.0;
+    double heapInUseMiB = 0.0;
+    double heapMappedMiB = 0.0;
+    double p50Ms = 0.0;
+    double p90Ms = 0.0;
+    double p99Ms = 0.0;
+    double msPerToken = 0.0;    // Median of request time over pieces emitted
+    double allocsPerRequest = 0.0;
+    int cancelled = 0;
+    int reconfigured = 0;
+    double reloadMs = 0.0;      // Longest unload and reload in the window
+};
+
+struct Drift {
+    const char* name;
+    const char* unit;
+    double start = 0.0;   // Fitted value at the first measured window
+    double end = 0.0;     // Fitted value at the last one
+    double change = 0.0;  // end - start, or end / start for ratios
+    double limit = 0.0;
+    bool ratio = false;
+    
+    bool exceeded() const { return change > limit; }
+};
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+/**
+ * Least-squares line through (requests, value) of the windows after the
+ * warm-up one, evaluated at the first and last of them
+ */
+static Drift fitDrift(const char* name, const char* unit, const std::vector<WindowSample>& windows,
+                      double WindowSample::*field, double limit, bool ratio) {
+    Drift drift;
+    drift.name = name;
+    drift.unit = unit;
+    drift.limit = limit;
+    drift.ratio = ratio;
+    
+    const size_t first = windows.size() > 2 ? 1 : 0;
+    const size_t n = windows.size() - first;
+    if (n == 0) {
+        return drift;
+    }
+    
+    double meanX = 0.0;
+    double meanY = 0.0;
+    for (size_t i = first; i < windows.size(); i++) {
+        meanX += windows[i].requests;
+        meanY += windows[i].*field;
+    }
+    meanX /= n;
+    meanY /= n;
+    
+    double covariance = 0.0;
+    double variance = 0.0;
+    for (size_t i = first; i < windows.size(); i++) {
+        covariance += (windows[i].requests - meanX) * (windows[i].*field - meanY);
+        variance += (windows[i].requests - meanX) * (windows[i].requests - meanX);
+    }
+    const double slope = variance > 0.0 ? covariance / variance : 0.0;
+    drift.start = meanY + slope * (windows[first].requests - meanX);
+    drift.end = meanY + slope * (windows.back().requests - meanX);
+    if (ratio) {
+        drift.change = drift.start > 0.0 ? drift.end / drift.start : 1.0;
+    } else {
+        drift.change = drift.end - drift.start;
+    }
+    return drift;
+}
+
+static std::string jsonNumber(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f", value);
+    return text;
+}
+
+static std::string toJson(const Options& options, const std::vector<WindowSample>& windows,
+                          const std::vector<Drift>& drifts, int failedRequests, bool passed) {
+    std::string json = "{\"benchmark\":\"soak\"";
+    json += ",\"timestamp\":" + std::to_string(static_cast<long long>(time(nullptr)));
+    json += ",\"version\":" + jsonQuote(LlamaContextWrapper::getVersion());
+    json += ",\"model\":" + jsonQuote(options.modelPath);
+    json += ",\"requests\":" + std::to_string(options.requests);
+    json += ",\"window\":" + std::to_string(options.window);
+    json += ",\"reload_every\":" + std::to_string(options.reloadEvery);
+    json += ",\"cancel_rate\":" + jsonNumber(options.cancelRate);
+    json += ",\"config_rate\":" + jsonNumber(options.configRate);
+    json += ",\"generate\":" + std::to_string(options.generate);
+    json += ",\"alloc_hook\":" + std::string(allocationHookEnabled() ? "true" : "false");
+    json += ",\"windows\":[";
+    for (size_t i = 0; i < windows.size(); i++) {
+        const WindowSample& w = windows[i];
+        json += i > 0 ? "," : "";
+        json += "{\"requests\":" + std::to_string(w.requests);
+        json += ",\"elapsed_s\":" + jsonNumber(w.elapsedS);
+        json += ",\"rss_mib\":" + jsonNumber(w.rssMiB);
+        json += ",\"heap_in_use_mib\":" + jsonNumber(w.heapInUseMiB);
+        json += ",\"heap_mapped_mib\":" + jsonNumber(w.heapMappedMiB);
+        json += ",\"p50_ms\":" + jsonNumber(w.p50Ms);
+        json += ",\"p90_ms\":" + jsonNumber(w.p90Ms);
+        json += ",\"p99_ms\":" + jsonNumber(w.p99Ms);
+        json += ",\"ms_per_token\":" + jsonNumber(w.msPerToken);
+        json += ",\"allocs_per_request\":" + jsonNumber(w.allocsPerRequest);
+        json += ",\"cancelled\":" + std::to_string(w.cancelled);
+        json += ",\"reconfigured\":" + std::to_string(w.reconfigured);
+        json += ",\"reload_ms\":" + jsonNumber(w.reloadMs) + "}";
+    }
+    json += "],\"drift\":{";
+    for (size_t i = 0; i < drifts.size(); i++) {
+        const Drift& d = drifts[i];
+        json += i > 0 ? "," : "";
+        json += jsonQuote(d.name) + ":{\"start\":" + jsonNumber(d.start) + ",\"end\":" + jsonNumber(d.end);
+        json += ",\"change\":" + jsonNumber(d.change) + ",\"limit\":" + jsonNumber(d.limit);
+        json += ",\"exceeded\":" + std::string(d.exceeded() ? "true" : "false") + "}";
+    }
+    json += "},\"failed_requests\":" + std::to_string(failedRequests);
+    json += ",\"passed\":" + std::string(passed ? "true" : "false") + "}\n";
+    return json;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char* arg = argv[i];
+        const char* value = argv[i + 1];
+        if (strcmp(arg, "--model") == 0) {
+            options.modelPath = value;
+        } else if (strcmp(arg, "--text") == 0) {
+            options.textPath = value;
+        } else if (strcmp(arg, "--json") == 0) {
+            options.jsonPath = value;
+        } else if (strcmp(arg, "--requests") == 0) {
+            options.requests = std::max(1, atoi(value));
+        } else if (strcmp(arg, "--window") == 0) {
+            options.window = std::max(1, atoi(value));
+        } else if (strcmp(arg, "--reload-every") == 0) {
+            options.reloadEvery = std::max(0, atoi(value));
+        } else if (strcmp(arg, "--cancel-rate") == 0) {
+            options.cancelRate = atof(value);
+        } else if (strcmp(arg, "--config-rate") == 0) {
+            options.configRate = atof(value);
+        } else if (strcmp(arg, "--gen") == 0) {
+            options.generate = std::max(2, atoi(value));
+        } else if (strcmp(arg, "--ctx") == 0) {
+            options.contextSize = atoi(value);
+        } else if (strcmp(arg, "--threads") == 0) {
+            options.threads = atoi(value);
+        } else if (strcmp(arg, "--seed") == 0) {
+            options.seed = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--max-rss-drift-mib") == 0) {
+            options.maxRssDriftMiB = atof(value);
+        } else if (strcmp(arg, "--max-heap-drift-mib") == 0) {
+            options.maxHeapDriftMiB = atof(value);
+        } else if (strcmp(arg, "--max-latency-drift") == 0) {
+            options.maxLatencyDrift = atof(value);
+        } else if (strcmp(arg, "--max-alloc-drift") == 0) {
+            options.maxAllocDrift = atof(value);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+    return (argc % 2) == 1;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr,
+                "Usage: %s [--model <tiny.gguf>] [--requests <n>] [--window <n>] [--reload-every <n>]\n"
+                "       [--cancel-rate <0..1>] [--config-rate <0..1>] [--gen <n>] [--ctx <n>] [--threads <n>]\n"
+                "       [--seed <n>] [--text <file>] [--json <path>] [--max-rss-drift-mib <x>]\n"
+                "       [--max-heap-drift-mib <x>] [--max-latency-drift <x>] [--max-alloc-drift <x>]\n",
+                argv[0]);
+        return 2;
+    }
+#if LLAMA_AVAILABLE
+    if (options.modelPath.empty()) {
+        fprintf(stderr, "--model is required when built with llama.cpp\n");
+        return 2;
+    }
+#else
+    if (options.modelPath.empty()) {
+        options.modelPath = "stub";
+    }
+#endif
+
+    std::ifstream file(options.textPath, std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "Cannot read %s\n", options.textPath.c_str());
+        return 1;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    const std::string text = contents.str();
+    
+    setLogLevel(LLAMA_LOG_LEVEL_ERROR);
+    
+    LlamaConfig loadConfig;
+    loadConfig.contextSize = options.contextSize;
+    loadConfig.threads = options.threads;
+    loadConfig.threadsBatch = options.threads;
+    loadConfig.maxTokens = options.generate;
+    loadConfig.seed = static_cast<int>(options.seed);
+    
+    LlamaContextWrapper wrapper;
+    if (!wrapper.loadModel(options.modelPath, loadConfig)) {
+        fprintf(stderr, "Cannot load %s: %s\n", options.modelPath.c_str(), wrapper.getLastError().c_str());
+        return 1;
+    }
+    
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::discrete_distribution<size_t> promptKind(std::begin(PROMPT_WEIGHTS), std::end(PROMPT_WEIGHTS));
+    static const int TOP_K_CHOICES[] = {0, 20, 40, 100};
+    
+    fprintf(stderr, "%8s %8s %9s %9s %9s %8s %8s %8s %8s %9s %6s %9s\n", "requests", "time s", "RSS MiB",
+            "heap MiB", "mapped", "p50 ms", "p90 ms", "p99 ms", "ms/tok", "allocs/rq", "cancel", "reload ms");
+    
+    std::vector<WindowSample> windows;
+    std::vector<double> latencies;
+    std::vector<double> perToken;
+    WindowSample current;
+    int failedRequests = 0;
+    uint64_t windowAllocations = 0;
+    const auto start = std::chrono::steady_clock::now();
+    
+    for (int request = 1; request <= options.requests; request++) {
+        if (options.reloadEvery > 0 && request % options.reloadEvery == 0) {
+            const auto reloadStart = std::chrono::steady_clock::now();
+            wrapper.unloadModel();
+            if (!wrapper.loadModel(options.modelPath, loadConfig)) {
+                fprintf(stderr, "Reload %d failed: %s\n", request / options.reloadEvery,
+                        wrapper.getLastError().c_str());
+                return 1;
+            }
+            const double reloadMs = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - reloadStart).count();
+            current.reloadMs = std::max(current.reloadMs, reloadMs);
+        }
+        
+        const size_t length = std::min(PROMPT_CHARS[promptKind(rng)], text.size());
+        const size_t offset = static_cast<size_t>(unit(rng) * (text.size() - length));
+        const std::string prompt = text.substr(offset, length);
+        
+        LlamaConfig requestConfig = loadConfig;
+        const bool reconfigure = unit(rng) < options.configRate;
+        if (reconfigure) {
+            requestConfig.temperature = static_cast<float>(unit(rng) * 1.2);
+            requestConfig.topK = TOP_K_CHOICES[rng() % 4];
+            requestConfig.topP = static_cast<float>(0.8 + unit(rng) * 0.2);
+            requestConfig.repeatPenalty = static_cast<float>(1.0 + unit(rng) * 0.3);
+            requestConfig.seed = static_cast<int>(rng() & 0x7fffffff);
+            current.reconfigured++;
+        }
+        const bool cancel = unit(rng) < options.cancelRate;
+        const int cancelAfter = 1 + static_cast<int>(rng() % static_cast<unsigned>(options.generate / 2));
+        
+        int pieces = 0;
+        const uint64_t allocationsBefore = threadAllocationCount();
+        const auto requestStart = std::chrono::steady_clock::now();
+        wrapper.generateStream(prompt, [&](const std::string&) {
+            pieces++;
+            if (cancel && pieces == cancelAfter) {
+                wrapper.cancelGeneration();
+            }
+        }, reconfigure ? &requestConfig : nullptr);
+        const double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - requestStart).count();
+        windowAllocations += threadAllocationCount() - allocationsBefore;
+        
+        const std::string error = wrapper.getLastError();
+        if (!error.empty()) {
+            if (failedRequests++ == 0) {
+                fprintf(stderr, "Request %d failed: %s\n", request, error.c_str());
+            }
+            continue;
+        }
+        latencies.push_back(ms);
+        perToken.push_back(ms / std::max(1, pieces));
+        current.cancelled += cancel && pieces >= cancelAfter ? 1 : 0;
+        
+        if (request % options.window == 0 || request == options.requests) {
+            ProcessMemory memory;
+            readProcessMemory(memory);
+            const int windowRequests = static_cast<int>(latencies.size());
+            current.requests = request;
+            current.elapsedS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            current.rssMiB = memory.rssBytes / MIB;
+            current.heapInUseMiB = memory.allocatorInUseBytes / MIB;
+            current.heapMappedMiB = memory.allocatorMappedBytes / MIB;
+            current.p50Ms = percentile(latencies, 0.50);
+            current.p90Ms = percentile(latencies, 0.90);
+            current.p99Ms = percentile(latencies, 0.99);
+            current.msPerToken = percentile(perToken, 0.50);
+            current.allocsPerRequest = windowRequests > 0 ? static_cast<double>(windowAllocations) / windowRequests : 0.0;
+            
+            fprintf(stderr, "%8d %8.1f %9.1f %9.1f %9.1f %8.2f %8.2f %8.2f %8.3f %9.1f %6d %9.1f\n",
+                    current.requests, current.elapsedS, current.rssMiB, current.heapInUseMiB,
+                    current.heapMappedMiB, current.p50Ms, current.p90Ms, current.p99Ms, current.msPerToken,
+                    current.allocsPerRequest, current.cancelled, current.reloadMs);
+            windows.push_back(current);
+            current = WindowSample();
+            latencies.clear();
+            perToken.clear();
+            windowAllocations = 0;
+        }
+    }
+    
+    std::vector<Drift> drifts = {
+        fitDrift("rss", " MiB", windows, &WindowSample::rssMiB, options.maxRssDriftMiB, false),
+        fitDrift("heap_in_use", " MiB", windows, &WindowSample::heapInUseMiB, options.maxHeapDriftMiB, false),
+        fitDrift("p50_latency", "", windows, &WindowSample::p50Ms, options.maxLatencyDrift, true),
+    };
+    if (allocationHookEnabled()) {
+        drifts.push_back(fitDrift("allocs_per_request", "", windows, &WindowSample::allocsPerRequest,
+                                  options.maxAllocDrift, false));
+    }
+    
+    bool passed = failedRequests == 0;
+    fprintf(stderr, "\n");
+    for (const Drift& drift : drifts) {
+        fprintf(stderr, "%-18s %10.3f -> %10.3f  %s %+.3f%s (limit %.3f)%s\n", drift.name, drift.start, drift.end,
+                drift.ratio ? "ratio" : "drift", drift.change, drift.unit, drift.limit,
+                drift.exceeded() ? "  EXCEEDED" : "");
+        passed = passed && !drift.exceeded();
+    }
+    if (failedRequests > 0) {
+        fprintf(stderr, "%d of %d requests failed\n", failedRequests, options.requests);
+    }
+    fprintf(stderr, "%s\n", passed ? "PASS" : "FAIL");
+    
+    if (!options.jsonPath.empty()) {
+        FILE* out = fopen(options.jsonPath.c_str(), "w");
+        if (out == nullptr) {
+            fprintf(stderr, "Cannot write %s: %s\n", options.jsonPath.c_str(), strerror(errno));
+            return 1;
+        }
+        fputs(toJson(options, windows, drifts, failedRequests, passed).c_str(), out);
+        fclose(out);
+    }
+    
+    flushLog();
+    return passed ? 0 : 1;
+}
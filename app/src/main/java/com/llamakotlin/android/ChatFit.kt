@@ -0,0 +1,18 @@
+package com.llamakotlin.android
+
+/**
+ * How a conversation was fitted into the context.
+ *
+ * @property promptTokens Tokens in the fitted prompt
+ * @property keptMessages Indices of the messages in the prompt, ascending
+ * @property truncatedTokens Tokens cut from inside messages ([ContextFitPolicy.MIDDLE_OUT])
+ * @property cachedMessages Messages whose tokens were reused from an earlier request
+ * @property tokenizedMessages Messages tokenised for this request
+ */
+data class ChatFit(
+    val promptTokens: Int,
+    val keptMessages: List<Int>,
+    val truncatedTokens: Int,
+    val cachedMessages: Int,
+    val tokenizedMessages: Int
+)
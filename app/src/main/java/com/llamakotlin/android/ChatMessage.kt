@@ -0,0 +1,18 @@
+package com.llamakotlin.android
+
+/**
+ * One message of a chat conversation.
+ *
+ * @property role "system", "user" or "assistant"
+ * @property content Message text
+ */
+data class ChatMessage(
+    val role: String,
+    val content: String
+) {
+    companion object {
+        fun system(content: String) = ChatMessage("system", content)
+        fun user(content: String) = ChatMessage("user", content)
+        fun assistant(content: String) = ChatMessage("assistant", content)
+    }
+}
@@ -0,0 +1,26 @@
+package com.llamakotlin.android
+
+/**
+ * How a conversation that is longer than the context is shortened.
+ *
+ * A turn is a user message together with the messages that answer it. The
+ * system messages at the start and the last turn are always kept.
+ * Order must match the native ContextFitPolicy enum.
+ */
+enum class ContextFitPolicy {
+    /** Keep everything; generation fails if the conversation does not fit. */
+    NONE,
+
+    /** Drop the oldest turns until the conversation fits. */
+    DROP_OLDEST,
+
+    /**
+     * Drop turns from the middle, keeping the start and the end of the
+     * conversation; if that is not enough, cut tokens from the middle of
+     * the longest messages.
+     */
+    MIDDLE_OUT,
+
+    /** Keep only the most recent turns, then drop the oldest of those if needed. */
+    SYSTEM_AND_LAST_TURNS
+}
@@ -0,0 +1,15 @@
+package com.llamakotlin.android
+
+import java.io.File
+
+/**
+ * A control vector combined into a steering set by [LlamaModel.createControlVectorSet].
+ *
+ * @property file GGUF file with one direction per layer, as written by llama.cpp's
+ *           cvector-generator for the same model
+ * @property scale Strength; negative values steer away from the direction
+ */
+data class ControlVector(
+    val file: File,
+    val scale: Float = 1.0f
+)
@@ -0,0 +1,19 @@
+package com.llamakotlin.android
+
+/**
+ * How [LlamaModel.embed] reduces the model's per-token outputs to one vector.
+ *
+ * Only models without pooling of their own (chat and other generation
+ * models) have per-token outputs; embedding models always use their own
+ * pooling. Order must match the native EmbeddingPooling enum.
+ */
+enum class EmbeddingPooling {
+    /** The model's pooling, or [MEAN] if it has none. */
+    DEFAULT,
+
+    /** Average over every token of the text. */
+    MEAN,
+
+    /** Output of the last token, which has attended to the whole text. */
+    LAST
+}
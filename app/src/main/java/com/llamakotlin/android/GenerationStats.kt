@@ -0,0 +1,43 @@
+package com.llamakotlin.android
+
+/**
+ * Cost of a generation: prompt evaluation, then the decode phase
+ * (everything after the prompt).
+ *
+ * @property tokens Tokens emitted
+ * @property paced Whether [LlamaConfig.pacedTokensPerSecond] was in effect
+ * @property wallMs Decode duration in milliseconds, including pacing sleeps
+ * @property cpuMs CPU time of the whole process while decoding, all threads
+ * @property sleptMs Time spent waiting for the reader to catch up
+ * @property promptTokens Prompt tokens evaluated; a prefix shared with the
+ *           previous request is reused and not counted
+ * @property prefillMs Time to evaluate them
+ */
+data class GenerationStats(
+    val tokens: Int,
+    val paced: Boolean,
+    val wallMs: Double,
+    val cpuMs: Double,
+    val sleptMs: Double,
+    val promptTokens: Int = 0,
+    val prefillMs: Double = 0.0
+) {
+    /**
+     * CPU milliseconds per emitted token; compare paced and unpaced runs
+     * of the same prompt to see the efficiency gain.
+     */
+    val cpuMsPerToken: Double
+        get() = if (tokens > 0) cpuMs / tokens else 0.0
+
+    /**
+     * Achieved output rate.
+     */
+    val tokensPerSecond: Double
+        get() = if (wallMs > 0.0) tokens * 1000.0 / wallMs else 0.0
+
+    /**
+     * Prompt evaluation rate.
+     */
+    val prefillTokensPerSecond: Double
+        get() = if (prefillMs > 0.0) promptTokens * 1000.0 / prefillMs else 0.0
+}
@@ -0,0 +1,16 @@
+package com.llamakotlin.android
+
+/**
+ * A chunk found by [LlamaModel.searchIndex].
+ *
+ * @property path Document file
+ * @property byteOffset Start of the chunk text in the file
+ * @property byteLength Length of the chunk text in bytes
+ * @property score Cosine similarity with the query
+ */
+data class IndexHit(
+    val path: String,
+    val byteOffset: Long,
+    val byteLength: Long,
+    val score: Float
+)
@@ -0,0 +1,28 @@
+package com.llamakotlin.android
+
+/**
+ * Counters of a document ingestion.
+ *
+ * @property files Documents processed
+ * @property unchangedFiles Documents skipped because their size and modification time were unchanged
+ * @property failedFiles Documents that could not be read
+ * @property removedFiles Documents pruned from the index
+ * @property chunks Chunks of the documents that were read
+ * @property embeddedChunks Chunks that were new or changed and were embedded
+ * @property reusedChunks Chunks whose stored vector was kept
+ * @property tokens Tokens read
+ * @property decodes Embedding decode calls
+ * @property elapsedMs Wall time of the ingestion
+ */
+data class IngestStats(
+    val files: Int,
+    val unchangedFiles: Int,
+    val failedFiles: Int,
+    val removedFiles: Int,
+    val chunks: Int,
+    val embeddedChunks: Int,
+    val reusedChunks: Int,
+    val tokens: Long,
+    val decodes: Int,
+    val elapsedMs: Long
+)
@@ -0,0 +1,21 @@
+package com.llamakotlin.android
+
+/**
+ * Element type of the KV cache.
+ *
+ * The KV cache grows with [LlamaConfig.contextSize] and is often the
+ * largest allocation after the weights. Quantised types trade a little
+ * accuracy for memory; a quantised cache needs flash attention, which
+ * llama.cpp enables where the backend supports it.
+ * Order must match the native KvCacheType enum.
+ */
+enum class KvCacheType {
+    /** 16-bit floats. Default. */
+    F16,
+
+    /** 8-bit blocks, about half the memory of [F16]. */
+    Q8_0,
+
+    /** 4-bit blocks, about a quarter of the memory of [F16]. */
+    Q4_0
+}
@@ -0,0 +1,136 @@
+package com.llamakotlin.android
+
+import com.llamakotlin.android.exception.LlamaException
+import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.channels.awaitClose
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.callbackFlow
+import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.isActive
+import kotlinx.coroutines.withContext
+
+/**
+ * Small/large model cascade with confidence-based escalation.
+ *
+ * The small model answers first. While it generates, the confidence of each
+ * token is checked against [threshold]; when it stays low for [patience]
+ * tokens, the large model takes over mid-stream by prefilling the prompt plus
+ * the text accepted so far. Most prompts finish on the small model, so average
+ * latency and energy drop while quality stays close to the large model.
+ *
+ * Both models stay owned by the caller and must remain open while the
+ * cascade is in use.
+ *
+ * Example:
+ * ```kotlin
+ * val cascade = LlamaCascade(smallModel, largeModel, threshold = -2.5f)
+ * cascade.generateStream(prompt).collect { token -> print(token) }
+ * ```
+ *
+ * @param small Fast model that generates first
+ * @param large Model used after escalation
+ * @param metric Confidence signal to monitor
+ * @param threshold Log-probability floor (for [Metric.LOG_PROB]) or entropy
+ *        ceiling (for [Metric.ENTROPY]), in nats
+ * @param patience Consecutive low-confidence tokens required to escalate
+ */
+class LlamaCascade(
+    private val small: LlamaModel,
+    private val large: LlamaModel,
+    val metric: Metric = Metric.LOG_PROB,
+    val threshold: Float = -2.5f,
+    val patience: Int = 1
+) {
+
+    /**
+     * Confidence signal used to decide when to escalate.
+     */
+    enum class Metric(internal val nativeValue: Int) {
+        /** Escalate when the sampled token's log-probability drops below the threshold. */
+        LOG_PROB(0),
+
+        /** Escalate when the next-token entropy rises above the threshold. */
+        ENTROPY(1)
+    }
+
+    /**
+     * Whether the last generation escalated to the large model.
+     */
+    @Volatile
+    var lastEscalated: Boolean = false
+        private set
+
+    init {
+        require(small !== large) { "Cascade needs two different models" }
+        require(patience >= 1) { "patience must be at least 1" }
+    }
+
+    /**
+     * Generate a streaming response through the cascade.
+     *
+     * @param prompt The input text prompt
+     * @param configOverride Optional configuration override applied to both models
+     * @return Flow of generated tokens
+     */
+    fun generateStream(
+        prompt: String,
+        configOverride: LlamaConfig? = null
+    ): Flow<String> = callbackFlow {
+        small.ensureNotClosed()
+        large.ensureNotClosed()
+        small.ensureModelLoaded()
+        large.ensureModelLoaded()
+
+        val nativeConfig = configOverride?.let {
+            it.validate()
+            LlamaNative.NativeConfig.fromLlamaConfig(it)
+        }
+
+        val callback = object : LlamaNative.NativeTokenCallback {
+            override fun onToken(token: String) {
+                if (isActive) {
+                    trySend(token)
+                }
+            }
+        }
+
+        try {
+            withContext(Dispatchers.Default) {
+                lastEscalated = LlamaNative.nativeGenerateCascadeStream(
+                    small.nativeHandle,
+                    large.nativeHandle,
+                    prompt,
+                    callback,
+                    metric.nativeValue,
+                    threshold,
+                    patience,
+                    nativeConfig
+                )
+            }
+        } catch (e: Exception) {
+            when (e) {
+                is LlamaException -> throw e
+                is CancellationException -> {
+                    cancelGeneration()
+                    throw e
+                }
+                else -> throw LlamaException.GenerationError(e.message ?: "Unknown error", e)
+            }
+        }
+
+        close()
+
+        awaitClose {
+            cancelGeneration()
+        }
+    }.flowOn(Dispatchers.Default)
+
+    /**
+     * Cancel an ongoing cascade generation on whichever model is active.
+     */
+    fun cancelGeneration() {
+        small.cancelGeneration()
+        large.cancelGeneration()
+    }
+}
@@ -87,18 +87,51 @@ data class LlamaConfig(
 
     /**
      * Frequency penalty.
-     * Penalizes tokens based on frequency in the generated text.
+     * Subtracted from a token's logit once for every time it occurs
+     * in the last [penaltyWindow] generated tokens.
      * Default: 0.0
      */
     var frequencyPenalty: Float = 0.0f,
 
     /**
      * Presence penalty.
-     * Penalizes tokens that have appeared in the generated text.
+     * Subtracted from a token's logit if it occurs in the last
+     * [penaltyWindow] generated tokens.
      * Default: 0.0
      */
     var presencePenalty: Float = 0.0f,
 
+    /**
+     * Number of generated tokens the penalties look back over.
+     * Set to 0 to disable all penalties, -1 to use the whole context.
+     * Counts are updated as tokens enter and leave the window, so long
+     * windows cost no more per token than short ones.
+     * Default: 64
+     */
+    var penaltyWindow: Int = 64,
+
+    /**
+     * DRY ("don't repeat yourself") multiplier.
+     * Penalizes a token that would extend a sequence already present in
+     * the window by dryMultiplier * dryBase^(length - dryAllowedLength),
+     * which breaks loops of repeated phrases without penalizing common
+     * single tokens. Typical value: 0.8. Set to 0 to disable.
+     * Default: 0.0
+     */
+    var dryMultiplier: Float = 0.0f,
+
+    /**
+     * Growth of the DRY penalty with the length of the repeat.
+     * Default: 1.75
+     */
+    var dryBase: Float = 1.75f,
+
+    /**
+     * Longest repeated sequence that DRY leaves unpenalized.
+     * Default: 2
+     */
+    var dryAllowedLength: Int = 2,
+
     // ========================================================================
     // Generation Limits
     // ========================================================================
@@ -134,6 +167,13 @@ data class LlamaConfig(
      */
     var useMlock: Boolean = false,
 
+    /**
+     * Element type of the KV cache. [KvCacheType.Q8_0] roughly halves its
+     * memory at a small quality cost.
+     * Default: F16
+     */
+    var kvCacheType: KvCacheType = KvCacheType.F16,
+
     // ========================================================================
     // GPU Options
     // ========================================================================
@@ -155,7 +195,93 @@ data class LlamaConfig(
      * Set to -1 for random seed.
      * Default: -1
      */
-    var seed: Int = -1
+    var seed: Int = -1,
+
+    // ========================================================================
+    // Process Isolation
+    // ========================================================================
+
+    /**
+     * Run inference in a separate helper process.
+     * A native crash or OOM kill inside llama.cpp then only takes down the
+     * helper, and the failure surfaces as a [LlamaException.GenerationError].
+     * Tokens stream back through shared memory at negligible cost.
+     * Default: false
+     */
+    var outOfProcess: Boolean = false,
+
+    // ========================================================================
+    // Concurrency
+    // ========================================================================
+
+    /**
+     * Number of requests decoded together in one batch when the model is
+     * shared through [LlamaServer]. The context window is shared by all of
+     * them. Takes effect at load time.
+     * Default: 1
+     */
+    var parallelSequences: Int = 1,
+
+    // ========================================================================
+    // Speculative Decoding
+    // ========================================================================
+
+    /**
+     * Number of draft branches verified per forward pass (0 = off).
+     * Drafts are continuations of earlier occurrences of the last few
+     * tokens in the prompt and output, so this pays off for summarisation,
+     * extraction, code editing and other tasks that repeat their input.
+     * The output is identical to plain decoding. Takes effect at load time.
+     * See [LlamaModel.speculationStats] for the acceptance achieved.
+     * Default: 0
+     */
+    var speculativeBranches: Int = 0,
+
+    /**
+     * Maximum draft tokens per branch.
+     * Default: 4
+     */
+    var speculativeDepth: Int = 4,
+
+    // ========================================================================
+    // Paced Generation
+    // ========================================================================
+
+    /**
+     * Target output rate in tokens per second (0 = as fast as possible).
+     * People read at roughly 5-10 tokens/s; decoding faster only to sit
+     * idle afterwards heats the device up for nothing. When set, tokens are
+     * decoded in short bursts on fewer threads and decoding sleeps once
+     * [pacedLeadTokens] are buffered ahead of the reader.
+     * See [LlamaModel.generationStats] for the CPU time saved.
+     * Default: 0
+     */
+    var pacedTokensPerSecond: Float = 0.0f,
+
+    /**
+     * Tokens decoded ahead of a reader consuming at [pacedTokensPerSecond].
+     * Default: 8
+     */
+    var pacedLeadTokens: Int = 8,
+
+    /**
+     * Decode threads while paced (0 = half of [threads]).
+     * Default: 0
+     */
+    var pacedThreads: Int = 0,
+
+    // ========================================================================
+    // Steering
+    // ========================================================================
+
+    /**
+     * Control vector set that steers the response (0 = none), from
+     * [LlamaModel.createControlVectorSet]. Steers tone or persona without
+     * spending prompt tokens on instructions; selecting a different set
+     * than the previous request clears the prompt cache.
+     * Default: 0
+     */
+    var controlVectorSet: Int = 0
 ) {
     /**
      * Builder companion for DSL-style configuration.
@@ -245,6 +371,39 @@ data class LlamaConfig(
         if (gpuLayers < 0) {
             throw LlamaException.InvalidConfig("gpuLayers must be non-negative")
         }
+        if (penaltyWindow < -1) {
+            throw LlamaException.InvalidConfig("penaltyWindow must be -1, 0 or positive")
+        }
+        if (dryMultiplier < 0.0f) {
+            throw LlamaException.InvalidConfig("dryMultiplier must be non-negative")
+        }
+        if (dryBase < 1.0f) {
+            throw LlamaException.InvalidConfig("dryBase must be at least 1.0")
+        }
+        if (dryAllowedLength < 1) {
+            throw LlamaException.InvalidConfig("dryAllowedLength must be at least 1")
+        }
+        if (parallelSequences < 1 || parallelSequences > 64) {
+            throw LlamaException.InvalidConfig("parallelSequences must be between 1 and 64")
+        }
+        if (speculativeBranches < 0 || speculativeBranches > 16) {
+            throw LlamaException.InvalidConfig("speculativeBranches must be between 0 and 16")
+        }
+        if (speculativeDepth < 1 || speculativeDepth > 16) {
+            throw LlamaException.InvalidConfig("speculativeDepth must be between 1 and 16")
+        }
+        if (pacedTokensPerSecond < 0.0f) {
+            throw LlamaException.InvalidConfig("pacedTokensPerSecond must be non-negative")
+        }
+        if (pacedLeadTokens < 1) {
+            throw LlamaException.InvalidConfig("pacedLeadTokens must be at least 1")
+        }
+        if (pacedThreads < 0) {
+            throw LlamaException.InvalidConfig("pacedThreads must be non-negative")
+        }
+        if (controlVectorSet < 0) {
+            throw LlamaException.InvalidConfig("controlVectorSet must be non-negative")
+        }
     }
 
     /**
@@ -0,0 +1,96 @@
+package com.llamakotlin.android
+
+/**
+ * Native log settings.
+ *
+ * Messages below [minLevel] are compiled out of the native library
+ * (release builds keep INFO and above); the runtime [level] can raise the
+ * threshold further or lower it down to [minLevel] while diagnosing an
+ * issue. llama.cpp's own output appears in logcat under the "llama.cpp" tag.
+ *
+ * Settings made before the inference engine is loaded are kept and applied
+ * when it loads, so configuring logging at app start does not load it.
+ *
+ * ```kotlin
+ * LlamaLog.level = LlamaLog.Level.WARN   // Quiet in production
+ * LlamaLog.rateLimit = 0                 // Keep every message while debugging
+ * ```
+ */
+object LlamaLog {
+    /**
+     * Log levels. Order must match the native LLAMA_LOG_LEVEL_* values.
+     */
+    enum class Level {
+        DEBUG,
+        INFO,
+        WARN,
+        ERROR,
+        NONE
+    }
+
+    /**
+     * Lowest level compiled into the native library.
+     */
+    val minLevel: Level
+        get() = Level.entries[LlamaNative.nativeGetMinLogLevel()]
+
+    /**
+     * Level set before the engine was loaded.
+     */
+    private var pendingLevel: Level? = null
+
+    /**
+     * Runtime level; messages below it are skipped before formatting.
+     * Default: [minLevel]
+     */
+    var level: Level
+        get() = synchronized(LlamaNative) {
+            if (LlamaNative.engineLoaded) {
+                Level.entries[LlamaNative.nativeGetLogLevel().coerceIn(0, Level.entries.size - 1)]
+            } else {
+                pendingLevel ?: minLevel
+            }
+        }
+        set(value) = synchronized(LlamaNative) {
+            if (LlamaNative.engineLoaded) {
+                LlamaNative.nativeSetLogLevel(value.ordinal)
+            } else {
+                pendingLevel = value
+            }
+        }
+
+    /**
+     * Messages per second from one native call site before further ones are
+     * suppressed and counted (0 = unlimited). Errors are never suppressed.
+     * Default: 50
+     */
+    var rateLimit: Int = 50
+        set(value) {
+            require(value >= 0) { "rateLimit must be non-negative" }
+            synchronized(LlamaNative) {
+                field = value
+                if (LlamaNative.engineLoaded) {
+                    LlamaNative.nativeSetLogRateLimit(value)
+                }
+            }
+        }
+
+    /**
+     * Write every queued native log message, e.g. before reporting a failure.
+     */
+    fun flush() {
+        if (LlamaNative.engineLoaded) {
+            LlamaNative.nativeFlushLog()
+        }
+    }
+
+    /**
+     * Apply the settings made before the engine was loaded. Called by
+     * [LlamaNative.ensureEngineLoaded] with the LlamaNative lock held.
+     */
+    internal fun applyPendingSettings() {
+        pendingLevel?.let { LlamaNative.nativeSetLogLevel(it.ordinal) }
+        pendingLevel = null
+        LlamaNative.nativeSetLogRateLimit(rateLimit)
+    }
+}
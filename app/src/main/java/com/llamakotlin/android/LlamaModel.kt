@@ -11,6 +11,7 @@ import kotlinx.coroutines.isActive
 import kotlinx.coroutines.withContext
 import java.io.Closeable
 import java.io.File
+import java.io.IOException
 import java.util.concurrent.atomic.AtomicBoolean
 import java.util.concurrent.atomic.AtomicLong
 
@@ -63,15 +64,15 @@ import java.util.concurrent.atomic.AtomicLong
  * @see LlamaException for error handling
  */
 class LlamaModel private constructor(
-    private val nativeHandle: Long,
-    private val _config: LlamaConfig
+    internal val nativeHandle: Long,
+    @Volatile private var _config: LlamaConfig
 ) : Closeable {
 
     private val isClosed = AtomicBoolean(false)
     private val isGeneratingFlag = AtomicBoolean(false)
 
     /**
-     * Configuration used to load this model.
+     * Configuration used to load the current model.
      */
     val config: LlamaConfig
         get() = _config.copy()
@@ -91,6 +92,67 @@ class LlamaModel private constructor(
     val isGenerating: Boolean
         get() = isGeneratingFlag.get() || LlamaNative.nativeIsGenerating(nativeHandle)
 
+    /**
+     * Tree speculation counters of the last generation.
+     * All zero unless [LlamaConfig.speculativeBranches] is set.
+     */
+    val speculationStats: SpeculationStats
+        get() {
+            ensureNotClosed()
+            val values = LlamaNative.nativeGetSpeculationStats(nativeHandle)
+            return SpeculationStats(
+                forwardPasses = values[0],
+                draftedTokens = values[1],
+                acceptedTokens = values[2],
+                generatedTokens = values[3]
+            )
+        }
+
+    /**
+     * Prompt evaluation time and decode cost of the last generation, for
+     * comparing runs with and without [LlamaConfig.pacedTokensPerSecond].
+     * All zero when running out of process.
+     */
+    val generationStats: GenerationStats
+        get() {
+            ensureNotClosed()
+            val values = LlamaNative.nativeGetGenerationStats(nativeHandle)
+            return GenerationStats(
+                tokens = values[0].toInt(),
+                paced = values[1] != 0.0,
+                wallMs = values[2],
+                cpuMs = values[3],
+                sleptMs = values[4],
+                promptTokens = values[5].toInt(),
+                prefillMs = values[6]
+            )
+        }
+
+    /**
+     * Where the native memory of this model goes: weights (and how much of
+     * the mapped file is in RAM), KV cache, compute buffers, heap and
+     * process RSS. Also logged after loading and after each generation.
+     */
+    val memoryStats: MemoryStats
+        get() {
+            ensureNotClosed()
+            val values = LlamaNative.nativeGetMemoryStats(nativeHandle)
+            return MemoryStats(
+                modelBytes = values[0],
+                modelMappedBytes = values[1],
+                modelResidentBytes = values[2],
+                kvCacheBytes = values[3],
+                computeBufferBytes = values[4],
+                outputBufferBytes = values[5],
+                allocatorInUseBytes = values[6],
+                allocatorMappedBytes = values[7],
+                allocatorPeakBytes = values[8],
+                rssBytes = values[9],
+                peakRssBytes = values[10],
+                sequenceCells = values.drop(11).map { it.toInt() }
+            )
+        }
+
     /**
      * Generate a complete response for the given prompt.
      *
@@ -228,6 +290,471 @@ class LlamaModel private constructor(
         }
     }.flowOn(Dispatchers.Default)
 
+    /**
+     * Generate a streaming response through the model's priority scheduler.
+     *
+     * Unlike the plain [generateStream], prioritised requests do not wait
+     * for each other to finish: up to [LlamaConfig.parallelSequences] of
+     * them decode together, higher classes are admitted first, and a
+     * [RequestPriority.FOREGROUND] request swaps out a running
+     * [RequestPriority.BACKGROUND] one when no sequence or KV space is free.
+     * The swapped-out request resumes where it stopped once there is room.
+     *
+     * Use either this or the plain generation functions on a model, not
+     * both at the same time. Cancel a request by cancelling its collector.
+     *
+     * Example:
+     * ```kotlin
+     * val model = LlamaModel.load(path) { parallelSequences = 2 }
+     * launch { model.generateStream(document, RequestPriority.BACKGROUND).collect { summary += it } }
+     * model.generateStream(question, RequestPriority.FOREGROUND).collect { print(it) }
+     * ```
+     *
+     * @param prompt The input text prompt
+     * @param priority Scheduling class
+     * @param configOverride Optional configuration override (defaults to [config])
+     * @return Flow of generated tokens
+     */
+    fun generateStream(
+        prompt: String,
+        priority: RequestPriority,
+        configOverride: LlamaConfig? = null
+    ): Flow<String> = callbackFlow {
+        ensureNotClosed()
+        ensureModelLoaded()
+
+        val effectiveConfig = configOverride ?: _config
+        effectiveConfig.validate()
+        val nativeConfig = LlamaNative.NativeConfig.fromLlamaConfig(effectiveConfig)
+
+        val callback = object : LlamaNative.NativeScheduledCallback {
+            override fun onToken(token: String) {
+                if (isActive) {
+                    trySend(token)
+                }
+            }
+
+            override fun isCancelled(): Boolean = !isActive
+        }
+
+        try {
+            withContext(Dispatchers.Default) {
+                LlamaNative.nativeGenerateScheduledStream(
+                    nativeHandle,
+                    prompt,
+                    priority.ordinal,
+                    callback,
+                    nativeConfig
+                )
+            }
+        } catch (e: Exception) {
+            when (e) {
+                is LlamaException -> throw e
+                is CancellationException -> throw e
+                else -> throw LlamaException.GenerationError(e.message ?: "Unknown error", e)
+            }
+        }
+
+        close()
+        awaitClose()
+    }.flowOn(Dispatchers.Default)
+
+    /**
+     * Tokenise a conversation with the model's chat template and shorten it to fit the context.
+     *
+     * Each message is tokenised once and cached, so calling this (or
+     * [generateChatStream]) again with the conversation grown by a message
+     * only tokenises the new one. Turns are dropped whole, so the prompt
+     * never starts in the middle of an exchange.
+     *
+     * @param messages Conversation, ending with the message to answer
+     * @param policy How to shorten the conversation
+     * @param keepLastTurns Turns kept by [ContextFitPolicy.SYSTEM_AND_LAST_TURNS]
+     * @param reserveTokens Context left for the response; -1 uses [LlamaConfig.maxTokens]
+     *   (at most half the context)
+     * @param configOverride Optional configuration override (for its maxTokens)
+     * @return What was kept
+     * @throws LlamaException.GenerationError if even the shortened conversation does not fit
+     */
+    suspend fun fitChat(
+        messages: List<ChatMessage>,
+        policy: ContextFitPolicy = ContextFitPolicy.DROP_OLDEST,
+        keepLastTurns: Int = 8,
+        reserveTokens: Int = -1,
+        configOverride: LlamaConfig? = null
+    ): ChatFit = withContext(Dispatchers.Default) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        require(messages.isNotEmpty()) { "Conversation is empty" }
+
+        val nativeConfig = configOverride?.let {
+            it.validate()
+            LlamaNative.NativeConfig.fromLlamaConfig(it)
+        }
+
+        val values = LlamaNative.nativeFitChat(
+            nativeHandle,
+            messages.map { it.role }.toTypedArray(),
+            messages.map { it.content }.toTypedArray(),
+            policy.ordinal,
+            keepLastTurns,
+            reserveTokens,
+            nativeConfig
+        )
+        ChatFit(
+            promptTokens = values[0],
+            keptMessages = values.drop(4),
+            truncatedTokens = values[1],
+            cachedMessages = values[2],
+            tokenizedMessages = values[3]
+        )
+    }
+
+    /**
+     * Generate a streaming chat reply, shortening the conversation to fit the context.
+     *
+     * The conversation is rendered with the model's chat template and
+     * tokenised message by message; the policy then works on the token
+     * arrays, so the history is never trimmed as text and tokenised again.
+     * See [fitChat] for what is kept.
+     *
+     * Example:
+     * ```kotlin
+     * history += ChatMessage.user(question)
+     * val reply = StringBuilder()
+     * model.generateChatStream(history, ContextFitPolicy.SYSTEM_AND_LAST_TURNS, keepLastTurns = 6)
+     *     .collect { token -> reply.append(token) }
+     * history += ChatMessage.assistant(reply.toString())
+     * ```
+     *
+     * @param messages Conversation, ending with the message to answer
+     * @param policy How to shorten the conversation
+     * @param keepLastTurns Turns kept by [ContextFitPolicy.SYSTEM_AND_LAST_TURNS]
+     * @param reserveTokens Context left for the response; -1 uses [LlamaConfig.maxTokens]
+     *   (at most half the context)
+     * @param configOverride Optional configuration override for this generation
+     * @return Flow of generated tokens
+     */
+    fun generateChatStream(
+        messages: List<ChatMessage>,
+        policy: ContextFitPolicy = ContextFitPolicy.DROP_OLDEST,
+        keepLastTurns: Int = 8,
+        reserveTokens: Int = -1,
+        configOverride: LlamaConfig? = null
+    ): Flow<String> = callbackFlow {
+        ensureNotClosed()
+        ensureModelLoaded()
+        require(messages.isNotEmpty()) { "Conversation is empty" }
+
+        if (isGeneratingFlag.getAndSet(true)) {
+            throw LlamaException.GenerationError("Generation already in progress")
+        }
+
+        val nativeConfig = configOverride?.let {
+            it.validate()
+            LlamaNative.NativeConfig.fromLlamaConfig(it)
+        }
+
+        val callback = object : LlamaNative.NativeTokenCallback {
+            override fun onToken(token: String) {
+                if (isActive) {
+                    trySend(token)
+                }
+            }
+        }
+
+        try {
+            withContext(Dispatchers.Default) {
+                LlamaNative.nativeGenerateChatStream(
+                    nativeHandle,
+                    messages.map { it.role }.toTypedArray(),
+                    messages.map { it.content }.toTypedArray(),
+                    policy.ordinal,
+                    keepLastTurns,
+                    reserveTokens,
+                    callback,
+                    nativeConfig
+                )
+            }
+        } catch (e: Exception) {
+            when (e) {
+                is LlamaException -> throw e
+                is CancellationException -> {
+                    LlamaNative.nativeCancelGeneration(nativeHandle)
+                    throw e
+                }
+                else -> throw LlamaException.GenerationError(e.message ?: "Unknown error", e)
+            }
+        } finally {
+            isGeneratingFlag.set(false)
+        }
+
+        close()
+
+        awaitClose {
+            if (isGeneratingFlag.get()) {
+                LlamaNative.nativeCancelGeneration(nativeHandle)
+                isGeneratingFlag.set(false)
+            }
+        }
+    }.flowOn(Dispatchers.Default)
+
+    /**
+     * Add documents to an on-disk embedding index, or bring them up to date.
+     *
+     * Files are read in blocks and split into chunks of up to [chunkTokens]
+     * tokens with the model's tokenizer; each chunk is embedded together
+     * with the last [overlapTokens] of the one before it. Chunk boundaries
+     * depend on the text around them rather than on their position, so
+     * after an edit only the chunks near the change are embedded again;
+     * files whose size and modification time are unchanged are skipped
+     * without being read. Chunks are embedded in large batches, one
+     * sequence each (set [LlamaConfig.parallelSequences] to batch more
+     * chunks per decode), and their vectors go straight to the index.
+     *
+     * Embedding clears the KV cache, so the next generation evaluates its
+     * prompt in full. Fails while [generateStream] with a [RequestPriority]
+     * or [LlamaServer] has started serving requests on the model.
+     *
+     * Example:
+     * ```kotlin
+     * val index = File(context.filesDir, "notes-index")
+     * model.ingestDocuments(index, notesDir.listFiles()!!.toList(), prune = true)
+     * val hits = model.searchIndex(index, "when is the dentist appointment")
+     * ```
+     *
+     * @param indexDir Index directory, created if needed
+     * @param files Documents (UTF-8 text)
+     * @param chunkTokens Longest chunk in tokens; chunks average about 3/4 of this
+     * @param overlapTokens Tokens of the previous chunk embedded with each chunk
+     * @param prune Remove indexed documents that are not in [files]
+     * @param onProgress Called with (filesDone, filesTotal) after each file
+     * @return Counters of the ingestion
+     * @throws LlamaException.GenerationError if the index cannot be written,
+     *         or the model is serving scheduled requests
+     * @throws CancellationException if the coroutine is cancelled
+     */
+    suspend fun ingestDocuments(
+        indexDir: File,
+        files: List<File>,
+        chunkTokens: Int = 256,
+        overlapTokens: Int = 32,
+        prune: Boolean = false,
+        onProgress: ((Int, Int) -> Unit)? = null
+    ): IngestStats = withContext(Dispatchers.IO) {
+        ensureNotClosed()
+        ensureModelLoaded()
+
+        val callback = object : LlamaNative.NativeIngestProgressCallback {
+            override fun onProgress(filesDone: Int, filesTotal: Int): Boolean {
+                onProgress?.invoke(filesDone, filesTotal)
+                return isActive
+            }
+        }
+
+        val values = try {
+            LlamaNative.nativeIngestDocuments(
+                nativeHandle,
+                indexDir.absolutePath,
+                files.map { it.absolutePath }.toTypedArray(),
+                chunkTokens,
+                overlapTokens,
+                prune,
+                callback
+            )
+        } catch (e: LlamaException) {
+            if (!isActive) {
+                throw CancellationException("Ingestion cancelled")
+            }
+            throw e
+        }
+
+        IngestStats(
+            files = values[0].toInt(),
+            unchangedFiles = values[1].toInt(),
+            failedFiles = values[2].toInt(),
+            removedFiles = values[3].toInt(),
+            chunks = values[4].toInt(),
+            embeddedChunks = values[5].toInt(),
+            reusedChunks = values[6].toInt(),
+            tokens = values[7],
+            decodes = values[8].toInt(),
+            elapsedMs = values[9]
+        )
+    }
+
+    /**
+     * Compute embeddings with the loaded model.
+     *
+     * The vectors come from the same weights and context that generate
+     * text, so no second model has to be loaded for retrieval. Embedding
+     * mode is only switched on for these texts; with [LlamaConfig.parallelSequences]
+     * above 1 they run beside the cached prompt, so the next generation can
+     * still reuse it.
+     *
+     * @param texts Texts to embed
+     * @param pooling How per-token outputs become one vector
+     * @return One L2-normalised vector per text
+     * @throws LlamaException.GenerationError if the texts cannot be embedded
+     */
+    suspend fun embed(
+        texts: List<String>,
+        pooling: EmbeddingPooling = EmbeddingPooling.DEFAULT
+    ): List<FloatArray> = withContext(Dispatchers.Default) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        if (texts.isEmpty()) {
+            return@withContext emptyList()
+        }
+
+        val values = LlamaNative.nativeEmbed(nativeHandle, texts.toTypedArray(), pooling.ordinal)
+        val dim = values.size / texts.size
+        List(texts.size) { i -> values.copyOfRange(i * dim, (i + 1) * dim) }
+    }
+
+    /**
+     * Compute the embedding of one text; see [embed].
+     */
+    suspend fun embed(
+        text: String,
+        pooling: EmbeddingPooling = EmbeddingPooling.DEFAULT
+    ): FloatArray = embed(listOf(text), pooling)[0]
+
+    /**
+     * Find the chunks of an index built by [ingestDocuments] that are most similar to a query.
+     *
+     * @param indexDir Index directory
+     * @param query Query text
+     * @param limit Maximum number of hits
+     * @return Hits, most similar first
+     * @throws LlamaException.GenerationError if the model is serving scheduled requests
+     */
+    suspend fun searchIndex(
+        indexDir: File,
+        query: String,
+        limit: Int = 10
+    ): List<IndexHit> = withContext(Dispatchers.IO) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        require(limit > 0) { "limit must be positive" }
+
+        val values = DoubleArray(limit * 3)
+        val paths = LlamaNative.nativeSearchIndex(nativeHandle, indexDir.absolutePath, query, limit, values)
+        paths.mapIndexed { i, path ->
+            IndexHit(
+                path = path,
+                byteOffset = values[i * 3 + 1].toLong(),
+                byteLength = values[i * 3 + 2].toLong(),
+                score = values[i * 3].toFloat()
+            )
+        }
+    }
+
+    /**
+     * Combine control vectors into a steering set for [LlamaConfig.controlVectorSet].
+     *
+     * A control vector shifts the model's hidden state towards a style or
+     * persona, so it replaces style instructions in the prompt at no
+     * prompt-processing cost. The vectors are read, scaled and summed once;
+     * requests then switch between sets by id. Sets belong to the loaded
+     * model and are dropped when another model is loaded or swapped in.
+     *
+     * Example:
+     * ```kotlin
+     * val formal = model.createControlVectorSet(listOf(ControlVector(File(dir, "formal.gguf"), 0.8f)))
+     * model.generateStream(question, LlamaConfig { controlVectorSet = formal }).collect { print(it) }
+     * ```
+     *
+     * @param vectors Control vectors and their strengths
+     * @param layerStart First steered layer (layers count from 1)
+     * @param layerEnd Last steered layer (-1 = the model's last layer)
+     * @return Set id
+     * @throws LlamaException.GenerationError if a file cannot be read or does not match the model
+     */
+    suspend fun createControlVectorSet(
+        vectors: List<ControlVector>,
+        layerStart: Int = 1,
+        layerEnd: Int = -1
+    ): Int = withContext(Dispatchers.IO) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        require(vectors.isNotEmpty()) { "At least one control vector is required" }
+
+        LlamaNative.nativeCreateControlVectorSet(
+            nativeHandle,
+            vectors.map { it.file.absolutePath }.toTypedArray(),
+            vectors.map { it.scale }.toFloatArray(),
+            layerStart,
+            layerEnd
+        )
+    }
+
+    /**
+     * Free a steering set created by [createControlVectorSet].
+     *
+     * @param setId Set id
+     */
+    fun releaseControlVectorSet(setId: Int) {
+        if (!isClosed.get()) {
+            LlamaNative.nativeReleaseControlVectorSet(nativeHandle, setId)
+        }
+    }
+
+    /**
+     * Replace the loaded model with a new one without a service gap.
+     *
+     * The new model is loaded and warmed up on a background thread while the
+     * current model keeps serving. New requests are then routed to the new
+     * model, a generation already in progress finishes on the old one, and the
+     * old model is freed once it has drained. Memory use is only doubled for
+     * the overlap window. A running [LlamaServer] and scheduled generations
+     * keep going: their active requests finish on the old model and queued
+     * ones start on the new one.
+     *
+     * If loading fails, the current model stays active.
+     *
+     * @param modelPath Absolute path to the new .gguf model file
+     * @param config Configuration for the new model
+     * @throws LlamaException.ModelNotFound if the model file doesn't exist
+     * @throws LlamaException.ModelLoadError if loading fails
+     * @throws LlamaException.InvalidConfig if configuration is invalid
+     *
+     * Example:
+     * ```kotlin
+     * model.swapModel("/sdcard/models/llama-3.2-1b-v2.gguf", model.config)
+     * ```
+     */
+    suspend fun swapModel(
+        modelPath: String,
+        config: LlamaConfig = _config
+    ) = withContext(Dispatchers.IO) {
+        ensureNotClosed()
+
+        val file = File(modelPath)
+        if (!file.exists()) {
+            throw LlamaException.ModelNotFound(modelPath)
+        }
+        if (!file.canRead()) {
+            throw LlamaException.ModelLoadError("Cannot read model file: $modelPath")
+        }
+
+        config.validate()
+
+        try {
+            val nativeConfig = LlamaNative.NativeConfig.fromLlamaConfig(config)
+            if (!LlamaNative.nativeSwapModel(nativeHandle, modelPath, nativeConfig)) {
+                val error = LlamaNative.nativeGetLastError(nativeHandle)
+                throw LlamaException.ModelLoadError(error.ifEmpty { "Unknown error" })
+            }
+            _config = config.copy()
+        } catch (e: Exception) {
+            when (e) {
+                is LlamaException -> throw e
+                else -> throw LlamaException.ModelLoadError(e.message ?: "Unknown error", e)
+            }
+        }
+    }
+
     /**
      * Cancel any ongoing generation.
      *
@@ -261,13 +788,13 @@ class LlamaModel private constructor(
         }
     }
 
-    private fun ensureNotClosed() {
+    internal fun ensureNotClosed() {
         if (isClosed.get()) {
             throw LlamaException.ContextClosed()
         }
     }
 
-    private fun ensureModelLoaded() {
+    internal fun ensureModelLoaded() {
         if (!LlamaNative.nativeIsModelLoaded(nativeHandle)) {
             throw LlamaException.ModelNotLoaded()
         }
@@ -279,11 +806,42 @@ class LlamaModel private constructor(
          */
         private val contextCounter = AtomicLong(0)
 
+        /**
+         * A BLAKE3 digest as lowercase hex
+         */
+        private val BLAKE3_HEX = Regex("[0-9a-f]{64}")
+
+        /**
+         * Digest cache of [verifyModel], inside the caller's cache directory
+         */
+        private const val DIGEST_CACHE_FILE = "llama_model_digests"
+
         init {
-            // Ensure native library is loaded
+            // Ensure the JNI shim is loaded; the engine loads with the first model
             LlamaNative.ensureLoaded()
         }
 
+        /**
+         * Load the inference engine (llama.cpp) ahead of the first [load],
+         * for example when the user opens a screen that will run a model.
+         * Until then only a small native shim is loaded, so screens that
+         * never use a model do not pay for the engine's startup or memory.
+         * Safe to call repeatedly and concurrently with [load].
+         *
+         * @throws UnsatisfiedLinkError if the engine library cannot be loaded
+         */
+        @JvmStatic
+        suspend fun preloadEngine() = withContext(Dispatchers.IO) {
+            LlamaNative.ensureEngineLoaded()
+        }
+
+        /**
+         * Whether the inference engine has been loaded by [preloadEngine] or [load].
+         */
+        @JvmStatic
+        val isEngineLoaded: Boolean
+            get() = LlamaNative.engineLoaded
+
         /**
          * Get the library version string.
          *
@@ -292,6 +850,61 @@ class LlamaModel private constructor(
         @JvmStatic
         fun getVersion(): String = LlamaNative.nativeGetVersion()
 
+        /**
+         * Check a model file before loading it, typically after a download.
+         *
+         * The file is hashed with BLAKE3 on all cores (1 MiB runs of the file
+         * are independent subtrees of the hash), and its GGUF header and
+         * tensor table are checked so that a truncated file is reported
+         * even without an expected hash. With [cacheDir], the digest is
+         * recorded under the file's inode, size and modification time, and
+         * an unchanged file is not read again on later calls.
+         *
+         * @param modelPath Path to the model file
+         * @param expectedHash BLAKE3 hash as hex (`b3sum` output), optionally
+         *        prefixed with "blake3:"; empty to only compute the digest
+         * @param cacheDir Directory for the digest cache (e.g. `context.cacheDir`),
+         *        or null to hash on every call
+         * @param threads Hashing threads (0 = one per core)
+         * @return What was found; check [ModelVerification.isValid]
+         * @throws LlamaException.ModelNotFound if the model file doesn't exist
+         * @throws LlamaException.ModelLoadError if the file cannot be read
+         */
+        @JvmStatic
+        suspend fun verifyModel(
+            modelPath: String,
+            expectedHash: String = "",
+            cacheDir: File? = null,
+            threads: Int = 0
+        ): ModelVerification = withContext(Dispatchers.IO) {
+            val expected = expectedHash.trim().lowercase().removePrefix("blake3:")
+            require(expected.isEmpty() || BLAKE3_HEX.matches(expected)) {
+                "expectedHash must be 64 hex digits"
+            }
+            if (!File(modelPath).exists()) {
+                throw LlamaException.ModelNotFound(modelPath)
+            }
+
+            val values = try {
+                LlamaNative.ensureEngineLoaded()
+                LlamaNative.nativeVerifyModel(
+                    modelPath,
+                    cacheDir?.let { File(it, DIGEST_CACHE_FILE).absolutePath } ?: "",
+                    threads
+                )
+            } catch (e: IOException) {
+                throw LlamaException.ModelLoadError("Cannot verify $modelPath: ${e.message}", e)
+            } catch (e: UnsatisfiedLinkError) {
+                throw LlamaException.ModelLoadError("Cannot load the inference engine: ${e.message}", e)
+            }
+
+            ModelVerification(
+                digest = values[0],
+                hashMatches = expected.isEmpty() || values[0] == expected,
+                structureError = values[1].ifEmpty { null }
+            )
+        }
+
         /**
          * Load a GGUF model from the specified path.
          *
@@ -323,7 +936,8 @@ class LlamaModel private constructor(
         /**
          * Load a GGUF model with explicit configuration.
          *
-         * @param modelPath Absolute path to the .gguf model file
+         * @param modelPath Absolute path to the .gguf model file, or to the
+         *        first shard of a split model (see [loadShards])
          * @param config Configuration for model loading
          * @return Loaded [LlamaModel] instance
          */
@@ -332,19 +946,75 @@ class LlamaModel private constructor(
             modelPath: String,
             config: LlamaConfig
         ): LlamaModel = withContext(Dispatchers.IO) {
-            // Validate path
-            val file = File(modelPath)
-            if (!file.exists()) {
-                throw LlamaException.ModelNotFound(modelPath)
+            createModel(listOf(modelPath), config) { handle, nativeConfig ->
+                LlamaNative.nativeLoadModel(handle, modelPath, nativeConfig)
             }
-            if (!file.canRead()) {
-                throw LlamaException.ModelLoadError("Cannot read model file: $modelPath")
+        }
+
+        /**
+         * Load a model split into GGUF shards (`name-00001-of-00004.gguf`, ...).
+         *
+         * The shards are read into memory in parallel, one thread each,
+         * before llama.cpp maps them, so they do not wait on storage one
+         * after another. [load] with the first shard's path does the same;
+         * use this to pass shards under other names or to follow progress.
+         *
+         * @param shardPaths Every shard in order, or only the first one when
+         *        the files keep their standard names
+         * @param config Configuration for model loading
+         * @param onProgress Called on the loading thread with the progress of
+         *        the whole load, from 0 to 1
+         * @return Loaded [LlamaModel] instance
+         * @throws LlamaException.ModelNotFound if a shard doesn't exist
+         * @throws LlamaException.ModelLoadError if loading fails
+         */
+        @JvmStatic
+        suspend fun loadShards(
+            shardPaths: List<String>,
+            config: LlamaConfig = LlamaConfig(),
+            onProgress: ((Float) -> Unit)? = null
+        ): LlamaModel = withContext(Dispatchers.IO) {
+            if (shardPaths.isEmpty()) {
+                throw LlamaException.InvalidConfig("No shard paths given")
+            }
+            val callback = onProgress?.let {
+                object : LlamaNative.NativeLoadProgressCallback {
+                    override fun onProgress(progress: Float) = it(progress)
+                }
+            }
+            createModel(shardPaths, config) { handle, nativeConfig ->
+                LlamaNative.nativeLoadModelShards(handle, shardPaths.toTypedArray(), nativeConfig, callback)
+            }
+        }
+
+        /**
+         * Create a native context and load a model into it with [nativeLoad].
+         */
+        private fun createModel(
+            paths: List<String>,
+            config: LlamaConfig,
+            nativeLoad: (Long, LlamaNative.NativeConfig) -> Boolean
+        ): LlamaModel {
+            // Validate paths
+            for (path in paths) {
+                val file = File(path)
+                if (!file.exists()) {
+                    throw LlamaException.ModelNotFound(path)
+                }
+                if (!file.canRead()) {
+                    throw LlamaException.ModelLoadError("Cannot read model file: $path")
+                }
             }
 
             // Validate config
             config.validate()
 
-            // Create native context
+            // Load the engine on first use, then create the native context
+            try {
+                LlamaNative.ensureEngineLoaded()
+            } catch (e: UnsatisfiedLinkError) {
+                throw LlamaException.ModelLoadError("Cannot load the inference engine: ${e.message}", e)
+            }
             val handle = LlamaNative.nativeCreateContext()
             if (handle == 0L) {
                 throw LlamaException.NativeError(-1, "Failed to create native context")
@@ -355,14 +1025,14 @@ class LlamaModel private constructor(
             try {
                 // Load model
                 val nativeConfig = LlamaNative.NativeConfig.fromLlamaConfig(config)
-                val success = LlamaNative.nativeLoadModel(handle, modelPath, nativeConfig)
+                val success = nativeLoad(handle, nativeConfig)
 
                 if (!success) {
                     val error = LlamaNative.nativeGetLastError(handle)
                     throw LlamaException.ModelLoadError(error.ifEmpty { "Unknown error" })
                 }
 
-                LlamaModel(handle, config)
+                return LlamaModel(handle, config)
             } catch (e: Exception) {
                 // Clean up on failure
                 LlamaNative.nativeDestroyContext(handle)
@@ -375,6 +1045,15 @@ class LlamaModel private constructor(
             }
         }
 
+        /**
+         * Wrap a native context that already has a model loaded, such as one
+         * acquired from a [ModelResidency].
+         */
+        internal fun wrap(handle: Long, config: LlamaConfig): LlamaModel {
+            contextCounter.incrementAndGet()
+            return LlamaModel(handle, config)
+        }
+
         /**
          * Load a model from Android assets or resources.
          *
@@ -10,13 +10,26 @@ import androidx.annotation.Keep
 internal object LlamaNative {
 
     /**
-     * Flag indicating if native library is loaded.
+     * Flag indicating if the JNI shim is loaded.
      */
     @Volatile
     private var isLoaded = false
 
     /**
-     * Load the native library.
+     * Flag indicating if the inference engine is loaded.
+     */
+    @Volatile
+    private var isEngineLoaded = false
+
+    /**
+     * Whether the inference engine is loaded and its methods are usable.
+     */
+    val engineLoaded: Boolean
+        get() = isEngineLoaded
+
+    /**
+     * Load the JNI shim. It is small and only answers version and log
+     * level queries; everything else needs [ensureEngineLoaded].
      * Thread-safe - can be called multiple times safely.
      */
     @Synchronized
@@ -27,12 +40,28 @@ internal object LlamaNative {
         }
     }
 
+    /**
+     * Load the inference engine (llama.cpp and ggml) and bind the methods
+     * below that need it. Takes tens of milliseconds; call it off the main
+     * thread. Thread-safe - can be called multiple times safely.
+     * @throws UnsatisfiedLinkError if the engine library cannot be loaded
+     */
+    @Synchronized
+    fun ensureEngineLoaded() {
+        if (!isEngineLoaded) {
+            ensureLoaded()
+            nativeLoadEngine()
+            isEngineLoaded = true
+            LlamaLog.applyPendingSettings()
+        }
+    }
+
     init {
         ensureLoaded()
     }
 
     // ========================================================================
-    // Version Information
+    // Shim (usable without the engine)
     // ========================================================================
 
     /**
@@ -41,6 +70,46 @@ internal object LlamaNative {
     @JvmStatic
     external fun nativeGetVersion(): String
 
+    /**
+     * Get the lowest level compiled into the native library.
+     */
+    @JvmStatic
+    external fun nativeGetMinLogLevel(): Int
+
+    /**
+     * Load the inference engine library and register its native methods.
+     */
+    @JvmStatic
+    private external fun nativeLoadEngine()
+
+    // ========================================================================
+    // Logging (this and everything below needs the engine)
+    // ========================================================================
+
+    /**
+     * Set the runtime native log level (ordinal of [LlamaLog.Level]).
+     */
+    @JvmStatic
+    external fun nativeSetLogLevel(level: Int)
+
+    /**
+     * Get the runtime native log level.
+     */
+    @JvmStatic
+    external fun nativeGetLogLevel(): Int
+
+    /**
+     * Set the messages per second and call site before suppression (0 = unlimited).
+     */
+    @JvmStatic
+    external fun nativeSetLogRateLimit(perSecond: Int)
+
+    /**
+     * Write all queued native log messages.
+     */
+    @JvmStatic
+    external fun nativeFlushLog()
+
     // ========================================================================
     // Context Management
     // ========================================================================
@@ -78,6 +147,40 @@ internal object LlamaNative {
         config: NativeConfig
     ): Boolean
 
+    /**
+     * Load a model split into GGUF shards, reading them ahead in parallel.
+     * @param handle Context handle
+     * @param shardPaths Every shard in order, or only the first one if the
+     *        files keep the standard "-00001-of-0000N.gguf" names
+     * @param config Configuration object
+     * @param callback Receives the progress of the whole load, or null
+     * @return true if successful
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeLoadModelShards(
+        handle: Long,
+        shardPaths: Array<String>,
+        config: NativeConfig,
+        callback: NativeLoadProgressCallback?
+    ): Boolean
+
+    /**
+     * Load a new model and atomically switch to it.
+     * Blocks while the new model loads; the current model keeps serving.
+     * @param handle Context handle
+     * @param modelPath Path to the new .gguf model file
+     * @param config Configuration object
+     * @return true if the new model is active
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeSwapModel(
+        handle: Long,
+        modelPath: String,
+        config: NativeConfig
+    ): Boolean
+
     /**
      * Unload the current model.
      * @param handle Context handle
@@ -128,6 +231,240 @@ internal object LlamaNative {
         config: NativeConfig?
     )
 
+    /**
+     * Generate text through the model's priority scheduler with streaming callback.
+     * @param handle Context handle
+     * @param prompt Input text
+     * @param priority [RequestPriority] ordinal
+     * @param callback Callback for each token, polled for cancellation
+     * @param config Sampling config and token limit
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeGenerateScheduledStream(
+        handle: Long,
+        prompt: String,
+        priority: Int,
+        callback: NativeScheduledCallback,
+        config: NativeConfig?
+    )
+
+    /**
+     * Generate through a small/large model cascade with streaming callback.
+     * @param smallHandle Context handle of the small model
+     * @param largeHandle Context handle of the large model
+     * @param prompt Input text
+     * @param callback Callback for each token
+     * @param metric Confidence metric (0 = log-probability, 1 = entropy)
+     * @param threshold Escalation threshold in nats
+     * @param patience Consecutive low-confidence tokens before escalating
+     * @param config Optional config override applied to both models
+     * @return true if generation escalated to the large model
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeGenerateCascadeStream(
+        smallHandle: Long,
+        largeHandle: Long,
+        prompt: String,
+        callback: NativeTokenCallback,
+        metric: Int,
+        threshold: Float,
+        patience: Int,
+        config: NativeConfig?
+    ): Boolean
+
+    // ========================================================================
+    // Prompt Templates
+    // ========================================================================
+
+    /**
+     * Compile a prompt template against the loaded model's vocabulary.
+     * @param handle Context handle
+     * @param template Template text with {slot} placeholders
+     * @return Template handle
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeCompileTemplate(handle: Long, template: String): Long
+
+    /**
+     * Free a compiled template.
+     * @param templateHandle Template handle
+     */
+    @JvmStatic
+    external fun nativeReleaseTemplate(templateHandle: Long)
+
+    /**
+     * Get the slot names of a template in order of first appearance.
+     * @param templateHandle Template handle
+     * @return Slot names
+     */
+    @JvmStatic
+    external fun nativeGetTemplateSlots(templateHandle: Long): Array<String>
+
+    /**
+     * Render a template and generate with streaming callback.
+     * @param templateHandle Template handle
+     * @param names Slot names
+     * @param values Slot values, parallel to [names]
+     * @param callback Callback for each token
+     * @param config Optional config override
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeGenerateTemplateStream(
+        templateHandle: Long,
+        names: Array<String>,
+        values: Array<String>,
+        callback: NativeTokenCallback,
+        config: NativeConfig?
+    )
+
+    // ========================================================================
+    // Chat Context Fitting
+    // ========================================================================
+
+    /**
+     * Tokenise a conversation with the model's chat template and shorten it to fit the context.
+     * @param handle Context handle
+     * @param roles Message roles
+     * @param contents Message texts, parallel to [roles]
+     * @param policy [ContextFitPolicy] ordinal
+     * @param keepLastTurns Turns kept by [ContextFitPolicy.SYSTEM_AND_LAST_TURNS]
+     * @param reserveTokens Context left for the response, -1 for maxTokens
+     * @param config Optional config override
+     * @return [promptTokens, truncatedTokens, cachedMessages, tokenizedMessages, kept message indices...]
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeFitChat(
+        handle: Long,
+        roles: Array<String>,
+        contents: Array<String>,
+        policy: Int,
+        keepLastTurns: Int,
+        reserveTokens: Int,
+        config: NativeConfig?
+    ): IntArray
+
+    /**
+     * Fit a conversation to the context and generate with streaming callback.
+     * @param handle Context handle
+     * @param roles Message roles
+     * @param contents Message texts, parallel to [roles]
+     * @param policy [ContextFitPolicy] ordinal
+     * @param keepLastTurns Turns kept by [ContextFitPolicy.SYSTEM_AND_LAST_TURNS]
+     * @param reserveTokens Context left for the response, -1 for maxTokens
+     * @param callback Callback for each token
+     * @param config Optional config override
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeGenerateChatStream(
+        handle: Long,
+        roles: Array<String>,
+        contents: Array<String>,
+        policy: Int,
+        keepLastTurns: Int,
+        reserveTokens: Int,
+        callback: NativeTokenCallback,
+        config: NativeConfig?
+    )
+
+    // ========================================================================
+    // Embeddings
+    // ========================================================================
+
+    /**
+     * Embed texts with the loaded model.
+     * @param handle Context handle
+     * @param texts Texts to embed
+     * @param pooling EmbeddingPooling ordinal
+     * @return L2-normalised vectors back to back, size / texts.size floats each
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeEmbed(handle: Long, texts: Array<String>, pooling: Int): FloatArray
+
+    // ========================================================================
+    // Document Index
+    // ========================================================================
+
+    /**
+     * Chunk, embed and store documents in an on-disk index.
+     * @param handle Context handle
+     * @param indexDir Index directory
+     * @param paths Document files
+     * @param chunkTokens Longest chunk in tokens
+     * @param overlapTokens Tokens of the previous chunk embedded with each chunk
+     * @param prune Remove indexed documents not in [paths]
+     * @param callback Progress callback, may cancel (optional)
+     * @return [files, unchangedFiles, failedFiles, removedFiles, chunks, embeddedChunks,
+     *          reusedChunks, tokens, decodes, elapsedMs]
+     * @throws com.llamakotlin.android.exception.LlamaException on failure or cancellation
+     */
+    @JvmStatic
+    external fun nativeIngestDocuments(
+        handle: Long,
+        indexDir: String,
+        paths: Array<String>,
+        chunkTokens: Int,
+        overlapTokens: Int,
+        prune: Boolean,
+        callback: NativeIngestProgressCallback?
+    ): LongArray
+
+    /**
+     * Find the indexed chunks most similar to a query.
+     * @param handle Context handle
+     * @param indexDir Index directory
+     * @param query Query text
+     * @param limit Maximum number of hits
+     * @param hits Receives [score, byteOffset, byteLength] per hit; at least 3 * [limit] long
+     * @return Document path of each hit, most similar first
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeSearchIndex(
+        handle: Long,
+        indexDir: String,
+        query: String,
+        limit: Int,
+        hits: DoubleArray
+    ): Array<String>
+
+    // ========================================================================
+    // Control Vectors
+    // ========================================================================
+
+    /**
+     * Combine control vectors into a steering set.
+     * @param handle Context handle
+     * @param vectorPaths GGUF control vector files
+     * @param scales Strength of each vector
+     * @param layerStart First steered layer (from 1)
+     * @param layerEnd Last steered layer (-1 = last layer)
+     * @return Set id for NativeConfig.controlVectorSet
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeCreateControlVectorSet(
+        handle: Long,
+        vectorPaths: Array<String>,
+        scales: FloatArray,
+        layerStart: Int,
+        layerEnd: Int
+    ): Int
+
+    /**
+     * Free a steering set.
+     * @param handle Context handle
+     * @param setId Set id
+     */
+    @JvmStatic
+    external fun nativeReleaseControlVectorSet(handle: Long, setId: Int)
+
     // ========================================================================
     // Generation Control
     // ========================================================================
@@ -147,6 +484,174 @@ internal object LlamaNative {
     @JvmStatic
     external fun nativeIsGenerating(handle: Long): Boolean
 
+    /**
+     * Get the tree speculation counters of the last generation.
+     * @param handle Context handle
+     * @return [forwardPasses, draftedTokens, acceptedTokens, generatedTokens]
+     */
+    @JvmStatic
+    external fun nativeGetSpeculationStats(handle: Long): IntArray
+
+    /**
+     * Get the prompt and decode cost of the last generation.
+     * @param handle Context handle
+     * @return [tokens, paced (0 or 1), wallMs, cpuMs, sleptMs, promptTokens, prefillMs]
+     */
+    @JvmStatic
+    external fun nativeGetGenerationStats(handle: Long): DoubleArray
+
+    /**
+     * Measure the memory of the loaded model, its context and the process.
+     * @param handle Context handle
+     * @return [modelBytes, modelMappedBytes, modelResidentBytes, kvCacheBytes,
+     *          computeBufferBytes, outputBufferBytes, allocatorInUseBytes,
+     *          allocatorMappedBytes, allocatorPeakBytes, rssBytes, peakRssBytes]
+     *          followed by the KV positions held by each sequence
+     */
+    @JvmStatic
+    external fun nativeGetMemoryStats(handle: Long): LongArray
+
+    // ========================================================================
+    // Model Residency
+    // ========================================================================
+
+    /**
+     * Create a residency manager.
+     * @param budgetBytes Bytes allowed for resident models (0 = unlimited)
+     * @return Manager handle
+     */
+    @JvmStatic
+    external fun nativeCreateResidencyManager(budgetBytes: Long): Long
+
+    /**
+     * Destroy a residency manager, unloading the models not in use.
+     * @param handle Manager handle
+     */
+    @JvmStatic
+    external fun nativeDestroyResidencyManager(handle: Long)
+
+    /**
+     * Register a model under a name without loading it.
+     * @param handle Manager handle
+     * @param name Unique model name
+     * @param modelPath Path to the .gguf model file
+     * @param config Configuration used whenever the model is loaded
+     * @return true on success
+     * @throws com.llamakotlin.android.exception.LlamaException if the name is taken
+     */
+    @JvmStatic
+    external fun nativeRegisterResidentModel(
+        handle: Long,
+        name: String,
+        modelPath: String,
+        config: NativeConfig
+    ): Boolean
+
+    /**
+     * Unload and forget a model.
+     * @param handle Manager handle
+     * @param name Model name
+     * @return false if the model is unknown or in use
+     */
+    @JvmStatic
+    external fun nativeUnregisterResidentModel(handle: Long, name: String): Boolean
+
+    /**
+     * Get a loaded model, loading it and evicting others if needed.
+     * The model stays pinned until the returned context is destroyed.
+     * @param handle Manager handle
+     * @param name Model name
+     * @return Context handle
+     * @throws com.llamakotlin.android.exception.LlamaException if loading fails
+     */
+    @JvmStatic
+    external fun nativeAcquireResidentModel(handle: Long, name: String): Long
+
+    /**
+     * Evict a model if it is resident and not in use.
+     * @param handle Manager handle
+     * @param name Model name
+     * @return true if the model was evicted
+     */
+    @JvmStatic
+    external fun nativeEvictResidentModel(handle: Long, name: String): Boolean
+
+    /**
+     * Change the budget, evicting models if now over it.
+     * @param handle Manager handle
+     * @param budgetBytes Bytes allowed for resident models (0 = unlimited)
+     */
+    @JvmStatic
+    external fun nativeSetResidencyBudget(handle: Long, budgetBytes: Long)
+
+    /**
+     * Get the residency counters of a manager.
+     * @param handle Manager handle
+     * @return [budgetBytes, residentBytes, hibernatedBytes, registeredModels,
+     *          residentModels, hits, loads, loadFailures, evictions,
+     *          cheapEvictions, overBudgetLoads]
+     */
+    @JvmStatic
+    external fun nativeGetResidencyStats(handle: Long): LongArray
+
+    /**
+     * Describe the registered models.
+     * @param handle Manager handle
+     * @param values Receives [resident, pinned, cheapToEvict, bytes,
+     *        hibernatedBytes, lastUsed, loadCount, evictionCount] per model;
+     *        models beyond values.size / 8 are left out
+     * @return Name and model path of each model, interleaved
+     */
+    @JvmStatic
+    external fun nativeGetResidentModels(handle: Long, values: LongArray): Array<String>
+
+    // ========================================================================
+    // Local API Server
+    // ========================================================================
+
+    /**
+     * Start the OpenAI-compatible server for a loaded model.
+     * Replaces a server already running for this context.
+     * @param handle Context handle
+     * @param socketPath Unix socket path ("@name" for the abstract namespace),
+     *        or empty for loopback TCP
+     * @param port TCP port when socketPath is empty (0 = any free port)
+     * @param modelName Model id reported to clients
+     * @param config Sampling defaults for requests, or null for the model's load-time configuration
+     * @return Bound TCP port, or 0 for a Unix socket
+     * @throws com.llamakotlin.android.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeStartServer(
+        handle: Long,
+        socketPath: String,
+        port: Int,
+        modelName: String,
+        config: NativeConfig?
+    ): Int
+
+    /**
+     * Stop the server of a context, if one is running.
+     * @param handle Context handle
+     */
+    @JvmStatic
+    external fun nativeStopServer(handle: Long)
+
+    // ========================================================================
+    // Model Verification
+    // ========================================================================
+
+    /**
+     * Hash a model file (BLAKE3, in parallel) and check its GGUF structure.
+     * @param modelPath Path to the model file
+     * @param digestCachePath File recording digests of unchanged files, or empty
+     * @param threads Hashing threads (0 = one per core)
+     * @return The digest (lowercase hex) and the structure problem (empty if none)
+     * @throws java.io.IOException if the file cannot be read
+     */
+    @JvmStatic
+    external fun nativeVerifyModel(modelPath: String, digestCachePath: String, threads: Int): Array<String>
+
     // ========================================================================
     // Error Handling
     // ========================================================================
@@ -177,11 +682,26 @@ internal object LlamaNative {
         @JvmField var topP: Float = 0.9f
         @JvmField var topK: Int = 40
         @JvmField var repeatPenalty: Float = 1.1f
+        @JvmField var frequencyPenalty: Float = 0.0f
+        @JvmField var presencePenalty: Float = 0.0f
+        @JvmField var penaltyWindow: Int = 64
+        @JvmField var dryMultiplier: Float = 0.0f
+        @JvmField var dryBase: Float = 1.75f
+        @JvmField var dryAllowedLength: Int = 2
         @JvmField var maxTokens: Int = 512
         @JvmField var useMmap: Boolean = true
         @JvmField var useMlock: Boolean = false
+        @JvmField var kvCacheType: Int = 0
         @JvmField var gpuLayers: Int = 0
         @JvmField var seed: Int = -1
+        @JvmField var outOfProcess: Boolean = false
+        @JvmField var parallelSequences: Int = 1
+        @JvmField var speculativeBranches: Int = 0
+        @JvmField var speculativeDepth: Int = 4
+        @JvmField var pacedTokensPerSecond: Float = 0.0f
+        @JvmField var pacedLeadTokens: Int = 8
+        @JvmField var pacedThreads: Int = 0
+        @JvmField var controlVectorSet: Int = 0
 
         companion object {
             /**
@@ -197,11 +717,26 @@ internal object LlamaNative {
                     topP = config.topP
                     topK = config.topK
                     repeatPenalty = config.repeatPenalty
+                    frequencyPenalty = config.frequencyPenalty
+                    presencePenalty = config.presencePenalty
+                    penaltyWindow = config.penaltyWindow
+                    dryMultiplier = config.dryMultiplier
+                    dryBase = config.dryBase
+                    dryAllowedLength = config.dryAllowedLength
                     maxTokens = config.maxTokens
                     useMmap = config.useMmap
                     useMlock = config.useMlock
+                    kvCacheType = config.kvCacheType.ordinal
                     gpuLayers = config.gpuLayers
                     seed = config.seed
+                    outOfProcess = config.outOfProcess
+                    parallelSequences = config.parallelSequences
+                    speculativeBranches = config.speculativeBranches
+                    speculativeDepth = config.speculativeDepth
+                    pacedTokensPerSecond = config.pacedTokensPerSecond
+                    pacedLeadTokens = config.pacedLeadTokens
+                    pacedThreads = config.pacedThreads
+                    controlVectorSet = config.controlVectorSet
                 }
             }
         }
@@ -219,4 +754,43 @@ internal object LlamaNative {
          */
         fun onToken(token: String)
     }
+
+    /**
+     * Callback for model load progress.
+     * Called from native code on the loading thread.
+     */
+    @Keep
+    interface NativeLoadProgressCallback {
+        /**
+         * @param progress Progress of the whole load, from 0 to 1
+         */
+        fun onProgress(progress: Float)
+    }
+
+    /**
+     * Progress callback for document ingestion.
+     * Called from native code on the ingesting thread.
+     */
+    @Keep
+    interface NativeIngestProgressCallback {
+        /**
+         * @param filesDone Files processed so far
+         * @param filesTotal Files to process
+         * @return false to cancel the ingestion
+         */
+        fun onProgress(filesDone: Int, filesTotal: Int): Boolean
+    }
+
+    /**
+     * Callback for scheduled generation, which may wait in a queue before
+     * producing tokens.
+     */
+    @Keep
+    interface NativeScheduledCallback : NativeTokenCallback {
+        /**
+         * Polled while the request is queued or generating.
+         * @return true to cancel the request
+         */
+        fun isCancelled(): Boolean
+    }
 }
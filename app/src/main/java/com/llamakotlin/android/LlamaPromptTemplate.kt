@@ -0,0 +1,141 @@
+package com.llamakotlin.android
+
+import com.llamakotlin.android.exception.LlamaException
+import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.channels.awaitClose
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.callbackFlow
+import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.isActive
+import kotlinx.coroutines.withContext
+import java.io.Closeable
+
+/**
+ * Prompt template with pre-tokenised static text.
+ *
+ * The template is text with `{name}` slots (`{{` and `}}` for literal
+ * braces). Its fixed text is tokenised once when the template is compiled;
+ * each request only tokenises the slot values and splices the token arrays
+ * together. The first renders are checked against a full tokenisation, and
+ * the template falls back to tokenising everything if they ever differ.
+ * Because the leading text is identical between requests, the model also
+ * reuses its KV cache for it instead of evaluating it again.
+ *
+ * Example:
+ * ```kotlin
+ * val template = LlamaPromptTemplate.compile(model, """
+ *     <|system|>
+ *     You are a support assistant for {product}.
+ *     <|user|>
+ *     {question}
+ *     <|assistant|>
+ *     """.trimIndent())
+ * template.generateStream(mapOf("product" to "Acme", "question" to q))
+ *     .collect { token -> print(token) }
+ * ```
+ *
+ * The template becomes stale when the model is closed; it recompiles
+ * automatically after a reload or swap.
+ */
+class LlamaPromptTemplate private constructor(
+    private val model: LlamaModel,
+    private val templateHandle: Long
+) : Closeable {
+
+    @Volatile
+    private var closed = false
+
+    /**
+     * Slot names in order of first appearance.
+     */
+    val slots: List<String> by lazy {
+        LlamaNative.nativeGetTemplateSlots(templateHandle).toList()
+    }
+
+    /**
+     * Generate a streaming response for the given slot values.
+     *
+     * @param values Value for every slot
+     * @param configOverride Optional configuration override
+     * @return Flow of generated tokens
+     */
+    fun generateStream(
+        values: Map<String, String>,
+        configOverride: LlamaConfig? = null
+    ): Flow<String> = callbackFlow {
+        check(!closed) { "Template has been closed" }
+        model.ensureNotClosed()
+        model.ensureModelLoaded()
+
+        val missing = slots.filterNot { values.containsKey(it) }
+        require(missing.isEmpty()) { "No value for slots: $missing" }
+
+        val nativeConfig = configOverride?.let {
+            it.validate()
+            LlamaNative.NativeConfig.fromLlamaConfig(it)
+        }
+
+        val callback = object : LlamaNative.NativeTokenCallback {
+            override fun onToken(token: String) {
+                if (isActive) {
+                    trySend(token)
+                }
+            }
+        }
+
+        try {
+            withContext(Dispatchers.Default) {
+                LlamaNative.nativeGenerateTemplateStream(
+                    templateHandle,
+                    values.keys.toTypedArray(),
+                    values.values.toTypedArray(),
+                    callback,
+                    nativeConfig
+                )
+            }
+        } catch (e: Exception) {
+            when (e) {
+                is LlamaException -> throw e
+                is CancellationException -> {
+                    model.cancelGeneration()
+                    throw e
+                }
+                else -> throw LlamaException.GenerationError(e.message ?: "Unknown error", e)
+            }
+        }
+
+        close()
+
+        awaitClose {
+            model.cancelGeneration()
+        }
+    }.flowOn(Dispatchers.Default)
+
+    /**
+     * Free the compiled template.
+     */
+    override fun close() {
+        if (!closed) {
+            closed = true
+            LlamaNative.nativeReleaseTemplate(templateHandle)
+        }
+    }
+
+    companion object {
+        /**
+         * Compile a template against a loaded model.
+         *
+         * @param model Loaded model whose vocabulary is used
+         * @param template Template text with `{name}` slots
+         * @return Compiled template
+         * @throws LlamaException if the model is not loaded
+         */
+        fun compile(model: LlamaModel, template: String): LlamaPromptTemplate {
+            model.ensureNotClosed()
+            model.ensureModelLoaded()
+            val handle = LlamaNative.nativeCompileTemplate(model.nativeHandle, template)
+            return LlamaPromptTemplate(model, handle)
+        }
+    }
+}
@@ -0,0 +1,89 @@
+package com.llamakotlin.android
+
+import java.io.Closeable
+
+/**
+ * Local OpenAI-compatible server for a loaded model.
+ *
+ * Lets other processes and plugins share one resident model through the
+ * standard `/v1/chat/completions`, `/v1/completions` and `/v1/embeddings`
+ * endpoints (with `"stream": true` as server-sent events), plus
+ * `/v1/models`. Requests from all clients are queued and decoded together
+ * in batches of up to [LlamaConfig.parallelSequences], so load the model
+ * with that set to the number of clients you expect to serve at once.
+ *
+ * The server stops when [close] is called, or when the model is unloaded,
+ * reloaded or closed. It keeps serving across [LlamaModel.swapModel]:
+ * requests already decoding finish on the old model and queued ones run on
+ * the new one.
+ *
+ * Example:
+ * ```kotlin
+ * val model = LlamaModel.load(path) { parallelSequences = 4 }
+ * val server = LlamaServer.start(model, socketPath = "@my-app-llm")
+ * // curl --abstract-unix-socket my-app-llm http://localhost/v1/models
+ * ```
+ *
+ * @property port Bound TCP port, or 0 when serving on a Unix socket
+ */
+class LlamaServer private constructor(
+    private val model: LlamaModel,
+    val port: Int
+) : Closeable {
+
+    @Volatile
+    private var closed = false
+
+    /**
+     * Stop serving and close all client connections.
+     */
+    override fun close() {
+        if (!closed) {
+            closed = true
+            LlamaNative.nativeStopServer(model.nativeHandle)
+        }
+    }
+
+    companion object {
+        /**
+         * Start serving a loaded model. Replaces a server already running
+         * for the same model.
+         *
+         * @param model Loaded model; must stay open while the server runs
+         * @param socketPath Unix socket path, or "@name" for the Linux abstract
+         *        namespace; null serves on 127.0.0.1 instead
+         * @param port TCP port when [socketPath] is null (0 = any free port)
+         * @param modelName Model id reported to clients
+         * @param defaults Sampling defaults for requests that do not set them, or null
+         *        for the model's load-time configuration
+         * @return Running server
+         * @throws com.llamakotlin.android.exception.LlamaException if the
+         *         socket cannot be bound or the model is not loaded
+         */
+        fun start(
+            model: LlamaModel,
+            socketPath: String? = null,
+            port: Int = 8080,
+            modelName: String = "local",
+            defaults: LlamaConfig? = null
+        ): LlamaServer {
+            model.ensureNotClosed()
+            model.ensureModelLoaded()
+            require(socketPath != null || port in 0..65535) { "Invalid port: $port" }
+
+            val nativeConfig = defaults?.let {
+                it.validate()
+                LlamaNative.NativeConfig.fromLlamaConfig(it)
+            }
+
+            val boundPort = LlamaNative.nativeStartServer(
+                model.nativeHandle,
+                socketPath ?: "",
+                port,
+                modelName,
+                nativeConfig
+            )
+            return LlamaServer(model, boundPort)
+        }
+    }
+}
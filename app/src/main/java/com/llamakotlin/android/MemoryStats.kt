@@ -0,0 +1,43 @@
+package com.llamakotlin.android
+
+/**
+ * Where the native memory of a loaded model and its context goes.
+ *
+ * Model and context figures are zero when running out of process
+ * ([LlamaConfig.outOfProcess]); the process figures are always those of
+ * the app process.
+ *
+ * @property modelBytes Size of the weights
+ * @property modelMappedBytes Bytes of the model file mapped into the process (0 without mmap)
+ * @property modelResidentBytes Mapped bytes currently in RAM; the rest is paged in on use
+ * @property kvCacheBytes KV cache buffers
+ * @property computeBufferBytes Buffers for intermediate results of a forward pass
+ * @property outputBufferBytes Logits and embeddings output buffer
+ * @property allocatorInUseBytes Native heap in use
+ * @property allocatorMappedBytes Native heap held from the OS
+ * @property allocatorPeakBytes Highest native heap in use seen since the model was loaded
+ * @property rssBytes Resident set of the process
+ * @property peakRssBytes Highest resident set since the model was loaded
+ *           (since process start on kernels that cannot reset it)
+ * @property sequenceCells KV cache positions held by each sequence
+ */
+data class MemoryStats(
+    val modelBytes: Long,
+    val modelMappedBytes: Long,
+    val modelResidentBytes: Long,
+    val kvCacheBytes: Long,
+    val computeBufferBytes: Long,
+    val outputBufferBytes: Long,
+    val allocatorInUseBytes: Long,
+    val allocatorMappedBytes: Long,
+    val allocatorPeakBytes: Long,
+    val rssBytes: Long,
+    val peakRssBytes: Long,
+    val sequenceCells: List<Int>
+) {
+    /**
+     * Bytes owned by llama.cpp for this context, besides the weights.
+     */
+    val contextBytes: Long
+        get() = kvCacheBytes + computeBufferBytes + outputBufferBytes
+}
@@ -0,0 +1,206 @@
+package com.llamakotlin.android
+
+import com.llamakotlin.android.exception.LlamaException
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+import java.io.Closeable
+import java.io.File
+import java.util.concurrent.ConcurrentHashMap
+
+/**
+ * Keeps a set of named models loaded within a RAM budget.
+ *
+ * Models are registered up front and loaded on first [acquire]. When a load
+ * would go over the budget, the least recently used models not in use are
+ * unloaded first, preferring memory-mapped ones whose pages are cheap to
+ * re-read. Their context state is kept in memory and restored when they
+ * are loaded again.
+ *
+ * A model returned by [acquire] stays loaded until it is closed, so close
+ * it as soon as the request is done. It cannot be reloaded, swapped or
+ * unloaded directly; the manager does that.
+ *
+ * Example:
+ * ```kotlin
+ * ModelResidency.create(budgetBytes = 3L shl 30).use { residency ->
+ *     residency.register("chat", chatPath)
+ *     residency.register("code", codePath) { contextSize = 4096 }
+ *     residency.acquire("chat").use { it.generate("Hello") }
+ * }
+ * ```
+ */
+class ModelResidency private constructor(
+    private val nativeHandle: Long
+) : Closeable {
+
+    @Volatile
+    private var closed = false
+
+    private val configs = ConcurrentHashMap<String, LlamaConfig>()
+
+    /**
+     * Register a model under a name without loading it.
+     *
+     * @param name Unique name used with [acquire]
+     * @param modelPath Path to the .gguf model file
+     * @param config Configuration used whenever the model is loaded
+     * @throws LlamaException.ModelNotFound if the file doesn't exist
+     * @throws LlamaException if the name is already registered
+     */
+    fun register(name: String, modelPath: String, config: LlamaConfig = LlamaConfig()) {
+        ensureNotClosed()
+        if (!File(modelPath).exists()) {
+            throw LlamaException.ModelNotFound(modelPath)
+        }
+        config.validate()
+        LlamaNative.nativeRegisterResidentModel(
+            nativeHandle,
+            name,
+            modelPath,
+            LlamaNative.NativeConfig.fromLlamaConfig(config)
+        )
+        configs[name] = config
+    }
+
+    /**
+     * Register a model using a configuration builder.
+     */
+    fun register(name: String, modelPath: String, config: LlamaConfig.() -> Unit) {
+        register(name, modelPath, LlamaConfig().apply(config))
+    }
+
+    /**
+     * Unload and forget a model.
+     *
+     * @return false if the model is unknown or in use
+     */
+    fun unregister(name: String): Boolean {
+        ensureNotClosed()
+        val removed = LlamaNative.nativeUnregisterResidentModel(nativeHandle, name)
+        if (removed) {
+            configs.remove(name)
+        }
+        return removed
+    }
+
+    /**
+     * Get a registered model, loading it and evicting others if needed.
+     * The model is not evicted until the returned instance is closed.
+     *
+     * @param name Registered model name
+     * @return Loaded model; close it when done
+     * @throws LlamaException if the model is unknown or cannot be loaded
+     */
+    suspend fun acquire(name: String): LlamaModel = withContext(Dispatchers.IO) {
+        ensureNotClosed()
+        val handle = LlamaNative.nativeAcquireResidentModel(nativeHandle, name)
+        LlamaModel.wrap(handle, configs[name] ?: LlamaConfig())
+    }
+
+    /**
+     * Unload a model now if it is loaded and not in use.
+     *
+     * @return true if the model was evicted
+     */
+    fun evict(name: String): Boolean {
+        ensureNotClosed()
+        return LlamaNative.nativeEvictResidentModel(nativeHandle, name)
+    }
+
+    /**
+     * Bytes allowed for loaded models (0 = unlimited). Lowering it evicts
+     * models immediately.
+     */
+    var budgetBytes: Long
+        get() = stats.budgetBytes
+        set(value) {
+            require(value >= 0) { "Budget must be non-negative: $value" }
+            ensureNotClosed()
+            LlamaNative.nativeSetResidencyBudget(nativeHandle, value)
+        }
+
+    /**
+     * Residency and eviction counters.
+     */
+    val stats: ResidencyStats
+        get() {
+            ensureNotClosed()
+            val values = LlamaNative.nativeGetResidencyStats(nativeHandle)
+            return ResidencyStats(
+                budgetBytes = values[0],
+                residentBytes = values[1],
+                hibernatedBytes = values[2],
+                registeredModels = values[3].toInt(),
+                residentModels = values[4].toInt(),
+                hits = values[5],
+                loads = values[6],
+                loadFailures = values[7],
+                evictions = values[8],
+                cheapEvictions = values[9],
+                overBudgetLoads = values[10]
+            )
+        }
+
+    /**
+     * Residency state of each registered model.
+     */
+    val models: List<ModelResidencyInfo>
+        get() {
+            ensureNotClosed()
+            val values = LongArray(maxOf(configs.size, 1) * MODEL_VALUES)
+            val names = LlamaNative.nativeGetResidentModels(nativeHandle, values)
+            return List(names.size / 2) { i ->
+                val v = i * MODEL_VALUES
+                ModelResidencyInfo(
+                    name = names[i * 2],
+                    modelPath = names[i * 2 + 1],
+                    resident = values[v] != 0L,
+                    pinned = values[v + 1] != 0L,
+                    cheapToEvict = values[v + 2] != 0L,
+                    bytes = values[v + 3],
+                    hibernatedBytes = values[v + 4],
+                    lastUsed = values[v + 5],
+                    loadCount = values[v + 6],
+                    evictionCount = values[v + 7]
+                )
+            }
+        }
+
+    /**
+     * Unload every model not in use and release the manager. Models still
+     * acquired stay loaded until they are closed.
+     */
+    override fun close() {
+        if (!closed) {
+            closed = true
+            LlamaNative.nativeDestroyResidencyManager(nativeHandle)
+        }
+    }
+
+    private fun ensureNotClosed() {
+        if (closed) {
+            throw IllegalStateException("Residency manager has been closed")
+        }
+    }
+
+    companion object {
+        private const val MODEL_VALUES = 8
+
+        /**
+         * Create a residency manager.
+         *
+         * @param budgetBytes Bytes allowed for loaded models (0 = unlimited)
+         * @return Manager with no models registered
+         */
+        @JvmStatic
+        fun create(budgetBytes: Long = 0): ModelResidency {
+            require(budgetBytes >= 0) { "Budget must be non-negative: $budgetBytes" }
+            try {
+                LlamaNative.ensureEngineLoaded()
+            } catch (e: UnsatisfiedLinkError) {
+                throw LlamaException.ModelLoadError("Cannot load the inference engine: ${e.message}", e)
+            }
+            return ModelResidency(LlamaNative.nativeCreateResidencyManager(budgetBytes))
+        }
+    }
+}
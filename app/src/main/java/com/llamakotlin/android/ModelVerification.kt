@@ -0,0 +1,21 @@
+package com.llamakotlin.android
+
+/**
+ * Result of [LlamaModel.verifyModel].
+ *
+ * @property digest BLAKE3 hash of the file as lowercase hex, the same as `b3sum` prints
+ * @property hashMatches Whether [digest] equals the expected hash (true when none was given)
+ * @property structureError Why the file is not a well-formed GGUF (for example a
+ *           truncated download), or null if it is
+ */
+data class ModelVerification(
+    val digest: String,
+    val hashMatches: Boolean,
+    val structureError: String?
+) {
+    /**
+     * Whether the file can be loaded: the hash matches and the structure is intact.
+     */
+    val isValid: Boolean
+        get() = hashMatches && structureError == null
+}
@@ -0,0 +1,19 @@
+package com.llamakotlin.android
+
+/**
+ * Scheduling class of a prioritised generation request.
+ *
+ * Higher classes are admitted first and may preempt lower ones; within a
+ * class, the request with the fewest tokens left to generate goes first.
+ * Order must match the native RequestPriority enum.
+ */
+enum class RequestPriority {
+    /** A user is waiting on the response, e.g. a chat reply. */
+    FOREGROUND,
+
+    /** Default class. */
+    NORMAL,
+
+    /** Deferred work such as summaries or indexing. */
+    BACKGROUND
+}
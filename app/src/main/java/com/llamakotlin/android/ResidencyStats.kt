@@ -0,0 +1,63 @@
+package com.llamakotlin.android
+
+/**
+ * Residency and eviction counters of a [ModelResidency].
+ *
+ * @property budgetBytes Bytes allowed for resident models (0 = unlimited)
+ * @property residentBytes Bytes of the models currently loaded
+ * @property hibernatedBytes Context state kept in memory for evicted models
+ * @property registeredModels Models registered with the manager
+ * @property residentModels Models currently loaded
+ * @property hits Acquisitions served by a model that was already loaded
+ * @property loads Acquisitions that had to load the model
+ * @property loadFailures Loads that failed
+ * @property evictions Models unloaded to make room or on request
+ * @property cheapEvictions Evictions of memory-mapped models, whose pages are re-read from storage
+ * @property overBudgetLoads Loads that went over the budget because every other model was in use
+ */
+data class ResidencyStats(
+    val budgetBytes: Long,
+    val residentBytes: Long,
+    val hibernatedBytes: Long,
+    val registeredModels: Int,
+    val residentModels: Int,
+    val hits: Long,
+    val loads: Long,
+    val loadFailures: Long,
+    val evictions: Long,
+    val cheapEvictions: Long,
+    val overBudgetLoads: Long
+) {
+    /**
+     * Share of acquisitions served without loading.
+     */
+    val hitRate: Double
+        get() = if (hits + loads > 0) hits.toDouble() / (hits + loads) else 0.0
+}
+
+/**
+ * Residency state of one model registered with a [ModelResidency].
+ *
+ * @property name Name the model was registered under
+ * @property modelPath Path to the model file
+ * @property resident Whether the model is loaded
+ * @property pinned Whether the model is in use and cannot be evicted
+ * @property cheapToEvict Whether the model is memory-mapped, so evicting it only drops clean pages
+ * @property bytes Measured footprint when loaded, estimated otherwise
+ * @property hibernatedBytes Context state kept in memory while evicted
+ * @property lastUsed Logical time of the last acquisition; higher is more recent
+ * @property loadCount Times the model was loaded
+ * @property evictionCount Times the model was evicted
+ */
+data class ModelResidencyInfo(
+    val name: String,
+    val modelPath: String,
+    val resident: Boolean,
+    val pinned: Boolean,
+    val cheapToEvict: Boolean,
+    val bytes: Long,
+    val hibernatedBytes: Long,
+    val lastUsed: Long,
+    val loadCount: Long,
+    val evictionCount: Long
+)
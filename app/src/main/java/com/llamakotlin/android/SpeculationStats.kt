@@ -0,0 +1,28 @@
+package com.llamakotlin.android
+
+/**
+ * Counters of a generation with tree speculation.
+ *
+ * @property forwardPasses Model forward passes after the prompt
+ * @property draftedTokens Draft tokens verified across all passes
+ * @property acceptedTokens Draft tokens that matched the model's own choice
+ * @property generatedTokens Tokens emitted
+ */
+data class SpeculationStats(
+    val forwardPasses: Int,
+    val draftedTokens: Int,
+    val acceptedTokens: Int,
+    val generatedTokens: Int
+) {
+    /**
+     * Mean number of draft tokens accepted per forward pass.
+     */
+    val acceptancePerPass: Double
+        get() = if (forwardPasses > 0) acceptedTokens.toDouble() / forwardPasses else 0.0
+
+    /**
+     * Mean number of tokens emitted per forward pass.
+     */
+    val tokensPerPass: Double
+        get() = if (forwardPasses > 0) generatedTokens.toDouble() / forwardPasses else 0.0
+}